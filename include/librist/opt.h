@@ -39,11 +39,72 @@ typedef struct {
 	rist_thread_callback_func_t thread_callback;
 } rist_thread_callback_t;
 
+//Socket I/O engines, see RIST_OPT_IO_ENGINE
+enum rist_io_engine
+{
+	//epoll where available, poll otherwise
+	RIST_IO_ENGINE_DEFAULT = 0,
+	RIST_IO_ENGINE_POLL = 1,
+	RIST_IO_ENGINE_EPOLL = 2,
+	//Linux 5.19 or later, multishot receives into provided buffer rings and batched sends
+	RIST_IO_ENGINE_IO_URING = 3,
+};
+
 enum rist_opt
 {
 	//Set callback called when a thread is created or destroyed. This can only be set before rist_start is called.
 	//optval1 must point to a rist_thread_callback_t struct, optval2 may contain a pointer to user data, optval3 must be NULL.
-	RIST_OPT_THREAD_CALLBACK
+	RIST_OPT_THREAD_CALLBACK,
+	//Allow rist_sender_data_write to be called concurrently from several threads. By default the sender input
+	//queue assumes a single writing thread and takes no locks. This can only be set before rist_start is called.
+	//optval1 must point to a bool, optval2 and optval3 must be NULL.
+	RIST_OPT_SENDER_MULTI_WRITER,
+	//Run the output of all receiver flows on a fixed pool of threads instead of one thread per flow. Flows are
+	//served in order of their next output deadline and idle flows cause no wakeups. This can only be set before
+	//rist_start is called. optval1 must point to a uint32_t holding the number of threads (0 restores one thread
+	//per flow), optval2 and optval3 must be NULL.
+	RIST_OPT_RECEIVER_DATAOUT_POOL,
+	//Have the sender thread precompute the AES-CTR keystream for the next packets of every encrypting peer while it
+	//is idle, leaving only an XOR on the send path. Costs about 1.3KB per packet per peer. This can only be set before
+	//rist_start is called. optval1 must point to a uint32_t holding the number of packets (0 disables), optval2 and
+	//optval3 must be NULL.
+	RIST_OPT_SENDER_KEYSTREAM_PRECOMPUTE,
+	//Send SMPTE 2022-1 style XOR FEC alongside the data so receivers can rebuild lost packets without a
+	//retransmission. Parity covers a matrix of L columns by D rows of consecutive packets. This can only be set
+	//before rist_start is called and is ignored by the simple profile. optval1 must point to a uint32_t holding
+	//L (1 to 20, 0 disables), optval2 must point to a uint32_t holding D (4 to 20) with L*D at most 100, optval3
+	//may point to a bool enabling row FEC in addition to column FEC (requires L of at least 4).
+	//Parity is sent in-band on the data flow, so a peer only gets it once it advertised FEC support in its
+	//keepalive (the F capability, set by receivers of this version on). Receivers without FEC support would
+	//output the parity as data, so they get the plain stream.
+	RIST_OPT_SENDER_FEC,
+	//Let the sender move traffic between weighted (bonded) peers by how well each one delivers: a peer's
+	//configured weight is scaled down by its retransmission ratio and by RTT growth over its lowest RTT, so a
+	//degraded link stops taking packets it cannot deliver. Peers with weight 0 still get every packet. This can
+	//only be set before rist_start is called. optval1 must point to a bool, optval2 and optval3 must be NULL.
+	RIST_OPT_SENDER_ADAPTIVE_WEIGHTS,
+	//Take the arrival time of received packets from the kernel receive timestamp (SO_TIMESTAMPING, or
+	//SO_TIMESTAMPNS on older kernels) instead of reading the clock once the receive call returns, so the arrival
+	//times used for clock offset estimation and the arrival timing mode carry no scheduling jitter. Linux only.
+	//This can only be set before rist_start is called. optval1 must point to a uint32_t: 0 disables, 1 uses the
+	//kernel software timestamp, 2 prefers the NIC hardware timestamp (the NIC clock must be synchronised to the
+	//system clock and its receive timestamping enabled) and falls back to the software one. optval2 and optval3
+	//must be NULL.
+	RIST_OPT_RX_TIMESTAMPS,
+	//Select how the peer sockets are read and written. The io_uring engine keeps a multishot receive armed on
+	//every peer socket and submits the sender's data packets and retransmissions in batches, it turns UDP GRO off
+	//on the sockets. Fails when the engine was not built in or the kernel refuses it. This can only be set before
+	//rist_start is called. optval1 must point to a uint32_t holding an enum rist_io_engine, optval2 and optval3
+	//must be NULL.
+	RIST_OPT_IO_ENGINE,
+	//Spread the listening peers of a receiver over several shards, each with its own socket bound to the listening
+	//address with SO_REUSEPORT, its own protocol thread and its own flows, so the load of many senders scales with
+	//the cores. On Linux senders are steered to a shard by source address, which keeps all traffic of a sender
+	//(the RTCP port of the simple profile included) on one shard. Reads, the data callback and the notify fd
+	//cover all shards, the other callbacks and options are handed to the shards by rist_start. This can only be
+	//set before any peer is created. optval1 must point to a uint32_t holding the number of shards (0 or 1
+	//disables), optval2 and optval3 must be NULL.
+	RIST_OPT_RECEIVER_SHARDS
 };
 
 /**
@@ -41,6 +41,7 @@ struct rist_peer;
 #define RIST_DEFAULT_SESSION_TIMEOUT (2000)
 #define RIST_DEFAULT_KEEPALIVE_INTERVAL (1000)
 #define RIST_DEFAULT_TIMING_MODE RIST_TIMING_MODE_SOURCE
+#define RIST_DEFAULT_PACING_MODE RIST_PACING_MODE_OFF
 
 enum rist_timing_mode
 {
@@ -49,6 +50,17 @@ enum rist_timing_mode
 	RIST_TIMING_MODE_RTC = 2
 };
 
+/* Sender output pacing, spaces the data packets of a peer at the measured input rate */
+enum rist_pacing_mode
+{
+	RIST_PACING_MODE_OFF = 0,
+	/* The protocol thread holds packets back on a userspace timer */
+	RIST_PACING_MODE_TIMER = 1,
+	/* Packets carry their departure time (SO_TXTIME) for the fq qdisc to honour,
+	 * falls back to the timer where the socket option is not available */
+	RIST_PACING_MODE_TXTIME = 2
+};
+
 enum rist_recovery_mode
 {
 	RIST_RECOVERY_MODE_UNCONFIGURED = 0,
@@ -63,7 +75,7 @@ enum rist_congestion_control_mode
 	RIST_CONGESTION_CONTROL_MODE_AGGRESSIVE = 2
 };
 
-#define RIST_PEER_CONFIG_VERSION (0)
+#define RIST_PEER_CONFIG_VERSION (1)
 
 struct rist_peer_config
 {
@@ -118,6 +130,9 @@ struct rist_peer_config
 	uint32_t timing_mode;
 	char srp_username[RIST_MAX_STRING_LONG];
 	char srp_password[RIST_MAX_STRING_LONG];
+
+	/* Version 1 */
+	enum rist_pacing_mode pacing_mode;
 };
 
 /**
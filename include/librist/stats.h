@@ -70,6 +70,8 @@ struct rist_stats_receiver_flow
 	uint64_t max_inter_packet_spacing;
 	/* avg rtt all non dead peers */
 	uint32_t rtt;
+	/* rebuilt from FEC parity, without a retry */
+	uint32_t recovered_fec;
 };
 
 enum rist_stats_type
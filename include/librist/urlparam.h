@@ -36,6 +36,7 @@
 #define RIST_URL_PARAM_MIN_RETRIES "min-retries"
 #define RIST_URL_PARAM_MAX_RETRIES "max-retries"
 #define RIST_URL_PARAM_TIMING_MODE "timing-mode"
+#define RIST_URL_PARAM_PACING "pacing"
 /* udp specific parameters */
 #define RIST_URL_PARAM_STREAM_ID "stream-id"
 #define RIST_URL_PARAM_RTP_TIMESTAMP "rtp-timestamp"
@@ -0,0 +1,204 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "aes_ctr.h"
+#include "contrib/aes.h"
+#include <string.h>
+
+#if HAVE_AESNI
+#include <immintrin.h>
+#endif
+#if HAVE_ARM_AES
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+#endif
+
+/* Blocks processed per kernel call, enough to keep the AES units pipelined */
+#define AES_CTR_PARALLEL_BLOCKS 8
+
+typedef void (*aes_ctr_blocks_func)(const struct rist_aes_ctr *ctx, const uint8_t *in, uint8_t *out, size_t blocks);
+
+static void table_encrypt_blocks(const struct rist_aes_ctr *ctx, const uint8_t *in, uint8_t *out, size_t blocks)
+{
+	for (size_t i = 0; i < blocks; i++)
+		aes_encrypt(&in[i * 16], &out[i * 16], ctx->key_sched, ctx->key_size);
+}
+
+#if HAVE_AESNI
+__attribute__((target("aes,sse2")))
+static void aesni_encrypt_blocks(const struct rist_aes_ctr *ctx, const uint8_t *in, uint8_t *out, size_t blocks)
+{
+	const __m128i *rk = (const __m128i *)ctx->round_keys;
+	while (blocks >= AES_CTR_PARALLEL_BLOCKS) {
+		__m128i b[AES_CTR_PARALLEL_BLOCKS];
+		__m128i k = _mm_loadu_si128(&rk[0]);
+		for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+			b[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i * 16]), k);
+		for (int r = 1; r < ctx->rounds; r++) {
+			k = _mm_loadu_si128(&rk[r]);
+			for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+				b[i] = _mm_aesenc_si128(b[i], k);
+		}
+		k = _mm_loadu_si128(&rk[ctx->rounds]);
+		for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+			_mm_storeu_si128((__m128i *)&out[i * 16], _mm_aesenclast_si128(b[i], k));
+		in += AES_CTR_PARALLEL_BLOCKS * 16;
+		out += AES_CTR_PARALLEL_BLOCKS * 16;
+		blocks -= AES_CTR_PARALLEL_BLOCKS;
+	}
+	for (size_t i = 0; i < blocks; i++) {
+		__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i * 16]), _mm_loadu_si128(&rk[0]));
+		for (int r = 1; r < ctx->rounds; r++)
+			b = _mm_aesenc_si128(b, _mm_loadu_si128(&rk[r]));
+		_mm_storeu_si128((__m128i *)&out[i * 16], _mm_aesenclast_si128(b, _mm_loadu_si128(&rk[ctx->rounds])));
+	}
+}
+#endif
+
+#if HAVE_ARM_AES
+/* AESE does AddRoundKey before SubBytes/ShiftRows, so the last round key is a plain xor */
+__attribute__((target("+crypto")))
+static void armv8_encrypt_blocks(const struct rist_aes_ctr *ctx, const uint8_t *in, uint8_t *out, size_t blocks)
+{
+	while (blocks >= AES_CTR_PARALLEL_BLOCKS) {
+		uint8x16_t b[AES_CTR_PARALLEL_BLOCKS];
+		for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+			b[i] = vld1q_u8(&in[i * 16]);
+		for (int r = 0; r < ctx->rounds - 1; r++) {
+			uint8x16_t k = vld1q_u8(ctx->round_keys[r]);
+			for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+				b[i] = vaesmcq_u8(vaeseq_u8(b[i], k));
+		}
+		uint8x16_t k = vld1q_u8(ctx->round_keys[ctx->rounds - 1]);
+		uint8x16_t last = vld1q_u8(ctx->round_keys[ctx->rounds]);
+		for (int i = 0; i < AES_CTR_PARALLEL_BLOCKS; i++)
+			vst1q_u8(&out[i * 16], veorq_u8(vaeseq_u8(b[i], k), last));
+		in += AES_CTR_PARALLEL_BLOCKS * 16;
+		out += AES_CTR_PARALLEL_BLOCKS * 16;
+		blocks -= AES_CTR_PARALLEL_BLOCKS;
+	}
+	for (size_t i = 0; i < blocks; i++) {
+		uint8x16_t b = vld1q_u8(&in[i * 16]);
+		for (int r = 0; r < ctx->rounds - 1; r++)
+			b = vaesmcq_u8(vaeseq_u8(b, vld1q_u8(ctx->round_keys[r])));
+		b = vaeseq_u8(b, vld1q_u8(ctx->round_keys[ctx->rounds - 1]));
+		vst1q_u8(&out[i * 16], veorq_u8(b, vld1q_u8(ctx->round_keys[ctx->rounds])));
+	}
+}
+#endif
+
+enum rist_aes_ctr_impl _librist_aes_ctr_detect(void)
+{
+#if HAVE_AESNI
+	if (__builtin_cpu_supports("aes"))
+		return RIST_AES_CTR_IMPL_AESNI;
+#endif
+#if HAVE_ARM_AES
+#if defined(__APPLE__)
+	return RIST_AES_CTR_IMPL_ARMV8;
+#elif defined(__linux__)
+	if (getauxval(AT_HWCAP) & HWCAP_AES)
+		return RIST_AES_CTR_IMPL_ARMV8;
+#endif
+#endif
+	return RIST_AES_CTR_IMPL_TABLE;
+}
+
+const char *_librist_aes_ctr_impl_name(enum rist_aes_ctr_impl impl)
+{
+	switch (impl) {
+	case RIST_AES_CTR_IMPL_AESNI:
+		return "AES-NI";
+	case RIST_AES_CTR_IMPL_ARMV8:
+		return "ARMv8 crypto extensions";
+	case RIST_AES_CTR_IMPL_TABLE:
+		break;
+	}
+	return "table";
+}
+
+int _librist_aes_ctr_setkey(struct rist_aes_ctr *ctx, const uint8_t key[], int key_size)
+{
+	switch (key_size) {
+	case 128: ctx->rounds = 10; break;
+	case 192: ctx->rounds = 12; break;
+	case 256: ctx->rounds = 14; break;
+	default: return -1;
+	}
+	ctx->key_size = key_size;
+	aes_key_setup(key, ctx->key_sched, key_size);
+	// The contrib schedule holds big-endian words, the hardware wants the round keys as bytes
+	for (int i = 0; i < 4 * (ctx->rounds + 1); i++) {
+		uint8_t *rk = &ctx->round_keys[i / 4][(i % 4) * 4];
+		rk[0] = (uint8_t)(ctx->key_sched[i] >> 24);
+		rk[1] = (uint8_t)(ctx->key_sched[i] >> 16);
+		rk[2] = (uint8_t)(ctx->key_sched[i] >> 8);
+		rk[3] = (uint8_t)ctx->key_sched[i];
+	}
+	ctx->impl = _librist_aes_ctr_detect();
+	return 0;
+}
+
+static inline void ctr_increment(uint8_t iv[16])
+{
+	for (int i = 15; i >= 0; i--) {
+		if (++iv[i] != 0)
+			break;
+	}
+}
+
+void _librist_aes_ctr_crypt(const struct rist_aes_ctr *ctx, uint8_t iv[16], size_t *offset,
+							uint8_t stream_block[16], const uint8_t *in, uint8_t *out, size_t len)
+{
+	aes_ctr_blocks_func encrypt_blocks = table_encrypt_blocks;
+#if HAVE_AESNI
+	if (ctx->impl == RIST_AES_CTR_IMPL_AESNI)
+		encrypt_blocks = aesni_encrypt_blocks;
+#endif
+#if HAVE_ARM_AES
+	if (ctx->impl == RIST_AES_CTR_IMPL_ARMV8)
+		encrypt_blocks = armv8_encrypt_blocks;
+#endif
+
+	// Use up what is left of the previous keystream block
+	size_t n = *offset;
+	while (n != 0 && len > 0) {
+		*out++ = *in++ ^ stream_block[n];
+		n = (n + 1) & 0x0F;
+		len--;
+	}
+
+	uint8_t counters[AES_CTR_PARALLEL_BLOCKS * 16];
+	uint8_t keystream[AES_CTR_PARALLEL_BLOCKS * 16];
+	while (len >= 16) {
+		size_t blocks = len / 16;
+		if (blocks > AES_CTR_PARALLEL_BLOCKS)
+			blocks = AES_CTR_PARALLEL_BLOCKS;
+		for (size_t i = 0; i < blocks; i++) {
+			memcpy(&counters[i * 16], iv, 16);
+			ctr_increment(iv);
+		}
+		encrypt_blocks(ctx, counters, keystream, blocks);
+		for (size_t i = 0; i < blocks * 16; i++)
+			out[i] = in[i] ^ keystream[i];
+		in += blocks * 16;
+		out += blocks * 16;
+		len -= blocks * 16;
+	}
+
+	if (len > 0) {
+		encrypt_blocks(ctx, iv, stream_block, 1);
+		ctr_increment(iv);
+		for (size_t i = 0; i < len; i++)
+			out[i] = in[i] ^ stream_block[i];
+		n = len;
+	}
+	*offset = n;
+}
@@ -0,0 +1,43 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RIST_CRYPTO_AES_CTR_H
+#define RIST_CRYPTO_AES_CTR_H
+
+#include "config.h"
+#include "common/attributes.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* AES-CTR for builds without mbedtls or nettle. Uses AES-NI or the ARMv8
+ * crypto extensions when the CPU has them (detected at runtime), otherwise
+ * the table driven contrib/aes.c implementation. */
+
+enum rist_aes_ctr_impl {
+	RIST_AES_CTR_IMPL_TABLE = 0,
+	RIST_AES_CTR_IMPL_AESNI,
+	RIST_AES_CTR_IMPL_ARMV8,
+};
+
+struct rist_aes_ctr {
+	enum rist_aes_ctr_impl impl;
+	int key_size;
+	int rounds;
+	/* round keys as byte strings, for the hardware kernels */
+	uint8_t round_keys[15][16];
+	/* contrib/aes.c key schedule */
+	uint32_t key_sched[60];
+};
+
+/* Implementation the next key setup will pick on this CPU */
+RIST_PRIV enum rist_aes_ctr_impl _librist_aes_ctr_detect(void);
+RIST_PRIV const char *_librist_aes_ctr_impl_name(enum rist_aes_ctr_impl impl);
+RIST_PRIV int _librist_aes_ctr_setkey(struct rist_aes_ctr *ctx, const uint8_t key[], int key_size);
+/* Same contract as mbedtls_aes_crypt_ctr: iv is the big-endian counter block and is advanced,
+ * offset/stream_block carry a partially used keystream block over to the next call. */
+RIST_PRIV void _librist_aes_ctr_crypt(const struct rist_aes_ctr *ctx, uint8_t iv[16], size_t *offset,
+									  uint8_t stream_block[16], const uint8_t *in, uint8_t *out, size_t len);
+
+#endif
@@ -9,6 +9,8 @@
 #include "psk.h"
 #include "log-private.h"
 #include "crypto-private.h"
+#include "endian-shim.h"
+#include <stdlib.h>
 #include <string.h>
 
 #if HAVE_MBEDTLS
@@ -52,6 +54,9 @@ int _librist_crypto_psk_rist_key_init(struct rist_key *key, uint32_t key_size, u
 
 int _librist_crypto_psk_rist_key_destroy(struct rist_key *key)
 {
+    free(key->keystream);
+    key->keystream = NULL;
+    key->keystream_depth = 0;
     if (key->key_size) {
 #if HAVE_MBEDTLS
 	    mbedtls_aes_free(&key->mbedtls_aes_ctx);
@@ -70,6 +75,7 @@ int _librist_crypto_psk_rist_key_clone(struct rist_key *key_in, struct rist_key
     memcpy(key_out->password, key_in->password, key_in->password_len);
     key_out->key_size = key_in->key_size;
     key_out->key_rotation = key_in->key_rotation;
+    key_out->kdf = key_in->kdf;
 #if HAVE_MBEDTLS
 	mbedtls_aes_init(&key_out->mbedtls_aes_ctx);
 #elif HAVE_NETTLE
@@ -81,9 +87,8 @@ int _librist_crypto_psk_rist_key_clone(struct rist_key *key_in, struct rist_key
 	return 0;
 }
 
-static void _librist_crypto_aes_key(struct rist_key *key)
+static void _librist_crypto_psk_pbkdf2(const struct rist_psk_kdf_params *params, uint8_t aes_key[])
 {
-    uint8_t aes_key[256 / 8];
 #if HAVE_MBEDTLS
     mbedtls_md_context_t sha_ctx;
     const mbedtls_md_info_t *info_sha;
@@ -103,26 +108,158 @@ static void _librist_crypto_aes_key(struct rist_key *key)
     }
 
     ret = mbedtls_pkcs5_pbkdf2_hmac(
-        &sha_ctx, (const unsigned char *)key->password, key->password_len,
-        key->gre_nonce, sizeof(key->gre_nonce),
-        RIST_PBKDF2_HMAC_SHA256_ITERATIONS, key->key_size / 8, aes_key);
+        &sha_ctx, (const unsigned char *)params->password, params->password_len,
+        params->nonce, sizeof(params->nonce),
+        RIST_PBKDF2_HMAC_SHA256_ITERATIONS, params->key_size / 8, aes_key);
     if (ret != 0) {
             // rist_log_priv(cctx, RIST_LOG_ERROR, "Mbed TLS pbkdf2 function
             // failed\n");
     }
     mbedtls_md_free(&sha_ctx);
 #elif HAVE_NETTLE
-    nettle_pbkdf2_hmac_sha256(key->password_len,(const uint8_t*)key->password,
+    nettle_pbkdf2_hmac_sha256(params->password_len,(const uint8_t*)params->password,
 							  RIST_PBKDF2_HMAC_SHA256_ITERATIONS,
-							  sizeof(key->gre_nonce), key->gre_nonce,
-							  key->key_size/8, aes_key);
+							  sizeof(params->nonce), params->nonce,
+							  params->key_size/8, aes_key);
 #else
     fastpbkdf2_hmac_sha256(
-            (const void *) key->password, key->password_len,
-            (const void *) key->gre_nonce, sizeof(key->gre_nonce),
+            (const void *) params->password, params->password_len,
+            (const void *) params->nonce, sizeof(params->nonce),
             RIST_PBKDF2_HMAC_SHA256_ITERATIONS,
-            aes_key, key->key_size / 8);
+            aes_key, params->key_size / 8);
 #endif
+}
+
+int _librist_crypto_psk_kdf_init(struct rist_psk_kdf *kdf)
+{
+	memset(kdf, 0, sizeof(*kdf));
+	atomic_init(&kdf->pending, false);
+	if (pthread_mutex_init(&kdf->lock, NULL) != 0)
+		return -1;
+	if (pthread_cond_init(&kdf->condition, NULL) != 0) {
+		pthread_mutex_destroy(&kdf->lock);
+		return -1;
+	}
+	return 0;
+}
+
+void _librist_crypto_psk_kdf_destroy(struct rist_psk_kdf *kdf)
+{
+	pthread_cond_destroy(&kdf->condition);
+	pthread_mutex_destroy(&kdf->lock);
+	//Don't leave derived keys & passphrases lying around
+	memset(kdf->cache, 0, sizeof(kdf->cache));
+	memset(kdf->queue, 0, sizeof(kdf->queue));
+}
+
+static void _librist_crypto_psk_kdf_params(struct rist_psk_kdf_params *params, const struct rist_key *key, const uint8_t nonce[4])
+{
+	memset(params, 0, sizeof(*params));
+	memcpy(params->password, key->password, key->password_len);
+	params->password_len = key->password_len;
+	memcpy(params->nonce, nonce, sizeof(params->nonce));
+	params->key_size = key->key_size;
+}
+
+//Called with kdf->lock held
+static struct rist_psk_kdf_entry *_librist_crypto_psk_kdf_find(struct rist_psk_kdf *kdf, const struct rist_psk_kdf_params *params)
+{
+	for (size_t i = 0; i < RIST_PSK_KDF_CACHE_SIZE; i++) {
+		struct rist_psk_kdf_entry *entry = &kdf->cache[i];
+		if (entry->valid && memcmp(&entry->params, params, sizeof(*params)) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+static bool _librist_crypto_psk_kdf_lookup(struct rist_psk_kdf *kdf, const struct rist_psk_kdf_params *params, uint8_t aes_key[])
+{
+	pthread_mutex_lock(&kdf->lock);
+	struct rist_psk_kdf_entry *entry = _librist_crypto_psk_kdf_find(kdf, params);
+	if (entry) {
+		entry->last_used = ++kdf->use_clock;
+		memcpy(aes_key, entry->aes_key, params->key_size / 8);
+	}
+	pthread_mutex_unlock(&kdf->lock);
+	return entry != NULL;
+}
+
+static void _librist_crypto_psk_kdf_insert(struct rist_psk_kdf *kdf, const struct rist_psk_kdf_params *params, const uint8_t aes_key[])
+{
+	pthread_mutex_lock(&kdf->lock);
+	struct rist_psk_kdf_entry *entry = _librist_crypto_psk_kdf_find(kdf, params);
+	if (!entry) {
+		//Evict the least recently used
+		entry = &kdf->cache[0];
+		for (size_t i = 0; i < RIST_PSK_KDF_CACHE_SIZE && entry->valid; i++) {
+			if (!kdf->cache[i].valid || kdf->cache[i].last_used < entry->last_used)
+				entry = &kdf->cache[i];
+		}
+		entry->params = *params;
+		memcpy(entry->aes_key, aes_key, params->key_size / 8);
+		entry->valid = true;
+	}
+	entry->last_used = ++kdf->use_clock;
+	pthread_mutex_unlock(&kdf->lock);
+}
+
+//Queue a derivation for the helper thread, dropped when the queue is full (the key is then derived inline)
+static void _librist_crypto_psk_kdf_request(struct rist_psk_kdf *kdf, const struct rist_psk_kdf_params *params)
+{
+	pthread_mutex_lock(&kdf->lock);
+	if (kdf->queue_count < RIST_PSK_KDF_QUEUE_SIZE && !_librist_crypto_psk_kdf_find(kdf, params)) {
+		kdf->queue[kdf->queue_count++] = *params;
+		atomic_store_explicit(&kdf->pending, true, memory_order_release);
+		pthread_cond_signal(&kdf->condition);
+	}
+	pthread_mutex_unlock(&kdf->lock);
+}
+
+bool _librist_crypto_psk_kdf_queued(struct rist_psk_kdf *kdf)
+{
+	return atomic_load_explicit(&kdf->pending, memory_order_acquire);
+}
+
+void _librist_crypto_psk_kdf_stop(struct rist_psk_kdf *kdf)
+{
+	pthread_mutex_lock(&kdf->lock);
+	kdf->shutdown = true;
+	pthread_cond_broadcast(&kdf->condition);
+	pthread_mutex_unlock(&kdf->lock);
+}
+
+void _librist_crypto_psk_kdf_run(struct rist_psk_kdf *kdf)
+{
+	struct rist_psk_kdf_params params;
+	uint8_t aes_key[256 / 8];
+	pthread_mutex_lock(&kdf->lock);
+	while (!kdf->shutdown) {
+		if (kdf->queue_count == 0) {
+			pthread_cond_wait(&kdf->condition, &kdf->lock);
+			continue;
+		}
+		params = kdf->queue[--kdf->queue_count];
+		atomic_store_explicit(&kdf->pending, kdf->queue_count > 0, memory_order_relaxed);
+		pthread_mutex_unlock(&kdf->lock);
+		_librist_crypto_psk_pbkdf2(&params, aes_key);
+		_librist_crypto_psk_kdf_insert(kdf, &params, aes_key);
+		pthread_mutex_lock(&kdf->lock);
+	}
+	pthread_mutex_unlock(&kdf->lock);
+	memset(&params, 0, sizeof(params));
+	memset(aes_key, 0, sizeof(aes_key));
+}
+
+static void _librist_crypto_aes_key(struct rist_key *key)
+{
+    uint8_t aes_key[256 / 8];
+    struct rist_psk_kdf_params params;
+    _librist_crypto_psk_kdf_params(&params, key, key->gre_nonce);
+    if (!key->kdf || !_librist_crypto_psk_kdf_lookup(key->kdf, &params, aes_key)) {
+        _librist_crypto_psk_pbkdf2(&params, aes_key);
+        if (key->kdf)
+            _librist_crypto_psk_kdf_insert(key->kdf, &params, aes_key);
+    }
 
 
 #if HAVE_MBEDTLS
@@ -140,15 +277,18 @@ static void _librist_crypto_aes_key(struct rist_key *key)
 	default:
 		nettle_aes128_set_encrypt_key(&key->nettle_ctx.u.ctx128, aes_key);
     }
-#elif defined(LINUX_CRYPTO)
-    if (key->linux_crypto_ctx)
-		linux_crypto_set_key(aes_key, key->key_size / 8, key->linux_crypto_ctx);
-    else
-        aes_key_setup(aes_key, key->aes_key_sched, key->key_size);
 #else
-    aes_key_setup(aes_key, key->aes_key_sched, key->key_size);
+    _librist_aes_ctr_setkey(&key->aes_ctr, aes_key, key->key_size);
+#if defined(LINUX_CRYPTO)
+    // AF_ALG costs syscalls per packet, only use it when the CPU has no AES instructions we can use
+    if (key->linux_crypto_ctx && key->aes_ctr.impl == RIST_AES_CTR_IMPL_TABLE)
+		linux_crypto_set_key(aes_key, key->key_size / 8, key->linux_crypto_ctx);
+#endif
 #endif
     key->used_times = 0;
+    key->key_epoch++;
+    memset(aes_key, 0, sizeof(aes_key));
+    memset(&params, 0, sizeof(params));
 }
 
 //This doesn't really belong here (not PSK related), but since all other crypto interop stuff is here it goes in here..
@@ -177,13 +317,15 @@ void _librist_crypto_aes_ctr(const uint8_t key[], int key_size, uint8_t iv[], co
 	}
 	nettle_ctr_crypt(&aes_ctx.u, f, AES_BLOCK_SIZE, iv, payload_len, outbuf, inbuf);
 #else
-    uint32_t aes_key_sched[60];
-    aes_key_setup(key, aes_key_sched, key_size);
-    aes_decrypt_ctr(inbuf, payload_len, outbuf, aes_key_sched, key_size, iv);
+    struct rist_aes_ctr ctx;
+    uint8_t stream_block[AES_BLOCK_SIZE];
+    size_t nc_off = 0;
+    _librist_aes_ctr_setkey(&ctx, key, key_size);
+    _librist_aes_ctr_crypt(&ctx, iv, &nc_off, stream_block, inbuf, outbuf, payload_len);
 #endif
 }
 
-static void _librist_crypto_psk_aes_ctr(struct rist_key *key, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len)
+static void _librist_crypto_psk_ctr_crypt(struct rist_key *key, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len)
 {
 #if HAVE_MBEDTLS
 	mbedtls_aes_crypt_ctr(&key->mbedtls_aes_ctx, payload_len, &key->aes_offset, key->iv, key->strean_block, inbuf, outbuf);
@@ -202,14 +344,47 @@ static void _librist_crypto_psk_aes_ctr(struct rist_key *key, const uint8_t inbu
 		f = (nettle_cipher_func *)nettle_aes128_encrypt;
 	}
 	nettle_ctr_crypt(&key->nettle_ctx.u, f, AES_BLOCK_SIZE, key->iv,payload_len, outbuf, inbuf);
-#elif defined(LINUX_CRYPTO)
-	if (key->linux_crypto_ctx)
+#else
+#if defined(LINUX_CRYPTO)
+	if (key->linux_crypto_ctx && key->aes_ctr.impl == RIST_AES_CTR_IMPL_TABLE)
 		linux_crypto_decrypt(inbuf, outbuf, payload_len, key->iv, key->linux_crypto_ctx);
 	else
-		aes_decrypt_ctr(inbuf, payload_len, outbuf,	key->aes_key_sched, key->key_size, key->iv);
-#else
-	aes_decrypt_ctr(inbuf, payload_len, outbuf, key->aes_key_sched, key->key_size, key->iv);
 #endif
+	_librist_aes_ctr_crypt(&key->aes_ctr, key->iv, &key->aes_offset, key->strean_block, inbuf, outbuf, payload_len);
+#endif
+}
+
+static void _librist_crypto_psk_aes_ctr(struct rist_key *key, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len)
+{
+	if (key->keystream_active) {
+		//XOR with the precomputed keystream, it ends on a block boundary so any remainder continues as plain CTR
+		size_t len = RIST_PSK_KEYSTREAM_SIZE - key->keystream_offset;
+		if (len > payload_len)
+			len = payload_len;
+		const uint8_t *ks = &key->keystream_active[key->keystream_offset];
+		for (size_t i = 0; i < len; i++)
+			outbuf[i] = inbuf[i] ^ ks[i];
+		key->keystream_offset += len;
+		payload_len -= len;
+		if (payload_len == 0) {
+			key->used_times++;
+			return;
+		}
+		inbuf += len;
+		outbuf += len;
+		key->keystream_active = NULL;
+		//Advance the big endian counter past the blocks the keystream covered
+		uint32_t carry = RIST_PSK_KEYSTREAM_SIZE / AES_BLOCK_SIZE;
+		for (int i = AES_BLOCK_SIZE - 1; i >= 0 && carry; i--) {
+			carry += key->iv[i];
+			key->iv[i] = (uint8_t)carry;
+			carry >>= 8;
+		}
+#if !HAVE_NETTLE
+		key->aes_offset = 0;
+#endif
+	}
+	_librist_crypto_psk_ctr_crypt(key, inbuf, outbuf, payload_len);
     key->used_times++;
 }
 
@@ -221,17 +396,17 @@ static void _librist_crypto_psk_prepare_iv(struct rist_key *key, uint8_t gre_ver
     memcpy(key->iv + copy_offset, &seq_nbe, sizeof(seq_nbe));
 }
 
-static void _librist_crypto_psk_generate_nonce(struct rist_key *key) {
+static void _librist_crypto_psk_generate_nonce(struct rist_key *key, uint8_t nonce[4]) {
 	uint32_t nonce_val;
 	do {
 		nonce_val = prand_u32();
 	} while (!nonce_val);
 
-	memcpy(key->gre_nonce, &nonce_val, sizeof(key->gre_nonce));
+	memcpy(nonce, &nonce_val, sizeof(key->gre_nonce));
 
-    UNSET_BIT(key->gre_nonce[0], 7);
+    UNSET_BIT(nonce[0], 7);
     if (key->odd)
-        SET_BIT(key->gre_nonce[0], 7);
+        SET_BIT(nonce[0], 7);
 }
 
 void _librist_crypto_psk_decrypt(struct rist_key *key, uint8_t nonce[4], uint32_t seq_nbe, uint8_t gre_version, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len)
@@ -251,7 +426,7 @@ void _librist_crypto_psk_decrypt(struct rist_key *key, uint8_t nonce[4], uint32_
         return;
 
     _librist_crypto_psk_prepare_iv(key, gre_version, seq_nbe);
-#if HAVE_MBEDTLS
+#if !HAVE_NETTLE
     key->aes_offset = 0;
 #endif
     _librist_crypto_psk_aes_ctr(key, inbuf, outbuf, payload_len);
@@ -262,17 +437,93 @@ void _librist_crypto_psk_encrypt(struct rist_key *key, uint32_t seq_nbe, uint8_t
 {
     uint32_t nonce_val = *((uint32_t *)key->gre_nonce);
     if (!nonce_val || (key->used_times +1) > RIST_AES_KEY_REUSE_TIMES || (key->key_rotation > 0 && key->used_times >= key->key_rotation)) {
-        _librist_crypto_psk_generate_nonce(key);
+        uint32_t next_nonce_val = *((uint32_t *)key->next_nonce);
+        if (next_nonce_val) {
+            //Derived by the helper thread already, unless it has fallen behind
+            memcpy(key->gre_nonce, key->next_nonce, sizeof(key->gre_nonce));
+            memset(key->next_nonce, 0, sizeof(key->next_nonce));
+        } else {
+            _librist_crypto_psk_generate_nonce(key, key->gre_nonce);
+        }
         _librist_crypto_aes_key(key);
+        if (key->kdf && key->key_rotation > 0) {
+            struct rist_psk_kdf_params params;
+            _librist_crypto_psk_generate_nonce(key, key->next_nonce);
+            _librist_crypto_psk_kdf_params(&params, key, key->next_nonce);
+            _librist_crypto_psk_kdf_request(key->kdf, &params);
+            memset(&params, 0, sizeof(params));
+        }
     }
     _librist_crypto_psk_prepare_iv(key, gre_version, seq_nbe);
-#if HAVE_MBEDTLS
+#if !HAVE_NETTLE
     key->aes_offset = 0;
 #endif
+    key->keystream_active = NULL;
+    if (key->keystream) {
+        uint32_t seq = be32toh(seq_nbe);
+        struct rist_psk_keystream *entry = &key->keystream[seq % key->keystream_depth];
+        if (entry->valid && entry->seq == seq && entry->key_epoch == key->key_epoch && entry->gre_version == gre_version) {
+            //Sequence numbers are never reused under one key, the entry is spent either way
+            entry->valid = false;
+            key->keystream_active = entry->data;
+            key->keystream_offset = 0;
+        }
+    }
     _librist_crypto_psk_aes_ctr(key, inbuf, outbuf, payload_len);
     return;
 }
 
+int _librist_crypto_psk_keystream_enable(struct rist_key *key, size_t depth)
+{
+	free(key->keystream);
+	key->keystream = NULL;
+	key->keystream_depth = 0;
+	key->keystream_active = NULL;
+	if (depth == 0)
+		return 0;
+	key->keystream = calloc(depth, sizeof(*key->keystream));
+	if (!key->keystream)
+		return -1;
+	key->keystream_depth = depth;
+	return 0;
+}
+
+//Generates the keystream for the next sequence numbers this key will encrypt, skipping entries that are still current
+void _librist_crypto_psk_keystream_fill(struct rist_key *key, uint32_t next_seq, uint8_t gre_version)
+{
+	static const uint8_t zeroes[RIST_PSK_KEYSTREAM_SIZE];
+	uint32_t nonce_val = *((uint32_t *)key->gre_nonce);
+	if (!key->keystream || !nonce_val)
+		return;
+
+	//Anything past the next key rotation would be generated with a key that is about to be replaced
+	uint64_t uses_left = key->used_times < RIST_AES_KEY_REUSE_TIMES ? RIST_AES_KEY_REUSE_TIMES - key->used_times : 0;
+	if (key->key_rotation > 0)
+		uses_left = key->used_times < key->key_rotation ? key->key_rotation - key->used_times : 0;
+	size_t count = key->keystream_depth;
+	if (uses_left < count)
+		count = (size_t)uses_left;
+
+	uint8_t iv[AES_BLOCK_SIZE];
+	memcpy(iv, key->iv, sizeof(iv));
+	for (size_t i = 0; i < count; i++) {
+		uint32_t seq = next_seq + (uint32_t)i;
+		struct rist_psk_keystream *entry = &key->keystream[seq % key->keystream_depth];
+		if (entry->valid && entry->seq == seq && entry->key_epoch == key->key_epoch && entry->gre_version == gre_version)
+			continue;
+		_librist_crypto_psk_prepare_iv(key, gre_version, htobe32(seq));
+#if !HAVE_NETTLE
+		key->aes_offset = 0;
+#endif
+		_librist_crypto_psk_ctr_crypt(key, zeroes, entry->data, RIST_PSK_KEYSTREAM_SIZE);
+		entry->seq = seq;
+		entry->key_epoch = key->key_epoch;
+		entry->gre_version = gre_version;
+		entry->valid = true;
+	}
+	memcpy(key->iv, iv, sizeof(iv));
+}
+
 int _librist_crypto_psk_set_passphrase(struct rist_key *key, const uint8_t *passsphrase, size_t passphrase_len) {
 	if (passphrase_len > sizeof(key->password) -1) {
 		return -1;
@@ -282,7 +533,8 @@ int _librist_crypto_psk_set_passphrase(struct rist_key *key, const uint8_t *pass
 	memcpy(key->password, passsphrase, passphrase_len);
 	key->password_len = passphrase_len;
 	key->used_times = 0;
-	_librist_crypto_psk_generate_nonce(key);
+	memset(key->next_nonce, 0, sizeof(key->next_nonce));
+	_librist_crypto_psk_generate_nonce(key, key->gre_nonce);
 	_librist_crypto_aes_key(key);
 	return 0;
 }
@@ -295,3 +547,21 @@ void _librist_crypto_psk_get_passphrase(struct rist_key *key, const uint8_t **pa
 void _librist_crypto_psk_encrypt_continue(struct rist_key *key, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len) {
 	_librist_crypto_psk_aes_ctr(key, inbuf, outbuf, payload_len);
 }
+
+//Whether encrypt_continue picks up mid keystream block, nettle and AF_ALG restart at a block boundary
+bool _librist_crypto_psk_encrypt_can_continue(const struct rist_key *key) {
+#if HAVE_MBEDTLS
+	RIST_MARK_UNUSED(key);
+	return true;
+#elif HAVE_NETTLE
+	RIST_MARK_UNUSED(key);
+	return false;
+#else
+#if defined(LINUX_CRYPTO)
+	if (key->linux_crypto_ctx && key->aes_ctr.impl == RIST_AES_CTR_IMPL_TABLE)
+		return false;
+#endif
+	RIST_MARK_UNUSED(key);
+	return true;
+#endif
+}
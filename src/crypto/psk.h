@@ -20,7 +20,10 @@
 #include "linux-crypto.h"
 #endif
 #include "contrib/aes.h"
+#include "aes_ctr.h"
 #endif
+#include "pthread-shim.h"
+#include <stdatomic.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
@@ -29,6 +32,51 @@
 #define AES_BLOCK_SIZE 16
 #endif
 
+/* PBKDF2 results shared by all keys of a context, keyed on passphrase, nonce and key size, so
+ * peers sharing a passphrase and nonces that come back skip the KDF. Senders also queue the
+ * nonce of their next rotation for a helper thread to derive ahead of time. */
+#define RIST_PSK_KDF_CACHE_SIZE 16
+#define RIST_PSK_KDF_QUEUE_SIZE 8
+
+struct rist_psk_kdf_params {
+	uint8_t password[128];
+	size_t password_len;
+	uint8_t nonce[4];
+	uint32_t key_size;
+};
+
+struct rist_psk_kdf_entry {
+	struct rist_psk_kdf_params params;
+	uint8_t aes_key[256 / 8];
+	uint64_t last_used;
+	bool valid;
+};
+
+struct rist_psk_kdf {
+	pthread_mutex_t lock;
+	struct rist_psk_kdf_entry cache[RIST_PSK_KDF_CACHE_SIZE];
+	uint64_t use_clock;
+	/* derivations waiting for the helper thread */
+	pthread_cond_t condition;
+	struct rist_psk_kdf_params queue[RIST_PSK_KDF_QUEUE_SIZE];
+	size_t queue_count;
+	/* queue_count > 0, readable without the lock */
+	atomic_bool pending;
+	bool shutdown;
+};
+
+/* Keystream for one upcoming GRE sequence number, enough for a 1316 byte TS payload with
+ * its RTP and reduced headers. Longer packets continue with regular CTR after it. */
+#define RIST_PSK_KEYSTREAM_SIZE (84 * AES_BLOCK_SIZE)
+
+struct rist_psk_keystream {
+	uint32_t seq;
+	uint32_t key_epoch;
+	uint8_t gre_version;
+	bool valid;
+	uint8_t data[RIST_PSK_KEYSTREAM_SIZE];
+};
+
 struct rist_key {
 	uint32_t key_size;
 	uint8_t gre_nonce[4];
@@ -39,12 +87,23 @@ struct rist_key {
 	mbedtls_aes_context mbedtls_aes_ctx;
 #elif HAVE_NETTLE
 	struct aes_ctx nettle_ctx;
-#elif defined(LINUX_CRYPTO)
+#else
+#if defined(LINUX_CRYPTO)
 	struct linux_crypto *linux_crypto_ctx;
 #endif
-	uint32_t aes_key_sched[60];//Do we still need this fallback?
+	size_t aes_offset;
+	unsigned char strean_block[16];
+	struct rist_aes_ctr aes_ctr;
+#endif
 	uint32_t key_rotation;
     uint64_t used_times;
+	struct rist_psk_kdf *kdf;//Context wide derived key cache, may be NULL
+	uint8_t next_nonce[4];//Nonce of the next rotation, already queued for derivation when non zero
+	uint32_t key_epoch;//Bumped on every AES key change, precomputed keystream of older epochs is stale
+	struct rist_psk_keystream *keystream;//Ring indexed by seq % keystream_depth, NULL unless enabled
+	size_t keystream_depth;
+	const uint8_t *keystream_active;//Entry the current packet is being encrypted with
+	size_t keystream_offset;
 	uint8_t password[128];
 	size_t password_len;
     bool bad_decryption;
@@ -58,6 +117,16 @@ RIST_PRIV int _librist_crypto_psk_rist_key_clone(struct rist_key *key_in, struct
 RIST_PRIV void _librist_crypto_psk_decrypt(struct rist_key *key, uint8_t nonce[4], uint32_t seq_nbe, uint8_t gre_version, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len);
 RIST_PRIV void _librist_crypto_psk_encrypt(struct rist_key *key, uint32_t seq_nbe, uint8_t gre_version, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len);
 RIST_PRIV void _librist_crypto_psk_encrypt_continue(struct rist_key *key, const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len);
+RIST_PRIV bool _librist_crypto_psk_encrypt_can_continue(const struct rist_key *key);
+RIST_PRIV int _librist_crypto_psk_kdf_init(struct rist_psk_kdf *kdf);
+RIST_PRIV void _librist_crypto_psk_kdf_destroy(struct rist_psk_kdf *kdf);
+/* Lock-free, the sender protocol loop polls it */
+RIST_PRIV bool _librist_crypto_psk_kdf_queued(struct rist_psk_kdf *kdf);
+RIST_PRIV void _librist_crypto_psk_kdf_stop(struct rist_psk_kdf *kdf);
+/* Helper thread body, derives queued keys into the cache until _librist_crypto_psk_kdf_stop */
+RIST_PRIV void _librist_crypto_psk_kdf_run(struct rist_psk_kdf *kdf);
+RIST_PRIV int _librist_crypto_psk_keystream_enable(struct rist_key *key, size_t depth);
+RIST_PRIV void _librist_crypto_psk_keystream_fill(struct rist_key *key, uint32_t next_seq, uint8_t gre_version);
 RIST_PRIV int _librist_crypto_psk_set_passphrase(struct rist_key *key, const uint8_t *passsphrase, size_t passphrase_len);
 RIST_PRIV void _librist_crypto_psk_get_passphrase(struct rist_key *key, const uint8_t **passphrase, size_t *passphrase_len);
 RIST_PRIV void _librist_crypto_aes_ctr(const uint8_t key[], int key_size, uint8_t iv[], const uint8_t inbuf[], uint8_t outbuf[], size_t payload_len);
@@ -0,0 +1,421 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "fec.h"
+#include "endian-shim.h"
+#include "proto/rist_time.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define FEC_XOR_SSE2 1
+#include <emmintrin.h>
+#endif
+#if HAVE_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define FEC_XOR_NEON 1
+#include <arm_neon.h>
+#endif
+
+static void fec_xor_c(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t a, b;
+		memcpy(&a, &dst[i], 8);
+		memcpy(&b, &src[i], 8);
+		a ^= b;
+		memcpy(&dst[i], &a, 8);
+	}
+	for (; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+#ifdef FEC_XOR_SSE2
+static void fec_xor_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	for (; i + 64 <= len; i += 64) {
+		__m128i a0 = _mm_loadu_si128((const __m128i *)&dst[i]);
+		__m128i a1 = _mm_loadu_si128((const __m128i *)&dst[i + 16]);
+		__m128i a2 = _mm_loadu_si128((const __m128i *)&dst[i + 32]);
+		__m128i a3 = _mm_loadu_si128((const __m128i *)&dst[i + 48]);
+		a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *)&src[i]));
+		a1 = _mm_xor_si128(a1, _mm_loadu_si128((const __m128i *)&src[i + 16]));
+		a2 = _mm_xor_si128(a2, _mm_loadu_si128((const __m128i *)&src[i + 32]));
+		a3 = _mm_xor_si128(a3, _mm_loadu_si128((const __m128i *)&src[i + 48]));
+		_mm_storeu_si128((__m128i *)&dst[i], a0);
+		_mm_storeu_si128((__m128i *)&dst[i + 16], a1);
+		_mm_storeu_si128((__m128i *)&dst[i + 32], a2);
+		_mm_storeu_si128((__m128i *)&dst[i + 48], a3);
+	}
+	for (; i + 16 <= len; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)&dst[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)&src[i])));
+	}
+	fec_xor_c(&dst[i], &src[i], len - i);
+}
+#endif
+
+#if HAVE_AVX2
+__attribute__((target("avx2")))
+static void fec_xor_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	for (; i + 128 <= len; i += 128) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		__m256i a1 = _mm256_loadu_si256((const __m256i *)&dst[i + 32]);
+		__m256i a2 = _mm256_loadu_si256((const __m256i *)&dst[i + 64]);
+		__m256i a3 = _mm256_loadu_si256((const __m256i *)&dst[i + 96]);
+		a0 = _mm256_xor_si256(a0, _mm256_loadu_si256((const __m256i *)&src[i]));
+		a1 = _mm256_xor_si256(a1, _mm256_loadu_si256((const __m256i *)&src[i + 32]));
+		a2 = _mm256_xor_si256(a2, _mm256_loadu_si256((const __m256i *)&src[i + 64]));
+		a3 = _mm256_xor_si256(a3, _mm256_loadu_si256((const __m256i *)&src[i + 96]));
+		_mm256_storeu_si256((__m256i *)&dst[i], a0);
+		_mm256_storeu_si256((__m256i *)&dst[i + 32], a1);
+		_mm256_storeu_si256((__m256i *)&dst[i + 64], a2);
+		_mm256_storeu_si256((__m256i *)&dst[i + 96], a3);
+	}
+	for (; i + 32 <= len; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)&src[i])));
+	}
+	fec_xor_c(&dst[i], &src[i], len - i);
+}
+#endif
+
+#ifdef FEC_XOR_NEON
+static void fec_xor_neon(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	for (; i + 64 <= len; i += 64) {
+		uint8x16_t a0 = veorq_u8(vld1q_u8(&dst[i]), vld1q_u8(&src[i]));
+		uint8x16_t a1 = veorq_u8(vld1q_u8(&dst[i + 16]), vld1q_u8(&src[i + 16]));
+		uint8x16_t a2 = veorq_u8(vld1q_u8(&dst[i + 32]), vld1q_u8(&src[i + 32]));
+		uint8x16_t a3 = veorq_u8(vld1q_u8(&dst[i + 48]), vld1q_u8(&src[i + 48]));
+		vst1q_u8(&dst[i], a0);
+		vst1q_u8(&dst[i + 16], a1);
+		vst1q_u8(&dst[i + 32], a2);
+		vst1q_u8(&dst[i + 48], a3);
+	}
+	for (; i + 16 <= len; i += 16)
+		vst1q_u8(&dst[i], veorq_u8(vld1q_u8(&dst[i]), vld1q_u8(&src[i])));
+	fec_xor_c(&dst[i], &src[i], len - i);
+}
+#endif
+
+rist_fec_xor_func rist_fec_xor_select(const char **name)
+{
+	const char *dummy;
+	if (!name)
+		name = &dummy;
+#if HAVE_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "AVX2";
+		return fec_xor_avx2;
+	}
+#endif
+#ifdef FEC_XOR_SSE2
+	*name = "SSE2";
+	return fec_xor_sse2;
+#elif defined(FEC_XOR_NEON)
+	*name = "NEON";
+	return fec_xor_neon;
+#else
+	*name = "C";
+	return fec_xor_c;
+#endif
+}
+
+int rist_fec_config_check(uint32_t columns, uint32_t rows, bool row_fec)
+{
+	if (columns < 1 || columns > RIST_FEC_COLUMNS_MAX)
+		return -1;
+	if (rows < RIST_FEC_ROWS_MIN || rows > RIST_FEC_ROWS_MAX)
+		return -1;
+	if (columns * rows > RIST_FEC_MATRIX_MAX)
+		return -1;
+	// A row of less than 4 packets costs more than it protects
+	if (row_fec && columns < 4)
+		return -1;
+	return 0;
+}
+
+static int fec_group_init(struct rist_fec_group *g)
+{
+	g->buf = malloc(RIST_MAX_PAYLOAD_OFFSET + sizeof(struct rist_fec_hdr) + RIST_MAX_PACKET_SIZE);
+	g->count = 0;
+	return g->buf ? 0 : -1;
+}
+
+struct rist_fec_encoder *rist_fec_encoder_create(uint32_t columns, uint32_t rows, bool row_fec)
+{
+	if (rist_fec_config_check(columns, rows, row_fec) != 0)
+		return NULL;
+	struct rist_fec_encoder *enc = calloc(1, sizeof(*enc));
+	if (!enc)
+		return NULL;
+	enc->columns = (uint8_t)columns;
+	enc->rows = (uint8_t)rows;
+	enc->row_fec = row_fec;
+	enc->xor_func = rist_fec_xor_select(NULL);
+	enc->column = calloc(columns, sizeof(*enc->column));
+	if (!enc->column)
+		goto fail;
+	for (uint32_t i = 0; i < columns; i++) {
+		if (fec_group_init(&enc->column[i]) != 0)
+			goto fail;
+	}
+	if (row_fec && fec_group_init(&enc->row) != 0)
+		goto fail;
+	return enc;
+
+fail:
+	rist_fec_encoder_destroy(enc);
+	return NULL;
+}
+
+void rist_fec_encoder_destroy(struct rist_fec_encoder *enc)
+{
+	if (!enc)
+		return;
+	if (enc->column) {
+		for (size_t i = 0; i < enc->columns; i++)
+			free(enc->column[i].buf);
+		free(enc->column);
+	}
+	free(enc->row.buf);
+	free(enc);
+}
+
+static void fec_group_add(rist_fec_xor_func xor_func, struct rist_fec_group *g, uint32_t seq,
+						  const uint8_t *payload, size_t len, uint32_t rtp_ts)
+{
+	uint8_t *acc = &g->buf[RIST_MAX_PAYLOAD_OFFSET + sizeof(struct rist_fec_hdr)];
+	if (g->count == 0) {
+		// First packet of the group, nothing to XOR with yet
+		memcpy(acc, payload, len);
+		g->len = len;
+		g->snbase = seq;
+		g->ts_recovery = rtp_ts;
+		g->length_recovery = (uint16_t)len;
+		g->pt_recovery = RTP_PTYPE_MPEGTS;
+	} else {
+		size_t common = len < g->len ? len : g->len;
+		xor_func(acc, payload, common);
+		// Shorter packets are zero padded, so the tail of a longer one is copied as is
+		if (len > g->len) {
+			memcpy(&acc[g->len], &payload[g->len], len - g->len);
+			g->len = len;
+		}
+		g->ts_recovery ^= rtp_ts;
+		g->length_recovery ^= (uint16_t)len;
+		g->pt_recovery ^= RTP_PTYPE_MPEGTS;
+	}
+	g->count++;
+}
+
+static void fec_group_finish(struct rist_fec_encoder *enc, struct rist_fec_group *g, bool row, struct rist_fec_packet *out)
+{
+	struct rist_fec_hdr *hdr = (struct rist_fec_hdr *)&g->buf[RIST_MAX_PAYLOAD_OFFSET];
+	hdr->snbase_low = htobe16((uint16_t)g->snbase);
+	hdr->length_recovery = htobe16(g->length_recovery);
+	hdr->pt_recovery = RTP_FEC_E_BIT | (g->pt_recovery & 0x7F);
+	memset(hdr->mask, 0, sizeof(hdr->mask));
+	hdr->ts_recovery = htobe32(g->ts_recovery);
+	hdr->flags = row ? RTP_FEC_D_ROW : 0;
+	hdr->offset = row ? 1 : enc->columns;
+	hdr->na = row ? enc->columns : enc->rows;
+	hdr->snbase_ext = (uint8_t)(g->snbase >> 16);
+	out->data = (uint8_t *)hdr;
+	out->len = sizeof(*hdr) + g->len;
+	out->seq = enc->fec_seq++;
+	g->count = 0;
+}
+
+size_t rist_fec_encoder_add(struct rist_fec_encoder *enc, uint32_t seq, const uint8_t *payload, size_t len,
+							uint32_t rtp_ts, struct rist_fec_packet out[2])
+{
+	if (RIST_UNLIKELY(len > RIST_MAX_PACKET_SIZE))
+		return 0;
+	if (RIST_UNLIKELY(!enc->started || seq != enc->next_seq)) {
+		// First packet or a seq discontinuity: start a new matrix, partial groups are dropped
+		enc->position = 0;
+		for (size_t i = 0; i < enc->columns; i++)
+			enc->column[i].count = 0;
+		enc->row.count = 0;
+		enc->started = true;
+	}
+	enc->next_seq = seq + 1;
+
+	size_t column = enc->position % enc->columns;
+	size_t row = enc->position / enc->columns;
+	size_t count = 0;
+	fec_group_add(enc->xor_func, &enc->column[column], seq, payload, len, rtp_ts);
+	// Columns complete on the last row, which spreads their parity over that row
+	if (row == (size_t)enc->rows - 1)
+		fec_group_finish(enc, &enc->column[column], false, &out[count++]);
+	if (enc->row_fec) {
+		fec_group_add(enc->xor_func, &enc->row, seq, payload, len, rtp_ts);
+		if (column == (size_t)enc->columns - 1)
+			fec_group_finish(enc, &enc->row, true, &out[count++]);
+	}
+	if (++enc->position == (size_t)enc->columns * enc->rows)
+		enc->position = 0;
+	return count;
+}
+
+struct rist_fec_decoder *rist_fec_decoder_create(void)
+{
+	struct rist_fec_decoder *dec = calloc(1, sizeof(*dec));
+	if (!dec)
+		return NULL;
+	dec->xor_func = rist_fec_xor_select(NULL);
+	return dec;
+}
+
+void rist_fec_decoder_destroy(struct rist_fec_decoder *dec)
+{
+	if (!dec)
+		return;
+	for (size_t i = 0; i < RIST_FEC_DECODER_SLOTS; i++)
+		free(dec->parity[i].buf);
+	free(dec);
+}
+
+void rist_fec_decoder_reset(struct rist_fec_decoder *dec)
+{
+	for (size_t i = 0; i < RIST_FEC_DECODER_SLOTS; i++)
+		dec->parity[i].used = false;
+	dec->columns = 0;
+	dec->rows = 0;
+}
+
+struct rist_fec_parity *rist_fec_decoder_add(struct rist_fec_decoder *dec, const uint8_t *data, size_t len,
+											 uint32_t ref_seq, uint64_t now)
+{
+	const struct rist_fec_hdr *hdr = (const struct rist_fec_hdr *)data;
+	if (len < sizeof(*hdr) || len - sizeof(*hdr) > RIST_MAX_PACKET_SIZE)
+		return NULL;
+	if (!(hdr->pt_recovery & RTP_FEC_E_BIT) || hdr->offset == 0 || hdr->na < 2 ||
+		hdr->na > RIST_FEC_COLUMNS_MAX || hdr->na > RIST_FEC_ROWS_MAX)
+		return NULL;
+
+	// 24 bits of SNBase, take the 32bit seq closest to what we are receiving
+	uint32_t snbase24 = ((uint32_t)hdr->snbase_ext << 16) | be16toh(hdr->snbase_low);
+	uint32_t diff = (snbase24 - ref_seq) & 0xFFFFFF;
+	if (diff & 0x800000)
+		diff |= 0xFF000000;
+	uint32_t snbase = ref_seq + diff;
+
+	for (size_t i = 0; i < RIST_FEC_DECODER_SLOTS; i++) {
+		const struct rist_fec_parity *p = &dec->parity[i];
+		if (p->used && p->snbase == snbase && p->offset == hdr->offset && p->na == hdr->na)
+			return NULL;
+	}
+
+	if (!(hdr->flags & RTP_FEC_D_ROW)) {
+		// Columns of a matrix come in order, a gap in their SNBase means a new matrix started
+		if (dec->columns != hdr->offset || dec->rows != hdr->na || snbase != dec->last_column_snbase + 1)
+			dec->matrix_base = snbase;
+		dec->columns = hdr->offset;
+		dec->rows = hdr->na;
+		dec->last_column_snbase = snbase;
+	}
+	dec->last_parity_time = now;
+
+	// Oldest parity goes first
+	struct rist_fec_parity *p = &dec->parity[dec->next_slot];
+	dec->next_slot = (dec->next_slot + 1) % RIST_FEC_DECODER_SLOTS;
+	if (!p->buf) {
+		p->buf = malloc(RIST_MAX_PACKET_SIZE);
+		if (!p->buf)
+			return NULL;
+	}
+	p->len = len - sizeof(*hdr);
+	memcpy(p->buf, &data[sizeof(*hdr)], p->len);
+	p->snbase = snbase;
+	p->ts_recovery = be32toh(hdr->ts_recovery);
+	p->length_recovery = be16toh(hdr->length_recovery);
+	p->offset = hdr->offset;
+	p->na = hdr->na;
+	p->used = true;
+	return p;
+}
+
+size_t rist_fec_decoder_find(struct rist_fec_decoder *dec, uint32_t seq, struct rist_fec_parity *found[], size_t max)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < RIST_FEC_DECODER_SLOTS && count < max; i++) {
+		struct rist_fec_parity *p = &dec->parity[i];
+		uint32_t distance = seq - p->snbase;
+		if (p->used && distance % p->offset == 0 && distance / p->offset < p->na)
+			found[count++] = p;
+	}
+	return count;
+}
+
+static inline const struct rist_buffer *fec_queue_get(struct rist_buffer **queue, size_t queue_max, uint32_t seq)
+{
+	const struct rist_buffer *b = queue[seq & (queue_max - 1)];
+	return b && b->seq == seq ? b : NULL;
+}
+
+bool rist_fec_decoder_rebuild(struct rist_fec_decoder *dec, const struct rist_fec_parity *parity,
+							  struct rist_buffer **queue, size_t queue_max, struct rist_fec_recovered *out)
+{
+	uint32_t missing_seq = 0;
+	size_t missing = 0;
+	for (uint32_t k = 0; k < parity->na; k++) {
+		uint32_t seq = parity->snbase + k * parity->offset;
+		if (fec_queue_get(queue, queue_max, seq))
+			continue;
+		if (++missing > 1)
+			return false;
+		missing_seq = seq;
+	}
+	if (missing != 1)
+		return false;
+
+	memcpy(dec->scratch, parity->buf, parity->len);
+	uint16_t length = parity->length_recovery;
+	uint32_t rtp_ts = parity->ts_recovery;
+	for (uint32_t k = 0; k < parity->na; k++) {
+		uint32_t seq = parity->snbase + k * parity->offset;
+		if (seq == missing_seq)
+			continue;
+		const struct rist_buffer *b = fec_queue_get(queue, queue_max, seq);
+		if (b->size > parity->len)
+			return false;
+		dec->xor_func(dec->scratch, (const uint8_t *)b->data + RIST_MAX_PAYLOAD_OFFSET, b->size);
+		length ^= (uint16_t)b->size;
+		// source_time came out of convertRTPtoNTP, which rounds down
+		rtp_ts ^= timestampRTP_u32(0, b->source_time + 1);
+		out->src_port = b->src_port;
+		out->dst_port = b->dst_port;
+	}
+	if (length == 0 || length > parity->len)
+		return false;
+	out->data = dec->scratch;
+	out->len = length;
+	out->seq = missing_seq;
+	out->rtp_ts = rtp_ts;
+	return true;
+}
+
+uint32_t rist_fec_decoder_hold(const struct rist_fec_decoder *dec, uint32_t seq, uint32_t current_seq, uint64_t now)
+{
+	// Parity stopped, or never came
+	if (dec->columns == 0 || now - dec->last_parity_time > 1000 * RIST_CLOCK)
+		return 0;
+	uint32_t matrix_size = (uint32_t)dec->columns * dec->rows;
+	uint32_t row = ((seq - dec->matrix_base) % matrix_size) / dec->columns;
+	// The column completes with its packet in the last row
+	uint32_t column_end = seq + (dec->rows - 1 - row) * dec->columns;
+	int32_t remaining = (int32_t)(column_end - current_seq);
+	return remaining > 0 ? (uint32_t)remaining : 0;
+}
@@ -0,0 +1,121 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RIST_FEC_H
+#define RIST_FEC_H
+
+#include "config.h"
+#include "common/attributes.h"
+#include "udp-private.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* SMPTE 2022-1 style XOR FEC over an L columns x D rows matrix of data packets,
+ * see the header description in proto/rtp.h */
+
+#define RIST_FEC_COLUMNS_MAX 20
+#define RIST_FEC_ROWS_MIN 4
+#define RIST_FEC_ROWS_MAX 20
+#define RIST_FEC_MATRIX_MAX 100
+/* Parity kept by a receiver, enough for two full matrices of rows and columns */
+#define RIST_FEC_DECODER_SLOTS (2 * (RIST_FEC_COLUMNS_MAX + RIST_FEC_ROWS_MAX))
+
+typedef void (*rist_fec_xor_func)(uint8_t *dst, const uint8_t *src, size_t len);
+
+/* One parity packet being accumulated */
+struct rist_fec_group {
+	/* RIST_MAX_PAYLOAD_OFFSET of headroom, the fec header and the XOR of the payloads */
+	uint8_t *buf;
+	size_t len;
+	uint32_t snbase;
+	uint32_t ts_recovery;
+	uint16_t length_recovery;
+	uint8_t pt_recovery;
+	uint8_t count;
+};
+
+struct rist_fec_encoder {
+	uint8_t columns;
+	uint8_t rows;
+	bool row_fec;
+	rist_fec_xor_func xor_func;
+	/* next expected seq and its position in the current matrix */
+	uint32_t next_seq;
+	size_t position;
+	bool started;
+	uint16_t fec_seq;
+	struct rist_fec_group row;
+	struct rist_fec_group *column;
+};
+
+/* A completed parity packet, data has RIST_MAX_PAYLOAD_OFFSET bytes of headroom
+ * and stays valid until the next rist_fec_encoder_add call */
+struct rist_fec_packet {
+	uint8_t *data;
+	size_t len;
+	uint16_t seq;
+};
+
+/* A received parity packet, buf holds the XOR payload */
+struct rist_fec_parity {
+	uint8_t *buf;
+	size_t len;
+	uint32_t snbase;
+	uint32_t ts_recovery;
+	uint16_t length_recovery;
+	uint8_t offset;
+	uint8_t na;
+	bool used;
+};
+
+struct rist_fec_decoder {
+	rist_fec_xor_func xor_func;
+	/* Matrix geometry and alignment, learned from the column parity */
+	uint8_t columns;
+	uint8_t rows;
+	uint32_t matrix_base;
+	uint32_t last_column_snbase;
+	uint64_t last_parity_time;
+	size_t next_slot;
+	struct rist_fec_parity parity[RIST_FEC_DECODER_SLOTS];
+	uint8_t scratch[RIST_MAX_PACKET_SIZE];
+};
+
+/* A rebuilt data packet, data points into the decoder and stays valid until the next rebuild */
+struct rist_fec_recovered {
+	const uint8_t *data;
+	size_t len;
+	uint32_t seq;
+	uint32_t rtp_ts;
+	uint16_t src_port;
+	uint16_t dst_port;
+};
+
+RIST_PRIV rist_fec_xor_func rist_fec_xor_select(const char **name);
+RIST_PRIV int rist_fec_config_check(uint32_t columns, uint32_t rows, bool row_fec);
+RIST_PRIV struct rist_fec_encoder *rist_fec_encoder_create(uint32_t columns, uint32_t rows, bool row_fec);
+RIST_PRIV void rist_fec_encoder_destroy(struct rist_fec_encoder *enc);
+/* Adds the next data packet, returns how many parity packets it completed (its column and/or its row) */
+RIST_PRIV size_t rist_fec_encoder_add(struct rist_fec_encoder *enc, uint32_t seq, const uint8_t *payload, size_t len,
+									  uint32_t rtp_ts, struct rist_fec_packet out[2]);
+
+RIST_PRIV struct rist_fec_decoder *rist_fec_decoder_create(void);
+RIST_PRIV void rist_fec_decoder_destroy(struct rist_fec_decoder *dec);
+/* Forgets all parity, for when the receiver queue restarts */
+RIST_PRIV void rist_fec_decoder_reset(struct rist_fec_decoder *dec);
+/* Stores a parity packet (its RTP payload), ref_seq is a recent data seq used to extend SNBase to 32 bits.
+ * Returns NULL for invalid or already stored parity. */
+RIST_PRIV struct rist_fec_parity *rist_fec_decoder_add(struct rist_fec_decoder *dec, const uint8_t *data, size_t len,
+													   uint32_t ref_seq, uint64_t now);
+/* Collects the stored parity covering seq, returns how many were found */
+RIST_PRIV size_t rist_fec_decoder_find(struct rist_fec_decoder *dec, uint32_t seq, struct rist_fec_parity *found[], size_t max);
+/* Rebuilds the one packet covered by parity that is missing from the receiver queue, fails if none or several are */
+RIST_PRIV bool rist_fec_decoder_rebuild(struct rist_fec_decoder *dec, const struct rist_fec_parity *parity,
+										struct rist_buffer **queue, size_t queue_max, struct rist_fec_recovered *out);
+/* Packets still to come after current_seq before the column parity covering seq is sent, 0 if none is expected */
+RIST_PRIV uint32_t rist_fec_decoder_hold(const struct rist_fec_decoder *dec, uint32_t seq, uint32_t current_seq, uint64_t now);
+
+#endif
@@ -10,19 +10,145 @@
 #include "log-private.h"
 #include "udp-private.h"
 #include "proto/rist_time.h"
+#include "fec.h"
 #include <assert.h>
 
+static inline bool missing_entry_before(const struct rist_missing_buffer *a, const struct rist_missing_buffer *b)
+{
+	if (a->next_nack != b->next_nack)
+		return a->next_nack < b->next_nack;
+	// Same deadline (e.g. one burst), keep sequence order so nacks pack into ranges
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void missing_heap_sift_up(struct rist_missing_buffer *heap, size_t i)
+{
+	struct rist_missing_buffer tmp = heap[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!missing_entry_before(&tmp, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = tmp;
+}
+
+static void missing_heap_sift_down(struct rist_missing_buffer *heap, size_t count, size_t i)
+{
+	struct rist_missing_buffer tmp = heap[i];
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && missing_entry_before(&heap[child + 1], &heap[child]))
+			child++;
+		if (!missing_entry_before(&heap[child], &tmp))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = tmp;
+}
+
+static inline size_t missing_bitmap_index(struct rist_missing_queue *q, uint32_t seq)
+{
+	return seq & (q->seq_bitmap_bits - 1);
+}
+
+int rist_missing_queue_init(struct rist_flow *f)
+{
+	struct rist_missing_queue *q = &f->missing;
+	q->seq_bitmap_bits = f->receiver_queue_max;
+	q->seq_bitmap = calloc(q->seq_bitmap_bits / 64, sizeof(*q->seq_bitmap));
+	q->entries = malloc(RIST_MISSING_QUEUE_INITIAL * sizeof(*q->entries));
+	if (!q->seq_bitmap || !q->entries) {
+		rist_missing_queue_free(f);
+		return -1;
+	}
+	q->size = RIST_MISSING_QUEUE_INITIAL;
+	q->count = 0;
+	q->heap_count = 0;
+	return 0;
+}
+
+void rist_missing_queue_free(struct rist_flow *f)
+{
+	struct rist_missing_queue *q = &f->missing;
+	free(q->entries);
+	free(q->seq_bitmap);
+	memset(q, 0, sizeof(*q));
+}
+
+struct rist_missing_buffer *rist_missing_queue_pop_due(struct rist_flow *f, uint64_t now)
+{
+	struct rist_missing_queue *q = &f->missing;
+	if (q->heap_count == 0 || q->entries[0].next_nack > now)
+		return NULL;
+	// Swap the root with the last heap slot, which becomes the first deferred slot
+	struct rist_missing_buffer top = q->entries[0];
+	q->heap_count--;
+	if (q->heap_count > 0) {
+		q->entries[0] = q->entries[q->heap_count];
+		missing_heap_sift_down(q->entries, q->heap_count, 0);
+	}
+	q->entries[q->heap_count] = top;
+	return &q->entries[q->heap_count];
+}
+
+void rist_missing_queue_remove(struct rist_flow *f, struct rist_missing_buffer *m)
+{
+	struct rist_missing_queue *q = &f->missing;
+	size_t idx = (size_t)(m - q->entries);
+	assert(idx >= q->heap_count && idx < q->count);
+	q->seq_bitmap[missing_bitmap_index(q, m->seq) / 64] &= ~(1ULL << (missing_bitmap_index(q, m->seq) % 64));
+	if (m->nack_count != 0)
+		f->missing_counter--;
+	q->count--;
+	if (idx != q->count)
+		q->entries[idx] = q->entries[q->count];
+}
+
+void rist_missing_queue_requeue(struct rist_flow *f)
+{
+	struct rist_missing_queue *q = &f->missing;
+	while (q->heap_count < q->count) {
+		missing_heap_sift_up(q->entries, q->heap_count);
+		q->heap_count++;
+	}
+}
+
 void rist_receiver_missing(struct rist_flow *f, struct rist_peer *peer,uint64_t nack_time, uint32_t seq, uint64_t rtt)
 {
-	struct rist_missing_buffer *m = calloc(1, sizeof(*m));
+	struct rist_missing_queue *q = &f->missing;
+	if (RIST_UNLIKELY(!q->entries))
+		return;
+	size_t bit = missing_bitmap_index(q, seq);
+	if (q->seq_bitmap[bit / 64] & (1ULL << (bit % 64))) {
+		// Already waiting for this one
+		return;
+	}
+	if (RIST_UNLIKELY(q->count == q->size)) {
+		struct rist_missing_buffer *entries = realloc(q->entries, 2 * q->size * sizeof(*entries));
+		if (!entries) {
+			rist_log_priv(get_cctx(peer), RIST_LOG_ERROR,
+				"Could not grow the missing queue beyond %zu entries, OOM\n", q->size);
+			return;
+		}
+		q->entries = entries;
+		q->size *= 2;
+	}
+
 	uint64_t now = timestampNTP_u64();
 	if (nack_time > now)
 		nack_time = now;
 	if (nack_time < (now - f->recovery_buffer_ticks))
 		nack_time = now;
+	// Deferred entries only exist inside receiver_nack_output, so count == heap_count here
+	struct rist_missing_buffer *m = &q->entries[q->count];
 	m->seq = seq;
 	m->insertion_time = nack_time;
-
+	m->nack_count = 0;
 	m->next_nack = now + rtt;
 	m->peer = peer;
 
@@ -32,19 +158,138 @@ void rist_receiver_missing(struct rist_flow *f, struct rist_peer *peer,uint64_t
 			"with deadline in %" PRIu64 "ms (queue=%d), last_seq_found %"PRIu32"\n",
 		seq, m->next_nack > now? (m->next_nack - now)/ RIST_CLOCK: 0, f->missing_counter, f->last_seq_found);
 
-	m->next = NULL;
-	// Insert it at the end of the queue
-	if (!f->missing) {
-		f->missing = m;
-		f->missing_tail = m;
-	} else {
-		f->missing_tail->next = m;
-		f->missing_tail = m;
+	q->seq_bitmap[bit / 64] |= 1ULL << (bit % 64);
+	missing_heap_sift_up(q->entries, q->count);
+	q->count++;
+	q->heap_count++;
+}
+
+/* Move the ring contents into a ring of new_max slots, called with f->mutex held from the
+ * protocol thread so neither the packet input path nor receiver_output can run concurrently */
+/* Seqs between the oldest missing packet and the newest one found */
+static uint32_t rist_missing_queue_span(struct rist_flow *f)
+{
+	struct rist_missing_queue *q = &f->missing;
+	uint32_t span = 0;
+	for (size_t i = 0; i < q->count; i++) {
+		uint32_t behind = f->last_seq_found - q->entries[i].seq;
+		if (f->short_seq)
+			behind = (uint16_t)behind;
+		if (behind > span)
+			span = behind;
+	}
+	return span;
+}
+
+static int rist_receiver_queue_resize(struct rist_receiver *ctx, struct rist_flow *f, size_t new_max)
+{
+	size_t old_max = f->receiver_queue_max;
+	// Missing seqs a multiple of new_max apart would share a bitmap bit, removing one would
+	// clear the other's. Keep the ring until the missing queue spans less than new_max.
+	uint32_t missing_span = new_max < old_max ? rist_missing_queue_span(f) : 0;
+	if (missing_span >= new_max) {
+		rist_log_priv(&ctx->common, RIST_LOG_DEBUG, "FLOW #%"PRIu32": missing queue spans %"PRIu32" seqs, not shrinking to %zu slots\n",
+			f->flow_id, missing_span, new_max);
+		return -1;
+	}
+	struct rist_buffer **old_queue = f->receiver_queue;
+	struct rist_buffer **new_queue = calloc(new_max, sizeof(*new_queue));
+	uint64_t *new_bitmap = calloc(new_max / 64, sizeof(*new_bitmap));
+	if (!new_queue || !new_bitmap) {
+		free(new_queue);
+		free(new_bitmap);
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "FLOW #%"PRIu32": could not resize receiver buffer to %zu slots, OOM\n",
+			f->flow_id, new_max);
+		return -1;
+	}
+
+	size_t output_idx = atomic_load_explicit(&f->receiver_queue_output_idx, memory_order_acquire);
+	// Seq that maps onto the output slot, derived from the oldest queued packet
+	uint32_t output_seq = f->last_seq_found + 1;
+	bool found = false;
+	for (size_t i = 0; i < old_max; i++) {
+		size_t idx = (output_idx + i) & (old_max - 1);
+		struct rist_buffer *b = old_queue[idx];
+		if (!b)
+			continue;
+		if (rist_flow_seq_is_output(f, b->seq)) {
+			// Stale, it would otherwise be taken for the output position
+			atomic_fetch_sub_explicit(&f->receiver_queue_size, b->size, memory_order_relaxed);
+			free_rist_buffer(&ctx->common, b);
+			continue;
+		}
+		if (!found) {
+			output_seq = b->seq - (uint32_t)i;
+			found = true;
+		}
+		size_t new_idx = b->seq & (new_max - 1);
+		if (new_queue[new_idx]) {
+			// Only possible when shrinking below the span in use, keep the newer packet
+			struct rist_buffer *old = new_queue[new_idx];
+			atomic_fetch_sub_explicit(&f->receiver_queue_size, old->size, memory_order_relaxed);
+			free_rist_buffer(&ctx->common, old);
+		}
+		new_queue[new_idx] = b;
+	}
+
+	// Re-index the missing bitmap for the new slot count
+	struct rist_missing_queue *q = &f->missing;
+	for (size_t i = 0; i < q->count; i++) {
+		size_t bit = q->entries[i].seq & (new_max - 1);
+		new_bitmap[bit / 64] |= 1ULL << (bit % 64);
+	}
+	free(q->seq_bitmap);
+	q->seq_bitmap = new_bitmap;
+	q->seq_bitmap_bits = new_max;
+
+	f->receiver_queue = new_queue;
+	f->receiver_queue_max = new_max;
+	atomic_store_explicit(&f->receiver_queue_output_idx, output_seq & (new_max - 1), memory_order_release);
+	free(old_queue);
+	rist_log_priv(&ctx->common, RIST_LOG_INFO, "FLOW #%"PRIu32": receiver buffer resized from %zu to %zu slots\n",
+		f->flow_id, old_max, new_max);
+	return 0;
+}
+
+void rist_receiver_queue_size_check(struct rist_receiver *ctx, uint64_t now)
+{
+	for (struct rist_flow *f = ctx->common.FLOWS; f != NULL; f = f->next) {
+		if (!f->receiver_queue || !f->receiver_queue_has_items)
+			continue;
+		size_t max_slots = f->short_seq ? UINT16_SIZE : RIST_SERVER_QUEUE_BUFFERS;
+		// Packets currently spanned between the output position and the newest seq
+		uint32_t span = f->last_seq_found - f->last_seq_output;
+		if (f->short_seq)
+			span = (uint16_t)span;
+		size_t target = rist_queue_slots(span, max_slots);
+		bool rate_sample = false;
+		uint64_t elapsed = now - f->queue_check_time;
+		if (elapsed >= ONE_SECOND) {
+			// Packet rate over the last window times the current buffer time
+			uint32_t seq_delta = f->last_seq_found - f->queue_check_seq;
+			if (f->short_seq)
+				seq_delta = (uint16_t)seq_delta;
+			uint64_t packets = (uint64_t)seq_delta * f->recovery_buffer_ticks / elapsed;
+			size_t rate_target = rist_queue_slots(packets, max_slots);
+			if (rate_target > target)
+				target = rate_target;
+			rate_sample = true;
+			f->queue_check_seq = f->last_seq_found;
+			f->queue_check_time = now;
+		}
+		// Grow as soon as the span needs it, shrink only on a rate sample showing 4x headroom
+		if (target > f->receiver_queue_max || (rate_sample && target * 4 <= f->receiver_queue_max)) {
+			pthread_mutex_lock(&f->mutex);
+			rist_receiver_queue_resize(ctx, f, target);
+			pthread_mutex_unlock(&f->mutex);
+		}
 	}
 }
 
 void empty_receiver_queue(struct rist_flow *f, struct rist_common_ctx *ctx)
 {
+	if (!f->receiver_queue)
+		return;
 	size_t output_queue_idx = atomic_load_explicit(&f->receiver_queue_output_idx, memory_order_acquire);
 	size_t counter = output_queue_idx;
 	while (atomic_load_explicit(&f->receiver_queue_size, memory_order_acquire) > 0) {
@@ -65,18 +310,20 @@ void empty_receiver_queue(struct rist_flow *f, struct rist_common_ctx *ctx)
 
 void rist_flush_missing_flow_queue(struct rist_flow *flow)
 {
-	struct rist_missing_buffer *current = flow->missing;
-	while (current)
-	{
-		struct rist_missing_buffer *delme = current;
-		current = current->next;
-		free(delme);
-		delme = NULL;
-	}
-	flow->missing = NULL;
+	struct rist_missing_queue *q = &flow->missing;
+	if (q->seq_bitmap)
+		memset(q->seq_bitmap, 0, (q->seq_bitmap_bits / 64) * sizeof(*q->seq_bitmap));
+	q->count = 0;
+	q->heap_count = 0;
 	flow->missing_counter = 0;
 }
 
+static inline size_t flow_hash_index(uint32_t flow_id)
+{
+	// Flow ids are SSRCs with the lsb cleared, multiplicative hashing spreads them
+	return (size_t)((flow_id * 2654435761u) >> 24) & (RIST_FLOW_HASH_BUCKETS - 1);
+}
+
 void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f)
 {
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Triggering data output thread termination\n");
@@ -88,6 +335,7 @@ void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f)
 	pthread_mutex_unlock(&f->mutex);
 	if (running)
 		pthread_join(f->receiver_thread, NULL);
+	rist_dataout_pool_remove(ctx, f);
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Resetting peer states\n");
 	struct rist_peer *p = NULL;
 	for (size_t i = 0; i <f->peer_lst_len; i++)
@@ -132,12 +380,17 @@ void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f)
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Deleting missing queue elements\n");
 	/* Delete all missing queue elements (if any) */
-	rist_flush_missing_flow_queue(f);
+	rist_missing_queue_free(f);
+	rist_fec_decoder_destroy(f->fec);
+	f->fec = NULL;
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Deleting output buffer data\n");
 	/* Delete all buffer data (if any) */
 	empty_receiver_queue(f, &ctx->common);
 
+	free(f->receiver_queue);
+	f->receiver_queue = NULL;
+
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Freeing data fifo queue\n");
 	for (size_t i = 0; i < ctx->fifo_queue_size; i++)
 	{
@@ -149,6 +402,15 @@ void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f)
 	free(f->dataout_fifo_queue);
 	// Delete flow
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Deleting flow\n");
+	pthread_mutex_lock(&ctx->common.flows_lock);
+	struct rist_flow **link = &ctx->common.flow_hash[flow_hash_index(f->flow_id)];
+	while (*link) {
+		if (*link == f) {
+			*link = f->hash_next;
+			break;
+		}
+		link = &(*link)->hash_next;
+	}
 	struct rist_flow **prev_flow = &ctx->common.FLOWS;
 	struct rist_flow *current_flow = *prev_flow;
 	while (current_flow)
@@ -162,7 +424,7 @@ void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f)
 		prev_flow = &current_flow->next;
 		current_flow = current_flow->next;
 	}
-
+	pthread_mutex_unlock(&ctx->common.flows_lock);
 }
 
 static void rist_flow_append(struct rist_flow **FLOWS, struct rist_flow *f)
@@ -187,7 +449,7 @@ static struct rist_flow *create_flow(struct rist_receiver *ctx, uint32_t flow_id
 	struct rist_flow *f = calloc(1, sizeof(*f));
 	if (!f) {
 		rist_log_priv(&ctx->common, RIST_LOG_ERROR,
-			"Could not create receiver buffer of size %d MB, OOM\n", sizeof(*f) / 1000000);
+			"Could not create flow of size %zu bytes, OOM\n", sizeof(*f));
 		return NULL;
 	}
 
@@ -220,9 +482,12 @@ static struct rist_flow *create_flow(struct rist_receiver *ctx, uint32_t flow_id
 	f->session_timeout = RIST_DEFAULT_SESSION_TIMEOUT * RIST_CLOCK;
 	f->flow_timeout = 250 * RIST_CLOCK;
 
-	/* Append flow to list */
+	/* Append flow to list and index it by flow_id */
 	pthread_mutex_lock(&ctx->common.flows_lock);
 	rist_flow_append(&ctx->common.FLOWS, f);
+	size_t idx = flow_hash_index(flow_id);
+	f->hash_next = ctx->common.flow_hash[idx];
+	ctx->common.flow_hash[idx] = f;
 	pthread_mutex_unlock(&ctx->common.flows_lock);
 	f->logging_settings = ctx->common.logging_settings;
 
@@ -250,7 +515,7 @@ int rist_receiver_associate_flow(struct rist_peer *p, uint32_t flow_id)
 	struct rist_flow *f;
 	if (ctx->common.profile > RIST_PROFILE_SIMPLE)
 	{
-		for (f = ctx->common.FLOWS; f != NULL; f = f->next) {
+		for (f = ctx->common.flow_hash[flow_hash_index(flow_id)]; f != NULL; f = f->hash_next) {
 			if (f->flow_id == flow_id) {
 				break;
 			}
@@ -274,15 +539,27 @@ int rist_receiver_associate_flow(struct rist_peer *p, uint32_t flow_id)
 		if (p->config.timing_mode == RIST_TIMING_MODE_RTC)
 			f->rtc_timing_mode = true;
 
-		if (ctx->common.profile < RIST_PROFILE_ADVANCED) {
+		size_t max_slots = RIST_SERVER_QUEUE_BUFFERS;
+		if (ctx->common.profile == RIST_PROFILE_SIMPLE) {
 			f->short_seq = true;
-			f->receiver_queue_max = UINT16_SIZE;
+			max_slots = UINT16_SIZE;
 		}
-		else
-			f->receiver_queue_max = RIST_SERVER_QUEUE_BUFFERS;
 
 		f->recovery_buffer_ticks = p->recovery_buffer_ticks;
-		rist_log_priv(&ctx->common, RIST_LOG_INFO, "FLOW #%"PRIu32" created (short=%d)\n", flow_id, f->short_seq);
+		// Start from the configured max bitrate, rist_receiver_queue_size_check adapts it to the measured rate
+		uint64_t packets = (uint64_t)p->config.recovery_maxbitrate * (f->recovery_buffer_ticks / RIST_CLOCK) /
+			(8 * RIST_QUEUE_PACKET_SIZE_ESTIMATE);
+		f->receiver_queue_max = rist_queue_slots(packets, max_slots);
+		f->receiver_queue = calloc(f->receiver_queue_max, sizeof(*f->receiver_queue));
+		if (!f->receiver_queue) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR,
+				"Could not create receiver buffer of %zu slots, OOM\n", f->receiver_queue_max);
+			rist_delete_flow(ctx, f);
+			return -1;
+		}
+		if (rist_missing_queue_init(f) != 0)
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "FLOW #%"PRIu32": could not allocate the missing queue, nacks are disabled\n", flow_id);
+		rist_log_priv(&ctx->common, RIST_LOG_INFO, "FLOW #%"PRIu32" created (short=%d, %zu buffer slots)\n", flow_id, f->short_seq, f->receiver_queue_max);
 	} else {
 		/* double check that this peer is not a member of this flow already */
 		if (flow_has_peer(f, flow_id, p->adv_peer_id)) {
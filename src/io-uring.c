@@ -0,0 +1,444 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "io-uring.h"
+
+#if HAVE_IO_URING
+#include "log-private.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Buffer group the receive buffers are provided under */
+#define RIST_URING_BGID 0
+
+struct rist_uring_queue {
+	int fd;
+	void *ring;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	atomic_uint *sq_head;
+	atomic_uint *sq_tail;
+	atomic_uint *sq_flags;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	/* SQEs are filled here and published to sq_tail on submit */
+	uint32_t sq_local_tail;
+	atomic_uint *cq_head;
+	atomic_uint *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+};
+
+/* One per peer socket, the user_data of its receive. Outlives the peer until the receive terminated. */
+struct rist_uring_slot {
+	/* NULL once the peer is gone */
+	struct rist_peer *peer;
+	int sd;
+	/* Only the name and control lengths are used, they lay out the buffers */
+	struct msghdr msg;
+	bool armed;
+	struct rist_uring_slot *next;
+};
+
+struct rist_uring {
+	struct rist_common_ctx *cctx;
+	struct rist_uring_queue rx;
+	struct rist_uring_queue tx;
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	uint16_t br_tail;
+	uint8_t *bufs;
+	size_t buf_size;
+	struct rist_uring_slot *slots;
+	/* a slot waits to be armed */
+	bool pending;
+	int tx_res[RIST_URING_SEND_ENTRIES];
+};
+
+static int rist_uring_queue_init(struct rist_uring_queue *q, unsigned int entries, unsigned int cq_entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+	p.cq_entries = cq_entries;
+	q->ring = MAP_FAILED;
+	q->sqes = MAP_FAILED;
+	q->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (q->fd < 0)
+		return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOSYS;
+		return -1;
+	}
+	size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	q->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	q->ring = mmap(NULL, q->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQ_RING);
+	if (q->ring == MAP_FAILED)
+		return -1;
+	q->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	q->sqes = mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQES);
+	if (q->sqes == MAP_FAILED)
+		return -1;
+
+	uint8_t *ring = q->ring;
+	q->sq_head = (atomic_uint *)(ring + p.sq_off.head);
+	q->sq_tail = (atomic_uint *)(ring + p.sq_off.tail);
+	q->sq_flags = (atomic_uint *)(ring + p.sq_off.flags);
+	q->sq_array = (uint32_t *)(ring + p.sq_off.array);
+	q->sq_mask = *(uint32_t *)(ring + p.sq_off.ring_mask);
+	q->sq_entries = p.sq_entries;
+	q->sq_local_tail = atomic_load_explicit(q->sq_tail, memory_order_relaxed);
+	q->cq_head = (atomic_uint *)(ring + p.cq_off.head);
+	q->cq_tail = (atomic_uint *)(ring + p.cq_off.tail);
+	q->cq_mask = *(uint32_t *)(ring + p.cq_off.ring_mask);
+	q->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+	return 0;
+}
+
+static void rist_uring_queue_free(struct rist_uring_queue *q)
+{
+	if (q->sqes != MAP_FAILED)
+		munmap(q->sqes, q->sqes_size);
+	if (q->ring != MAP_FAILED)
+		munmap(q->ring, q->ring_size);
+	if (q->fd >= 0)
+		close(q->fd);
+}
+
+static struct io_uring_sqe *rist_uring_sqe(struct rist_uring_queue *q)
+{
+	uint32_t head = atomic_load_explicit(q->sq_head, memory_order_acquire);
+	if (q->sq_local_tail - head >= q->sq_entries)
+		return NULL;
+	uint32_t idx = q->sq_local_tail & q->sq_mask;
+	struct io_uring_sqe *sqe = &q->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	q->sq_array[idx] = idx;
+	q->sq_local_tail++;
+	return sqe;
+}
+
+/* Submits the filled SQEs and waits for wait completions, getevents alone flushes overflowed ones */
+static int rist_uring_enter(struct rist_uring_queue *q, unsigned int wait, bool getevents)
+{
+	atomic_store_explicit(q->sq_tail, q->sq_local_tail, memory_order_release);
+	for (;;) {
+		uint32_t submit = q->sq_local_tail - atomic_load_explicit(q->sq_head, memory_order_acquire);
+		int ret = (int)syscall(__NR_io_uring_enter, q->fd, submit, wait, (wait || getevents) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret >= 0)
+			return 0;
+		if (errno != EINTR)
+			return -1;
+	}
+}
+
+static void rist_uring_buf_add(struct rist_uring *ring, uint16_t bid)
+{
+	struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (RIST_URING_RECV_BUFFERS - 1)];
+	buf->addr = (uintptr_t)&ring->bufs[(size_t)bid * ring->buf_size];
+	buf->len = (uint32_t)ring->buf_size;
+	buf->bid = bid;
+	ring->br_tail++;
+}
+
+static void rist_uring_buf_publish(struct rist_uring *ring)
+{
+	atomic_store_explicit((atomic_ushort *)&ring->br->tail, ring->br_tail, memory_order_release);
+}
+
+struct rist_uring *rist_uring_create(struct rist_common_ctx *cctx)
+{
+	struct rist_uring *ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	ring->cctx = cctx;
+	ring->rx.fd = -1;
+	ring->rx.ring = ring->rx.sqes = MAP_FAILED;
+	ring->tx.fd = -1;
+	ring->tx.ring = ring->tx.sqes = MAP_FAILED;
+	ring->br = MAP_FAILED;
+	// Every receive completion holds a buffer until it is reaped, with room for the final completion
+	// of each request the receive queue cannot overflow
+	if (rist_uring_queue_init(&ring->rx, RIST_URING_RECV_ENTRIES, 2 * RIST_URING_RECV_BUFFERS) != 0 ||
+		rist_uring_queue_init(&ring->tx, RIST_URING_SEND_ENTRIES, 2 * RIST_URING_SEND_ENTRIES) != 0) {
+		rist_log_priv(cctx, RIST_LOG_ERROR, "Could not set up io_uring: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	// Room for the recvmsg header, the source address, receive timestamps and the largest datagram
+	ring->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +
+		RIST_RX_TIMESTAMP_CMSG_SIZE + RIST_MAX_PACKET_SIZE;
+	ring->buf_size = (ring->buf_size + 63) & ~(size_t)63;
+	ring->bufs = malloc(RIST_URING_RECV_BUFFERS * ring->buf_size);
+	ring->br_size = RIST_URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+	ring->br = mmap(NULL, ring->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!ring->bufs || ring->br == MAP_FAILED) {
+		rist_log_priv(cctx, RIST_LOG_ERROR, "Could not allocate the io_uring receive buffers, OOM\n");
+		goto fail;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)ring->br;
+	reg.ring_entries = RIST_URING_RECV_BUFFERS;
+	reg.bgid = RIST_URING_BGID;
+	if (syscall(__NR_io_uring_register, ring->rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		rist_log_priv(cctx, RIST_LOG_ERROR, "Could not register the io_uring buffer ring: %s\n", strerror(errno));
+		goto fail;
+	}
+	for (uint16_t bid = 0; bid < RIST_URING_RECV_BUFFERS; bid++)
+		rist_uring_buf_add(ring, bid);
+	rist_uring_buf_publish(ring);
+	rist_log_priv(cctx, RIST_LOG_INFO, "Using the io_uring I/O engine, %u receive buffers of %zu bytes\n",
+		RIST_URING_RECV_BUFFERS, ring->buf_size);
+	return ring;
+
+fail:
+	rist_uring_destroy(ring);
+	return NULL;
+}
+
+void rist_uring_destroy(struct rist_uring *ring)
+{
+	if (!ring)
+		return;
+	rist_uring_queue_free(&ring->rx);
+	rist_uring_queue_free(&ring->tx);
+	if (ring->br != MAP_FAILED)
+		munmap(ring->br, ring->br_size);
+	free(ring->bufs);
+	while (ring->slots) {
+		struct rist_uring_slot *next = ring->slots->next;
+		if (ring->slots->peer)
+			ring->slots->peer->uring_slot = NULL;
+		free(ring->slots);
+		ring->slots = next;
+	}
+	free(ring);
+}
+
+int rist_uring_fd(struct rist_uring *ring)
+{
+	return ring->rx.fd;
+}
+
+int rist_uring_add_peer(struct rist_uring *ring, struct rist_peer *peer)
+{
+	struct rist_uring_slot *slot = calloc(1, sizeof(*slot));
+	if (!slot) {
+		rist_log_priv(ring->cctx, RIST_LOG_ERROR, "Could not add socket %d to io_uring, OOM\n", peer->sd);
+		return -1;
+	}
+	slot->peer = peer;
+	slot->sd = peer->sd;
+	slot->msg.msg_namelen = sizeof(struct sockaddr_storage);
+	slot->msg.msg_controllen = RIST_RX_TIMESTAMP_CMSG_SIZE;
+	slot->next = ring->slots;
+	ring->slots = slot;
+	peer->uring_slot = slot;
+	ring->pending = true;
+	return 0;
+}
+
+static void rist_uring_slot_free(struct rist_uring *ring, struct rist_uring_slot *slot)
+{
+	for (struct rist_uring_slot **s = &ring->slots; *s; s = &(*s)->next) {
+		if (*s == slot) {
+			*s = slot->next;
+			break;
+		}
+	}
+	free(slot);
+}
+
+void rist_uring_del_peer(struct rist_uring *ring, struct rist_peer *peer)
+{
+	struct rist_uring_slot *slot = peer->uring_slot;
+	if (!slot)
+		return;
+	peer->uring_slot = NULL;
+	slot->peer = NULL;
+	if (!slot->armed) {
+		rist_uring_slot_free(ring, slot);
+		return;
+	}
+	// The request holds on to the socket, it has to go before the socket is really closed
+	struct io_uring_sqe *sqe = rist_uring_sqe(&ring->rx);
+	if (!sqe) {
+		rist_uring_enter(&ring->rx, 0, false);
+		sqe = rist_uring_sqe(&ring->rx);
+	}
+	if (sqe) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)slot;
+		sqe->user_data = 0;
+		rist_uring_enter(&ring->rx, 0, false);
+	}
+	// The slot is freed once its last completion comes in
+}
+
+void rist_uring_submit(struct rist_uring *ring)
+{
+	if (!ring->pending)
+		return;
+	ring->pending = false;
+	for (struct rist_uring_slot *slot = ring->slots; slot; slot = slot->next) {
+		if (slot->armed || !slot->peer)
+			continue;
+		struct io_uring_sqe *sqe = rist_uring_sqe(&ring->rx);
+		if (!sqe) {
+			rist_uring_enter(&ring->rx, 0, false);
+			sqe = rist_uring_sqe(&ring->rx);
+			if (!sqe) {
+				ring->pending = true;
+				break;
+			}
+		}
+		sqe->opcode = IORING_OP_RECVMSG;
+		sqe->fd = slot->sd;
+		sqe->addr = (uintptr_t)&slot->msg;
+		sqe->len = 1;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = RIST_URING_BGID;
+		sqe->user_data = (uintptr_t)slot;
+		slot->armed = true;
+	}
+	if (rist_uring_enter(&ring->rx, 0, false) != 0)
+		rist_log_priv(ring->cctx, RIST_LOG_ERROR, "io_uring submit failed: %s\n", strerror(errno));
+}
+
+/* The buffer holds the recvmsg header, then the name and control areas at the sizes asked for in the
+ * slot's msghdr, then the payload */
+static void rist_uring_deliver(struct rist_uring *ring, struct rist_uring_slot *slot, uint8_t *buf, size_t len, rist_uring_recv_func deliver)
+{
+	size_t header = sizeof(struct io_uring_recvmsg_out) + slot->msg.msg_namelen + slot->msg.msg_controllen;
+	if (len < header)
+		return;
+	struct io_uring_recvmsg_out out;
+	memcpy(&out, buf, sizeof(out));
+	if (out.flags & MSG_TRUNC) {
+		rist_log_priv(ring->cctx, RIST_LOG_WARN, "Dropped a %u byte datagram on socket %d, larger than the receive buffer\n",
+			out.payloadlen, slot->sd);
+		return;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &buf[sizeof(out)];
+	msg.msg_namelen = out.namelen < slot->msg.msg_namelen ? out.namelen : slot->msg.msg_namelen;
+	msg.msg_control = out.controllen ? &buf[sizeof(out) + slot->msg.msg_namelen] : NULL;
+	msg.msg_controllen = out.controllen < slot->msg.msg_controllen ? out.controllen : slot->msg.msg_controllen;
+	size_t payload = len - header;
+	if (out.payloadlen < payload)
+		payload = out.payloadlen;
+	deliver(slot->peer, &buf[header], payload, &msg);
+}
+
+void rist_uring_recv(struct rist_uring *ring, rist_uring_recv_func deliver)
+{
+	struct rist_uring_queue *q = &ring->rx;
+	for (;;) {
+		uint32_t head = atomic_load_explicit(q->cq_head, memory_order_relaxed);
+		uint32_t tail = atomic_load_explicit(q->cq_tail, memory_order_acquire);
+		if (head == tail) {
+			// Completions the queue had no room for wait in the kernel, and keep the fd readable
+			if (!(atomic_load_explicit(q->sq_flags, memory_order_acquire) & IORING_SQ_CQ_OVERFLOW) ||
+				rist_uring_enter(q, 0, true) != 0)
+				break;
+			continue;
+		}
+		bool recycled = false;
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &q->cqes[head & q->cq_mask];
+			int res = cqe->res;
+			uint32_t flags = cqe->flags;
+			struct rist_uring_slot *slot = (struct rist_uring_slot *)(uintptr_t)cqe->user_data;
+			// Free the entry first, delivering may submit
+			atomic_store_explicit(q->cq_head, head + 1, memory_order_release);
+			if (!slot)
+				continue;
+			if (flags & IORING_CQE_F_BUFFER) {
+				uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+				if (res > 0 && slot->peer)
+					rist_uring_deliver(ring, slot, &ring->bufs[(size_t)bid * ring->buf_size], (size_t)res, deliver);
+				rist_uring_buf_add(ring, bid);
+				recycled = true;
+			} else if (res < 0 && res != -ENOBUFS && res != -ECANCELED && slot->peer) {
+				rist_log_priv(ring->cctx, RIST_LOG_ERROR, "Receive failed: errno=%d, reason=%s, socket=%d\n",
+					-res, strerror(-res), slot->sd);
+			}
+			if (!(flags & IORING_CQE_F_MORE)) {
+				// Ran out of buffers or failed, armed again once the buffers are back
+				slot->armed = false;
+				if (slot->peer)
+					ring->pending = true;
+				else
+					rist_uring_slot_free(ring, slot);
+			}
+		}
+		if (recycled)
+			rist_uring_buf_publish(ring);
+	}
+	rist_uring_submit(ring);
+}
+
+int rist_uring_sendmmsg(struct rist_uring *ring, int sd, struct mmsghdr *msgs, unsigned int count)
+{
+	struct rist_uring_queue *q = &ring->tx;
+	if (count > RIST_URING_SEND_ENTRIES)
+		count = RIST_URING_SEND_ENTRIES;
+	if (count > q->sq_entries)
+		count = q->sq_entries;
+	for (unsigned int i = 0; i < count; i++) {
+		struct io_uring_sqe *sqe = rist_uring_sqe(q);
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = sd;
+		sqe->addr = (uintptr_t)&msgs[i].msg_hdr;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_DONTWAIT;
+		sqe->user_data = i;
+		// A failed send cancels the rest of the chain, as sendmmsg stops at the first error
+		if (i + 1 < count)
+			sqe->flags = IOSQE_IO_LINK;
+		ring->tx_res[i] = -ECANCELED;
+	}
+	if (rist_uring_enter(q, count, false) != 0)
+		return -1;
+
+	unsigned int reaped = 0;
+	while (reaped < count) {
+		uint32_t head = atomic_load_explicit(q->cq_head, memory_order_relaxed);
+		uint32_t tail = atomic_load_explicit(q->cq_tail, memory_order_acquire);
+		if (head == tail) {
+			if (rist_uring_enter(q, count - reaped, false) != 0)
+				return -1;
+			continue;
+		}
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &q->cqes[head & q->cq_mask];
+			if (cqe->user_data < count)
+				ring->tx_res[cqe->user_data] = cqe->res;
+			reaped++;
+		}
+		atomic_store_explicit(q->cq_head, head, memory_order_release);
+	}
+
+	int sent = 0;
+	while ((unsigned int)sent < count && ring->tx_res[sent] >= 0) {
+		msgs[sent].msg_len = (unsigned int)ring->tx_res[sent];
+		sent++;
+	}
+	if (sent == 0) {
+		errno = -ring->tx_res[0];
+		return -1;
+	}
+	return sent;
+}
+#endif
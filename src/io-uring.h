@@ -0,0 +1,49 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RIST_IO_URING_H
+#define RIST_IO_URING_H
+
+#include "common/attributes.h"
+#include "rist-private.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#if HAVE_IO_URING
+/* io_uring I/O engine: every peer socket keeps a multishot recvmsg armed that takes its buffers from
+ * a provided buffer ring. The receive ring fd sits in the evsocket loop like a socket would, its
+ * completions are reaped once it turns readable. Sender batches go out on a second ring as linked
+ * sendmsg SQEs, submitted and completed with a single io_uring_enter. */
+
+/* Receive buffers shared by all sockets of a context, a power of 2 */
+#define RIST_URING_RECV_BUFFERS 128
+/* Submission queue sizes, the send one takes a full sender batch */
+#define RIST_URING_RECV_ENTRIES 32
+#define RIST_URING_SEND_ENTRIES 64
+
+struct rist_uring;
+
+/* Hands a received datagram to the packet pipeline, msg carries its source address and control data */
+typedef void (*rist_uring_recv_func)(struct rist_peer *peer, uint8_t *buf, size_t len, const struct msghdr *msg);
+
+RIST_PRIV struct rist_uring *rist_uring_create(struct rist_common_ctx *cctx);
+/* Closing the rings cancels whatever is still armed */
+RIST_PRIV void rist_uring_destroy(struct rist_uring *ring);
+RIST_PRIV int rist_uring_fd(struct rist_uring *ring);
+/* Queues a multishot receive on the socket of peer, it is armed by the next rist_uring_submit call so
+ * the requests belong to the protocol thread */
+RIST_PRIV int rist_uring_add_peer(struct rist_uring *ring, struct rist_peer *peer);
+/* Cancels the receive of peer, completions still in flight for it are dropped */
+RIST_PRIV void rist_uring_del_peer(struct rist_uring *ring, struct rist_peer *peer);
+/* Arms the receives queued or terminated since the last call, from the protocol thread */
+RIST_PRIV void rist_uring_submit(struct rist_uring *ring);
+/* Reaps the receive completions, calling deliver for every datagram */
+RIST_PRIV void rist_uring_recv(struct rist_uring *ring, rist_uring_recv_func deliver);
+/* sendmmsg on the send ring: returns the number of leading messages sent, -1 with errno set when the
+ * first one failed. The messages are linked so none is sent after one that failed. */
+RIST_PRIV int rist_uring_sendmmsg(struct rist_uring *ring, int sd, struct mmsghdr *msgs, unsigned int count);
+#endif
+
+#endif
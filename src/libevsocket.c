@@ -6,6 +6,7 @@
  */
 
 #include "common/attributes.h"
+#include "config.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -33,6 +34,13 @@ typedef unsigned long int nfds_t;
 # include <poll.h>
 #endif
 
+#if HAVE_EPOLL
+# include <sys/epoll.h>
+# include <unistd.h>
+/* Max ready descriptors fetched per epoll_wait call */
+# define EVSOCKET_EPOLL_MAX_EVENTS (64)
+#endif
+
 #include "stdio-shim.h"
 #include "libevsocket.h"
 #include "socket-shim.h"
@@ -57,6 +65,13 @@ struct evsocket_ctx {
 	struct evsocket_event *_array;
 	int giveup;
 	struct evsocket_ctx *next;
+#if HAVE_EPOLL
+	/* epoll backend, used whenever epoll_create1 succeeds. The poll fields above are unused then */
+	int epfd;
+	int n_ready;
+	int ready_idx;
+	struct epoll_event ready[EVSOCKET_EPOLL_MAX_EVENTS];
+#endif
 };
 #if !defined(_WIN32) || HAVE_PTHREADS
 static pthread_mutex_t ctx_list_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -121,6 +136,19 @@ struct evsocket_event *evsocket_addevent(struct evsocket_ctx *ctx, int fd, short
 	e->err_callback = err_callback;
 	e->arg = arg;
 
+#if HAVE_EPOLL
+	if (ctx->epfd >= 0) {
+		struct epoll_event ev = { 0 };
+		ev.events = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+		ev.data.ptr = e;
+		if (epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			rist_log_priv3( RIST_LOG_ERROR, "libevsocket, evsocket_addevent: epoll_ctl failed for fd %d, error = %d\n",
+				fd, errno);
+			free(e);
+			return NULL;
+		}
+	}
+#endif
 	ctx->changed = 1;
 
 	e->next = ctx->events;
@@ -138,6 +166,17 @@ void evsocket_delevent(struct evsocket_ctx *ctx, struct evsocket_event *e)
 	}
 
 	ctx->changed = 1;
+#if HAVE_EPOLL
+	if (ctx->epfd >= 0) {
+		// The fd may already be closed, in which case the kernel dropped it from the set
+		epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, e->fd, NULL);
+		// Make sure a callback later in the current ready batch never sees the freed event
+		for (int i = ctx->ready_idx; i < ctx->n_ready; i++) {
+			if (ctx->ready[i].data.ptr == e)
+				ctx->ready[i].data.ptr = NULL;
+		}
+	}
+#endif
 	cur = ctx->events;
 	prev = NULL;
 
@@ -238,6 +277,43 @@ static void serve_event(struct evsocket_ctx *ctx, int n)
 }
 
 
+#if HAVE_EPOLL
+static int evsocket_loop_single_epoll(struct evsocket_ctx *ctx, int timeout, int max_events)
+{
+	int max_ready = EVSOCKET_EPOLL_MAX_EVENTS;
+	if (max_events > 0 && max_events < max_ready)
+		max_ready = max_events;
+
+	int ret = epoll_wait(ctx->epfd, ctx->ready, max_ready, timeout);
+	if (ret <= 0) {
+		if (ret < 0 && errno != EINTR) {
+			rist_log_priv3( RIST_LOG_ERROR, "libevsocket, evsocket_loop: epoll_wait returned %d, n_events = %d, error = %d\n",
+				ret, ctx->n_events, errno);
+			return -4;
+		}
+		// No events, regular timeout
+		return 0;
+	}
+
+	ctx->n_ready = ret;
+	for (ctx->ready_idx = 0; ctx->ready_idx < ctx->n_ready; ctx->ready_idx++) {
+		struct evsocket_event *e = ctx->ready[ctx->ready_idx].data.ptr;
+		if (!e)
+			continue;
+		uint32_t ev = ctx->ready[ctx->ready_idx].events;
+		short revents = (short)(((ev & EPOLLIN) ? POLLIN : 0) | ((ev & EPOLLOUT) ? POLLOUT : 0) |
+			((ev & EPOLLERR) ? POLLERR : 0) | ((ev & EPOLLHUP) ? POLLHUP : 0));
+		if ((revents & (POLLHUP | POLLERR)) && e->err_callback)
+			e->err_callback(ctx, e->fd, revents, e->arg);
+		else if (e->callback)
+			e->callback(ctx, e->fd, revents, e->arg);
+	}
+	ctx->n_ready = 0;
+	ctx->ready_idx = 0;
+	return 0;
+}
+#endif
+
 /*** PUBLIC API ***/
 
 struct evsocket_ctx *evsocket_create(void)
@@ -254,6 +330,11 @@ struct evsocket_ctx *evsocket_create(void)
 	ctx->giveup = 0;
 	ctx->n_events = 0;
 	ctx->changed = 0;
+#if HAVE_EPOLL
+	ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->epfd < 0)
+		rist_log_priv3( RIST_LOG_WARN, "libevsocket, evsocket_create: epoll unavailable (error = %d), using poll\n", errno);
+#endif
 	ctx_add(ctx);
 	return ctx;
 }
@@ -279,6 +360,19 @@ int evsocket_loop_single(struct evsocket_ctx *ctx, int timeout, int max_events)
 		goto loop_error;
 	}
 
+#if HAVE_EPOLL
+	if (ctx->epfd >= 0) {
+		if (ctx->n_events < 1) {
+			retval = -2;
+			goto loop_error;
+		}
+		retval = evsocket_loop_single_epoll(ctx, timeout, max_events);
+		if (retval < 0)
+			goto loop_error;
+		return 0;
+	}
+#endif
+
 	if (ctx->changed) {
 		//rist_log_priv3( RIST_LOG_DEBUG, "libevsocket, evsocket_loop_single: rebuild poll\n");
 		rebuild_poll(ctx);
@@ -337,6 +431,10 @@ loop_error:
 void evsocket_destroy(struct evsocket_ctx *ctx)
 {
 	ctx_del(ctx);
+#if HAVE_EPOLL
+	if (ctx->epfd >= 0)
+		close(ctx->epfd);
+#endif
 	if (ctx->pfd)
 		free(ctx->pfd);
 	if (ctx->_array)
@@ -345,6 +443,38 @@ void evsocket_destroy(struct evsocket_ctx *ctx)
 	ctx = NULL;
 }
 
+int evsocket_set_epoll(struct evsocket_ctx *ctx, int enable)
+{
+#if HAVE_EPOLL
+	if (!enable) {
+		if (ctx->epfd >= 0)
+			close(ctx->epfd);
+		ctx->epfd = -1;
+		ctx->changed = 1;
+		return 0;
+	}
+	if (ctx->epfd >= 0)
+		return 0;
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		return -1;
+	for (struct evsocket_event *e = ctx->events; e; e = e->next) {
+		struct epoll_event ev = { 0 };
+		ev.events = ((e->events & POLLIN) ? EPOLLIN : 0) | ((e->events & POLLOUT) ? EPOLLOUT : 0);
+		ev.data.ptr = e;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, e->fd, &ev) != 0) {
+			close(epfd);
+			return -1;
+		}
+	}
+	ctx->epfd = epfd;
+	return 0;
+#else
+	RIST_MARK_UNUSED(ctx);
+	return enable ? -1 : 0;
+#endif
+}
+
 void evsocket_loop_stop(struct evsocket_ctx *ctx)
 {
 	if (ctx)
@@ -13,5 +13,8 @@
 struct evsocket_event;
 struct evsocket_ctx;
 
+/* Moves the registered events to the epoll backend (enable) or to poll, returns -1 when epoll is not available */
+RIST_PRIV int evsocket_set_epoll(struct evsocket_ctx *ctx, int enable);
+
 #endif
 
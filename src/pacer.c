@@ -0,0 +1,124 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "pacer.h"
+#include "path-sched.h"
+#include "log-private.h"
+#include <string.h>
+#if HAVE_SO_TXTIME
+#include <linux/net_tstamp.h>
+#include <time.h>
+#endif
+
+void rist_pacer_init(struct rist_peer *peer)
+{
+	memset(&peer->pacer, 0, sizeof(peer->pacer));
+	if (peer->config.pacing_mode != RIST_PACING_MODE_TXTIME)
+		return;
+#if HAVE_SO_TXTIME
+	struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+	if (setsockopt(peer->sd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0) {
+		peer->pacer.txtime = true;
+		rist_log_priv(get_cctx(peer), RIST_LOG_INFO, "Pacing peer %"PRIu32" with SO_TXTIME, the egress qdisc needs to be fq\n",
+			peer->adv_peer_id);
+		return;
+	}
+	rist_log_priv(get_cctx(peer), RIST_LOG_WARN, "Could not enable SO_TXTIME (%s), pacing peer %"PRIu32" on the timer\n",
+		strerror(errno), peer->adv_peer_id);
+#else
+	rist_log_priv(get_cctx(peer), RIST_LOG_WARN, "SO_TXTIME is not supported, pacing peer %"PRIu32" on the timer\n",
+		peer->adv_peer_id);
+#endif
+}
+
+static void rist_pacer_measure(struct rist_pacer *pc, size_t len, uint64_t queued)
+{
+	if (pc->window_start == 0 || queued < pc->window_start) {
+		pc->window_start = queued;
+		pc->window_bytes = 0;
+	}
+	pc->window_bytes += len;
+	uint64_t span = queued - pc->window_start;
+	if (span < RIST_PACER_WINDOW)
+		return;
+	double rate = (double)pc->window_bytes / (double)span;
+	// Follow a rising rate at once so no backlog builds, a falling one slowly
+	if (rate > pc->rate)
+		pc->rate = rate;
+	else
+		pc->rate = (7 * pc->rate + rate) / 8;
+	pc->window_start = queued;
+	pc->window_bytes = 0;
+}
+
+void rist_pacer_depart(struct rist_peer *peer, size_t len, uint64_t queued, uint64_t now)
+{
+	struct rist_pacer *pc = &peer->pacer;
+	rist_pacer_measure(pc, len, queued);
+	if (pc->rate == 0)
+		return;
+
+	uint64_t max_delay = 2 * (uint64_t)peer->sender_ctx->common.rist_max_jitter;
+	uint64_t depart = pc->next;
+	if (depart + RIST_PACER_SLACK < now)
+		depart = now - RIST_PACER_SLACK;
+	// The input outran the estimate, do not let the packets fall further behind
+	if (depart > now + max_delay)
+		depart = now + max_delay;
+	pc->next = depart + (uint64_t)((double)len / (pc->rate * RIST_PACER_HEADROOM));
+
+#if HAVE_SO_TXTIME
+	if (pc->txtime && depart > now) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		pc->txtime_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec + (depart - now) * 1000000 / RIST_CLOCK;
+	}
+#endif
+}
+
+static uint64_t rist_pacer_due(struct rist_peer *peer, uint64_t due)
+{
+	if (peer->config.pacing_mode == RIST_PACING_MODE_OFF || peer->pacer.txtime || !rist_path_usable(peer))
+		return due;
+	uint64_t next = peer->pacer.next > RIST_PACER_SLACK ? peer->pacer.next - RIST_PACER_SLACK : 0;
+	return next > due ? next : due;
+}
+
+uint64_t rist_pacer_hold(struct rist_sender *ctx, uint64_t queued, uint64_t now)
+{
+	if (!ctx->pacing)
+		return 0;
+	// Held back long enough, pacing must not eat into the recovery buffer
+	if (now > queued + 2 * (uint64_t)ctx->common.rist_max_jitter)
+		return 0;
+	// The set is rebuilt before the next packet, nothing to look ahead at
+	struct rist_path_set *ps = &ctx->paths;
+	if (atomic_load_explicit(&ctx->paths_dirty, memory_order_acquire) || now >= ps->next_refresh)
+		return 0;
+
+	uint64_t due = now;
+	for (size_t i = 0; i < ps->mirror_count; i++)
+		due = rist_pacer_due(ps->mirrors[i], due);
+	if (ps->schedule_len > 0)
+		due = rist_pacer_due(ps->paths[ps->schedule[ps->schedule_pos]].peer, due);
+	return due - now;
+}
+
+#if HAVE_SO_TXTIME
+void rist_pacer_cmsg(struct rist_peer *p, struct msghdr *msg, uint8_t *ctrl)
+{
+	struct rist_peer *path = p->parent ? p->parent : p;
+	if (!path->pacer.txtime_ns)
+		return;
+	memset(ctrl, 0, CMSG_SPACE(sizeof(uint64_t)));
+	msg->msg_control = ctrl;
+	msg->msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+	struct cmsghdr *cm = CMSG_FIRSTHDR(msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_TXTIME;
+	cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cm), &path->pacer.txtime_ns, sizeof(uint64_t));
+}
+#endif
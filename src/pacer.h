@@ -0,0 +1,38 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RIST_PACER_H
+#define RIST_PACER_H
+
+#include "common/attributes.h"
+#include "rist-private.h"
+#include "proto/rist_time.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sender output pacing: a peer with a pacing mode spaces its data packets at the rate they were
+ * written by the application, measured from their enqueue times so the pacing itself does not
+ * slow the estimate down. The bucket is kept as the departure time of the next packet. */
+
+/* Input rate measurement window */
+#define RIST_PACER_WINDOW (100 * RIST_CLOCK)
+/* Credit a peer may build up while idle or between timer wakeups, the timer granularity */
+#define RIST_PACER_SLACK (RIST_CLOCK)
+/* Pace above the input rate so a backlog drains */
+#define RIST_PACER_HEADROOM 1.125
+
+/* Sets the socket up for SO_TXTIME when the peer asks for it */
+RIST_PRIV void rist_pacer_init(struct rist_peer *peer);
+/* Books a data packet enqueued at queued on the peer, and for SO_TXTIME peers stamps its departure
+ * into pacer.txtime_ns for the send functions. The caller clears txtime_ns once it is sent. */
+RIST_PRIV void rist_pacer_depart(struct rist_peer *peer, size_t len, uint64_t queued, uint64_t now);
+/* Ticks until the next queued packet may leave on the timer paced peers it is going to, 0 if now */
+RIST_PRIV uint64_t rist_pacer_hold(struct rist_sender *ctx, uint64_t queued, uint64_t now);
+#if HAVE_SO_TXTIME
+/* Attaches the departure time stamped on the path of p to msg, ctrl must hold CMSG_SPACE(sizeof(uint64_t)) */
+RIST_PRIV void rist_pacer_cmsg(struct rist_peer *p, struct msghdr *msg, uint8_t *ctrl);
+#endif
+
+#endif
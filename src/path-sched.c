@@ -0,0 +1,249 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "path-sched.h"
+#include "log-private.h"
+#if HAVE_SRP_SUPPORT
+#include "proto/eap.h"
+#endif
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool rist_path_usable(struct rist_peer *peer)
+{
+	if (peer->listening)
+		return peer->child_alive_count > 0;
+#if HAVE_SRP_SUPPORT
+	if (!peer->multicast_sender && !eap_is_authenticated(peer->eap_ctx))
+		return false;
+#endif
+	return peer->authenticated && !peer->dead;
+}
+
+static uint32_t gcd_u32(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Lays out one smooth WRR round: every pick adds each path's share to its credit and takes the
+ * path with the most credit, which then pays the round length. Weights 5:1:1 give a b a c a a a
+ * rather than a a a a a b c. */
+static void rist_paths_schedule(struct rist_sender *ctx)
+{
+	struct rist_path_set *ps = &ctx->paths;
+	ps->schedule_len = 0;
+	ps->schedule_pos = 0;
+	if (ps->count == 0)
+		return;
+
+	uint32_t divisor = 0;
+	for (size_t i = 0; i < ps->count; i++)
+		divisor = gcd_u32(divisor, ps->paths[i].weight);
+	uint64_t total = 0;
+	for (size_t i = 0; i < ps->count; i++) {
+		ps->paths[i].share = ps->paths[i].weight / divisor;
+		total += ps->paths[i].share;
+	}
+	if (total > RIST_PATH_SCHEDULE_MAX) {
+		uint64_t scaled_total = 0;
+		for (size_t i = 0; i < ps->count; i++) {
+			uint32_t share = (uint32_t)(ps->paths[i].share * RIST_PATH_SCHEDULE_MAX / total);
+			ps->paths[i].share = share ? share : 1;
+			scaled_total += ps->paths[i].share;
+		}
+		total = scaled_total;
+	}
+	if (total > ps->schedule_size) {
+		uint16_t *schedule = realloc(ps->schedule, total * sizeof(*schedule));
+		if (!schedule) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not grow the path schedule to %"PRIu64" slots, OOM\n", total);
+			return;
+		}
+		ps->schedule = schedule;
+		ps->schedule_size = total;
+	}
+
+	for (size_t i = 0; i < ps->count; i++)
+		ps->paths[i].current = 0;
+	for (size_t n = 0; n < total; n++) {
+		size_t best = 0;
+		for (size_t i = 0; i < ps->count; i++) {
+			ps->paths[i].current += ps->paths[i].share;
+			if (ps->paths[i].current > ps->paths[best].current)
+				best = i;
+		}
+		ps->paths[best].current -= (int64_t)total;
+		ps->schedule[n] = (uint16_t)best;
+	}
+	ps->schedule_len = total;
+}
+
+static uint64_t rist_path_rtt(struct rist_peer *p)
+{
+	struct rist_peer *rtcp = p->peer_rtcp ? p->peer_rtcp : p;
+	return rtcp->eight_times_rtt / 8;
+}
+
+/* Rates how well the path delivers. A path that gets retransmission requests for 5% of the packets
+ * it carried loses a fifth of its share. An RTT above twice the lowest one seen means packets are
+ * queueing on the link, the share shrinks with it. The quality is smoothed so one bad interval does
+ * not flap the weights, and only moves once the path carried enough packets to tell. */
+static void rist_path_measure(struct rist_sender *ctx, struct rist_peer *peer)
+{
+	if (peer->path_packets < RIST_PATH_MEASURE_PACKETS)
+		return;
+	double loss = (double)peer->path_nacks / (double)peer->path_packets;
+	uint32_t packets = peer->path_packets;
+	peer->path_packets = 0;
+	peer->path_nacks = 0;
+
+	uint64_t rtt = 0;
+	if (peer->listening) {
+		for (struct rist_peer *child = peer->child; child; child = child->sibling_next) {
+			if (child->authenticated && child->is_data && !child->dead && rist_path_rtt(child) > rtt)
+				rtt = rist_path_rtt(child);
+		}
+	} else {
+		rtt = rist_path_rtt(peer);
+	}
+
+	double target = 1.0 - 4.0 * loss;
+	if (rtt > 0) {
+		if (peer->path_base_rtt == 0 || rtt < peer->path_base_rtt)
+			peer->path_base_rtt = rtt;
+		else
+			// Follow a lasting route change, over about 25s
+			peer->path_base_rtt += (rtt - peer->path_base_rtt) / 256;
+		if (rtt > 2 * peer->path_base_rtt)
+			target *= (double)(2 * peer->path_base_rtt) / (double)rtt;
+	}
+	if (target < RIST_PATH_QUALITY_MIN)
+		target = RIST_PATH_QUALITY_MIN;
+	if (peer->path_quality == 0)
+		peer->path_quality = target;
+	else
+		peer->path_quality = (3 * peer->path_quality + target) / 4;
+
+	if (ctx->common.debug)
+		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
+			"Path %"PRIu32" quality %.2f (%.1f%% of %"PRIu32" packets nacked, rtt %"PRIu64"/%"PRIu64"us)\n",
+			peer->adv_peer_id, peer->path_quality, loss * 100, packets,
+			rtt * 1000 / RIST_CLOCK, peer->path_base_rtt * 1000 / RIST_CLOCK);
+}
+
+static uint32_t rist_path_weight(struct rist_sender *ctx, struct rist_peer *peer)
+{
+	if (!ctx->adaptive_weights)
+		return peer->config.weight;
+	double quality = peer->path_quality > 0 ? peer->path_quality : 1.0;
+	uint32_t steps = (uint32_t)(quality * RIST_PATH_QUALITY_STEPS + 0.5);
+	if (steps == 0)
+		steps = 1;
+	return peer->config.weight * steps;
+}
+
+/* measure is set on the periodic refresh, rebuilds for peer changes keep the current qualities */
+static void rist_paths_rebuild(struct rist_sender *ctx, uint64_t now, bool measure)
+{
+	struct rist_path_set *ps = &ctx->paths;
+	if (measure)
+		ps->next_refresh = now + RIST_PATH_REFRESH_INTERVAL;
+
+	size_t peers = 0;
+	for (struct rist_peer *peer = ctx->common.PEERS; peer; peer = peer->next)
+		peers++;
+	if (peers > ps->capacity) {
+		struct rist_path *paths = realloc(ps->paths, peers * sizeof(*paths));
+		if (paths)
+			ps->paths = paths;
+		struct rist_peer **mirrors = realloc(ps->mirrors, peers * sizeof(*mirrors));
+		if (mirrors)
+			ps->mirrors = mirrors;
+		if (!paths || !mirrors) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not grow the path set to %zu peers, OOM\n", peers);
+			ps->count = 0;
+			ps->mirror_count = 0;
+			ps->schedule_len = 0;
+			return;
+		}
+		ps->capacity = peers;
+	}
+
+	size_t old_count = ps->count;
+	bool changed = false;
+	ps->count = 0;
+	ps->mirror_count = 0;
+	for (struct rist_peer *peer = ctx->common.PEERS; peer; peer = peer->next) {
+		if (!peer->is_data || peer->parent || !rist_path_usable(peer))
+			continue;
+		if (peer->config.weight == 0) {
+			ps->mirrors[ps->mirror_count++] = peer;
+			continue;
+		}
+		if (measure && ctx->adaptive_weights)
+			rist_path_measure(ctx, peer);
+		uint32_t weight = rist_path_weight(ctx, peer);
+		struct rist_path *path = &ps->paths[ps->count];
+		if (ps->count >= old_count || path->peer != peer || path->weight != weight)
+			changed = true;
+		path->peer = peer;
+		path->weight = weight;
+		ps->count++;
+	}
+	if (changed || ps->count != old_count)
+		rist_paths_schedule(ctx);
+}
+
+struct rist_peer *rist_paths_next(struct rist_sender *ctx, uint64_t now)
+{
+	struct rist_path_set *ps = &ctx->paths;
+	bool due = now >= ps->next_refresh;
+	if (due || atomic_load_explicit(&ctx->paths_dirty, memory_order_acquire)) {
+		atomic_store_explicit(&ctx->paths_dirty, false, memory_order_relaxed);
+		rist_paths_rebuild(ctx, now, due);
+	}
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (ps->schedule_len == 0)
+			return NULL;
+		struct rist_path *path = &ps->paths[ps->schedule[ps->schedule_pos]];
+		if (++ps->schedule_pos == ps->schedule_len)
+			ps->schedule_pos = 0;
+		if (rist_path_usable(path->peer)) {
+			path->peer->path_packets++;
+			return path->peer;
+		}
+		// Died or lost its authentication since the last rebuild
+		rist_paths_rebuild(ctx, now, false);
+	}
+	return NULL;
+}
+
+void rist_paths_nack(struct rist_sender *ctx, struct rist_peer *path)
+{
+	struct rist_path_set *ps = &ctx->paths;
+	// A dirty set may still list a peer that is gone
+	if (!path || !ctx->adaptive_weights || atomic_load_explicit(&ctx->paths_dirty, memory_order_acquire))
+		return;
+	for (size_t i = 0; i < ps->count; i++) {
+		if (ps->paths[i].peer == path) {
+			path->path_nacks++;
+			return;
+		}
+	}
+}
+
+void rist_paths_free(struct rist_path_set *ps)
+{
+	free(ps->paths);
+	free(ps->mirrors);
+	free(ps->schedule);
+	memset(ps, 0, sizeof(*ps));
+}
@@ -0,0 +1,37 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef RIST_PATH_SCHED_H
+#define RIST_PATH_SCHED_H
+
+#include "common/attributes.h"
+#include "rist-private.h"
+#include "proto/rist_time.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sender bonding: data peers with a weight share the packets by smooth weighted round-robin,
+ * weight 0 peers get every packet */
+
+/* How often the path set is rebuilt when no peer change flagged it, and adaptive weights re-evaluated */
+#define RIST_PATH_REFRESH_INTERVAL (100 * RIST_CLOCK)
+/* Longest smooth WRR round, larger weight sums are scaled down to it */
+#define RIST_PATH_SCHEDULE_MAX 256
+/* Adaptive weights move the configured weight in 1/64 steps */
+#define RIST_PATH_QUALITY_STEPS 64
+/* Packets a path has to carry before its retransmission ratio is trusted */
+#define RIST_PATH_MEASURE_PACKETS 32
+/* Share a path keeps however bad it measures, so it is still probed */
+#define RIST_PATH_QUALITY_MIN 0.05
+
+RIST_PRIV bool rist_path_usable(struct rist_peer *peer);
+/* Returns the weighted path for the next packet, NULL if there is none. Rebuilds the set first when
+ * it is stale, so the mirrors are current once this returns. Called with the peerlist lock held. */
+RIST_PRIV struct rist_peer *rist_paths_next(struct rist_sender *ctx, uint64_t now);
+/* Counts a retransmission request against the path that carried the original packet */
+RIST_PRIV void rist_paths_nack(struct rist_sender *ctx, struct rist_peer *path);
+RIST_PRIV void rist_paths_free(struct rist_path_set *ps);
+
+#endif
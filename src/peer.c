@@ -1,6 +1,7 @@
 #include "rist-private.h"
 #include "librist_config.h"
 #include "peer.h"
+#include "log-private.h"
 #if HAVE_SRP_SUPPORT
 #include "proto/eap.h"
 #endif
@@ -95,10 +96,117 @@ static inline bool _librist_peer_equal_address(uint16_t family, struct sockaddr
 	return result;
 }
 
+static inline uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *d = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= d[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t peer_hash_index(const struct rist_common_ctx *cctx, const struct rist_peer *parent, uint16_t family, const struct sockaddr *addr)
+{
+	uintptr_t parent_key = (uintptr_t)parent;
+	uint32_t hash = fnv1a(2166136261u, &parent_key, sizeof(parent_key));
+	if (family == AF_INET) {
+		const struct sockaddr_in *a = (const struct sockaddr_in *)addr;
+		hash = fnv1a(hash, &a->sin_port, sizeof(a->sin_port));
+		hash = fnv1a(hash, &a->sin_addr, sizeof(a->sin_addr));
+	} else {
+		const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)addr;
+		hash = fnv1a(hash, &a->sin6_port, sizeof(a->sin6_port));
+		hash = fnv1a(hash, &a->sin6_addr, sizeof(a->sin6_addr));
+	}
+	return hash & (cctx->peer_hash_size - 1);
+}
+
+static void peer_hash_grow(struct rist_common_ctx *cctx)
+{
+	size_t new_size = cctx->peer_hash_size ? cctx->peer_hash_size * 2 : RIST_PEER_HASH_INITIAL;
+	struct rist_peer **new_hash = calloc(new_size, sizeof(*new_hash));
+	if (!new_hash)
+		return;
+	struct rist_peer **old_hash = cctx->peer_hash;
+	size_t old_size = cctx->peer_hash_size;
+	cctx->peer_hash = new_hash;
+	cctx->peer_hash_size = new_size;
+	for (size_t i = 0; i < old_size; i++) {
+		struct rist_peer *p = old_hash[i];
+		while (p) {
+			struct rist_peer *next = p->hash_next;
+			size_t idx = peer_hash_index(cctx, p->parent, p->address_family, &p->u.address);
+			p->hash_next = new_hash[idx];
+			new_hash[idx] = p;
+			p = next;
+		}
+	}
+	free(old_hash);
+}
+
+void _librist_peer_hash_insert(struct rist_peer *p)
+{
+	struct rist_common_ctx *cctx = get_cctx(p);
+	if (p->hashed || !p->parent)
+		return;
+	if (cctx->peer_hash_count >= cctx->peer_hash_size)
+		peer_hash_grow(cctx);
+	if (!cctx->peer_hash) {
+		// Lookups fall back to walking the child list
+		rist_log_priv(cctx, RIST_LOG_WARN, "Could not allocate the peer index, using linear peer lookup\n");
+		cctx->peer_hash_unindexed++;
+		return;
+	}
+	size_t idx = peer_hash_index(cctx, p->parent, p->address_family, &p->u.address);
+	p->hash_next = cctx->peer_hash[idx];
+	cctx->peer_hash[idx] = p;
+	p->hashed = true;
+	cctx->peer_hash_count++;
+}
+
+void _librist_peer_hash_remove(struct rist_peer *p)
+{
+	struct rist_common_ctx *cctx = get_cctx(p);
+	if (!p->parent)
+		return;
+	if (!p->hashed) {
+		if (cctx->peer_hash_unindexed)
+			cctx->peer_hash_unindexed--;
+		return;
+	}
+	struct rist_peer **link = &cctx->peer_hash[peer_hash_index(cctx, p->parent, p->address_family, &p->u.address)];
+	while (*link) {
+		if (*link == p) {
+			*link = p->hash_next;
+			break;
+		}
+		link = &(*link)->hash_next;
+	}
+	p->hash_next = NULL;
+	p->hashed = false;
+	if (--cctx->peer_hash_count == 0) {
+		free(cctx->peer_hash);
+		cctx->peer_hash = NULL;
+		cctx->peer_hash_size = 0;
+	}
+}
+
 struct rist_peer * _librist_peer_match_peer_addr(struct rist_peer *p, uint16_t family, struct sockaddr *addr) {
 	if (p->listening) {
 		if (_librist_peer_equal_address(family, addr, p))
 			return p;
+		struct rist_common_ctx *cctx = get_cctx(p);
+		if (cctx->peer_hash) {
+			struct rist_peer *c = cctx->peer_hash[peer_hash_index(cctx, p, family, addr)];
+			while (c) {
+				if (c->parent == p && _librist_peer_equal_address(family, addr, c))
+					return c;
+				c = c->hash_next;
+			}
+			if (!cctx->peer_hash_unindexed)
+				return NULL;
+		}
 		p = p->child;
 		while (p) {
 			if (_librist_peer_equal_address(family, addr, p))
@@ -11,6 +11,7 @@
 #include "udp-private.h"
 #include "eap.h"
 #include "peer.h"
+#include "pacer.h"
 
 #include <errno.h>
 #include <stddef.h>
@@ -25,9 +26,10 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 
 	/* Our encryption and compression operations directly modify the payload buffer we receive as a pointer
 	   so we create a local pointer that points to the payload pointer, if we would either encrypt or compress we instead
-	   malloc and mempcy, to ensure our source stays clean. We only do this with RAW data as these buffers are the only
-	   assumed to be reused by retransmits */
-    bool modifying_payload = encrypt && (payload_type == RIST_PAYLOAD_TYPE_DATA_RAW || payload_type == RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT);//Need to make a copy of our data if we'd resend it in the future, otherwise we can safely overwrite the buffer
+	   write into the context's encryption scratch buffer, to ensure our source stays clean. We only do this with RAW data
+	   as these buffers are the only assumed to be reused by retransmits */
+    bool modifying_payload = encrypt && (payload_type == RIST_PAYLOAD_TYPE_DATA_RAW || payload_type == RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT || payload_type == RIST_PAYLOAD_TYPE_FEC);//Need to make a copy of our data if we'd resend it in the future, otherwise we can safely overwrite the buffer
+	bool payload_allocated = false;
 
 	uint8_t *payload_wr = payload;
 	uint8_t hdr_buf[MAX_GRE_SIZE];
@@ -93,11 +95,6 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 	}
 
 	if (encrypt) {
-		if (modifying_payload || (hdr_payload_offset != hdr_len && !HAVE_MBEDTLS)) {
-			payload_wr = malloc(payload_len + 8);//Let's get rid of this malloc in the hotpath here
-			modifying_payload = true;
-			assert(payload_wr);
-		}
 		pthread_mutex_lock(&key_peer->peer_lock);
 		struct rist_key *key = &key_peer->key_tx;
 
@@ -111,19 +108,33 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 		if (key_peer->key_tx_odd_active)
 			key = &p->key_tx_odd;
 
+		size_t hdr_encrypt_len = hdr_len - hdr_payload_offset;
+		bool can_continue = _librist_crypto_psk_encrypt_can_continue(key);
+		if (modifying_payload || (hdr_encrypt_len && !can_continue)) {
+			//Everything is sent from the protocol thread, so the per context scratch buffer is ours until the send returns
+			size_t wr_len = payload_len + (can_continue ? 0 : hdr_encrypt_len);
+			if (RIST_LIKELY(wr_len <= sizeof(get_cctx(p)->buf.enc))) {
+				payload_wr = get_cctx(p)->buf.enc;
+			} else {
+				payload_wr = malloc(wr_len);
+				payload_allocated = true;
+				assert(payload_wr);
+			}
+		}
+
 		//Data that should be encrypted is part of the header
-		if (hdr_payload_offset != hdr_len) {
-#if HAVE_MBEDTLS
-			//MbedTLS allows us to continue encryption, so we can encrypt hdr & payload in 2 ops
-			_librist_crypto_psk_encrypt(key, htobe32(seq), gre_version, &hdr_buf[hdr_payload_offset], &hdr_buf[hdr_payload_offset], hdr_len - hdr_payload_offset);
-			_librist_crypto_psk_encrypt_continue(key, payload, payload_wr, payload_len);
-#else
-			memcpy(payload_wr, &hdr_buf[hdr_payload_offset], hdr_len - hdr_payload_offset);
-			memcpy(&payload_wr[hdr_len - hdr_payload_offset], payload, payload_len);
-			payload_len += (hdr_len - hdr_payload_offset);
-			hdr_len -= (hdr_len - hdr_payload_offset);
-			_librist_crypto_psk_encrypt(key, htobe32(seq), gre_version, payload_wr, payload_wr, payload_len);
-#endif
+		if (hdr_encrypt_len) {
+			if (can_continue) {
+				//Encryption can be continued mid block, so we can encrypt hdr & payload in 2 ops
+				_librist_crypto_psk_encrypt(key, htobe32(seq), gre_version, &hdr_buf[hdr_payload_offset], &hdr_buf[hdr_payload_offset], hdr_encrypt_len);
+				_librist_crypto_psk_encrypt_continue(key, payload, payload_wr, payload_len);
+			} else {
+				memcpy(payload_wr, &hdr_buf[hdr_payload_offset], hdr_encrypt_len);
+				memcpy(&payload_wr[hdr_encrypt_len], payload, payload_len);
+				payload_len += hdr_encrypt_len;
+				hdr_len -= hdr_encrypt_len;
+				_librist_crypto_psk_encrypt(key, htobe32(seq), gre_version, payload_wr, payload_wr, payload_len);
+			}
 		} else {
 			//Single encryption pass suffices
 			_librist_crypto_psk_encrypt(key, htobe32(seq), gre_version, payload, payload_wr, payload_len);
@@ -137,6 +148,12 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 	ssize_t ret;
 	int errorcode = 0;
 
+#if HAVE_SENDMMSG
+	// Staged for a single sendmmsg when the sender thread is draining its queues
+	if ((ret = rist_send_batch_append(p, hdr_buf, hdr_len, payload_wr, payload_len)) >= 0)
+		goto out;
+#endif
+
 	//TODO: abstract this away
 #ifndef _WIN32
 	//TODO: this is POSIX only: add windows equivalent
@@ -153,6 +170,10 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 	msghdr.msg_control = NULL;
 	msghdr.msg_controllen = 0;
 	msghdr.msg_flags = 0;
+#if HAVE_SO_TXTIME
+	uint8_t ctrl[CMSG_SPACE(sizeof(uint64_t))];
+	rist_pacer_cmsg(p, &msghdr, ctrl);
+#endif
 	ret = sendmsg(p->sd, &msghdr, MSG_DONTWAIT);
 	if (RIST_UNLIKELY(ret < 0)) {
 		errorcode = errno;
@@ -177,7 +198,10 @@ ssize_t _librist_proto_gre_send_data(struct rist_peer *p, uint8_t payload_type,
 	}
 #endif
 
-	if (modifying_payload) {
+#if HAVE_SENDMMSG
+out:
+#endif
+	if (payload_allocated) {
 		free(payload_wr);
 	}
 
@@ -197,6 +221,8 @@ void _librist_proto_gre_send_keepalive(struct rist_peer *p, uint8_t gre_version)
 	SET_BIT(ka.capabilities1, 5); // Bonding
 	//SET_BIT(ka.capabilities2, 3);//OTF Passphrase change
 	SET_BIT(ka.capabilities2, 5);//Reduced overhead
+	if (p->receiver_ctx)
+		SET_BIT(ka.capabilities2, 3);//SMPTE-2022-1 FEC, senders only send us parity when this is set
 	_librist_proto_gre_send_data(p, 0, RIST_GRE_PROTOCOL_TYPE_KEEPALIVE, (uint8_t *)&ka, sizeof(ka), 0, 0, gre_version);
 }
 
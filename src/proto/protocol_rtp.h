@@ -9,6 +9,7 @@ void rist_rtcp_write_empty_rr(uint8_t *buf, int *offset, const uint32_t flow_id)
 void rist_rtcp_write_rr(uint8_t *buf, int *offset, const struct rist_peer *peer);
 void rist_rtcp_write_sr(uint8_t *buf, int *offset, struct rist_peer *peer);
 void rist_rtcp_write_sdes(uint8_t *buf, int *offset, const char *name, const uint32_t flow_id);
+void rist_rtcp_write_seqext(uint8_t *buf, int *offset, const uint16_t seq_msb, const uint32_t flow_id);
 void rist_rtcp_write_echoreq(uint8_t *buf, int *offset, const uint32_t flow_id);
 void rist_rtcp_write_echoresp(uint8_t *buf, int *offset, const uint64_t request_time, const uint32_t flow_id);
 void rist_rtcp_write_xr_echoreq(uint8_t *buf, int *offset, struct rist_peer *peer) ;
@@ -85,6 +85,20 @@ void rist_rtcp_write_sdes(uint8_t *buf, int *offset,
   memcpy(sdes->udn, name, namelen + padding);
 }
 
+void rist_rtcp_write_seqext(uint8_t *buf, int *offset, const uint16_t seq_msb,
+                                          const uint32_t flow_id) {
+  struct rist_rtcp_seqext *seqext =
+      (struct rist_rtcp_seqext *)(buf + RIST_MAX_PAYLOAD_OFFSET + *offset);
+  *offset += sizeof(struct rist_rtcp_seqext);
+  seqext->flags = RTCP_NACK_SEQEXT_FLAGS;
+  seqext->ptype = PTYPE_NACK_CUSTOM;
+  seqext->len = htons(3);
+  seqext->ssrc = htobe32(flow_id);
+  memcpy(seqext->name, "RIST", 4);
+  seqext->seq_msb = htobe16(seq_msb);
+  seqext->reserved0 = 0;
+}
+
 void rist_rtcp_write_echoreq(uint8_t *buf, int *offset,
                                            const uint32_t flow_id) {
   struct rist_rtcp_echoext *echo =
@@ -69,6 +69,30 @@ deletion and sequence number extension (VSF TR-06-02, 8.3)
 +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 
+/*
+FEC packet header (SMPTE 2022-1, RFC 2733 header plus the 2022-1 extension word)
+FEC packets are RTP packets with PT=RTP_PTYPE_FEC on the data flow, their own
+RTP seq is a separate counter. Receivers that do not know them take them for data,
+so they are only sent to peers that set the F (FEC) keepalive capability. The payload is the XOR of the NA protected packets
+SNBase, SNBase + Offset, ... as the receiver stores them (RIST header extension
+removed, deleted null packets restored), zero padded to the longest.
+
+0                   1                   2                   3
+0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|      SNBase low bits          |        Length Recovery        |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|E| PT recovery |                    Mask                         |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                          TS recovery                          |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|X|D|type |index|    Offset     |       NA      | SNBase ext bits |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+
+D: 0 = column FEC (Offset = L, NA = D), 1 = row FEC (Offset = 1, NA = L)
+Mask: 0, recovered packets never carry an RTP header extension
+*/
+
 /*
 RTCP Control Channel:
 
@@ -106,12 +130,15 @@ RTCP Control Channel:
 #define RTCP_NACK_SEQEXT_FLAGS 0x81
 #define RTCP_ECHOEXT_REQ_FLAGS 0x82
 #define RTCP_ECHOEXT_RESP_FLAGS 0x83
+#define RTP_FEC_E_BIT 0x80
+#define RTP_FEC_D_ROW 0x40
 
 // RTP Payload types and clocks
 // March 1995 (page 9): https://tools.ietf.org/html/draft-ietf-avt-profile-04
 // Nov 2019 (page 2): https://www.iana.org/assignments/rtp-parameters/rtp-parameters.xhtml
 #define RTP_PTYPE_MPEGTS (0x21)
 #define RTP_PTYPE_MPEGTS_CLOCKHZ (90000)
+#define RTP_PTYPE_FEC (96)
 #define RTP_PTYPE_RIST (21)
 #define RTP_PTYPE_RIST_CLOCKHZ (UINT16_MAX + 1)
 
@@ -131,6 +158,18 @@ RIST_PACKED_STRUCT(rist_rtp_hdr_ext, {
 	uint16_t seq_ext;
 })
 
+RIST_PACKED_STRUCT(rist_fec_hdr, {
+	uint16_t snbase_low;
+	uint16_t length_recovery;
+	uint8_t  pt_recovery; /* E bit + PT recovery */
+	uint8_t  mask[3];
+	uint32_t ts_recovery;
+	uint8_t  flags; /* X|D|type|index */
+	uint8_t  offset;
+	uint8_t  na;
+	uint8_t  snbase_ext;
+})
+
 RIST_PACKED_STRUCT(rist_protocol_hdr,{
 	uint16_t src_port;
 	uint16_t dst_port;
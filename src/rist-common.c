@@ -24,6 +24,10 @@
 #include "proto/eap.h"
 #endif
 #include "mpegts.h"
+#include "fec.h"
+#include "path-sched.h"
+#include "pacer.h"
+#include "io-uring.h"
 #include "rist_ref.h"
 #include "config.h"
 #include "rist-thread.h"
@@ -35,8 +39,15 @@
 
 static void rist_peer_recv(struct evsocket_ctx *evctx, int fd, short revents, void *arg, bool *again);
 static void rist_peer_recv_wrap(struct evsocket_ctx *evctx, int fd, short revents, void *arg);
+#if HAVE_RECVMMSG
+static int rist_peer_recv_batch(struct rist_peer *peer, int fd);
+#endif
 static void rist_peer_sockerr(struct evsocket_ctx *evctx, int fd, short revents, void *arg);
+static void rist_peer_recv_register(struct rist_peer *peer);
+static void rist_peer_recv_unregister(struct rist_peer *peer);
 static PTHREAD_START_FUNC(receiver_pthread_dataout,arg);
+static int rist_dataout_pool_add(struct rist_receiver *ctx, struct rist_flow *f);
+static void rist_dataout_pool_wake(struct rist_receiver *ctx, struct rist_flow *f);
 static void store_peer_settings(const struct rist_peer_config *settings, struct rist_peer *peer);
 static struct rist_peer *peer_initialize(const char *url, struct rist_sender *sender_ctx,
 										struct rist_receiver *receiver_ctx);
@@ -229,6 +240,10 @@ int parse_url_options(const char* url, struct rist_peer_config *output_peer_conf
 				int temp = atoi( val );
 				if (temp >= 0 && temp <= 2)
 					output_peer_config->timing_mode = temp;
+			} else if (output_peer_config->version >= 1 && strcmp( url_params[i].key, RIST_URL_PARAM_PACING ) == 0) {
+				int temp = atoi( val );
+				if (temp >= 0 && temp <= 2)
+					output_peer_config->pacing_mode = temp;
 			} else if (strcmp( url_params[i].key, RIST_URL_PARAM_MIN_RETRIES ) == 0) {
 				int temp = atoi( val );
 				if (temp > 0)
@@ -330,33 +345,84 @@ static void init_peer_settings(struct rist_peer *peer)
 	}
 }
 
+static const size_t rist_buffer_pool_class_size[RIST_BUFFER_POOL_CLASSES] = {
+	RIST_BUFFER_POOL_CLASS_SMALL,
+	RIST_BUFFER_POOL_CLASS_MEDIUM,
+	RIST_BUFFER_POOL_CLASS_LARGE,
+};
+
+static inline int rist_buffer_pool_class(size_t len)
+{
+	for (int i = 0; i < RIST_BUFFER_POOL_CLASSES; i++) {
+		if (len <= rist_buffer_pool_class_size[i])
+			return i;
+	}
+	return -1;
+}
+
+static inline uint64_t rist_buffer_pool_class_max(int pool_class)
+{
+	if (pool_class == RIST_BUFFER_POOL_BARE)
+		return RIST_BUFFER_POOL_MAX_BYTES / sizeof(struct rist_buffer);
+	return RIST_BUFFER_POOL_MAX_BYTES / (rist_buffer_pool_class_size[pool_class] + RIST_MAX_PAYLOAD_OFFSET);
+}
+
+static inline struct rist_buffer *rist_buffer_pool_pop(struct rist_common_ctx *ctx, int list)
+{
+	struct rist_buffer *b = ctx->rist_free_buffer[list];
+	if (b) {
+		ctx->rist_free_buffer[list] = b->next_free;
+		ctx->rist_free_buffer_count[list]--;
+		if (ctx->rist_free_buffer_count[list] < ctx->rist_free_buffer_low[list])
+			ctx->rist_free_buffer_low[list] = ctx->rist_free_buffer_count[list];
+	}
+	return b;
+}
+
 struct rist_buffer *rist_new_buffer(struct rist_common_ctx *ctx, const void *buf, size_t len, uint8_t type, uint32_t seq, uint64_t source_time, uint16_t src_port, uint16_t dst_port)
 {
-	RIST_MARK_UNUSED(ctx);
 	// TODO: we will ran out of stack before heap and when that happens malloc will crash not just
 	// return NULL ... We need to find and remove all heap allocations
-	struct rist_buffer *b;
-	b = malloc(sizeof(*b));
+	struct rist_buffer *b = NULL;
+	int pool_class = rist_buffer_pool_class(len);
+	if (RIST_LIKELY(pool_class >= 0)) {
+		pthread_mutex_lock(&ctx->rist_free_buffer_mutex);
+		b = rist_buffer_pool_pop(ctx, pool_class);
+		// The receiver hands its payloads out, what comes back is mostly bare structs
+		if (!b)
+			b = rist_buffer_pool_pop(ctx, RIST_BUFFER_POOL_BARE);
+		if (b)
+			ctx->rist_free_buffer_hits++;
+		else
+			ctx->rist_free_buffer_misses++;
+		pthread_mutex_unlock(&ctx->rist_free_buffer_mutex);
+	}
 	if (!b) {
-		fprintf(stderr, "OOM\n");
-		return NULL;
+		b = malloc(sizeof(*b));
+		if (!b) {
+			fprintf(stderr, "OOM\n");
+			return NULL;
+		}
+		b->data = NULL;
+		b->alloc_size = 0;
 	}
 
-	if (buf != NULL && len > 0)
+	/* The payload may have been handed out to the application (see receiver_output), in that
+	 * case only the struct came back to the pool and we need to allocate the payload again */
+	if (buf != NULL && len > 0 && !b->data)
 	{
-		b->data = malloc(len + RIST_MAX_PAYLOAD_OFFSET);
+		b->alloc_size = pool_class >= 0 ? rist_buffer_pool_class_size[pool_class] : len;
+		b->data = malloc(b->alloc_size + RIST_MAX_PAYLOAD_OFFSET);
 		if (!b->data) {
 			free(b);
 			fprintf(stderr, "OOM\n");
 			return NULL;
 		}
 	}
-	b->alloc_size = len;
 	if (buf != NULL && len > 0)
 	{
 		memcpy((uint8_t *)b->data + RIST_MAX_PAYLOAD_OFFSET, buf, len);
 	}
-	b->alloc_size = len;
 	b->next_free = NULL;
 	b->free = false;
 	b->size = len;
@@ -375,10 +441,67 @@ struct rist_buffer *rist_new_buffer(struct rist_common_ctx *ctx, const void *buf
 
 void free_rist_buffer(struct rist_common_ctx *ctx, struct rist_buffer *b)
 {
-	RIST_MARK_UNUSED(ctx);
+	int pool_class = b->data ? rist_buffer_pool_class(b->alloc_size) : RIST_BUFFER_POOL_BARE;
+	/* Only exact class sized payloads can be recycled, the struct alone always can */
+	if (pool_class >= 0 && (!b->data || b->alloc_size == rist_buffer_pool_class_size[pool_class])) {
+		pthread_mutex_lock(&ctx->rist_free_buffer_mutex);
+		if (ctx->rist_free_buffer_count[pool_class] < rist_buffer_pool_class_max(pool_class)) {
+			b->free = true;
+			b->next_free = ctx->rist_free_buffer[pool_class];
+			ctx->rist_free_buffer[pool_class] = b;
+			ctx->rist_free_buffer_count[pool_class]++;
+			pthread_mutex_unlock(&ctx->rist_free_buffer_mutex);
+			return;
+		}
+		pthread_mutex_unlock(&ctx->rist_free_buffer_mutex);
+	}
 	free(b->data);
 	free(b);
+}
+
+/* Called periodically from the protocol thread: buffers that stayed in the pool during the
+ * whole interval are surplus, release half of them back to the system */
+void rist_buffer_pool_trim(struct rist_common_ctx *ctx)
+{
+	struct rist_buffer *release = NULL;
+	pthread_mutex_lock(&ctx->rist_free_buffer_mutex);
+	for (int i = 0; i < RIST_BUFFER_POOL_LISTS; i++) {
+		uint64_t surplus = ctx->rist_free_buffer_low[i] / 2;
+		while (surplus-- > 0 && ctx->rist_free_buffer[i]) {
+			struct rist_buffer *b = ctx->rist_free_buffer[i];
+			ctx->rist_free_buffer[i] = b->next_free;
+			ctx->rist_free_buffer_count[i]--;
+			b->next_free = release;
+			release = b;
+		}
+		ctx->rist_free_buffer_low[i] = ctx->rist_free_buffer_count[i];
+	}
+	pthread_mutex_unlock(&ctx->rist_free_buffer_mutex);
+	while (release) {
+		struct rist_buffer *next = release->next_free;
+		free(release->data);
+		free(release);
+		release = next;
+	}
+}
 
+void rist_buffer_pool_destroy(struct rist_common_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->rist_free_buffer_mutex);
+	for (int i = 0; i < RIST_BUFFER_POOL_LISTS; i++) {
+		struct rist_buffer *b = ctx->rist_free_buffer[i];
+		while (b) {
+			struct rist_buffer *next = b->next_free;
+			free(b->data);
+			free(b);
+			b = next;
+		}
+		ctx->rist_free_buffer[i] = NULL;
+		ctx->rist_free_buffer_count[i] = 0;
+		ctx->rist_free_buffer_low[i] = 0;
+	}
+	pthread_mutex_unlock(&ctx->rist_free_buffer_mutex);
+	pthread_mutex_destroy(&ctx->rist_free_buffer_mutex);
 }
 
 static uint64_t receiver_calculate_packet_time(struct rist_flow *f, const uint64_t source_time, uint64_t now, bool retry, uint8_t payload_type)
@@ -436,20 +559,75 @@ static int receiver_insert_queue_packet(struct rist_flow *f, struct rist_peer *p
 	return 0;
 }
 
+static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64_t packet_recv_time, const void *buf, size_t len, uint32_t seq, uint64_t rtt, bool retry, uint16_t src_port, uint16_t dst_port, uint8_t payload_type);
+
+/* Rebuild what the pending parity allows, a rebuilt packet may leave a single hole in the
+ * crossing row or column so the parity covering it is tried next. pending must have room
+ * for RIST_FEC_DECODER_SLOTS entries. */
+static void receiver_fec_run(struct rist_peer *peer, struct rist_fec_parity **pending, size_t count, uint64_t now)
+{
+	struct rist_flow *f = peer->flow;
+	struct rist_fec_recovered rec;
+	while (count > 0) {
+		struct rist_fec_parity *parity = pending[--count];
+		// The output frees the queued buffers under the flow mutex, a group it already reached is gone
+		pthread_mutex_lock(&f->mutex);
+		bool rebuilt = (int32_t)(parity->snbase - f->last_seq_output) > 0 &&
+			rist_fec_decoder_rebuild(f->fec, parity, f->receiver_queue, f->receiver_queue_max, &rec);
+		pthread_mutex_unlock(&f->mutex);
+		if (!rebuilt)
+			continue;
+		uint64_t source_time;
+		if (RIST_UNLIKELY(peer->config.timing_mode == RIST_TIMING_MODE_ARRIVAL))
+			source_time = timestampNTP_u64();
+		else
+			source_time = convertRTPtoNTP(RTP_PTYPE_MPEGTS, 0, rec.rtp_ts);
+		// A matrix can start before the first packet the flow stored, those seqs have no slot left
+		if ((int32_t)(rec.seq - f->last_seq_output) <= 0)
+			continue;
+		// Queued like a retry: no missing check, too late packets are dropped
+		if (receiver_enqueue(peer, source_time, now, rec.data, rec.len, rec.seq, 0, true, rec.src_port, rec.dst_port, RTP_PTYPE_MPEGTS) != 0)
+			continue;
+		RIST_FLOW_COUNT_ADD(f, recovered_fec, 1);
+		if (get_cctx(peer)->debug)
+			rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Datagram %"PRIu32" rebuilt from FEC\n", rec.seq);
+		count += rist_fec_decoder_find(f->fec, rec.seq, &pending[count], RIST_FEC_DECODER_SLOTS - count);
+	}
+}
+
+static bool receiver_fec_recover_seq(struct rist_peer *peer, uint32_t seq, uint64_t now)
+{
+	struct rist_flow *f = peer->flow;
+	struct rist_fec_parity *pending[RIST_FEC_DECODER_SLOTS];
+	size_t count = rist_fec_decoder_find(f->fec, seq, pending, RIST_FEC_DECODER_SLOTS);
+	if (count == 0)
+		return false;
+	receiver_fec_run(peer, pending, count, now);
+	pthread_mutex_lock(&f->mutex);
+	struct rist_buffer *b = f->receiver_queue[seq & (f->receiver_queue_max - 1)];
+	bool found = b && b->seq == seq;
+	pthread_mutex_unlock(&f->mutex);
+	return found;
+}
+
 static inline void receiver_mark_missing(struct rist_flow *f, struct rist_peer *peer, uint32_t current_seq, uint64_t rtt) {
 	uint32_t counter = 1;
 	uint64_t packet_time_last = 0;
-	if (RIST_UNLIKELY(!f->receiver_queue[f->last_seq_found]))
+	size_t last_idx = f->last_seq_found & (f->receiver_queue_max - 1);
+	if (RIST_UNLIKELY(!f->receiver_queue[last_idx]))
 		if (RIST_LIKELY(!f->rtc_timing_mode))
 			packet_time_last = timestampNTP_u64();
 		else
 			packet_time_last = timestampNTP_RTC_u64();
 	else
-		packet_time_last = f->receiver_queue[f->last_seq_found]->packet_time;
-	uint64_t packet_time_now = f->receiver_queue[current_seq]->packet_time;
-	uint32_t missing_count = (current_seq - f->last_seq_found) & UINT16_MAX;
+		packet_time_last = f->receiver_queue[last_idx]->packet_time;
+	uint64_t packet_time_now = f->receiver_queue[current_seq & (f->receiver_queue_max - 1)]->packet_time;
+	uint32_t missing_count = current_seq - f->last_seq_found;
+	if (f->short_seq)
+		missing_count = (uint16_t)missing_count;
 	//arbitrary large number to prevent incorrectly marking packets as missing when wrap-around occurs & we did not correctly detect as out of order
-	if (missing_count > 32768)
+	//with extended seqs anything beyond the buffer could not be recovered anyway
+	if (missing_count > (f->short_seq ? 32768 : f->receiver_queue_max))
 		return;
 	uint64_t interpacket_time = (packet_time_now - packet_time_last) / (missing_count +1);
 	uint32_t missing_seq = (f->last_seq_found + counter);
@@ -458,6 +636,7 @@ static inline void receiver_mark_missing(struct rist_flow *f, struct rist_peer *
 		missing_seq = (uint16_t)missing_seq;
 
 	uint64_t nack_time = packet_time_last;
+	uint64_t now = f->fec ? timestampNTP_u64() : 0;
 	while (missing_seq != current_seq)
 	{
 		nack_time += interpacket_time;
@@ -473,7 +652,15 @@ static inline void receiver_mark_missing(struct rist_flow *f, struct rist_peer *
 					"Link has collapsed. Not queuing new retries until it recovers.\n");
 			break;
 		}
-		rist_receiver_missing(f, peer, nack_time, missing_seq, rtt);
+		if (!f->fec)
+			rist_receiver_missing(f, peer, nack_time, missing_seq, rtt);
+		else if (!receiver_fec_recover_seq(peer, missing_seq, now)) {
+			// Hold the first nack until the parity covering the packet had its chance
+			uint64_t fec_hold = rist_fec_decoder_hold(f->fec, missing_seq, current_seq, now) * interpacket_time;
+			if (fec_hold > f->recovery_buffer_ticks / 2)
+				fec_hold = f->recovery_buffer_ticks / 2;
+			rist_receiver_missing(f, peer, nack_time, missing_seq, rtt + fec_hold);
+		}
 		if (RIST_UNLIKELY(counter == f->receiver_queue_max))
 			break;
 		counter++;
@@ -541,6 +728,8 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 			empty_receiver_queue(f, get_cctx(peer));
 		}
 		rist_flush_missing_flow_queue(f);
+		if (f->fec)
+			rist_fec_decoder_reset(f->fec);
 		/* Initialize flow session timeout and stats timers */
 		f->flag_flow_buffer_start = true;
 		f->last_recv_ts = now_monotonic;
@@ -552,6 +741,9 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 		f->last_seq_output = seq - 1;
 		f->last_seq_found = seq;
 		f->max_source_time = source_time;
+		/* Restart the packet rate sampling used for buffer sizing */
+		f->queue_check_seq = seq;
+		f->queue_check_time = now_monotonic;
 		/* This will synchronize idx and seq so we can insert packets into receiver buffer based on seq number */
 		size_t idx_initial = seq & (f->receiver_queue_max -1);
 			rist_log_priv(get_cctx(peer), RIST_LOG_INFO,
@@ -563,14 +755,22 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 		atomic_store_explicit(&f->receiver_queue_output_idx, idx_initial, memory_order_release);
 
 		/* reset stats */
-		pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
 		memset(&f->stats_instant, 0, sizeof(f->stats_instant));
-		pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
+		rist_flow_counters_reset(f);
 		f->receiver_queue_has_items = true;
 		pthread_mutex_unlock(&f->mutex);
 		return 0; // not a dupe
 	}
 
+	/* A packet the output already went past can not be output anymore, storing it would leave
+	   a stale buffer in its slot until the output wraps around to it a full ring later.
+	   Its seq was either output or flushed (and counted) as lost, so it only duplicates. */
+	if (RIST_UNLIKELY(rist_flow_seq_is_output(f, seq))) {
+		rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Packet %"PRIu32" is behind the output (%"PRIu32"), dropping!\n", seq, f->last_seq_output);
+		RIST_FLOW_COUNT_ADD(f, dupe, 1);
+		return 1;
+	}
+
 	uint64_t packet_time = receiver_calculate_packet_time(f, source_time, now, retry, payload_type);
     size_t idx = seq & (f->receiver_queue_max - 1);
     if (RIST_UNLIKELY(peer->config.timing_mode == RIST_TIMING_MODE_ARRIVAL && retry))
@@ -617,21 +817,22 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 	   output time than the highest known output time) */
 	size_t reader_idx;
 	bool out_of_order = false;
-	uint32_t expected_seq = (f->last_seq_found +1) & (UINT16_MAX -1);
+	uint32_t expected_seq = f->last_seq_found + 1;
+	if (f->short_seq)
+		expected_seq = (uint16_t)expected_seq;
 	if (RIST_UNLIKELY(packet_time < f->last_packet_ts && seq != expected_seq)) {
 		if (now > (packet_time + (f->recovery_buffer_ticks *1.1)))
 		{
 			rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Packet %"PRIu32" too late, dropping!\n", seq);
-			pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
-			f->stats_instant.dropped_late++;
-                        if (f->stats_instant.dropped_late > 5 * f->stats_instant.received)
+			unsigned long dropped_late = RIST_FLOW_COUNT_ADD(f, dropped_late, 1) + 1;
+			unsigned long received = RIST_FLOW_COUNT_GET(f, received);
+                        if (dropped_late > 5 * received)
                             f->receiver_queue_has_items = false;
-			if ((f->stats_instant.dropped_late > (f->stats_instant.received * 5) && f->stats_instant.received > 100) ||
-				(f->stats_instant.dropped_late > 100 && f->stats_instant.received == 0)) {
+			if ((dropped_late > (received * 5) && received > 100) ||
+				(dropped_late > 100 && received == 0)) {
 					rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Too many late packets received, resetting flow");
 					f->receiver_queue_has_items = false;
 			}
-			pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
 			return -1;
 		}
 		if (!retry) {
@@ -648,11 +849,8 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 		rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Buffer is full, dropping packet %"PRIu32"/%zu\n", seq, idx);
 		if (packet_time > f->last_packet_ts)
 			f->last_seq_found  = seq;
-		pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
-		f->stats_instant.dropped_full++;
-		pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
 		//Something is wrong, and we should reset
-		if (f->stats_instant.dropped_full > 100) {
+		if (RIST_FLOW_COUNT_ADD(f, dropped_full, 1) + 1 > 100) {
 			rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Buffer is full, resetting buffer\n");
 			f->receiver_queue_has_items = false;
 		}
@@ -663,9 +861,7 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 		struct rist_buffer *b = f->receiver_queue[idx];
 		if (b->source_time == source_time) {
 			rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Dupe! %"PRIu32"/%zu\n", seq, idx);
-			pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
-			f->stats_instant.dupe++;
-			pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
+			RIST_FLOW_COUNT_ADD(f, dupe, 1);
 			return 1;
 		}
 		else {
@@ -681,11 +877,9 @@ static int receiver_enqueue(struct rist_peer *peer, uint64_t source_time, uint64
 		// only error is OOM, safe to exit here ...
 		return 0;
 	}
-	pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
 	if (out_of_order)
-		f->stats_instant.reordered++;
-	f->stats_instant.received++;
-	pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
+		RIST_FLOW_COUNT_ADD(f, reordered, 1);
+	RIST_FLOW_COUNT_ADD(f, received, 1);
 	// Check for missing data and queue retries
 	if (!retry) {
 		/* check for missing packets */
@@ -754,9 +948,7 @@ static int rist_process_nack(struct rist_flow *f, struct rist_missing_buffer *b)
 			}
 			if (b->nack_count == 0) {
 				f->missing_counter++;
-				pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
-				f->stats_instant.missing++;
-				pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
+				RIST_FLOW_COUNT_ADD(f, missing, 1);
 			}
 
 			// TODO: make this 10% overhead configurable?
@@ -777,9 +969,7 @@ static int rist_process_nack(struct rist_flow *f, struct rist_missing_buffer *b)
 			// update peer information
 			f->nacks.array[f->nacks.counter] = b->seq;
 			f->nacks.counter++;
-			pthread_mutex_lock(&(get_cctx(peer)->stats_lock));
-			f->stats_instant.retries++;
-			pthread_mutex_unlock(&(get_cctx(peer)->stats_lock));
+			RIST_FLOW_COUNT_ADD(f, retries, 1);
 		}
 	}
 
@@ -845,7 +1035,8 @@ static struct rist_data_block *new_data_block(struct rist_data_block *output_buf
 
 static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 {
-
+	// A shard hands its data to the context the application reads from
+	struct rist_receiver *out = ctx->shard_parent ? ctx->shard_parent : ctx;
 	uint64_t recovery_buffer_ticks = f->recovery_buffer_ticks;
 	uint64_t now;
 	if (RIST_LIKELY(!f->rtc_timing_mode))
@@ -884,9 +1075,7 @@ static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 					break;
 				}
 			}
-			pthread_mutex_lock(&ctx->common.stats_lock);
-			f->stats_instant.lost += holes;
-			pthread_mutex_unlock(&ctx->common.stats_lock);
+			RIST_FLOW_COUNT_ADD(f, lost, holes);
 			output_idx = counter;
 			rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
 					"Empty buffer element, flushing %"PRIu32" hole(s), now at index %zu, size is %zu\n",
@@ -942,9 +1131,7 @@ static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 					rist_log_priv(&ctx->common, RIST_LOG_ERROR,
 							"Discontinuity, expected %" PRIu32 " got %" PRIu32 "\n",
 							f->last_seq_output + 1, b->seq);
-					pthread_mutex_lock(&ctx->common.stats_lock);
-					f->stats_instant.lost++;
-					pthread_mutex_unlock(&ctx->common.stats_lock);
+					RIST_FLOW_COUNT_ADD(f, lost, 1);
 					holes = 1;
 				}
 				if (b->type == RIST_PAYLOAD_TYPE_DATA_RAW) {
@@ -961,10 +1148,10 @@ static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 							NULL, b,
 							&payload[RIST_MAX_PAYLOAD_OFFSET], f->flow_id, flags);
 					b->data = NULL;
-					if (ctx->receiver_data_callback && block) {
+					if (out->receiver_data_callback && block) {
 						rist_ref_inc(block->ref);
 						// send to callback synchronously
-						ctx->receiver_data_callback(ctx->receiver_data_callback_argument,
+						out->receiver_data_callback(out->receiver_data_callback_argument,
 								block);
 					}
 
@@ -972,7 +1159,7 @@ static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 					size_t dataout_fifo_read_index = atomic_load_explicit(&f->dataout_fifo_queue_read_index, memory_order_acquire);
 					uint32_t fifo_count = (dataout_fifo_write_index - dataout_fifo_read_index)&(ctx->fifo_queue_size -1);
 					if (fifo_count +1 == ctx->fifo_queue_size || !ctx->fifo_queue_size) {
-						if (!ctx->receiver_data_callback)
+						if (!out->receiver_data_callback)
 							rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Rist data out fifo queue overflow\n");
 						rist_receiver_data_block_free2(&block);
 						atomic_store_explicit(&f->fifo_overflow, true, memory_order_release);
@@ -981,24 +1168,19 @@ static void receiver_output(struct rist_receiver *ctx, struct rist_flow *f)
 						f->dataout_fifo_queue[dataout_fifo_write_index] = block;
 						atomic_store_explicit(&f->dataout_fifo_queue_write_index, (dataout_fifo_write_index + 1)& (ctx->fifo_queue_size-1), memory_order_relaxed);
 						// Wake up the fifo read thread (poll)
-						if (ctx->receiver_data_ready_notify_fd) {
+						if (out->receiver_data_ready_notify_fd) {
 							// send a data ready signal by writing a single byte of value 0
 							char empty = '\0';
-							if(write(ctx->receiver_data_ready_notify_fd, &empty, 1) == -1)
+							if(write(out->receiver_data_ready_notify_fd, &empty, 1) == -1)
 							{
 								// We ignore the error condition as missing data is not harmful here
 								// It is only a signaling mechanism
 							}
 						}
 					}
-					pthread_mutex_lock(&ctx->common.stats_lock);
-					if (f->stats_instant.buffer_duration_count < 2048)
-					{
-						f->stats_instant.buffer_duration[f->stats_instant.buffer_duration_count] = (uint32_t)(delay_rtc / RIST_CLOCK);
-						f->stats_instant.buffer_duration_count++;
-					}
-					pthread_mutex_unlock(&ctx->common.stats_lock);
-					if (pthread_cond_signal(&(ctx->condition)))
+					RIST_FLOW_COUNT_ADD(f, buffer_duration_sum, delay_rtc / RIST_CLOCK);
+					RIST_FLOW_COUNT_ADD(f, buffer_duration_count, 1);
+					if (pthread_cond_signal(&(out->condition)))
 						rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Call to pthread_cond_signal failed.\n");
 				}
 				// Track this one only for data
@@ -1056,7 +1238,7 @@ static void send_nack_group(struct rist_receiver *ctx, struct rist_flow *f)
 		}
 	}
 	if (peer != NULL)
-		rist_receiver_send_nacks(peer,f->nacks.array, f->nacks.counter);
+		rist_receiver_send_nacks(peer,f->nacks.array, f->nacks.counter, f->seq_ext);
 	else
 	{
 		for (size_t i = 0; i < f->peer_lst_len; i++)
@@ -1068,7 +1250,7 @@ static void send_nack_group(struct rist_receiver *ctx, struct rist_flow *f)
 				peer = check;
 			}
 			if (peer != NULL)
-				rist_receiver_send_nacks(peer,f->nacks.array, f->nacks.counter);
+				rist_receiver_send_nacks(peer,f->nacks.array, f->nacks.counter, f->seq_ext);
 		}
 	}
 	f->nacks.counter = 0;
@@ -1085,16 +1267,19 @@ void receiver_nack_output(struct rist_receiver *ctx, struct rist_flow *f)
 
 	const size_t maxcounter = RIST_MAX_NACKS;
 
-	/* Now loop through missing queue and process items */
-	struct rist_missing_buffer *mb = f->missing;
-	struct rist_missing_buffer **prev = &f->missing;
-	struct rist_missing_buffer *previous = NULL;
+	/* Now process the missing entries whose nack deadline has passed */
+	uint64_t now;
+	if (RIST_LIKELY(!f->rtc_timing_mode))
+		now = timestampNTP_u64();
+	else
+		now = timestampNTP_RTC_u64();
+	struct rist_missing_buffer *mb = NULL;
 	int empty = 0;
 	uint32_t seq_msb = 0;
-	if (mb)
-		seq_msb = mb->seq >> 16;
+	if (f->missing.heap_count > 0)
+		seq_msb = f->missing.entries[0].seq >> 16;
 
-	while (mb) {
+	while ((mb = rist_missing_queue_pop_due(f, now)) != NULL) {
 		int remove_from_queue_reason = 0;
 		struct rist_peer *peer = mb->peer;
 		ssize_t idx = mb->seq& (f->receiver_queue_max -1);
@@ -1103,36 +1288,34 @@ void receiver_nack_output(struct rist_receiver *ctx, struct rist_flow *f)
 					"Nack processing is disabled for this peer, removing seq %"PRIu32" from queue ...\n",
 					mb->seq);
 			remove_from_queue_reason = 10;
-			f->stats_instant.missing--;
+			RIST_FLOW_COUNT_SUB(f, missing, 1);
 			goto nack_loop_continue;
 		} else if (f->receiver_queue[idx]) {
 			if (f->receiver_queue[idx]->seq == mb->seq) {
-				pthread_mutex_lock(&ctx->common.stats_lock);
 				// We filled in the hole already ... packet has been recovered
 				remove_from_queue_reason = 3;
 				if (mb->nack_count > 0)
-					f->stats_instant.recovered++;
+					RIST_FLOW_COUNT_ADD(f, recovered, 1);
 				switch(mb->nack_count) {
 					case 0:
 						break;
 					case 1:
-						f->stats_instant.recovered_0nack++;
+						RIST_FLOW_COUNT_ADD(f, recovered_0nack, 1);
 						break;
 					case 2:
-						f->stats_instant.recovered_1nack++;
+						RIST_FLOW_COUNT_ADD(f, recovered_1nack, 1);
 						break;
 					case 3:
-						f->stats_instant.recovered_2nack++;
+						RIST_FLOW_COUNT_ADD(f, recovered_2nack, 1);
 						break;
 					case 4:
-						f->stats_instant.recovered_3nack++;
+						RIST_FLOW_COUNT_ADD(f, recovered_3nack, 1);
 						break;
 					default:
-						f->stats_instant.recovered_morenack++;
+						RIST_FLOW_COUNT_ADD(f, recovered_morenack, 1);
 						break;
 				}
-				f->stats_instant.recovered_sum += mb->nack_count;
-				pthread_mutex_unlock(&ctx->common.stats_lock);
+				RIST_FLOW_COUNT_ADD(f, recovered_sum, mb->nack_count);
 			}
 			else {
 				// Message with wrong seq!!!
@@ -1140,9 +1323,7 @@ void receiver_nack_output(struct rist_receiver *ctx, struct rist_flow *f)
 						"Retry queue has the wrong seq %"PRIu32" != %"PRIu32", removing ...\n",
 						f->receiver_queue[idx]->seq, mb->seq);
 				remove_from_queue_reason = 4;
-				pthread_mutex_lock(&ctx->common.stats_lock);
-				f->stats_instant.missing--;
-				pthread_mutex_unlock(&ctx->common.stats_lock);
+				RIST_FLOW_COUNT_SUB(f, missing, 1);
 				goto nack_loop_continue;
 			}
 		} else if (peer->buffer_bloat_active) {
@@ -1178,6 +1359,7 @@ void receiver_nack_output(struct rist_receiver *ctx, struct rist_flow *f)
 							seq_msb, mb->seq >> 16, mb->seq, f->nacks.counter,
 							f->missing_counter);
 				send_nack_group(ctx, f);
+				seq_msb = mb->seq >> 16;
 			}
 			else if (f->nacks.counter == (maxcounter - 1)) {
 				rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
@@ -1201,22 +1383,11 @@ nack_loop_continue:
 				rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
 						"Removing seq %" PRIu32 " from missing, queue size is %d, retry #%u, age %"PRIu64"ms, reason %d\n",
 						mb->seq, f->missing_counter, mb->nack_count, (timestampNTP_u64() - mb->insertion_time) / RIST_CLOCK, remove_from_queue_reason);
-			struct rist_missing_buffer *next = mb->next;
-			if (!next)
-				f->missing_tail = previous;
-			*prev = next;
-			if (mb->nack_count != 0)
-				f->missing_counter--;
-			free(mb);
-			mb = next;
-		} else {
-			/* Move it to the end of the queue */
-			// TODO: I think this is wrong and we loose nacks when we get here
-			previous = mb;
-			prev = &mb->next;
-			mb = mb->next;
+			rist_missing_queue_remove(f, mb);
 		}
+		/* else: still missing, it goes back into the heap with its new deadline below */
 	}
+	rist_missing_queue_requeue(f);
 
 	// Empty all peer nack queues, i.e. send them
 	send_nack_group(ctx, f);
@@ -1304,6 +1475,9 @@ struct rist_peer *_librist_peer_create_common(struct rist_common_ctx *cctx, stru
 		return NULL;
 	}
 
+	// Before the key setup, every derivation goes through the context wide cache
+	p->key_tx.kdf = &cctx->kdf;
+	p->key_tx_odd.kdf = &cctx->kdf;
 	_librist_crypto_psk_rist_key_init(&p->key_tx, key_size, config->key_rotation, config->secret, false);
 	_librist_crypto_psk_rist_key_init(&p->key_tx_odd, key_size, config->key_rotation, config->secret, true);
 	_librist_crypto_psk_rist_key_clone(&p->key_tx, &p->key_rx);
@@ -1389,11 +1563,7 @@ void rist_fsm_init_comm(struct rist_peer *peer)
 	rist_print_inet_info("Active ", peer);
 
 	/* Start the timer that reads data from this peer */
-	if (!peer->event_recv) {
-		struct evsocket_ctx *evctx = get_cctx(peer)->evctx;
-		peer->event_recv = evsocket_addevent(evctx, peer->sd, EVSOCKET_EV_READ,
-				rist_peer_recv_wrap, rist_peer_sockerr, peer);
-	}
+	rist_peer_recv_register(peer);
 
 	/* Enable RTCP timer and jump start it */
 	if (!peer->listening && peer->is_rtcp) {
@@ -1429,6 +1599,7 @@ void rist_peer_authenticate(struct rist_peer *peer)
 	peer->authenticated = true;
 	if (peer->peer_data)
 		peer->peer_data->authenticated = true;
+	rist_paths_invalidate(peer);
 
 	rist_log_priv(get_cctx(peer), RIST_LOG_INFO,
 			"Successfully Authenticated peer %"PRIu32"\n", peer->adv_peer_id);
@@ -1543,9 +1714,18 @@ static void rist_calculate_flow_bitrate(struct rist_flow *flow, size_t len, stru
 	}
 }
 
+/* Nacks without a seqext record only carry the low 16 bits, they can only refer to
+ * packets we already sent so take the closest seq_rtp at or before the last one sent */
+static inline uint32_t rist_sender_nack_seq(struct rist_sender *ctx, uint16_t seq, bool seq_ext, uint32_t nack_seq_msb)
+{
+	if (seq_ext)
+		return nack_seq_msb + seq;
+	return ctx->seq_rtp_sent - (uint16_t)((uint16_t)ctx->seq_rtp_sent - seq);
+}
+
 static void rist_sender_recv_nack(struct rist_peer *peer,
 		uint32_t flow_id, uint16_t src_port, uint16_t dst_port, const uint8_t *payload,
-		size_t payload_len, uint32_t nack_seq_msb)
+		size_t payload_len, bool seq_ext, uint32_t nack_seq_msb)
 {
 	RIST_MARK_UNUSED(flow_id);
 	RIST_MARK_UNUSED(src_port);
@@ -1586,10 +1766,11 @@ static void rist_sender_recv_nack(struct rist_peer *peer,
 			struct rist_rtp_nack_record *nr = (struct rist_rtp_nack_record *)(payload + sizeof(struct rist_rtcp_nack_range) + i * sizeof(struct rist_rtp_nack_record));
 			missing =  ntohs(nr->start);
 			additional = ntohs(nr->extra);
-			rist_retry_enqueue(peer->sender_ctx, nack_seq_msb + (uint32_t)missing, peer);
-			//rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Record %"PRIu32": base packet: %"PRIu32" range len: %d\n", i, nack_seq_msb + missing, additional);
+			uint32_t seq = rist_sender_nack_seq(peer->sender_ctx, missing, seq_ext, nack_seq_msb);
+			rist_retry_enqueue(peer->sender_ctx, seq, peer);
+			//rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Record %"PRIu32": base packet: %"PRIu32" range len: %d\n", i, seq, additional);
 			for (j = 0; j < additional; j++) {
-				rist_retry_enqueue(peer->sender_ctx, nack_seq_msb + (uint32_t)missing + j + 1, peer);
+				rist_retry_enqueue(peer->sender_ctx, seq + j + 1, peer);
 			}
 		}
 	} else if (rtcp->ptype == PTYPE_NACK_BITMASK) {
@@ -1603,11 +1784,12 @@ static void rist_sender_recv_nack(struct rist_peer *peer,
 			struct rist_rtp_nack_record *nr = (struct rist_rtp_nack_record *)(payload + sizeof(struct rist_rtcp_nack_bitmask) + i * sizeof(struct rist_rtp_nack_record));
 			missing = ntohs(nr->start);
 			bitmask = ntohs(nr->extra);
-			rist_retry_enqueue(peer->sender_ctx, nack_seq_msb + (uint32_t)missing, peer);
-			//rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Record %"PRIu32": base packet: %"PRIu32" bitmask: %04x\n", i, nack_seq_msb + missing, bitmask);
+			uint32_t seq = rist_sender_nack_seq(peer->sender_ctx, missing, seq_ext, nack_seq_msb);
+			rist_retry_enqueue(peer->sender_ctx, seq, peer);
+			//rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Record %"PRIu32": base packet: %"PRIu32" bitmask: %04x\n", i, seq, bitmask);
 			for (j = 0; j < 16; j++) {
 				if ((bitmask & (1 << j)) == (1 << j))
-					rist_retry_enqueue(peer->sender_ctx, nack_seq_msb + missing + j + 1, peer);
+					rist_retry_enqueue(peer->sender_ctx, seq + j + 1, peer);
 			}
 		}
 	} else {
@@ -1828,7 +2010,14 @@ static bool rist_receiver_rtcp_authenticate(struct rist_peer *peer, uint32_t seq
 		if (peer->flow) {
 			// We do multiple ifs to make these checks stateless
 			pthread_mutex_lock(&peer->flow->mutex);
-			if (!peer->flow->receiver_thread_running) {
+			if (ctx->dataout_pool) {
+				if (!peer->flow->dataout_pooled && rist_dataout_pool_add(ctx, peer->flow) != 0) {
+					rist_log_priv(&ctx->common, RIST_LOG_ERROR,
+							"Could not schedule receiver data output on the pool.\n");
+					pthread_mutex_unlock(&peer->flow->mutex);
+					return false;
+				}
+			} else if (!peer->flow->receiver_thread_running) {
 				// Make sure this data out thread is created only once per flow
 				if (rist_thread_create(&ctx->common, &peer->flow->receiver_thread, NULL, receiver_pthread_dataout, (void *)peer->flow) != 0) {
 					rist_log_priv(&ctx->common, RIST_LOG_ERROR,
@@ -1862,7 +2051,13 @@ static bool rist_receiver_rtcp_authenticate(struct rist_peer *peer, uint32_t seq
 	}
 }
 
-static void rist_receiver_recv_data(struct rist_peer *peer, uint32_t seq, uint32_t flow_id,
+/* Closest 32bit seq to the last one found with the same low 16 bits */
+static inline uint32_t rist_receiver_extend_seq(struct rist_flow *f, uint16_t seq)
+{
+	return f->last_seq_found + (uint32_t)(int16_t)(seq - (uint16_t)f->last_seq_found);
+}
+
+static void rist_receiver_recv_data(struct rist_peer *peer, uint32_t seq, bool seq_ext, uint32_t flow_id,
 		uint64_t source_time, uint64_t packet_recv_time, struct rist_buffer *payload, uint8_t retry, uint8_t payload_type)
 {
 	assert(peer->receiver_ctx != NULL);
@@ -1914,15 +2109,48 @@ static void rist_receiver_recv_data(struct rist_peer *peer, uint32_t seq, uint32
         peer->flow->flow_id_actual = flow_id;
 	}
 
+	// Senders without the RTP seq extension only give us 16 bits, main profile flows still track 32
+	struct rist_flow *f = peer->flow;
+	if (seq_ext) {
+		if (RIST_UNLIKELY(!f->seq_ext)) {
+			rist_log_priv(&ctx->common, RIST_LOG_INFO, "FLOW #%"PRIu32": sender uses extended sequence numbers\n", f->flow_id);
+			f->seq_ext = true;
+		}
+	} else if (!f->short_seq && f->receiver_queue_has_items)
+		seq = rist_receiver_extend_seq(f, (uint16_t)seq);
+
 	// Wake up output thread when data comes in
 	if (pthread_cond_signal(&(peer->flow->condition)))
 		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Call to pthread_cond_signal failed.\n");
 	if (!receiver_enqueue(peer, source_time, packet_recv_time, payload->data, payload->size, seq, rtt, retry, payload->src_port, payload->dst_port, payload_type)) {
-		pthread_mutex_lock(&ctx->common.stats_lock);
+		// Same thread as the stats report, no locking needed
 		rist_calculate_flow_bitrate(peer->flow, payload->size, &peer->flow->bw); // update bitrate only if not a dupe
-		pthread_mutex_unlock(&ctx->common.stats_lock);
 
 	}
+	if (ctx->dataout_pool)
+		rist_dataout_pool_wake(ctx, peer->flow);
+}
+
+static void rist_receiver_recv_fec(struct rist_peer *peer, uint64_t packet_recv_time, struct rist_buffer *payload)
+{
+	struct rist_flow *f = peer->flow;
+	// Parity only helps once the flow is receiving data
+	if (!f || !f->receiver_queue_has_items)
+		return;
+	if (RIST_UNLIKELY(!f->fec)) {
+		f->fec = rist_fec_decoder_create();
+		if (!f->fec) {
+			rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Could not create FEC decoder, OOM\n");
+			return;
+		}
+		const char *xor_name;
+		rist_fec_xor_select(&xor_name);
+		rist_log_priv(get_cctx(peer), RIST_LOG_INFO, "FLOW #%"PRIu32": sender uses FEC, using %s XOR\n", f->flow_id, xor_name);
+	}
+	struct rist_fec_parity *pending[RIST_FEC_DECODER_SLOTS];
+	pending[0] = rist_fec_decoder_add(f->fec, payload->data, payload->size, f->last_seq_found, packet_recv_time);
+	if (pending[0])
+		receiver_fec_run(peer, pending, 1, packet_recv_time);
 }
 
 static void rist_recv_oob_data(struct rist_peer *peer, struct rist_buffer *payload)
@@ -2090,6 +2318,7 @@ static void rist_recv_rtcp(struct rist_peer *peer, uint32_t seq,
 	uint16_t records;
 	uint8_t subtype;
 	uint32_t nack_seq_msb = 0;
+	bool nack_seq_ext = false;
 	peer->stats_receiver_instant.received_rtcp++;
 	struct rist_common_ctx *ctx = get_cctx(peer);
 
@@ -2126,6 +2355,7 @@ static void rist_recv_rtcp(struct rist_peer *peer, uint32_t seq,
 				{
 					struct rist_rtcp_seqext *seq_ext = (struct rist_rtcp_seqext *) pkt;
 					nack_seq_msb = ((uint32_t)be16toh(seq_ext->seq_msb)) << 16;
+					nack_seq_ext = true;
 					break;
 				}
 				else if (subtype == ECHO_RESPONSE) {
@@ -2148,7 +2378,7 @@ static void rist_recv_rtcp(struct rist_peer *peer, uint32_t seq,
 				}
 			case PTYPE_NACK_BITMASK:
 				//Also FMT Range
-				rist_sender_recv_nack(peer, flow_id, payload->src_port, payload->dst_port, pkt, bytes_left, nack_seq_msb);
+				rist_sender_recv_nack(peer, flow_id, payload->src_port, payload->dst_port, pkt, bytes_left, nack_seq_ext, nack_seq_msb);
 				break;
 			case PTYPE_RR:
 				if (ntohs(rtcp->len) == 7) {
@@ -2284,6 +2514,7 @@ static void peer_copy_settings(struct rist_peer *peer_src, struct rist_peer *pee
 	peer->config.min_retries = peer_src->config.min_retries;
 	peer->config.max_retries = peer_src->config.max_retries;
 	peer->config.timing_mode = peer_src->config.timing_mode;
+	peer->config.pacing_mode = peer_src->config.pacing_mode;
 	peer->rtcp_keepalive_interval = peer_src->rtcp_keepalive_interval;
 	peer->peer_ssrc = peer_src->peer_ssrc;
 	peer->session_timeout = peer_src->session_timeout;
@@ -2299,9 +2530,15 @@ static void kill_peer(struct rist_peer *peer)
 	if (peer->peer_data && (current_state != peer->peer_data->dead && peer->peer_data->parent))
 		--peer->peer_data->parent->child_alive_count;
 	peer->dead_since = timestampNTP_u64();
+	rist_paths_invalidate(peer);
 }
 
 static void rist_peer_recv_wrap(struct evsocket_ctx *evctx, int fd, short revents, void *arg) {
+#if HAVE_RECVMMSG
+	struct rist_peer *peer = (struct rist_peer *) arg;
+	if (!get_cctx(peer)->recv_batch_disabled && rist_peer_recv_batch(peer, fd) == 0)
+		return;
+#endif
 	#ifdef _WIN32
 	bool again = false;
 	#else
@@ -2340,6 +2577,26 @@ static void rist_new_connection(struct rist_peer *peer, struct rist_peer *p, uin
 	}
 }
 
+static void rist_peer_recv_packet(struct rist_peer *peer, uint8_t *recv_buf, size_t recv_bufsize, struct sockaddr *addr, socklen_t addrlen, uint64_t now);
+
+#if HAVE_UDP_GRO
+/* Runs each datagram UDP GRO coalesced into buf through the packet pipeline, they all share the
+ * sender, the arrival time and the segment size but for a shorter last one */
+static void rist_peer_recv_segments(struct rist_peer *peer, uint8_t *buf, size_t len, const struct msghdr *msg, struct sockaddr *addr, socklen_t addrlen, uint64_t now)
+{
+	size_t segment = peer->gro ? rist_udp_gro_segment(msg) : 0;
+	if (segment == 0 || segment >= len) {
+		rist_peer_recv_packet(peer, buf, len, addr, addrlen, now);
+		return;
+	}
+	for (size_t offset = 0; offset < len; offset += segment) {
+		if (atomic_load_explicit(&peer->shutdown, memory_order_acquire))
+			return;
+		rist_peer_recv_packet(peer, &buf[offset], len - offset < segment ? len - offset : segment, addr, addrlen, now);
+	}
+}
+#endif
+
 static void rist_peer_recv(struct evsocket_ctx *evctx, int fd, short revents, void *arg, bool *again)
 {
 	RIST_MARK_UNUSED(evctx);
@@ -2350,23 +2607,40 @@ static void rist_peer_recv(struct evsocket_ctx *evctx, int fd, short revents, vo
 	if (atomic_load_explicit(&peer->shutdown, memory_order_acquire)) {
 		return;
 	}
-	uint64_t now = timestampNTP_u64();
 	struct rist_common_ctx *cctx = get_cctx(peer);
 
 	socklen_t addrlen = peer->address_len;
-	size_t recv_bufsize = 0;
-	uint16_t family = peer->address_family;
 	struct sockaddr_storage ss = {0};
 	struct sockaddr *addr = (struct sockaddr *)&ss;
-	struct rist_peer *p = NULL;
 	uint8_t *recv_buf = cctx->buf.recv;
-	uint16_t port = 0;
 
-	ssize_t ret = recvfrom(peer->sd, (char*)recv_buf, RIST_MAX_PACKET_SIZE, MSG_DONTWAIT, (struct sockaddr *)addr, &addrlen);
-	if (ss.ss_family == AF_INET)
-		port = htons(((struct sockaddr_in *)addr)->sin_port);
-	else
-		port = htons(((struct sockaddr_in6 *)addr)->sin6_port);
+	ssize_t ret;
+#if HAVE_SO_TIMESTAMPING || HAVE_UDP_GRO
+	struct msghdr msg = { 0 };
+	struct iovec iov = { .iov_base = recv_buf, .iov_len = RIST_MAX_PACKET_SIZE };
+	uint8_t ctrl[RIST_RECV_CMSG_SIZE];
+	bool with_msg = cctx->rx_timestamps != 0;
+#if HAVE_UDP_GRO
+	if (peer->gro) {
+		// A coalesced datagram does not fit the regular buffer, the batch one is idle on this path
+		recv_buf = (uint8_t *)cctx->recv_batch.buf;
+		iov.iov_base = recv_buf;
+		iov.iov_len = RIST_RECV_GRO_SIZE;
+		with_msg = true;
+	}
+#endif
+	if (with_msg) {
+		msg.msg_name = addr;
+		msg.msg_namelen = addrlen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		ret = recvmsg(peer->sd, &msg, MSG_DONTWAIT);
+		addrlen = msg.msg_namelen;
+	} else
+#endif
+	ret = recvfrom(peer->sd, (char*)recv_buf, RIST_MAX_PACKET_SIZE, MSG_DONTWAIT, (struct sockaddr *)addr, &addrlen);
 
 #ifndef _WIN32
 	if (ret <= 0) {
@@ -2381,12 +2655,257 @@ static void rist_peer_recv(struct evsocket_ctx *evctx, int fd, short revents, vo
 		if (errorcode == WSAEWOULDBLOCK)
 			return;
 #endif
-		rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Receive failed: errno=%d, ret=%d, socket=%d\n", errorcode, recv_bufsize, fd);
+		rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "Receive failed: errno=%d, ret=%d, socket=%d\n", errorcode, (int)ret, fd);
 		rist_log_priv(get_cctx(peer), RIST_LOG_ERROR, "%s\n", strerror(errorcode));
 		return;
 	}
 
-	recv_bufsize = ret;
+	uint64_t now = timestampNTP_u64();
+#if HAVE_SO_TIMESTAMPING
+	if (cctx->rx_timestamps) {
+		struct timespec realtime;
+		clock_gettime(CLOCK_REALTIME, &realtime);
+		now = rist_rx_timestamp(&msg, &realtime, now);
+	}
+#endif
+#if HAVE_UDP_GRO
+	if (with_msg) {
+		rist_peer_recv_segments(peer, recv_buf, (size_t)ret, &msg, addr, addrlen, now);
+		return;
+	}
+#endif
+	rist_peer_recv_packet(peer, recv_buf, (size_t)ret, addr, addrlen, now);
+}
+
+#if HAVE_RECVMMSG
+/* Pulls up to RIST_RECV_BATCH_SIZE datagrams per syscall and runs each of them through the
+ * regular packet pipeline, returns -1 when recvmmsg is not usable so the caller can fall back */
+static int rist_peer_recv_batch(struct rist_peer *peer, int fd)
+{
+	struct rist_common_ctx *cctx = get_cctx(peer);
+	struct rist_recv_batch *batch = &cctx->recv_batch;
+
+	for (;;) {
+		if (atomic_load_explicit(&peer->shutdown, memory_order_acquire))
+			return 0;
+		int slots = RIST_RECV_BATCH_SIZE;
+#if HAVE_UDP_GRO
+		// Coalesced datagrams take a few large slots of the same buffer
+		if (peer->gro)
+			slots = RIST_RECV_GRO_BATCH_SIZE;
+#endif
+		for (int i = 0; i < slots; i++) {
+			batch->iov[i].iov_base = batch->buf[i];
+			batch->iov[i].iov_len = RIST_MAX_PACKET_SIZE;
+#if HAVE_UDP_GRO
+			if (peer->gro) {
+				batch->iov[i].iov_base = (uint8_t *)batch->buf + (size_t)i * RIST_RECV_GRO_SIZE;
+				batch->iov[i].iov_len = RIST_RECV_GRO_SIZE;
+			}
+#endif
+			batch->msgs[i].msg_hdr.msg_name = &batch->addr[i];
+			batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addr[i]);
+			batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msgs[i].msg_hdr.msg_iovlen = 1;
+			batch->msgs[i].msg_hdr.msg_control = NULL;
+			batch->msgs[i].msg_hdr.msg_controllen = 0;
+#if HAVE_SO_TIMESTAMPING || HAVE_UDP_GRO
+			bool with_ctrl = cctx->rx_timestamps != 0;
+#if HAVE_UDP_GRO
+			with_ctrl = with_ctrl || peer->gro;
+#endif
+			if (with_ctrl) {
+				batch->msgs[i].msg_hdr.msg_control = batch->ctrl[i];
+				batch->msgs[i].msg_hdr.msg_controllen = sizeof(batch->ctrl[i]);
+			}
+#endif
+			batch->msgs[i].msg_hdr.msg_flags = 0;
+			batch->msgs[i].msg_len = 0;
+		}
+		int count = recvmmsg(peer->sd, batch->msgs, (unsigned int)slots, MSG_DONTWAIT, NULL);
+		if (count <= 0) {
+			int errorcode = errno;
+			if (count < 0 && (errorcode == ENOSYS || errorcode == EOPNOTSUPP)) {
+				rist_log_priv(cctx, RIST_LOG_WARN, "recvmmsg not supported, falling back to single datagram receive\n");
+				cctx->recv_batch_disabled = true;
+				return -1;
+			}
+			if (count == 0 || errorcode == EAGAIN || errorcode == EWOULDBLOCK)
+				return 0;
+			rist_log_priv(cctx, RIST_LOG_ERROR, "Receive failed: errno=%d, ret=%d, socket=%d\n", errorcode, count, fd);
+			rist_log_priv(cctx, RIST_LOG_ERROR, "%s\n", strerror(errorcode));
+			return 0;
+		}
+		uint64_t now = timestampNTP_u64();
+#if HAVE_SO_TIMESTAMPING
+		struct timespec realtime;
+		if (cctx->rx_timestamps)
+			clock_gettime(CLOCK_REALTIME, &realtime);
+#endif
+		for (int i = 0; i < count; i++) {
+			if (atomic_load_explicit(&peer->shutdown, memory_order_acquire))
+				return 0;
+			uint64_t arrival = now;
+#if HAVE_SO_TIMESTAMPING
+			if (cctx->rx_timestamps)
+				arrival = rist_rx_timestamp(&batch->msgs[i].msg_hdr, &realtime, now);
+#endif
+#if HAVE_UDP_GRO
+			rist_peer_recv_segments(peer, batch->msgs[i].msg_hdr.msg_iov->iov_base, batch->msgs[i].msg_len, &batch->msgs[i].msg_hdr,
+					(struct sockaddr *)&batch->addr[i], batch->msgs[i].msg_hdr.msg_namelen, arrival);
+#else
+			rist_peer_recv_packet(peer, batch->buf[i], batch->msgs[i].msg_len,
+					(struct sockaddr *)&batch->addr[i], batch->msgs[i].msg_hdr.msg_namelen, arrival);
+#endif
+		}
+		// A partial batch means the socket has been drained
+		if (count < slots)
+			return 0;
+	}
+}
+#endif
+
+#if HAVE_IO_URING
+static void rist_peer_recv_uring(struct rist_peer *peer, uint8_t *buf, size_t len, const struct msghdr *msg)
+{
+	if (atomic_load_explicit(&peer->shutdown, memory_order_acquire))
+		return;
+	uint64_t now = timestampNTP_u64();
+#if HAVE_SO_TIMESTAMPING
+	if (get_cctx(peer)->rx_timestamps) {
+		struct timespec realtime;
+		clock_gettime(CLOCK_REALTIME, &realtime);
+		now = rist_rx_timestamp(msg, &realtime, now);
+	}
+#endif
+	rist_peer_recv_packet(peer, buf, len, msg->msg_name, msg->msg_namelen, now);
+}
+
+static void rist_uring_event(struct evsocket_ctx *evctx, int fd, short revents, void *arg)
+{
+	RIST_MARK_UNUSED(evctx);
+	RIST_MARK_UNUSED(fd);
+	RIST_MARK_UNUSED(revents);
+	struct rist_common_ctx *cctx = arg;
+	rist_uring_recv(cctx->uring, rist_peer_recv_uring);
+}
+#endif
+
+/* Hands the socket of peer to the I/O engine of its context */
+static void rist_peer_recv_register(struct rist_peer *peer)
+{
+	struct rist_common_ctx *cctx = get_cctx(peer);
+#if HAVE_IO_URING
+	if (cctx->uring) {
+		if (!peer->uring_slot && peer->sd >= 0) {
+#if HAVE_UDP_GRO
+			// Coalesced datagrams would not fit the ring buffers
+			rist_udp_gro_set(peer, false);
+#endif
+			rist_uring_add_peer(cctx->uring, peer);
+		}
+		return;
+	}
+#endif
+	if (!peer->event_recv)
+		peer->event_recv = evsocket_addevent(cctx->evctx, peer->sd, EVSOCKET_EV_READ,
+				rist_peer_recv_wrap, rist_peer_sockerr, peer);
+}
+
+static void rist_peer_recv_unregister(struct rist_peer *peer)
+{
+	struct rist_common_ctx *cctx = get_cctx(peer);
+	if (peer->event_recv) {
+		rist_log_priv(cctx, RIST_LOG_INFO, "[CLEANUP] Removing peer data received event\n");
+		evsocket_delevent(cctx->evctx, peer->event_recv);
+		peer->event_recv = NULL;
+	}
+#if HAVE_IO_URING
+	if (peer->uring_slot) {
+		rist_log_priv(cctx, RIST_LOG_INFO, "[CLEANUP] Cancelling peer io_uring receive\n");
+		rist_uring_del_peer(cctx->uring, peer);
+	}
+#endif
+}
+
+int rist_io_engine_set(struct rist_common_ctx *ctx, enum rist_io_engine engine)
+{
+	if (engine == RIST_IO_ENGINE_IO_URING) {
+#if HAVE_IO_URING
+		if (!ctx->uring) {
+			struct rist_uring *ring = rist_uring_create(ctx);
+			if (!ring)
+				return -1;
+			ctx->uring_event = evsocket_addevent(ctx->evctx, rist_uring_fd(ring), EVSOCKET_EV_READ, rist_uring_event, NULL, ctx);
+			if (!ctx->uring_event) {
+				rist_uring_destroy(ring);
+				return -1;
+			}
+			ctx->uring = ring;
+			// Peers created so far read from the event loop
+			for (struct rist_peer *peer = ctx->PEERS; peer; peer = peer->next) {
+				if (!peer->parent && peer->event_recv) {
+					rist_peer_recv_unregister(peer);
+					rist_peer_recv_register(peer);
+				}
+			}
+		}
+		ctx->io_engine = engine;
+		return 0;
+#else
+		rist_log_priv3(RIST_LOG_ERROR, "The io_uring I/O engine is not built in\n");
+		return -1;
+#endif
+	}
+#if HAVE_IO_URING
+	if (ctx->uring) {
+		struct rist_uring *ring = ctx->uring;
+		ctx->uring = NULL;
+		for (struct rist_peer *peer = ctx->PEERS; peer; peer = peer->next) {
+			if (peer->uring_slot) {
+				rist_uring_del_peer(ring, peer);
+#if HAVE_UDP_GRO
+				rist_udp_gro_set(peer, true);
+#endif
+				rist_peer_recv_register(peer);
+			}
+		}
+		evsocket_delevent(ctx->evctx, ctx->uring_event);
+		ctx->uring_event = NULL;
+		rist_uring_destroy(ring);
+	}
+#endif
+	if (evsocket_set_epoll(ctx->evctx, engine != RIST_IO_ENGINE_POLL) != 0 && engine == RIST_IO_ENGINE_EPOLL) {
+		rist_log_priv3(RIST_LOG_ERROR, "The epoll I/O engine is not available\n");
+		return -1;
+	}
+	ctx->io_engine = engine;
+	return 0;
+}
+
+static void rist_io_engine_release(struct rist_common_ctx *ctx)
+{
+#if HAVE_IO_URING
+	if (!ctx->uring)
+		return;
+	evsocket_delevent(ctx->evctx, ctx->uring_event);
+	rist_uring_destroy(ctx->uring);
+	ctx->uring = NULL;
+#else
+	RIST_MARK_UNUSED(ctx);
+#endif
+}
+
+static void rist_peer_recv_packet(struct rist_peer *peer, uint8_t *recv_buf, size_t recv_bufsize, struct sockaddr *addr, socklen_t addrlen, uint64_t now)
+{
+	struct rist_common_ctx *cctx = get_cctx(peer);
+	uint16_t family = peer->address_family;
+	struct rist_peer *p = NULL;
+	uint16_t port = 0;
+	if (addr->sa_family == AF_INET)
+		port = htons(((struct sockaddr_in *)addr)->sin_port);
+	else
+		port = htons(((struct sockaddr_in6 *)addr)->sin6_port);
 
 	struct rist_key *k = &peer->key_rx;
 	uint32_t seq = 0;
@@ -2745,9 +3264,19 @@ protocol_bypass:
 
 	uint32_t rtp_time = 0;
 	uint64_t source_time = 0;
+	bool seq_ext = false;
+	uint16_t seq_msb = 0;
 	if (cctx->profile == RIST_PROFILE_SIMPLE || gre_proto == RIST_GRE_PROTOCOL_TYPE_REDUCED) {
+		if (rtp->payload_type == RTP_PTYPE_FEC && cctx->profile != RIST_PROFILE_SIMPLE) {
+			// Parity from a sender using RIST_OPT_SENDER_FEC
+			flow_id = be32toh(rtp->ssrc);
+			payload_offset += sizeof(*rtp);
+			payload.size = recv_bufsize - payload_offset;
+			payload.data = (void *)&recv_buf[payload_offset];
+			payload.type = RIST_PAYLOAD_TYPE_FEC;
+		}
 		// Finish defining the payload (we assume reduced header)
-		if(rtp->payload_type < 200) {
+		else if(rtp->payload_type < 200) {
 			flow_id = be32toh(rtp->ssrc);
 			// If this is a retry, extract the information and restore correct flow_id
 			if (flow_id & 1UL)
@@ -2767,6 +3296,10 @@ protocol_bypass:
 				{
 					payload.size -= sizeof(*hdr_ext);
 					data_payload += sizeof(*hdr_ext);
+					if (CHECK_BIT(hdr_ext->flags, 6) && cctx->profile != RIST_PROFILE_SIMPLE) {
+						seq_ext = true;
+						seq_msb = be16toh(hdr_ext->seq_ext);
+					}
 					if (CHECK_BIT(hdr_ext->flags, 7))
 						expand_null_packets(data_payload, &payload.size, hdr_ext->npd_bits);
 				}
@@ -2801,6 +3334,7 @@ protocol_bypass:
 					p->adv_peer_id, dead_time / RIST_CLOCK);
 		if (p->peer_data)
 			p->peer_data->dead = 0;
+		rist_paths_invalidate(p);
 	}
 	p->last_pkt_received = now;
 	if (p->flow)
@@ -2866,15 +3400,19 @@ protocol_bypass:
 				source_time = timestampNTP_u64();
 			else
 				source_time = convertRTPtoNTP(rtp->payload_type, time_extension, rtp_time);
-			seq = (uint32_t)be16toh(rtp->seq);
+			seq = ((uint32_t)seq_msb << 16) | be16toh(rtp->seq);
 			if (RIST_UNLIKELY(!p->receiver_mode))
 				rist_log_priv(get_cctx(peer), RIST_LOG_WARN,
 						"Received data packet on sender, ignoring (%d bytes)...\n", payload.size);
 			else {
 				rist_calculate_bitrate((recv_bufsize - payload_offset), &p->bw);//use the unexpanded size to show real BW
-				rist_receiver_recv_data(p, seq, flow_id, source_time, now, &payload, retry, rtp->payload_type);
+				rist_receiver_recv_data(p, seq, seq_ext, flow_id, source_time, now, &payload, retry, rtp->payload_type);
 			}
 			break;
+		case RIST_PAYLOAD_TYPE_FEC:
+			if (p->receiver_mode)
+				rist_receiver_recv_fec(p, now, &payload);
+			break;
 		case RIST_PAYLOAD_TYPE_EAPOL:
 #if HAVE_SRP_SUPPORT
 			if (p->eap_ctx == NULL) {
@@ -3008,23 +3546,30 @@ static void sender_send_nacks(struct rist_sender *ctx)
 	if (ctx->max_nacksperloop == 0)
 		return; // No peers yet
 
-	// Send nack retries. Stop when the retry queue is empty or when the data in the
-	// send fifo queue grows to 10 packets (we do not want to harm real-time data)
+	// Send nack retries, earliest deadline first. Once the data in the send fifo queue grows
+	// to 10 packets only the retries that would miss their deadline by waiting for the next
+	// pass still go out, the others yield to the real-time data.
 	// We also stop on maxcounter (jitter control and max bandwidth protection)
 	size_t queued_items = (atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) - atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire)) &ctx->sender_queue_max;
 	uint64_t start_time = timestampNTP_u64();
-	while (queued_items < 10) {
-		ssize_t ret = rist_retry_dequeue(ctx);
+	uint64_t urgent_limit = start_time + 2 * ctx->common.rist_max_jitter;
+	int throttled = 0;
+	for (;;) {
+		ssize_t ret = rist_retry_dequeue(ctx, queued_items < 10 ? UINT64_MAX : urgent_limit);
 		if (ret == 0) {
 			// ret == 0 is valid (nothing to send)
 			break;
+		} else if (ret == -2) {
+			// Out of tokens for that peer, it is retried on the next pass
+			throttled++;
 		} else if (ret < 0) {
 			errors++;
 		} else {
 			total_bytes += ret;
 			counter++;
 		}
-		if (counter > ctx->max_nacksperloop) {
+		// Deferred pops count too, a throttled peer must not cycle the whole heap every pass
+		if (counter + throttled > ctx->max_nacksperloop) {
 			break;
 		}
 		if (((timestampNTP_u64() - start_time) / RIST_CLOCK) > 100)
@@ -3035,19 +3580,28 @@ static void sender_send_nacks(struct rist_sender *ctx)
 		}
 		queued_items = (atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) - atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire)) & ctx->sender_queue_max;
 	}
+	rist_retry_queue_requeue(ctx);
 	if (ctx->common.debug && 2 * (counter - 1) > ctx->max_nacksperloop)
 	{
 		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
-				"Had to process multiple fifo nacks: c=%d, e=%d, b=%zu, s=%zu, m=%zu\n",
-				counter - 1, errors, total_bytes, rist_get_sender_retry_queue_size(ctx),
+				"Had to process multiple fifo nacks: c=%d, e=%d, t=%d, b=%zu, s=%zu, m=%zu\n",
+				counter - 1, errors, throttled, total_bytes, rist_get_sender_retry_queue_size(ctx),
 				ctx->max_nacksperloop);
 	}
 
 }
 
-static void sender_send_data(struct rist_sender *ctx, int maxcount)
+static inline bool sender_queue_pending(struct rist_sender *ctx)
+{
+	size_t idx = ((size_t)atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_relaxed) + 1)& (ctx->sender_queue_max-1);
+	return idx != (size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire);
+}
+
+/* Returns how many ticks the head of the queue is held back by pacing, 0 if it is not */
+static uint64_t sender_send_data(struct rist_sender *ctx, int maxcount)
 {
 	int counter = 0;
+	uint64_t hold = 0;
 
 	while (1) {
 		// If we fall behind, only empty 100 every 5ms (master loop)
@@ -3057,13 +3611,19 @@ static void sender_send_data(struct rist_sender *ctx, int maxcount)
 
 		size_t idx = ((size_t)atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire) + 1)& (ctx->sender_queue_max-1);
 
-		if (idx == (size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_relaxed)) {
+		if (idx == (size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire)) {
 			//rist_log_priv(&ctx->common, RIST_LOG_ERROR,
 			//    "\t[GOOD] We are all up to date, index is %d\n",
 			//    ctx->sender_queue_read_index);
 			break;
 		}
 
+		if (ctx->pacing && ctx->sender_queue[idx] && ctx->sender_queue[idx]->type != RIST_PAYLOAD_TYPE_RTCP) {
+			hold = rist_pacer_hold(ctx, ctx->sender_queue[idx]->time, timestampNTP_u64());
+			if (hold)
+				break;
+		}
+
 		atomic_store_explicit(&ctx->sender_queue_read_index, idx, memory_order_release);
 		if (RIST_UNLIKELY(ctx->sender_queue[idx] == NULL)) {
 			// This should never happen!
@@ -3084,11 +3644,15 @@ static void sender_send_data(struct rist_sender *ctx, int maxcount)
 			else {
 				rist_sender_send_data_balanced(ctx, buffer);
 				// For non-advanced mode seq to index mapping
-				ctx->seq_index[buffer->seq_rtp] = (uint32_t)idx;
+				ctx->seq_index[buffer->seq_rtp & (ctx->sender_queue_max - 1)] = (uint32_t)idx;
+				ctx->seq_rtp_sent = buffer->seq_rtp;
+				if (ctx->fec)
+					rist_sender_fec_encode(ctx, buffer);
 			}
 		}
 
 	}
+	return hold;
 }
 
 static struct rist_peer *peer_initialize(const char *url, struct rist_sender *sender_ctx,
@@ -3127,11 +3691,26 @@ static struct rist_peer *peer_initialize(const char *url, struct rist_sender *se
 	return p;
 }
 
-static PTHREAD_START_FUNC(receiver_pthread_dataout, arg)
+static void receiver_dataout_init(struct rist_flow *flow)
 {
-	struct rist_flow *flow = (struct rist_flow *)arg;
-	struct rist_receiver *receiver_ctx = (void *)flow->receiver_id;
+	flow->output_target_buffer_ticks = flow->recovery_buffer_ticks;
+	flow->output_next_buffer_adjust = timestampNTP_u64() + ONE_SECOND;
+	flow->output_buffer_adjust_step_time = 0;
+	flow->output_buffer_adjust_step_size = 0;
+	flow->output_buffer_adjust_steps_left = 0;
+}
+
+static int receiver_dataout_jitter_ms(struct rist_flow *flow)
+{
+	// Default max jitter is 5ms
+	int max_output_jitter_ms = flow->max_output_jitter / RIST_CLOCK;
+	if (max_output_jitter_ms > 100)
+		max_output_jitter_ms = 100;
+	return max_output_jitter_ms;
+}
 
+static void receiver_dataout_set_priority(struct rist_receiver *receiver_ctx)
+{
 #ifndef _WIN32
 	int prio_max = sched_get_priority_max(SCHED_RR);
 	struct sched_param param = { 0 };
@@ -3139,24 +3718,82 @@ static PTHREAD_START_FUNC(receiver_pthread_dataout, arg)
 	if (pthread_setschedparam(pthread_self(), SCHED_RR, &param) != 0)
 		rist_log_priv(&receiver_ctx->common, RIST_LOG_WARN, "Failed to set data output thread to RR scheduler with prio of %i\n", prio_max);
 #else
+	(void)receiver_ctx;
 	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
 #endif
-	// Default max jitter is 5ms
-	int max_output_jitter_ms = flow->max_output_jitter / RIST_CLOCK;
-	if (max_output_jitter_ms > 100)
-		max_output_jitter_ms = 100;
+}
+
+/* One output pass for a flow, called with flow->mutex held */
+static void receiver_dataout_run(struct rist_receiver *ctx, struct rist_flow *flow)
+{
+	if (atomic_load_explicit(&flow->receiver_queue_size, memory_order_acquire) > 0) {
+		receiver_output(ctx, flow);
+	}
+
+	if (flow->flow_auto_buffer_scaling) {
+		uint64_t now = timestampNTP_u64();
+		if (flow->output_target_buffer_ticks == flow->recovery_buffer_ticks) {
+			if (now >= flow->output_next_buffer_adjust) {
+				if (flow->currently_scaling_buffer) {
+					flow->currently_scaling_buffer = false;
+					rist_log_priv(&ctx->common, RIST_LOG_INFO, "Done rescaling buffer\n");
+				}
+				flow->output_next_buffer_adjust += ONE_SECOND;
+				uint64_t tmp_target_buffer_size = 0;
+				for (size_t i=0; i < flow->peer_lst_len; i++) {
+					struct rist_peer *p = flow->peer_lst[i];
+					if (p->recovery_buffer_ticks > tmp_target_buffer_size) {
+						tmp_target_buffer_size = p->recovery_buffer_ticks;
+					}
+				}
+
+				uint64_t diff = flow->output_target_buffer_ticks - tmp_target_buffer_size;
+				if (tmp_target_buffer_size > flow->output_target_buffer_ticks)
+					diff = tmp_target_buffer_size - flow->output_target_buffer_ticks;
+
+				if (diff > RIST_CLOCK * 15) {
+					rist_log_priv(&ctx->common, RIST_LOG_INFO, "Adjusting flow buffer time to %"PRIu64"ms\n", tmp_target_buffer_size/ RIST_CLOCK);
+					flow->output_target_buffer_ticks = tmp_target_buffer_size;
+					flow->output_buffer_adjust_step_size = diff / 100;
+					flow->output_buffer_adjust_steps_left = 100;
+					flow->output_buffer_adjust_step_time = flow->output_buffer_adjust_step_size * 8;//Magic factor of 8 to ensure our changes aren't too dramatic
+					if (flow->recovery_buffer_ticks > flow->output_target_buffer_ticks)
+						flow->output_buffer_adjust_step_size *= -1;
+					flow->output_next_buffer_adjust = now + flow->output_buffer_adjust_step_time;
+					if ((flow->output_target_buffer_ticks *2ULL) > flow->session_timeout)
+						flow->session_timeout = 2ULL * flow->output_target_buffer_ticks;
+					flow->currently_scaling_buffer = true;
+				}
+			}
+		} else if (now >= flow->output_next_buffer_adjust) {
+			flow->recovery_buffer_ticks += flow->output_buffer_adjust_step_size;
+			flow->output_buffer_adjust_steps_left--;
+			flow->output_next_buffer_adjust += flow->output_buffer_adjust_step_time;
+			if (flow->output_buffer_adjust_steps_left == 0) {
+				flow->recovery_buffer_ticks = flow->output_target_buffer_ticks;
+				uint64_t next_min = 2 * ONE_SECOND;
+				if (flow->recovery_buffer_ticks *1.5 > next_min)
+					next_min = flow->recovery_buffer_ticks *1.5;
+				flow->output_next_buffer_adjust = now +  2 *ONE_SECOND;// We don't want to adjust to often, so keep 2 seconds between adjustments
+			}
+		}
+	}
+}
+
+static PTHREAD_START_FUNC(receiver_pthread_dataout, arg)
+{
+	struct rist_flow *flow = (struct rist_flow *)arg;
+	struct rist_receiver *receiver_ctx = (void *)flow->receiver_id;
+
+	receiver_dataout_set_priority(receiver_ctx);
+	int max_output_jitter_ms = receiver_dataout_jitter_ms(flow);
 
 	rist_log_priv(&receiver_ctx->common, RIST_LOG_INFO, "Starting data output thread with %d ms max output jitter\n", max_output_jitter_ms);
 
 	pthread_mutex_lock(&(flow->mutex));
-	uint64_t target_recovery_buffer_size = flow->recovery_buffer_ticks;
+	receiver_dataout_init(flow);
 	pthread_mutex_unlock(&(flow->mutex));
 
-	uint64_t next_buffer_adjust_step = timestampNTP_u64() + ONE_SECOND;
-	uint64_t buffer_adjust_step_time = 0;
-	int64_t buffer_adjust_step_size = 0;
-	int buffer_adjust_steps_left = 0;
-
 	while (true) {
 		pthread_mutex_lock(&(flow->mutex));
 		int ret = pthread_cond_timedwait_ms(&flow->condition, &flow->mutex, max_output_jitter_ms);
@@ -3164,67 +3801,261 @@ static PTHREAD_START_FUNC(receiver_pthread_dataout, arg)
 			rist_log_priv(&receiver_ctx->common, RIST_LOG_ERROR, "Error %d in receiver data out loop\n", ret);
 		if (atomic_load_explicit(&flow->shutdown,memory_order_acquire) > 0)
 			break;
-		if (atomic_load_explicit(&flow->receiver_queue_size, memory_order_acquire) > 0) {
-			receiver_output(receiver_ctx, flow);
+		receiver_dataout_run(receiver_ctx, flow);
+		pthread_mutex_unlock(&(flow->mutex));
+	}
+	rist_log_priv(&receiver_ctx->common, RIST_LOG_INFO, "Data output thread shutting down\n");
+	atomic_store_explicit(&flow->shutdown, 2, memory_order_release);
+	pthread_mutex_unlock(&flow->mutex);
+	return 0;
+}
+
+/* Shared dataout pool: the heap is keyed by dataout_due, ties are irrelevant */
+static void dataout_heap_swap(struct rist_dataout_pool *pool, size_t a, size_t b)
+{
+	struct rist_flow *tmp = pool->heap[a];
+	pool->heap[a] = pool->heap[b];
+	pool->heap[b] = tmp;
+	pool->heap[a]->dataout_heap_idx = a;
+	pool->heap[b]->dataout_heap_idx = b;
+}
+
+static void dataout_heap_up(struct rist_dataout_pool *pool, size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (pool->heap[parent]->dataout_due <= pool->heap[i]->dataout_due)
+			break;
+		dataout_heap_swap(pool, i, parent);
+		i = parent;
+	}
+}
+
+static void dataout_heap_down(struct rist_dataout_pool *pool, size_t i)
+{
+	for (;;) {
+		size_t smallest = i;
+		size_t l = 2 * i + 1;
+		size_t r = l + 1;
+		if (l < pool->heap_count && pool->heap[l]->dataout_due < pool->heap[smallest]->dataout_due)
+			smallest = l;
+		if (r < pool->heap_count && pool->heap[r]->dataout_due < pool->heap[smallest]->dataout_due)
+			smallest = r;
+		if (smallest == i)
+			break;
+		dataout_heap_swap(pool, i, smallest);
+		i = smallest;
+	}
+}
+
+static int dataout_heap_push(struct rist_dataout_pool *pool, struct rist_flow *f)
+{
+	if (pool->heap_count == pool->heap_size) {
+		size_t new_size = pool->heap_size ? pool->heap_size * 2 : 16;
+		struct rist_flow **heap = realloc(pool->heap, new_size * sizeof(*heap));
+		if (!heap)
+			return -1;
+		pool->heap = heap;
+		pool->heap_size = new_size;
+	}
+	f->dataout_heap_idx = pool->heap_count;
+	pool->heap[pool->heap_count++] = f;
+	dataout_heap_up(pool, f->dataout_heap_idx);
+	// A new head may be due before the time the idle workers are sleeping for
+	if (f->dataout_heap_idx == 0)
+		pthread_cond_signal(&pool->condition);
+	return 0;
+}
+
+static void dataout_heap_delete(struct rist_dataout_pool *pool, size_t i)
+{
+	pool->heap_count--;
+	if (i != pool->heap_count) {
+		dataout_heap_swap(pool, i, pool->heap_count);
+		dataout_heap_down(pool, i);
+		dataout_heap_up(pool, i);
+	}
+}
+
+/* Next time the flow needs an output pass, called with flow->mutex held */
+static uint64_t receiver_dataout_next_due(struct rist_flow *f, uint64_t now)
+{
+	uint64_t jitter = (uint64_t)receiver_dataout_jitter_ms(f) * RIST_CLOCK;
+	if (atomic_load_explicit(&f->receiver_queue_size, memory_order_acquire) == 0) {
+		// Nothing buffered: park until data arrives, still run the scaling bookkeeping now and then
+		atomic_store(&f->dataout_idle, true);
+		if (atomic_load(&f->receiver_queue_size) == 0)
+			return now + RIST_DATAOUT_POOL_IDLE_TICKS;
+		atomic_store(&f->dataout_idle, false);
+		return now + jitter;
+	}
+	size_t output_idx = atomic_load_explicit(&f->receiver_queue_output_idx, memory_order_acquire);
+	struct rist_buffer *b = f->receiver_queue[output_idx];
+	if (!b)
+		return now + jitter;
+	// The head is the next packet in order, nothing can be output before it is due
+	uint64_t flow_now = f->rtc_timing_mode ? timestampNTP_RTC_u64() : now;
+	if (b->target_output_time <= flow_now)
+		return now;
+	uint64_t wait = b->target_output_time - flow_now;
+	if (wait > RIST_DATAOUT_POOL_IDLE_TICKS)
+		wait = RIST_DATAOUT_POOL_IDLE_TICKS;
+	return now + wait;
+}
+
+static PTHREAD_START_FUNC(receiver_pthread_dataout_pool, arg)
+{
+	struct rist_receiver *ctx = (struct rist_receiver *)arg;
+	struct rist_dataout_pool *pool = ctx->dataout_pool;
+
+	receiver_dataout_set_priority(ctx);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->shutdown) {
+		if (pool->heap_count == 0) {
+			pthread_cond_wait(&pool->condition, &pool->mutex);
+			continue;
+		}
+		struct rist_flow *f = pool->heap[0];
+		uint64_t now = timestampNTP_u64();
+		if (f->dataout_due > now) {
+			uint32_t wait_ms = (uint32_t)((f->dataout_due - now + RIST_CLOCK - 1) / RIST_CLOCK);
+			pthread_cond_timedwait_ms(&pool->condition, &pool->mutex, wait_ms);
+			continue;
 		}
+		dataout_heap_delete(pool, 0);
+		f->dataout_busy = true;
+		// More flows may be due, let another worker pick them up
+		if (pool->heap_count > 0)
+			pthread_cond_signal(&pool->condition);
+		pthread_mutex_unlock(&pool->mutex);
 
-		if (flow->flow_auto_buffer_scaling) {
-			uint64_t now = timestampNTP_u64();
-			if (target_recovery_buffer_size == flow->recovery_buffer_ticks) {
-				if (now >= next_buffer_adjust_step) {
-					if (flow->currently_scaling_buffer) {
-						flow->currently_scaling_buffer = false;
-						rist_log_priv(&receiver_ctx->common, RIST_LOG_INFO, "Done rescaling buffer\n");
-					}
-					next_buffer_adjust_step += ONE_SECOND;
-					uint64_t tmp_target_buffer_size = 0;
-					for (size_t i=0; i < flow->peer_lst_len; i++) {
-						struct rist_peer *p = flow->peer_lst[i];
-						if (p->recovery_buffer_ticks > tmp_target_buffer_size) {
-							tmp_target_buffer_size = p->recovery_buffer_ticks;
-						}
-					}
+		pthread_mutex_lock(&f->mutex);
+		uint64_t due = 0;
+		if (atomic_load_explicit(&f->shutdown, memory_order_acquire) == 0) {
+			receiver_dataout_run(ctx, f);
+			due = receiver_dataout_next_due(f, timestampNTP_u64());
+		}
+		pthread_mutex_unlock(&f->mutex);
 
-					uint64_t diff = target_recovery_buffer_size - tmp_target_buffer_size;
-					if (tmp_target_buffer_size > target_recovery_buffer_size)
-						diff = tmp_target_buffer_size - target_recovery_buffer_size;
-
-					if (diff > RIST_CLOCK * 15) {
-						rist_log_priv(&receiver_ctx->common, RIST_LOG_INFO, "Adjusting flow buffer time to %"PRIu64"ms\n", tmp_target_buffer_size/ RIST_CLOCK);
-						target_recovery_buffer_size = tmp_target_buffer_size;
-						buffer_adjust_step_size = diff / 100;
-						buffer_adjust_steps_left = 100;
-						buffer_adjust_step_time = buffer_adjust_step_size * 8;//Magic factor of 8 to ensure our changes aren't too dramatic
-						if (flow->recovery_buffer_ticks > target_recovery_buffer_size)
-							buffer_adjust_step_size *= -1;
-						next_buffer_adjust_step = now + buffer_adjust_step_time;
-						if ((target_recovery_buffer_size *2ULL) > flow->session_timeout)
-							flow->session_timeout = 2ULL * target_recovery_buffer_size;
-						flow->currently_scaling_buffer = true;
-					}
-				}
-			} else if (now >= next_buffer_adjust_step) {
-				flow->recovery_buffer_ticks += buffer_adjust_step_size;
-				buffer_adjust_steps_left--;
-				next_buffer_adjust_step += buffer_adjust_step_time;
-				if (buffer_adjust_steps_left == 0) {
-					flow->recovery_buffer_ticks = target_recovery_buffer_size;
-					uint64_t next_min = 2 * ONE_SECOND;
-					if (flow->recovery_buffer_ticks *1.5 > next_min)
-						next_min = flow->recovery_buffer_ticks *1.5;
-					next_buffer_adjust_step = now +  2 *ONE_SECOND;// We don't want to adjust to often, so keep 2 seconds between adjustments
-				}
-			}
+		pthread_mutex_lock(&pool->mutex);
+		f->dataout_busy = false;
+		if (f->dataout_removed || due == 0) {
+			pthread_cond_broadcast(&pool->done);
+			continue;
+		}
+		if (f->dataout_wakeup) {
+			f->dataout_wakeup = false;
+			due = timestampNTP_u64();
 		}
+		f->dataout_due = due;
+		if (dataout_heap_push(pool, f) != 0)
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not reschedule flow %"PRIu32" output, OOM\n", f->flow_id);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
 
-		pthread_mutex_unlock(&(flow->mutex));
+/* Schedule a flow on the shared pool, called once when the flow gets authenticated */
+static int rist_dataout_pool_add(struct rist_receiver *ctx, struct rist_flow *f)
+{
+	struct rist_dataout_pool *pool = ctx->dataout_pool;
+	receiver_dataout_init(f);
+	pthread_mutex_lock(&pool->mutex);
+	f->dataout_due = timestampNTP_u64();
+	int ret = dataout_heap_push(pool, f);
+	if (ret == 0)
+		f->dataout_pooled = true;
+	pthread_mutex_unlock(&pool->mutex);
+	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Flow %"PRIu32" output scheduled on the shared %zu thread pool\n",
+		f->flow_id, pool->thread_count);
+	return ret;
+}
+
+/* Pull a parked flow forward when data arrives for it */
+static void rist_dataout_pool_wake(struct rist_receiver *ctx, struct rist_flow *f)
+{
+	if (!atomic_exchange(&f->dataout_idle, false))
+		return;
+	struct rist_dataout_pool *pool = ctx->dataout_pool;
+	pthread_mutex_lock(&pool->mutex);
+	if (f->dataout_busy) {
+		f->dataout_wakeup = true;
+	} else if (f->dataout_pooled && !f->dataout_removed) {
+		f->dataout_due = timestampNTP_u64();
+		dataout_heap_up(pool, f->dataout_heap_idx);
+		if (f->dataout_heap_idx == 0)
+			pthread_cond_signal(&pool->condition);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void rist_dataout_pool_remove(struct rist_receiver *ctx, struct rist_flow *f)
+{
+	struct rist_dataout_pool *pool = ctx->dataout_pool;
+	if (!pool || !f->dataout_pooled)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	f->dataout_removed = true;
+	while (f->dataout_busy)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	if (f->dataout_heap_idx < pool->heap_count && pool->heap[f->dataout_heap_idx] == f)
+		dataout_heap_delete(pool, f->dataout_heap_idx);
+	f->dataout_pooled = false;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+int rist_dataout_pool_create(struct rist_receiver *ctx)
+{
+	if (ctx->dataout_pool_size == 0)
+		return 0;
+	struct rist_dataout_pool *pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return -1;
+	pool->threads = calloc(ctx->dataout_pool_size, sizeof(*pool->threads));
+	if (!pool->threads) {
+		free(pool);
+		return -1;
 	}
-	rist_log_priv(&receiver_ctx->common, RIST_LOG_INFO, "Data output thread shutting down\n");
-	atomic_store_explicit(&flow->shutdown, 2, memory_order_release);
-	pthread_mutex_unlock(&flow->mutex);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->condition, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	ctx->dataout_pool = pool;
+	for (uint32_t i = 0; i < ctx->dataout_pool_size; i++) {
+		if (rist_thread_create(&ctx->common, &pool->threads[i], NULL, receiver_pthread_dataout_pool, (void *)ctx) != 0) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create data output pool thread %"PRIu32"\n", i);
+			break;
+		}
+		pool->thread_count++;
+	}
+	if (pool->thread_count == 0) {
+		rist_dataout_pool_destroy(ctx);
+		return -1;
+	}
+	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Started %zu shared data output threads\n", pool->thread_count);
 	return 0;
 }
 
+void rist_dataout_pool_destroy(struct rist_receiver *ctx)
+{
+	struct rist_dataout_pool *pool = ctx->dataout_pool;
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->condition);
+	pthread_mutex_unlock(&pool->mutex);
+	for (size_t i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->condition);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->heap);
+	free(pool->threads);
+	free(pool);
+	ctx->dataout_pool = NULL;
+}
+
 static void rist_peer_periodic(struct rist_peer *p, uint64_t now) {
 	if (p->send_keepalive) {
 		if (now > p->next_periodic_rtcp) {
@@ -3262,6 +4093,52 @@ static void sender_peer_events(struct rist_sender *ctx, uint64_t now)
 	pthread_mutex_unlock(&ctx->common.peerlist_lock);
 }
 
+static PTHREAD_START_FUNC(sender_pthread_kdf, arg)
+{
+	struct rist_sender *ctx = (struct rist_sender *)arg;
+	_librist_crypto_psk_kdf_run(&ctx->common.kdf);
+	return 0;
+}
+
+/* Key rotation queues the derivation of the next key, start the helper thread the first time */
+static void sender_kdf_thread_check(struct rist_sender *ctx)
+{
+	if (ctx->kdf_thread_running || !_librist_crypto_psk_kdf_queued(&ctx->common.kdf))
+		return;
+	if (rist_thread_create(&ctx->common, &ctx->kdf_thread, NULL, sender_pthread_kdf, (void *)ctx) != 0) {
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create key derivation thread, keys will be derived inline\n");
+		return;
+	}
+	ctx->kdf_thread_running = true;
+}
+
+/* Tops up the precomputed keystream of every encrypting peer for the GRE sequence numbers it
+ * will send next, run from the protocol loop while the input ring is empty. Mirrors the key
+ * selection in _librist_proto_gre_send_data. */
+static void sender_keystream_fill(struct rist_sender *ctx)
+{
+	pthread_mutex_lock(&ctx->common.peerlist_lock);
+	for (size_t j = 0; j < ctx->peer_lst_len; j++) {
+		struct rist_peer *p = ctx->peer_lst[j];
+		if (p->dead || p->key_tx.key_size == 0)
+			continue;
+		struct rist_peer *key_peer = p;
+		if (key_peer->parent != NULL && key_peer->parent->multicast_sender)
+			key_peer = key_peer->parent;
+		pthread_mutex_lock(&key_peer->peer_lock);
+		struct rist_key *key = key_peer->key_tx_odd_active ? &p->key_tx_odd : &key_peer->key_tx;
+		if (!key->keystream && _librist_crypto_psk_keystream_enable(key, ctx->keystream_depth) != 0) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not allocate precomputed keystream, disabling it\n");
+			ctx->keystream_depth = 0;
+		} else {
+			_librist_crypto_psk_keystream_fill(key, key_peer->seq, p->rist_gre_version);
+		}
+		pthread_mutex_unlock(&key_peer->peer_lock);
+		if (ctx->keystream_depth == 0)
+			break;
+	}
+	pthread_mutex_unlock(&ctx->common.peerlist_lock);
+}
 
 static void receiver_peer_events(struct rist_receiver *ctx, uint64_t now)
 {
@@ -3325,10 +4202,24 @@ PTHREAD_START_FUNC(sender_pthread_protocol, arg)
 	ctx->stats_next_time = now;
 	ctx->checks_next_time = now;
 	uint64_t nacks_next_time = now;
+	uint64_t pacing_hold = 0;
 	while(!atomic_load_explicit(&ctx->common.shutdown, memory_order_acquire)) {
-		// Conditional 5ms sleep that is woken by data coming in
+		// Conditional 5ms sleep that is woken by data coming in. Writers only signal
+		// while we are parked, so do not sleep when the input ring already has data,
+		// unless pacing holds it back, then sleep until it is due.
+		uint32_t wait_ms = max_jitter_ms;
+		if (pacing_hold) {
+			uint64_t hold_ms = (pacing_hold + RIST_CLOCK - 1) / RIST_CLOCK;
+			if (hold_ms < wait_ms)
+				wait_ms = (uint32_t)hold_ms;
+		}
 		pthread_mutex_lock(&(ctx->mutex));
-		int ret = pthread_cond_timedwait_ms(&(ctx->condition), &(ctx->mutex), max_jitter_ms);
+		int ret = 0;
+		atomic_store_explicit(&ctx->sender_thread_parked, true, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (pacing_hold || !sender_queue_pending(ctx) || !atomic_load_explicit(&ctx->common.startup_complete, memory_order_acquire))
+			ret = pthread_cond_timedwait_ms(&(ctx->condition), &(ctx->mutex), wait_ms);
+		atomic_store_explicit(&ctx->sender_thread_parked, false, memory_order_relaxed);
 		if (RIST_UNLIKELY(!atomic_load_explicit(&ctx->common.startup_complete, memory_order_acquire))) {
 			pthread_mutex_unlock(&(ctx->mutex));
 			continue;
@@ -3346,6 +4237,7 @@ PTHREAD_START_FUNC(sender_pthread_protocol, arg)
 			pthread_mutex_lock(&ctx->common.peerlist_lock);
 			rist_timeout_check(&ctx->common, now);
 			pthread_mutex_unlock(&ctx->common.peerlist_lock);
+			rist_buffer_pool_trim(&ctx->common);
 		}
 
 		// stats timer
@@ -3367,6 +4259,10 @@ PTHREAD_START_FUNC(sender_pthread_protocol, arg)
 
 		// socket polls (returns as fast as possible and processes the next 100 socket events)
 		pthread_mutex_lock(&ctx->common.peerlist_lock);
+#if HAVE_IO_URING
+		if (ctx->common.uring)
+			rist_uring_submit(ctx->common.uring);
+#endif
 		evsocket_loop_single(ctx->common.evctx, 0, 100);
 		pthread_mutex_unlock(&ctx->common.peerlist_lock);
 
@@ -3374,25 +4270,40 @@ PTHREAD_START_FUNC(sender_pthread_protocol, arg)
 		sender_peer_events(ctx, now);
 
 
+		// Follow the packet rate with the ring sizes
+		rist_sender_queue_size_check(ctx, now);
+
 		// Send data and process nacks
-		pthread_mutex_lock(&ctx->queue_lock);
-		if (ctx->sender_queue_bytesize > 0) {
+		pacing_hold = 0;
+		if (atomic_load_explicit(&ctx->sender_queue_bytesize, memory_order_relaxed) > 0) {
 			pthread_mutex_lock(&ctx->common.peerlist_lock);
-			sender_send_data(ctx, max_dataperloop);
+#if HAVE_SENDMMSG
+			rist_send_batch_begin(ctx);
+#endif
+			pacing_hold = sender_send_data(ctx, max_dataperloop);
+#if HAVE_SENDMMSG
+			rist_send_batch_flush(ctx);
+#endif
 			pthread_mutex_unlock(&ctx->common.peerlist_lock);
 			// Group nacks and send them all at rist_max_jitter intervals
 			if (now > nacks_next_time) {
 				sender_send_nacks(ctx);
 				nacks_next_time += ctx->common.rist_max_jitter;
 			}
+#if HAVE_SENDMMSG
+			rist_send_batch_end(ctx);
+#endif
 			/* perform queue cleanup */
 			rist_clean_sender_enqueue(ctx);
 		}
-		pthread_mutex_unlock(&ctx->queue_lock);
 		// Send oob data
 		if (ctx->common.oob_queue_bytesize > 0)
 			rist_oob_dequeue(&ctx->common, max_oobperloop);
 
+		// Use the idle time before parking to get ahead on encryption
+		if (ctx->keystream_depth > 0 && !sender_queue_pending(ctx))
+			sender_keystream_fill(ctx);
+		sender_kdf_thread_check(ctx);
 	}
 
 #ifdef _WIN32
@@ -3447,6 +4358,10 @@ int init_common_ctx(struct rist_common_ctx *ctx, enum rist_profile profile)
 		rist_log_priv3( RIST_LOG_ERROR, "Failed to init ctx->stats_lock\n");
 		return -1;
 	}
+	if (_librist_crypto_psk_kdf_init(&ctx->kdf) != 0) {
+		rist_log_priv3( RIST_LOG_ERROR, "Failed to init ctx->kdf\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -3533,6 +4448,7 @@ int rist_peer_remove(struct rist_common_ctx *ctx, struct rist_peer *peer, struct
 		check = check->next;
 	}
 	if (peer->parent) {
+		_librist_peer_hash_remove(peer);
 		peer_remove_child(peer);
 		if (peer->parent->child == NULL) {
 			peer->parent->authenticated = false;
@@ -3541,6 +4457,7 @@ int rist_peer_remove(struct rist_common_ctx *ctx, struct rist_peer *peer, struct
 		}
 	}
 	peer_remove_linked_list(peer);
+	rist_paths_invalidate(peer);
 
 	if (peer->parent && peer->flow && peer->flow->peer_lst_len > 0 && peer->flow->peer_lst != NULL) {
 		remove_peer_from_flow(peer);
@@ -3595,12 +4512,8 @@ int rist_peer_remove(struct rist_common_ctx *ctx, struct rist_peer *peer, struct
 
 
 	/* data receive event */
-	if (!peer->parent && peer->event_recv)
-	{
-		rist_log_priv2(ctx->logging_settings, RIST_LOG_INFO, "[CLEANUP] Removing peer data received event\n");
-		struct evsocket_ctx *evctx = ctx->evctx;
-		evsocket_delevent(evctx, peer->event_recv);
-	}
+	if (!peer->parent)
+		rist_peer_recv_unregister(peer);
 
 	/* rtcp timer */
 	if (peer->send_keepalive)
@@ -3625,6 +4538,7 @@ int rist_peer_remove(struct rist_common_ctx *ctx, struct rist_peer *peer, struct
 #endif
 	if (peer->url)
 		free(peer->url);
+	free(peer->shard_config);
 
 	if (peer->parent != NULL && ctx->auth.disconn_cb) {
 		ctx->auth.disconn_cb(ctx->auth.arg, peer);
@@ -3699,6 +4613,8 @@ static void store_peer_settings(const struct rist_peer_config *settings, struct
 	peer->config.weight = settings->weight;
 	peer->config.timing_mode = settings->timing_mode;
 	peer->config.virt_dst_port = settings->virt_dst_port;
+	if (settings->version >= 1)
+		peer->config.pacing_mode = settings->pacing_mode;
 
 	init_peer_settings(peer);
 }
@@ -3733,6 +4649,10 @@ struct rist_peer *rist_sender_peer_insert_local(struct rist_sender *ctx,
 	newpeer->is_rtcp = b_rtcp;
 	newpeer->adv_peer_id = ++ctx->common.peer_counter;
 	newpeer->peer_ssrc = newpeer->adv_flow_id = ctx->adv_flow_id;
+	if (!b_rtcp && newpeer->config.pacing_mode != RIST_PACING_MODE_OFF) {
+		rist_pacer_init(newpeer);
+		ctx->pacing = true;
+	}
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Advertising flow_id  %" PRIu64 " and peer_id %u, %u/%u\n",
 			newpeer->adv_flow_id, newpeer->adv_peer_id, newpeer->local_port, newpeer->remote_port);
@@ -3777,6 +4697,7 @@ void rist_receiver_destroy_local(struct rist_receiver *ctx)
 		f = nextflow;
 	}
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Flows cleanup complete\n");
+	rist_dataout_pool_destroy(ctx);
 
 	// Destroy all peers
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Starting Peers cleanup\n");
@@ -3793,17 +4714,13 @@ void rist_receiver_destroy_local(struct rist_receiver *ctx)
 	pthread_mutex_unlock(&ctx->common.peerlist_lock);
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Freeing main data buffers\n");
-	struct rist_buffer *b = ctx->common.rist_free_buffer;
-	struct rist_buffer *next_buf;
-	while (b) {
-		next_buf = b->next_free;
-		free_rist_buffer(&ctx->common, b);
-		b = next_buf;
-	}
+	rist_buffer_pool_destroy(&ctx->common);
+	rist_io_engine_release(&ctx->common);
 	evsocket_destroy(ctx->common.evctx);
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Removing peerlist_lock\n");
 	pthread_mutex_destroy(&ctx->common.peerlist_lock);
+	_librist_crypto_psk_kdf_destroy(&ctx->common.kdf);
 	if (ctx->common.oob_data_enabled) {
 		rist_log_priv(&ctx->common, RIST_LOG_INFO, "Freeing oob fifo queue\n");
 		rist_empty_oob_queue(&ctx->common);
@@ -3831,14 +4748,13 @@ void _librist_receiver_buffer_calc(struct rist_receiver *ctx) {
 			double modifier = 1.0;
 
 			//Modify our buffersize based on some magic numbers, these likely still need tuning
-			pthread_mutex_lock(&p->flow->mutex);
-			modifier += p->flow->stats_instant.lost * 0.05;//5% extra per packet lost
-			if (p->flow->stats_instant.lost > 25)
+			unsigned long lost = RIST_FLOW_COUNT_GET(p->flow, lost);
+			modifier += lost * 0.05;//5% extra per packet lost
+			if (lost > 25)
 				has_high_loss = true;
 
-			modifier += p->flow->stats_instant.recovered_morenack * 0.02;
-			modifier += p->flow->stats_instant.recovered_3nack * 0.01;
-			pthread_mutex_unlock(&p->flow->mutex);
+			modifier += RIST_FLOW_COUNT_GET(p->flow, recovered_morenack) * 0.02;
+			modifier += RIST_FLOW_COUNT_GET(p->flow, recovered_3nack) * 0.01;
 
 			desired_buffer_level *= modifier;
 
@@ -3963,6 +4879,10 @@ PTHREAD_START_FUNC(receiver_pthread_protocol, arg)
 
 		// socket polls (returns in max_jitter_ms max and processes the next 100 socket events)
 		pthread_mutex_lock(&ctx->common.peerlist_lock);
+#if HAVE_IO_URING
+		if (ctx->common.uring)
+			rist_uring_submit(ctx->common.uring);
+#endif
 		evsocket_loop_single(ctx->common.evctx, max_jitter_ms, 100);
 		pthread_mutex_unlock(&ctx->common.peerlist_lock);
 		// keepalive timer
@@ -3985,6 +4905,7 @@ PTHREAD_START_FUNC(receiver_pthread_protocol, arg)
 			pthread_mutex_lock(&ctx->common.peerlist_lock);
 			rist_timeout_check(&ctx->common, now);
 			pthread_mutex_unlock(&ctx->common.peerlist_lock);
+			rist_receiver_queue_size_check(ctx, now);
 		}
 		// Send oob data
 		if (ctx->common.oob_queue_bytesize > 0)
@@ -3992,6 +4913,7 @@ PTHREAD_START_FUNC(receiver_pthread_protocol, arg)
 
 		if (now >= buffer_check_next_time) {
 			_librist_receiver_buffer_calc(ctx);
+			rist_buffer_pool_trim(&ctx->common);
 			buffer_check_next_time += 2 * ONE_SECOND;
 		}
 
@@ -4007,6 +4929,11 @@ PTHREAD_START_FUNC(receiver_pthread_protocol, arg)
 
 void rist_sender_destroy_local(struct rist_sender *ctx)
 {
+	if (ctx->kdf_thread_running) {
+		_librist_crypto_psk_kdf_stop(&ctx->common.kdf);
+		pthread_join(ctx->kdf_thread, NULL);
+		ctx->kdf_thread_running = false;
+	}
 	rist_log_priv(&ctx->common, RIST_LOG_INFO,
 			"Starting peers cleanup, count %d\n",
 			(unsigned) ctx->peer_lst_len);
@@ -4023,10 +4950,12 @@ void rist_sender_destroy_local(struct rist_sender *ctx)
 		rist_peer_remove(&ctx->common, peer, &next);
 		peer = next;
 	}
+	rist_io_engine_release(&ctx->common);
 	evsocket_destroy(ctx->common.evctx);
 
 	pthread_mutex_unlock(&ctx->common.peerlist_lock);
 	pthread_mutex_destroy(&ctx->common.peerlist_lock);
+	_librist_crypto_psk_kdf_destroy(&ctx->common.kdf);
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Peers cleanup complete\n");
 
 	if (ctx->common.oob_data_enabled) {
@@ -4038,25 +4967,35 @@ void rist_sender_destroy_local(struct rist_sender *ctx)
 
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Freeing up context memory allocations\n");
 	free(ctx->sender_retry_queue);
+	free(ctx->retry_pending.entries);
+	rist_paths_free(&ctx->paths);
 	struct rist_buffer *b = NULL;
+	size_t delete_index = atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed);
 	while(1) {
-		b = ctx->sender_queue[ctx->sender_queue_delete_index];
+		b = ctx->sender_queue[delete_index];
 		while (!b) {
-			ctx->sender_queue_delete_index = (ctx->sender_queue_delete_index + 1)& (ctx->sender_queue_max -1);
-			b = ctx->sender_queue[ctx->sender_queue_delete_index];
-			if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_relaxed) == ctx->sender_queue_delete_index)
+			delete_index = (delete_index + 1)& (ctx->sender_queue_max -1);
+			b = ctx->sender_queue[delete_index];
+			if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_relaxed) == delete_index)
 				break;
 		}
 		if (b) {
-			ctx->sender_queue_bytesize -= b->size;
+			atomic_fetch_sub_explicit(&ctx->sender_queue_bytesize, b->size, memory_order_relaxed);
 			free_rist_buffer(&ctx->common, b);
-			ctx->sender_queue[ctx->sender_queue_delete_index] = NULL;
+			ctx->sender_queue[delete_index] = NULL;
 		}
-		if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) == ctx->sender_queue_delete_index) {
+		if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) == delete_index) {
 			break;
 		}
-		ctx->sender_queue_delete_index = (ctx->sender_queue_delete_index + 1)& (ctx->sender_queue_max -1);
-	}
+		delete_index = (delete_index + 1)& (ctx->sender_queue_max -1);
+	}
+	free(ctx->sender_queue);
+	free(ctx->seq_index);
+	rist_fec_encoder_destroy(ctx->fec);
+	rist_buffer_pool_destroy(&ctx->common);
+#if HAVE_SENDMMSG
+	free(ctx->send_batch);
+#endif
 	free(ctx);
 	ctx = NULL;
 }
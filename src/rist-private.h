@@ -34,15 +34,53 @@
 #undef RIST_DEPRECATED
 
 #define UINT16_SIZE (UINT16_MAX + 1)
-// These 4 control the memory footprint and buffer capacity of the lib
+// These control the memory footprint and buffer capacity of the lib
 // They MUST be a power of two or wrap-around index calculations will break
+// Sender/receiver packet rings are sized at runtime, RIST_SERVER_QUEUE_BUFFERS is their upper bound
 #define RIST_SERVER_QUEUE_BUFFERS ((UINT16_SIZE) * 8)
-#define RIST_RETRY_QUEUE_BUFFERS ((UINT16_SIZE) * 4)
+#define RIST_QUEUE_BUFFERS_MIN (1024)
+#define RIST_SENDER_QUEUE_BUFFERS_INITIAL (16384)
 #define RIST_OOB_QUEUE_BUFFERS ((UINT16_SIZE) * 2)
 #define RIST_DATAOUT_QUEUE_BUFFERS (1024)
 // This will restrict the use of the library to the configured maximum packet size
 #define RIST_MAX_PACKET_SIZE (10000)
+// Packet size assumed when converting a configured bitrate into a packet rate for ring sizing
+#define RIST_QUEUE_PACKET_SIZE_ESTIMATE (1316)
 #define RIST_RTT_MIN (3)
+// Recycled rist_buffer pool, payload size classes and per class memory budget
+#define RIST_BUFFER_POOL_CLASSES (3)
+#define RIST_BUFFER_POOL_CLASS_SMALL (256)
+#define RIST_BUFFER_POOL_CLASS_MEDIUM (1500)
+#define RIST_BUFFER_POOL_CLASS_LARGE (RIST_MAX_PACKET_SIZE)
+#define RIST_BUFFER_POOL_MAX_BYTES (8 * 1024 * 1024)
+// Free list of structs whose payload went to the application, after the class lists
+#define RIST_BUFFER_POOL_BARE (RIST_BUFFER_POOL_CLASSES)
+#define RIST_BUFFER_POOL_LISTS (RIST_BUFFER_POOL_CLASSES + 1)
+// Max datagrams pulled from a socket per recvmmsg call
+#define RIST_RECV_BATCH_SIZE (32)
+#if HAVE_SO_TIMESTAMPING
+// Room for struct scm_timestamping, SO_TIMESTAMPNS needs less
+#define RIST_RX_TIMESTAMP_CMSG_SIZE CMSG_SPACE(3 * sizeof(struct timespec))
+#else
+#define RIST_RX_TIMESTAMP_CMSG_SIZE 0
+#endif
+#if HAVE_UDP_GRO
+// Largest datagram UDP GRO coalesces, read into the batch buffer split in slots of this size
+#define RIST_RECV_GRO_SIZE (65535)
+#define RIST_RECV_GRO_BATCH_SIZE (RIST_RECV_BATCH_SIZE * RIST_MAX_PACKET_SIZE / RIST_RECV_GRO_SIZE)
+#define RIST_RECV_GRO_CMSG_SIZE CMSG_SPACE(sizeof(int))
+#else
+#define RIST_RECV_GRO_CMSG_SIZE 0
+#endif
+#define RIST_RECV_CMSG_SIZE (RIST_RX_TIMESTAMP_CMSG_SIZE + RIST_RECV_GRO_CMSG_SIZE)
+// Max datagrams staged by the sender thread before a sendmmsg flush, 48 1316 byte TS payloads
+// fill one UDP GSO message
+#define RIST_SEND_BATCH_SIZE (48)
+#define RIST_SEND_BATCH_SLOT_SIZE (RIST_MAX_PACKET_SIZE + RIST_MAX_HEADER_SIZE)
+#if HAVE_UDP_SEGMENT
+// Largest UDP payload a GSO message may carry in total
+#define RIST_SEND_GSO_MAX_BYTES (65000)
+#endif
 
 /* nack requests are sent every time a data packet is received. */
 /* this timer will be triggered to ensure we output nacks even when there is no data coming in */
@@ -86,7 +124,7 @@ struct rist_buffer {
 	uint64_t source_time;
 	int8_t use_seq;
 	uint32_t seq;
-	uint16_t seq_rtp;
+	uint32_t seq_rtp;
 
 	uint64_t time;//Time we received the packet
 	uint64_t packet_time;//Timestamp based on the RTP time of the packet
@@ -111,7 +149,32 @@ struct rist_missing_buffer {
 	uint64_t insertion_time;
 	uint32_t nack_count;
 	struct rist_peer *peer;
-	struct rist_missing_buffer *next;
+};
+
+/* Initial number of missing entries preallocated per flow, grows by doubling */
+#define RIST_MISSING_QUEUE_INITIAL (1024)
+/* Longest a flow scheduled on the shared dataout pool sleeps between output passes */
+#define RIST_DATAOUT_POOL_IDLE_TICKS (100 * RIST_CLOCK)
+/* Flow lookup by flow_id, fixed bucket count (power of two) */
+#define RIST_FLOW_HASH_BUCKETS (256)
+/* Initial bucket count of the listener child peer index, doubles as peers connect */
+#define RIST_PEER_HASH_INITIAL (64)
+/* Upper bound of RIST_OPT_RECEIVER_SHARDS */
+#define RIST_RECEIVER_SHARDS_MAX (64)
+
+/*
+ * Missing packets waiting for retransmission. entries[0..heap_count) is a
+ * min-heap on next_nack, entries[heap_count..count) holds entries popped
+ * during the current nack pass that still have to be re-inserted.
+ * seq_bitmap has one bit per receiver_queue slot, set while that seq is queued.
+ */
+struct rist_missing_queue {
+	struct rist_missing_buffer *entries;
+	size_t count;
+	size_t heap_count;
+	size_t size;
+	uint64_t *seq_bitmap;
+	size_t seq_bitmap_bits;
 };
 
 struct rist_bandwidth_estimation {
@@ -131,8 +194,8 @@ struct rist_peer_flow_stats {
 	uint32_t dupe;
 	uint32_t dropped_full;
 	uint32_t dropped_late;
-	size_t buffer_duration_count;
-	uint32_t buffer_duration[2048];
+	uint64_t buffer_duration_sum;
+	uint32_t buffer_duration_count;
 
 	uint32_t missing;
 	uint32_t retries;
@@ -140,6 +203,7 @@ struct rist_peer_flow_stats {
 	uint32_t reordered;
 	uint32_t dups;
 	uint32_t recovered_0nack;
+	uint32_t recovered_fec;
 	uint32_t recovered_1nack;
 	uint32_t recovered_2nack;
 	uint32_t recovered_3nack;
@@ -157,6 +221,37 @@ struct rist_peer_flow_stats {
 	uint64_t total_ips;
 };
 
+/* Per-flow counters bumped from the packet path (protocol and output threads)
+ * with relaxed atomics. rist_flow_counters_drain() moves them into stats_instant
+ * when the stats report runs, so the data path never takes stats_lock. */
+struct rist_flow_counters {
+	atomic_ulong lost;
+	atomic_ulong received;
+	atomic_ulong dupe;
+	atomic_ulong dropped_full;
+	atomic_ulong dropped_late;
+	atomic_ulong buffer_duration_sum;
+	atomic_ulong buffer_duration_count;
+	atomic_ulong missing;
+	atomic_ulong retries;
+	atomic_ulong recovered;
+	atomic_ulong reordered;
+	atomic_ulong recovered_0nack;
+	atomic_ulong recovered_fec;
+	atomic_ulong recovered_1nack;
+	atomic_ulong recovered_2nack;
+	atomic_ulong recovered_3nack;
+	atomic_ulong recovered_morenack;
+	atomic_ulong recovered_sum;
+};
+
+#define RIST_FLOW_COUNT_ADD(f, counter, n) \
+	atomic_fetch_add_explicit(&(f)->counters.counter, (n), memory_order_relaxed)
+#define RIST_FLOW_COUNT_SUB(f, counter, n) \
+	atomic_fetch_sub_explicit(&(f)->counters.counter, (n), memory_order_relaxed)
+#define RIST_FLOW_COUNT_GET(f, counter) \
+	atomic_load_explicit(&(f)->counters.counter, memory_order_relaxed)
+
 struct rist_peer_sender_stats {
 	uint64_t sent;
 	uint32_t received;
@@ -181,7 +276,7 @@ struct rist_flow {
 	atomic_int shutdown;
 	int max_output_jitter;
 
-	struct rist_buffer *receiver_queue[RIST_SERVER_QUEUE_BUFFERS]; /* output queue */
+	struct rist_buffer **receiver_queue; /* output queue, receiver_queue_max slots */
 
 	pthread_rwlock_t queue_lock;
 
@@ -193,13 +288,18 @@ struct rist_flow {
 	uint64_t stats_report_time; 	   /* in ticks */
 	atomic_ulong receiver_queue_output_idx;  /* next packet to output */
 	size_t receiver_queue_max;
+	/* Packet rate sampling used to size receiver_queue */
+	uint32_t queue_check_seq;
+	uint64_t queue_check_time;
 	bool flag_flow_buffer_start;
 
 	/* Missing incoming packets, waiting for retransmission */
-	struct rist_missing_buffer *missing;
-	struct rist_missing_buffer *missing_tail;
+	struct rist_missing_queue missing;
 	uint32_t missing_counter;
+	/* Parity from the sender, created on the first FEC packet */
+	struct rist_fec_decoder *fec;
 
+	struct rist_flow_counters counters;
 	struct rist_peer_flow_stats stats_instant;
 	struct rist_peer_flow_stats stats_total;//TODO: use the total stats!
 	struct rist_bandwidth_estimation bw;
@@ -213,6 +313,7 @@ struct rist_flow {
 	uint32_t flow_id_actual;
 	int dead;
 	struct rist_flow *next;
+	struct rist_flow *hash_next;
 	struct rist_peer **peer_lst;
 	size_t peer_lst_len;
 	uint32_t last_seq_output;
@@ -243,8 +344,26 @@ struct rist_flow {
 	pthread_cond_t condition;
 	pthread_mutex_t mutex;
 
+	/* Output buffer scaling state, owned by whichever thread runs the output */
+	uint64_t output_target_buffer_ticks;
+	uint64_t output_next_buffer_adjust;
+	uint64_t output_buffer_adjust_step_time;
+	int64_t output_buffer_adjust_step_size;
+	int output_buffer_adjust_steps_left;
+
+	/* Shared dataout pool scheduling, protected by the pool mutex */
+	bool dataout_pooled;
+	bool dataout_busy;
+	bool dataout_removed;
+	bool dataout_wakeup;
+	uint64_t dataout_due;
+	size_t dataout_heap_idx;
+	atomic_bool dataout_idle;
+
 	/* variable used for seq number length (16bit or 32bit) */
 	bool short_seq;
+	/* sender carries the seq msb in the RTP header extension, nacks get a seqext record */
+	bool seq_ext;
 
 	/* Session timeouts variables */
 	uint64_t session_timeout;
@@ -270,6 +389,115 @@ struct rist_retry {
 	bool active;//signal whether this retry has been consumed (false) or not
 };
 
+/* Initial number of pending retries preallocated per sender, grows by doubling */
+#define RIST_RETRY_QUEUE_INITIAL (1024)
+
+struct rist_retry_pending {
+	struct rist_peer *peer;
+	uint64_t insert_time;
+	/* Last time the retransmission can leave and still reach the receiver before its buffer plays it out */
+	uint64_t deadline;
+	uint32_t seq;
+	/* Slot of this retry in sender_retry_queue, whose active flag is cleared once it is handled */
+	size_t history_index;
+	/* Held back at least once for lack of tokens */
+	bool throttled;
+};
+
+/*
+ * Retries waiting to be sent, earliest deadline first. entries[0..heap_count) is a
+ * min-heap on deadline, entries[heap_count..count) holds retries held back during the
+ * current nack pass (out of tokens) that still have to be re-inserted.
+ */
+struct rist_retry_queue {
+	struct rist_retry_pending *entries;
+	size_t count;
+	size_t heap_count;
+	size_t size;
+};
+
+/* A bonding path: a weighted data peer that takes its share of the packets */
+struct rist_path {
+	struct rist_peer *peer;
+	/* Weight the path was scheduled with, the configured one or its adaptive value */
+	uint32_t weight;
+	/* Weight reduced by the common divisor of all paths, and the smooth WRR credit */
+	uint32_t share;
+	int64_t current;
+};
+
+/*
+ * Data peers a packet can go out on, rebuilt from the peer list when peers change
+ * (paths_dirty) and every RIST_PATH_REFRESH_INTERVAL. schedule holds one smooth
+ * weighted round-robin round as indexes into paths, so picking a path is O(1).
+ */
+struct rist_path_set {
+	struct rist_path *paths;
+	size_t count;
+	/* weight 0 peers, they get every packet */
+	struct rist_peer **mirrors;
+	size_t mirror_count;
+	size_t capacity;
+	uint16_t *schedule;
+	size_t schedule_len;
+	size_t schedule_size;
+	size_t schedule_pos;
+	uint64_t next_refresh;
+};
+
+/* Output pacing of a data peer, see pacer.h */
+struct rist_pacer {
+	/* Input rate in bytes per tick, measured from the enqueue times of the packets the peer got */
+	double rate;
+	uint64_t window_start;
+	size_t window_bytes;
+	/* Departure time of the next packet */
+	uint64_t next;
+	/* The socket took SO_TXTIME, departure times go to the kernel instead of the timer */
+	bool txtime;
+	/* CLOCK_MONOTONIC departure of the packet being sent in ns, 0 when it leaves right away */
+	uint64_t txtime_ns;
+};
+
+#if HAVE_RECVMMSG
+struct rist_recv_batch {
+	uint8_t buf[RIST_RECV_BATCH_SIZE][RIST_MAX_PACKET_SIZE];
+	struct mmsghdr msgs[RIST_RECV_BATCH_SIZE];
+	struct iovec iov[RIST_RECV_BATCH_SIZE];
+	struct sockaddr_storage addr[RIST_RECV_BATCH_SIZE];
+#if HAVE_SO_TIMESTAMPING || HAVE_UDP_GRO
+	uint8_t ctrl[RIST_RECV_BATCH_SIZE][RIST_RECV_CMSG_SIZE];
+#endif
+};
+#endif
+
+#if HAVE_SENDMMSG
+struct rist_send_batch {
+	/* only the thread that opened the batch may stage packets into it */
+	bool active;
+	pthread_t owner;
+	/* set by the caller while staging a retransmission */
+	bool retry;
+	size_t count;
+	uint8_t buf[RIST_SEND_BATCH_SIZE][RIST_SEND_BATCH_SLOT_SIZE];
+	struct mmsghdr msgs[RIST_SEND_BATCH_SIZE];
+	struct iovec iov[RIST_SEND_BATCH_SIZE];
+	struct rist_peer *peer[RIST_SEND_BATCH_SIZE];
+	bool is_retry[RIST_SEND_BATCH_SIZE];
+#if HAVE_SO_TXTIME
+	uint8_t ctrl[RIST_SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint64_t))];
+#endif
+#if HAVE_UDP_SEGMENT
+	/* The kernel takes UDP_SEGMENT, runs of equal sized datagrams to one peer go out as one message */
+	bool gso;
+	struct mmsghdr gso_msgs[RIST_SEND_BATCH_SIZE];
+	uint8_t gso_ctrl[RIST_SEND_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+	size_t gso_first[RIST_SEND_BATCH_SIZE];
+	size_t gso_count[RIST_SEND_BATCH_SIZE];
+#endif
+};
+#endif
+
 struct rist_common_ctx {
 	atomic_int shutdown;
 	atomic_bool startup_complete;
@@ -282,10 +510,25 @@ struct rist_common_ctx {
 
 	/* Flows */
 	struct rist_flow *FLOWS;
+	struct rist_flow *flow_hash[RIST_FLOW_HASH_BUCKETS];
 	pthread_mutex_t flows_lock;
 
+	/* Children of listening peers keyed by (parent, family, address, port),
+	 * kept in sync by peer_append() and rist_peer_remove() */
+	struct rist_peer **peer_hash;
+	size_t peer_hash_size;
+	size_t peer_hash_count;
+	size_t peer_hash_unindexed; /* children that could not be indexed, forces the linear fallback */
+
 	/* evsocket */
 	struct evsocket_ctx *evctx;
+	/* see RIST_OPT_IO_ENGINE */
+	enum rist_io_engine io_engine;
+#if HAVE_IO_URING
+	/* Set when the io_uring engine runs the peer sockets, its receive ring is an event on evctx */
+	struct rist_uring *uring;
+	struct evsocket_event *uring_event;
+#endif
 
 	/* Timers */
 	int rist_max_jitter;
@@ -294,6 +537,9 @@ struct rist_common_ctx {
 	struct rist_peer *PEERS;
 	pthread_mutex_t peerlist_lock;
 
+	/* PBKDF2 results shared by the keys of all peers */
+	struct rist_psk_kdf kdf;
+
 	/* buffers */
 	/* these are pre-allocated buffers, not pre-allocated aligned stack */
 	struct {
@@ -302,9 +548,20 @@ struct rist_common_ctx {
 		uint8_t recv[RIST_MAX_PACKET_SIZE];
 		uint8_t rtcp[RIST_MAX_PACKET_SIZE];
 	} buf;
-	struct rist_buffer *rist_free_buffer;
+#if HAVE_RECVMMSG
+	struct rist_recv_batch recv_batch;
+	bool recv_batch_disabled;
+#endif
+	/* Take packet arrival times from kernel (1) or NIC (2) receive timestamps, see RIST_OPT_RX_TIMESTAMPS */
+	uint32_t rx_timestamps;
+	/* recycled buffers, one free list per payload size class plus one without payload */
+	struct rist_buffer *rist_free_buffer[RIST_BUFFER_POOL_LISTS];
 	pthread_mutex_t rist_free_buffer_mutex;
-	uint64_t rist_free_buffer_count;
+	uint64_t rist_free_buffer_count[RIST_BUFFER_POOL_LISTS];
+	/* lowest free count since the last trim, anything below it went unused */
+	uint64_t rist_free_buffer_low[RIST_BUFFER_POOL_LISTS];
+	uint64_t rist_free_buffer_hits;
+	uint64_t rist_free_buffer_misses;
 
 	/* timers */
 	uint64_t nacks_next_time;
@@ -315,7 +572,8 @@ struct rist_common_ctx {
 
 	/* seq variables */
 	uint32_t seq;
-	uint16_t seq_rtp;
+	/* extended (32bit) rtp seq, the upper half goes out in the RTP header extension */
+	uint32_t seq_rtp;
 
 	/* Peer counter (only the ones created by the API) */
 	uint32_t peer_counter;
@@ -354,6 +612,20 @@ struct rist_common_ctx {
 	void *thread_callback_arg;
 };
 
+/* Fixed set of output workers shared by all flows of a receiver, flows are
+ * kept in a min-heap ordered by the time their output is next due */
+struct rist_dataout_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	pthread_cond_t done;
+	bool shutdown;
+	struct rist_flow **heap;
+	size_t heap_count;
+	size_t heap_size;
+	pthread_t *threads;
+	size_t thread_count;
+};
+
 struct rist_receiver {
 	/* data out thread signaling for fifo */
 	pthread_cond_t condition;
@@ -379,6 +651,17 @@ struct rist_receiver {
 	bool simulate_loss;
 	uint16_t loss_percentage;
 	uint32_t fifo_queue_size;
+
+	/* Output worker pool, NULL when every flow has its own output thread */
+	uint32_t dataout_pool_size;
+	struct rist_dataout_pool *dataout_pool;
+
+	/* Listening peers are spread over shard_count receivers, see RIST_OPT_RECEIVER_SHARDS. This context
+	 * is the first shard, rist_start creates the others in shards. */
+	uint32_t shard_count;
+	struct rist_ctx **shards;
+	/* Set on the other shards: data output is signalled on and read through this context */
+	struct rist_receiver *shard_parent;
 };
 
 struct rist_sender {
@@ -399,13 +682,40 @@ struct rist_sender {
 
 	bool sender_initialized;
 	uint32_t total_weight;
-	struct rist_buffer *sender_queue[RIST_SERVER_QUEUE_BUFFERS]; /* input queue */
-	size_t sender_queue_bytesize;
-	size_t sender_queue_delete_index;
+	/* Input ring: the writer (rist_sender_data_write) owns write_index, the protocol
+	 * thread owns read_index and delete_index. Slots are published with release/acquire
+	 * on the indexes, so neither side takes a lock. */
+	struct rist_buffer **sender_queue; /* input queue, sender_queue_max slots */
+	atomic_ulong sender_queue_bytesize;
+	atomic_ulong sender_queue_delete_index;
 	atomic_ulong sender_queue_read_index;
 	atomic_ulong sender_queue_write_index;
 	size_t sender_queue_max;
-	int weight_counter;
+	/* Set while the protocol thread is (about to be) waiting on condition */
+	atomic_bool sender_thread_parked;
+	/* Ring resize handshake: the writer flags itself inside rist_sender_enqueue, each side
+	 * that finds the other one busy sleeps on resize_condition until it is done */
+	atomic_bool sender_queue_writing;
+	atomic_bool sender_queue_resizing;
+	pthread_mutex_t resize_mutex;
+	pthread_cond_t resize_condition;
+	/* Packet rate sampling used to size sender_queue */
+	uint32_t queue_check_seq;
+	uint64_t queue_check_time;
+	/* Several application threads call rist_sender_data_write, serialize them on queue_lock */
+	bool multi_writer;
+	/* Upcoming GRE sequence numbers per peer to precompute the AES-CTR keystream for, 0 is off */
+	size_t keystream_depth;
+	/* Derives the keys of upcoming rotations, started on the first queued derivation */
+	pthread_t kdf_thread;
+	bool kdf_thread_running;
+	/* Bonding paths, see path-sched.h */
+	struct rist_path_set paths;
+	atomic_bool paths_dirty;
+	/* Scale path weights by measured retransmits and RTT */
+	bool adaptive_weights;
+	/* A data peer was configured with output pacing */
+	bool pacing;
 	uint64_t last_datagram_time;
 	bool simulate_loss;
 	uint16_t loss_percentage;
@@ -413,17 +723,23 @@ struct rist_sender {
 	uint64_t checks_next_time;
 	uint32_t session_timeout;
 
-	/* retry queue */
+	/* retry history, used to reject duplicate requests */
 	struct rist_retry *sender_retry_queue;
 	size_t sender_retry_queue_write_index;
-	size_t sender_retry_queue_read_index;
 	size_t sender_retry_queue_size;
+	/* retries waiting to be sent */
+	struct rist_retry_queue retry_pending;
 	uint64_t cooldown_time;
 	int cooldown_mode;
 
 	/* Recovery */
-	uint32_t seq_index[UINT16_SIZE];
+	/* seq_rtp -> sender_queue slot, indexed by seq_rtp & (sender_queue_max - 1) */
+	uint32_t *seq_index;
+	/* last seq_rtp handed to the peers, used to extend 16bit nacks */
+	uint32_t seq_rtp_sent;
 	size_t sender_recover_min_time;
+	/* Row/column parity sent alongside the data, NULL when FEC is off */
+	struct rist_fec_encoder *fec;
 
 	/* Reporting id */
 	intptr_t id;
@@ -438,8 +754,13 @@ struct rist_sender {
 	struct rist_peer **peer_lst;
 	size_t peer_lst_len;
 
-	/* Queue lock for fifo buffer */
+	/* Serializes writers into the fifo buffer in multi_writer mode */
 	pthread_mutex_t queue_lock;
+
+#if HAVE_SENDMMSG
+	/* Outgoing datagrams staged during a drain loop */
+	struct rist_send_batch *send_batch;
+#endif
 };
 
 enum rist_ctx_mode {
@@ -490,6 +811,14 @@ struct rist_peer {
 	struct rist_peer *sibling_prev;
 	struct rist_peer *sibling_next;
 	struct rist_peer *child;
+	/* Sharded listener: the socket shares its address with the other shards. The peer the application
+	 * created keeps its config for the shards to clone it from, a clone points back at it. */
+	bool reuseport;
+	struct rist_peer_config *shard_config;
+	struct rist_peer *shard_origin;
+	/* Chains the listener child index in rist_common_ctx.peer_hash */
+	struct rist_peer *hash_next;
+	bool hashed;
 	uint32_t child_alive_count;
 
 	/* Flow for incoming traffic */
@@ -521,7 +850,12 @@ struct rist_peer {
 	/* Data sending */
 	uint32_t seq;
 	uint64_t eight_times_rtt;
-	uint32_t w_count; /* Counter for weight in distributed send */
+	/* Adaptive bonding: smoothed path quality (0 until measured), the lowest RTT seen and the
+	 * packets carried and retransmissions requested since the last measurement */
+	double path_quality;
+	uint64_t path_base_rtt;
+	uint32_t path_packets;
+	uint32_t path_nacks;
 
 	/* RTT statistics */
 	uint64_t last_rtt;
@@ -563,6 +897,14 @@ struct rist_peer {
 	struct timeval expire;
 	bool send_keepalive;
 	struct evsocket_event *event_recv;
+#if HAVE_UDP_GRO
+	/* the socket hands over UDP GRO coalesced datagrams */
+	bool gro;
+#endif
+#if HAVE_IO_URING
+	/* receive of the socket on the io_uring engine, instead of event_recv */
+	struct rist_uring_slot *uring_slot;
+#endif
 
 	/* listening mode with @ */
 	bool listening;
@@ -595,6 +937,10 @@ struct rist_peer {
 	/* bw estimation */
 	struct rist_bandwidth_estimation bw;
 	struct rist_bandwidth_estimation retry_bw;
+	/* Retransmission token bucket in bytes, filled with what the data leaves of recovery_maxbitrate */
+	double retry_tokens;
+	uint64_t retry_tokens_time;
+	struct rist_pacer pacer;
 
 	/* shutting down flag */
 	atomic_bool shutdown;
@@ -629,8 +975,27 @@ static inline struct rist_common_ctx *rist_struct_get_common(struct rist_ctx *ct
 		return NULL;
 }
 
+/* Ring slots needed to keep [packets] in flight with 2x headroom, a power of two in [RIST_QUEUE_BUFFERS_MIN, max_slots] */
+static inline size_t rist_queue_slots(uint64_t packets, size_t max_slots)
+{
+	size_t slots = RIST_QUEUE_BUFFERS_MIN;
+	while (slots < max_slots && (uint64_t)slots < 2 * packets)
+		slots <<= 1;
+	return slots;
+}
+
+/* True when the output already went past [seq], it was either output or flushed as a hole */
+static inline bool rist_flow_seq_is_output(const struct rist_flow *f, uint32_t seq)
+{
+	if (f->short_seq)
+		return (int16_t)(uint16_t)(seq - f->last_seq_output) <= 0;
+	return (int32_t)(seq - f->last_seq_output) <= 0;
+}
+
 /* defined in flow.c */
 RIST_PRIV void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *flow);
+RIST_PRIV void rist_flow_counters_drain(struct rist_flow *flow);
+RIST_PRIV void rist_flow_counters_reset(struct rist_flow *flow);
 RIST_PRIV void rist_sender_peer_statistics(struct rist_peer *peer);
 RIST_PRIV void rist_delete_flow(struct rist_receiver *ctx, struct rist_flow *f);
 RIST_PRIV void rist_receiver_missing(struct rist_flow *f, struct rist_peer *peer,uint64_t nack_time, uint32_t seq, uint64_t rtt);
@@ -638,9 +1003,17 @@ RIST_PRIV int rist_receiver_associate_flow(struct rist_peer *p, uint32_t flow_id
 RIST_PRIV size_t rist_best_rtt_index(struct rist_flow *f);
 RIST_PRIV struct rist_buffer *rist_new_buffer(struct rist_common_ctx *ctx, const void *buf, size_t len, uint8_t type, uint32_t seq, uint64_t source_time, uint16_t src_port, uint16_t dst_port);
 RIST_PRIV void free_rist_buffer(struct rist_common_ctx *ctx, struct rist_buffer *b);
+RIST_PRIV void rist_buffer_pool_trim(struct rist_common_ctx *ctx);
+RIST_PRIV void rist_buffer_pool_destroy(struct rist_common_ctx *ctx);
 RIST_PRIV void rist_calculate_bitrate(size_t len, struct rist_bandwidth_estimation *bw);
 RIST_PRIV void empty_receiver_queue(struct rist_flow *f, struct rist_common_ctx *ctx);
 RIST_PRIV void rist_flush_missing_flow_queue(struct rist_flow *flow);
+RIST_PRIV int rist_missing_queue_init(struct rist_flow *f);
+RIST_PRIV void rist_missing_queue_free(struct rist_flow *f);
+RIST_PRIV struct rist_missing_buffer *rist_missing_queue_pop_due(struct rist_flow *f, uint64_t now);
+RIST_PRIV void rist_missing_queue_remove(struct rist_flow *f, struct rist_missing_buffer *m);
+RIST_PRIV void rist_missing_queue_requeue(struct rist_flow *f);
+RIST_PRIV void rist_receiver_queue_size_check(struct rist_receiver *ctx, uint64_t now);
 
 /* defined in rist-common.c */
 RIST_PRIV void rist_peer_authenticate(struct rist_peer *peer);
@@ -660,12 +1033,17 @@ RIST_PRIV struct rist_peer *rist_receiver_peer_insert_local(struct rist_receiver
 															const struct rist_peer_config *config);
 RIST_PRIV void rist_sender_destroy_local(struct rist_sender *ctx);
 RIST_PRIV void rist_receiver_destroy_local(struct rist_receiver *ctx);
+RIST_PRIV int rist_dataout_pool_create(struct rist_receiver *ctx);
+RIST_PRIV void rist_dataout_pool_destroy(struct rist_receiver *ctx);
+RIST_PRIV void rist_dataout_pool_remove(struct rist_receiver *ctx, struct rist_flow *f);
 RIST_PRIV struct rist_peer *rist_sender_peer_insert_local(struct rist_sender *ctx,
 														  const struct rist_peer_config *config, bool b_rtcp);
 RIST_PRIV void rist_fsm_init_comm(struct rist_peer *peer);
 RIST_PRIV int rist_oob_enqueue(struct rist_common_ctx *ctx, struct rist_peer *peer, const void *buf, size_t len);
 RIST_PRIV int init_common_ctx(struct rist_common_ctx *ctx, enum rist_profile profile);
 RIST_PRIV int rist_peer_remove(struct rist_common_ctx *ctx, struct rist_peer *peer, struct rist_peer **next);
+/* Moves the peer sockets to another I/O engine, called with the peerlist lock held */
+RIST_PRIV int rist_io_engine_set(struct rist_common_ctx *ctx, enum rist_io_engine engine);
 RIST_PRIV int rist_auth_handler(struct rist_common_ctx *ctx,
 								int (*conn_cb)(void *arg, const char *connecting_ip, uint16_t connecting_port, const char *local_ip, uint16_t local_port, struct rist_peer *peer),
 								int (*disconn_cb)(void *arg, struct rist_peer *peer),
@@ -675,12 +1053,24 @@ RIST_PRIV void sender_peer_append(struct rist_sender *ctx, struct rist_peer *pee
 /* Get common context */
 RIST_PRIV struct rist_common_ctx *get_cctx(struct rist_peer *peer);
 
+/* defined in peer.c */
+RIST_PRIV void _librist_peer_hash_insert(struct rist_peer *p);
+RIST_PRIV void _librist_peer_hash_remove(struct rist_peer *p);
+
+/* Peer state the sender path set depends on changed, it is rebuilt before the next packet */
+static inline void rist_paths_invalidate(struct rist_peer *p)
+{
+	if (p->sender_ctx)
+		atomic_store_explicit(&p->sender_ctx->paths_dirty, true, memory_order_release);
+}
+
 /*static inline in header file */
 static inline void peer_append(struct rist_peer *p)
 {
 	struct rist_common_ctx *cctx = get_cctx(p);
 	struct rist_peer **PEERS = &cctx->PEERS;
 	struct rist_peer *plist = *PEERS;
+	rist_paths_invalidate(p);
 	if (!plist)
 	{
 		*PEERS = p;
@@ -709,6 +1099,7 @@ static inline void peer_append(struct rist_peer *p)
 			}
 		}
 		++peer->child_alive_count;
+		_librist_peer_hash_insert(p);
 	}
 	while (plist)
 	{
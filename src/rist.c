@@ -10,6 +10,7 @@
 #include "rist-private.h"
 #include "log-private.h"
 #include "udp-private.h"
+#include "fec.h"
 #include "vcs_version.h"
 #include "rist-thread.h"
 #include "proto/rist_time.h"
@@ -117,27 +118,38 @@ int rist_receiver_nack_type_set(struct rist_ctx *rist_ctx, enum rist_nack_type n
 	return 0;
 }
 
+/* Shard i of a receiver, the context itself is shard 0. NULL past the last one. */
+static struct rist_receiver *rist_receiver_shard(struct rist_receiver *ctx, uint32_t i)
+{
+	if (i == 0)
+		return ctx;
+	return ctx->shards && i < ctx->shard_count ? ctx->shards[i - 1]->receiver_ctx : NULL;
+}
+
 static struct rist_flow *rist_get_longest_flow(struct rist_receiver *ctx, ssize_t *num)
 {
 	// Select the flow with highest queue count
 	ssize_t num_loop = 0;
 	struct rist_flow *f = NULL;
-	pthread_mutex_lock(&ctx->common.flows_lock);
-	struct rist_flow *f_loop = ctx->common.FLOWS;
-	while (f_loop) {
-		struct rist_flow *nextflow = f_loop->next;
-		unsigned long reader_index = atomic_load_explicit(&f_loop->dataout_fifo_queue_read_index, memory_order_relaxed);
-		unsigned long write_index = atomic_load_explicit(&f_loop->dataout_fifo_queue_write_index, memory_order_acquire);
-
-		num_loop = (write_index - reader_index)&(ctx->fifo_queue_size -1);
-		if (num_loop > *num)
-		{
-			f = f_loop;
-			*num = num_loop;
+	struct rist_receiver *shard;
+	for (uint32_t i = 0; (shard = rist_receiver_shard(ctx, i)) != NULL; i++) {
+		pthread_mutex_lock(&shard->common.flows_lock);
+		struct rist_flow *f_loop = shard->common.FLOWS;
+		while (f_loop) {
+			struct rist_flow *nextflow = f_loop->next;
+			unsigned long reader_index = atomic_load_explicit(&f_loop->dataout_fifo_queue_read_index, memory_order_relaxed);
+			unsigned long write_index = atomic_load_explicit(&f_loop->dataout_fifo_queue_write_index, memory_order_acquire);
+
+			num_loop = (write_index - reader_index)&(ctx->fifo_queue_size -1);
+			if (num_loop > *num)
+			{
+				f = f_loop;
+				*num = num_loop;
+			}
+			f_loop = nextflow;
 		}
-		f_loop = nextflow;
+		pthread_mutex_unlock(&shard->common.flows_lock);
 	}
-	pthread_mutex_unlock(&ctx->common.flows_lock);
 	return f;
 }
 
@@ -348,24 +360,49 @@ int rist_sender_create(struct rist_ctx **_ctx, enum rist_profile profile,
 	//ctx->common.seq = 9159579;
 	//ctx->common.seq = RIST_SERVER_QUEUE_BUFFERS - 25000;
 
+	// Both rings start small and follow the packet rate, see rist_sender_queue_size_check
 	if (!ctx->sender_retry_queue)
 	{
-		ctx->sender_retry_queue = calloc(RIST_RETRY_QUEUE_BUFFERS, sizeof(*ctx->sender_retry_queue));
+		ctx->sender_retry_queue = calloc(RIST_SENDER_QUEUE_BUFFERS_INITIAL, sizeof(*ctx->sender_retry_queue));
 		if (RIST_UNLIKELY(!ctx->sender_retry_queue))
 		{
-			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create sender retry buffer of size %u MB, OOM\n",
-						  (unsigned)(RIST_SERVER_QUEUE_BUFFERS * sizeof(ctx->sender_retry_queue[0])) / 1000000);
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create sender retry buffer of %u slots, OOM\n",
+						  (unsigned)RIST_SENDER_QUEUE_BUFFERS_INITIAL);
 			ret = -1;
 			goto free_ctx_and_ret;
 		}
 
 		ctx->sender_retry_queue_write_index = 1;
-		ctx->sender_retry_queue_read_index = 0;
-		ctx->sender_retry_queue_size = RIST_RETRY_QUEUE_BUFFERS;
+		ctx->sender_retry_queue_size = RIST_SENDER_QUEUE_BUFFERS_INITIAL;
+	}
+
+	ctx->sender_queue = calloc(RIST_SENDER_QUEUE_BUFFERS_INITIAL, sizeof(*ctx->sender_queue));
+	ctx->seq_index = calloc(RIST_SENDER_QUEUE_BUFFERS_INITIAL, sizeof(*ctx->seq_index));
+	if (RIST_UNLIKELY(!ctx->sender_queue || !ctx->seq_index))
+	{
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create sender buffer of %u slots, OOM\n",
+					  (unsigned)RIST_SENDER_QUEUE_BUFFERS_INITIAL);
+		ret = -1;
+		goto free_ctx_and_ret;
 	}
 
-	ctx->sender_queue_delete_index = 1;
-	ctx->sender_queue_max = RIST_SERVER_QUEUE_BUFFERS;
+#if HAVE_SENDMMSG
+	ctx->send_batch = calloc(1, sizeof(*ctx->send_batch));
+	if (RIST_UNLIKELY(!ctx->send_batch))
+		rist_log_priv(&ctx->common, RIST_LOG_WARN, "Could not allocate send batch buffers, sending one datagram at a time\n");
+#if HAVE_UDP_SEGMENT
+	else
+		rist_send_batch_gso_probe(ctx);
+#endif
+#endif
+
+	atomic_init(&ctx->sender_queue_delete_index, 1);
+	atomic_init(&ctx->sender_queue_bytesize, 0);
+	atomic_init(&ctx->sender_thread_parked, false);
+	atomic_init(&ctx->sender_queue_writing, false);
+	atomic_init(&ctx->sender_queue_resizing, false);
+	ctx->sender_queue_max = RIST_SENDER_QUEUE_BUFFERS_INITIAL;
+	ctx->queue_check_time = timestampNTP_u64();
 	atomic_init(&ctx->sender_queue_write_index, 1);
 	atomic_init(&ctx->sender_queue_read_index, 0);
 
@@ -412,6 +449,20 @@ int rist_sender_create(struct rist_ctx **_ctx, enum rist_profile profile,
 		goto free_ctx_and_ret;
 	}
 
+	ret = pthread_mutex_init(&ctx->resize_mutex, NULL);
+	if (ret)
+	{
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Error %d initializing pthread_mutex\n", ret);
+		goto free_ctx_and_ret;
+	}
+
+	ret = pthread_cond_init(&ctx->resize_condition, NULL);
+	if (ret)
+	{
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Error %d initializing pthread_condition\n", ret);
+		goto free_ctx_and_ret;
+	}
+
 	ctx->sender_initialized = true;
 
 	*_ctx = rist_ctx;
@@ -419,6 +470,13 @@ int rist_sender_create(struct rist_ctx **_ctx, enum rist_profile profile,
 
 	// Failed!
 free_ctx_and_ret:
+	free(ctx->sender_queue);
+	free(ctx->seq_index);
+	free(ctx->sender_retry_queue);
+	free(ctx->retry_pending.entries);
+#if HAVE_SENDMMSG
+	free(ctx->send_batch);
+#endif
 	free(ctx);
 	free(rist_ctx);
 	return ret;
@@ -524,18 +582,29 @@ int rist_sender_data_write(struct rist_ctx *rist_ctx, const struct rist_data_blo
 	}
 
 	uint64_t ts_ntp = data_block->ts_ntp == 0 ? timestampNTP_u64() : data_block->ts_ntp;
+	// The input ring has a single writer, extra writers queue up here
+	if (ctx->multi_writer)
+		pthread_mutex_lock(&ctx->queue_lock);
 	uint32_t seq_rtp;
-	if (data_block->flags & RIST_DATA_FLAGS_USE_SEQ)
-		seq_rtp = (uint32_t)data_block->seq;
-	else
+	if (data_block->flags & RIST_DATA_FLAGS_USE_SEQ) {
+		// Callers may hand us plain 16bit RTP seqs, take the low half and extend it from our own counter
+		seq_rtp = ctx->common.seq_rtp + (uint32_t)(int16_t)((uint16_t)data_block->seq - (uint16_t)ctx->common.seq_rtp);
+		ctx->common.seq_rtp = seq_rtp + 1;
+	} else
 		seq_rtp = ctx->common.seq_rtp++;
-	//When we support 32bit seq this should be changed
-	seq_rtp = seq_rtp & (UINT16_MAX);
 
 	int ret = rist_sender_enqueue(ctx, data_block->payload, data_block->payload_len, ts_ntp, data_block->virt_src_port, data_block->virt_dst_port, seq_rtp);
-	// Wake up data/nack output thread when data comes in
-	if (pthread_cond_signal(&ctx->condition))
-		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Call to pthread_cond_signal failed.\n");
+	if (ctx->multi_writer)
+		pthread_mutex_unlock(&ctx->queue_lock);
+	// Wake up data/nack output thread when data comes in, but only if it is sleeping.
+	// Pairs with the fence in sender_pthread_protocol after it sets sender_thread_parked.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (ret == 0 && atomic_load_explicit(&ctx->sender_thread_parked, memory_order_relaxed)) {
+		pthread_mutex_lock(&ctx->mutex);
+		if (pthread_cond_signal(&ctx->condition))
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Call to pthread_cond_signal failed.\n");
+		pthread_mutex_unlock(&ctx->mutex);
+	}
 
 	if (ret < 0)
 		return ret;
@@ -580,8 +649,9 @@ int rist_oob_write(struct rist_ctx *ctx, const struct rist_oob_block *oob_block)
 	struct rist_peer *peer = oob_block->peer;
 	if (peer == NULL)
 		peer = cctx->oob_current_peer;
+	// The peer may have connected through another receiver shard, its own context sends it
 	if (peer)
-		return rist_oob_enqueue(cctx, peer, oob_block->payload, oob_block->payload_len);
+		return rist_oob_enqueue(get_cctx(peer), peer, oob_block->payload, oob_block->payload_len);
 	else
 	{
 		rist_log_priv(cctx, RIST_LOG_WARN,
@@ -816,6 +886,7 @@ int rist_peer_config_defaults_set(struct rist_peer_config *peer_config)
 		peer_config->congestion_control_mode = RIST_DEFAULT_CONGESTION_CONTROL_MODE;
 		peer_config->min_retries = RIST_DEFAULT_MIN_RETRIES;
 		peer_config->max_retries = RIST_DEFAULT_MAX_RETRIES;
+		peer_config->pacing_mode = RIST_DEFAULT_PACING_MODE;
 		return 0;
 	}
 	else
@@ -861,6 +932,17 @@ static int rist_receiver_peer_create(struct rist_receiver *ctx,
 	struct rist_peer *p = rist_receiver_peer_insert_local(ctx, config);
 	if (!p)
 		return -1;
+	if (p->reuseport && !ctx->shard_parent) {
+		// rist_start clones the peer onto the other shards from the config as the application gave it
+		p->shard_config = malloc(sizeof(*config));
+		if (!p->shard_config) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create peer, OOM\n");
+			udpsocket_close(p->sd);
+			free(p);
+			return -1;
+		}
+		memcpy(p->shard_config, config, sizeof(*config));
+	}
 
 	p->peer_ssrc = prand_u32();
 	if (ctx->common.profile == RIST_PROFILE_SIMPLE)
@@ -918,8 +1000,6 @@ static int rist_sender_peer_create(struct rist_sender *ctx,
 	// TODO: Validate config data (virt_dst_port != 0 for example)
 
 	newpeer->is_data = true;
-	if (config->weight > 0)
-		newpeer->w_count = config->weight;
 	peer_append(newpeer);
 
 	if (ctx->common.profile == RIST_PROFILE_SIMPLE)
@@ -965,6 +1045,48 @@ static int rist_sender_peer_create(struct rist_sender *ctx,
 	return 0;
 }
 
+/* Creates the copies of a sharded listening peer on the other shards, called with the peerlist lock held */
+static int rist_receiver_shard_clone(struct rist_receiver *ctx, struct rist_peer *peer)
+{
+	struct rist_receiver *shard;
+	for (uint32_t i = 1; (shard = rist_receiver_shard(ctx, i)) != NULL; i++) {
+		struct rist_peer_config config = *peer->shard_config;
+		struct rist_peer *clone = NULL;
+		pthread_mutex_lock(&shard->common.peerlist_lock);
+		int ret = rist_receiver_peer_create(shard, &clone, &config);
+		if (ret == 0) {
+			clone->shard_origin = peer;
+#if HAVE_SRP_SUPPORT
+			if (peer->eap_ctx && eap_clone_ctx(peer->eap_ctx, clone) == 0)
+				clone->eap_authentication_state = peer->eap_authentication_state;
+#endif
+		}
+		pthread_mutex_unlock(&shard->common.peerlist_lock);
+		if (ret != 0) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create peer %"PRIu32" on shard %"PRIu32"\n", peer->adv_peer_id, i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Removes the copies of a sharded listening peer, called with the peerlist lock held */
+static void rist_receiver_shard_remove(struct rist_receiver *ctx, struct rist_peer *peer)
+{
+	struct rist_receiver *shard;
+	for (uint32_t i = 1; (shard = rist_receiver_shard(ctx, i)) != NULL; i++) {
+		pthread_mutex_lock(&shard->common.peerlist_lock);
+		struct rist_peer *p = shard->common.PEERS;
+		while (p) {
+			struct rist_peer *next = p->next;
+			if (p->shard_origin == peer)
+				rist_peer_remove(&shard->common, p, &next);
+			p = next;
+		}
+		pthread_mutex_unlock(&shard->common.peerlist_lock);
+	}
+}
+
 int rist_peer_create(struct rist_ctx *ctx, struct rist_peer **peer, const struct rist_peer_config *config) {
 	if (!ctx) {
 		rist_log_priv3(RIST_LOG_ERROR, "rist_peer_create call with null ctx\n");
@@ -976,6 +1098,14 @@ int rist_peer_create(struct rist_ctx *ctx, struct rist_peer **peer, const struct
 		cctx = &ctx->receiver_ctx->common;
 		pthread_mutex_lock(&cctx->peerlist_lock);
 		ret = rist_receiver_peer_create(ctx->receiver_ctx, peer, config);
+		// Already running shards get the new listener right away
+		if (ret == 0 && (*peer)->shard_config && ctx->receiver_ctx->shards &&
+			rist_receiver_shard_clone(ctx->receiver_ctx, *peer) != 0) {
+			rist_receiver_shard_remove(ctx->receiver_ctx, *peer);
+			rist_peer_remove(cctx, *peer, NULL);
+			*peer = NULL;
+			ret = -1;
+		}
 	}
 	else if (ctx->mode == RIST_SENDER_MODE && ctx->sender_ctx) {
 		cctx = &ctx->sender_ctx->common;
@@ -1021,7 +1151,6 @@ int rist_peer_weight_set(struct rist_ctx *ctx, struct rist_peer *peer, const uin
 		struct rist_receiver *rctx = ctx->receiver_ctx;
 		pthread_mutex_lock(&rctx->common.peerlist_lock);
 		peer->config.weight = weight;
-		peer->w_count = weight;
 		pthread_mutex_unlock(&rctx->common.peerlist_lock);
 	}
 	else if (ctx->mode == RIST_SENDER_MODE && ctx->sender_ctx)
@@ -1033,9 +1162,9 @@ int rist_peer_weight_set(struct rist_ctx *ctx, struct rist_peer *peer, const uin
 		peer->config.weight = weight;
 		if ((peer->listening && peer->child != NULL) || !peer->listening) {
 			sctx->total_weight -= cur_weight;
-			peer->w_count = peer->config.weight;
 			sctx->total_weight += peer->config.weight;
 		}
+		rist_paths_invalidate(peer);
 		pthread_mutex_unlock(&sctx->common.peerlist_lock);
 		pthread_mutex_unlock(&sctx->mutex);
 	}
@@ -1058,7 +1187,12 @@ int rist_peer_destroy(struct rist_ctx *ctx, struct rist_peer *peer) {
 	else
 		return -1;
 	assert(cctx != NULL);
+	// Peers that connected through another shard belong to that shard
+	if (ctx->mode == RIST_RECEIVER_MODE && peer->receiver_ctx != ctx->receiver_ctx)
+		cctx = &peer->receiver_ctx->common;
 	pthread_mutex_lock(&cctx->peerlist_lock);
+	if (peer->shard_config)
+		rist_receiver_shard_remove(ctx->receiver_ctx, peer);
 	int ret = rist_peer_remove(cctx, peer, NULL);
 	pthread_mutex_unlock(&cctx->peerlist_lock);
 	return ret;
@@ -1079,7 +1213,6 @@ static int rist_sender_start(struct rist_sender *ctx)
 	}
 	if (ctx->total_weight > 0)
 	{
-		ctx->weight_counter = ctx->total_weight;
 		rist_log_priv(&ctx->common, RIST_LOG_INFO, "Total weight: %lu\n", ctx->total_weight);
 	}
 	atomic_store_explicit(&ctx->common.startup_complete, true, memory_order_release);
@@ -1092,11 +1225,96 @@ unlock_failed:
 	return -1;
 }
 
+static void rist_receiver_shards_destroy(struct rist_receiver *ctx)
+{
+	if (!ctx->shards)
+		return;
+	for (uint32_t i = 0; i + 1 < ctx->shard_count; i++)
+		rist_destroy(ctx->shards[i]);
+	free(ctx->shards);
+	ctx->shards = NULL;
+}
+
+/* Creates the other shards with the configuration of ctx, clones the listening peers onto them and
+ * starts them */
+static int rist_receiver_shards_start(struct rist_receiver *ctx)
+{
+	struct rist_ctx **shards = calloc(ctx->shard_count - 1, sizeof(*shards));
+	if (!shards)
+		return -1;
+	for (uint32_t i = 0; i + 1 < ctx->shard_count; i++) {
+		if (rist_receiver_create(&shards[i], ctx->common.profile, ctx->common.logging_settings) != 0)
+			goto fail;
+		struct rist_receiver *shard = shards[i]->receiver_ctx;
+		shard->shard_parent = ctx;
+		shard->nack_type = ctx->nack_type;
+		shard->simulate_loss = ctx->simulate_loss;
+		shard->loss_percentage = ctx->loss_percentage;
+		shard->fifo_queue_size = ctx->fifo_queue_size;
+		shard->dataout_pool_size = ctx->dataout_pool_size;
+		shard->common.rist_max_jitter = ctx->common.rist_max_jitter;
+		shard->common.stats_callback = ctx->common.stats_callback;
+		shard->common.stats_callback_argument = ctx->common.stats_callback_argument;
+		shard->common.stats_report_time = ctx->common.stats_report_time;
+		shard->common.connection_status_callback = ctx->common.connection_status_callback;
+		shard->common.connection_status_callback_argument = ctx->common.connection_status_callback_argument;
+		shard->common.auth = ctx->common.auth;
+		shard->common.thread_callback = ctx->common.thread_callback;
+		shard->common.thread_callback_arg = ctx->common.thread_callback_arg;
+		shard->common.rx_timestamps = ctx->common.rx_timestamps;
+		if (ctx->common.oob_data_enabled &&
+			rist_oob_callback_set(shards[i], ctx->common.oob_data_callback, ctx->common.oob_data_callback_argument) != 0)
+			goto fail;
+		if (ctx->common.io_engine != RIST_IO_ENGINE_DEFAULT) {
+			pthread_mutex_lock(&shard->common.peerlist_lock);
+			int ret = rist_io_engine_set(&shard->common, ctx->common.io_engine);
+			pthread_mutex_unlock(&shard->common.peerlist_lock);
+			if (ret != 0)
+				goto fail;
+		}
+	}
+	ctx->shards = shards;
+
+	int ret = 0;
+	pthread_mutex_lock(&ctx->common.peerlist_lock);
+	for (struct rist_peer *p = ctx->common.PEERS; p && ret == 0; p = p->next) {
+		if (p->shard_config)
+			ret = rist_receiver_shard_clone(ctx, p);
+	}
+	pthread_mutex_unlock(&ctx->common.peerlist_lock);
+	for (uint32_t i = 0; i + 1 < ctx->shard_count && ret == 0; i++)
+		ret = rist_start(shards[i]);
+	if (ret != 0) {
+		rist_receiver_shards_destroy(ctx);
+		return -1;
+	}
+	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Listening with %"PRIu32" shards\n", ctx->shard_count);
+	return 0;
+
+fail:
+	for (uint32_t i = 0; i + 1 < ctx->shard_count; i++) {
+		if (shards[i])
+			rist_destroy(shards[i]);
+	}
+	free(shards);
+	return -1;
+}
+
 static int rist_receiver_start(struct rist_receiver *ctx)
 {
 	pthread_mutex_lock(&ctx->mutex);
 	if (!ctx->protocol_running)
 	{
+		if (ctx->shard_count > 1 && rist_receiver_shards_start(ctx) != 0)
+		{
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not start the receiver shards.\n");
+			goto unlock_failed;
+		}
+		if (rist_dataout_pool_create(ctx) != 0)
+		{
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create the shared data output pool.\n");
+			goto unlock_failed;
+		}
 		if (rist_thread_create(&ctx->common, &ctx->receiver_thread, NULL, receiver_pthread_protocol, (void *)ctx) != 0)
 		{
 			rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not create receiver protocol thread.\n");
@@ -1154,6 +1372,8 @@ static int rist_receiver_destroy(struct rist_receiver *ctx)
 		return -1;
 	}
 
+	// The shards output into this context and may share its EAP credentials, they go first
+	rist_receiver_shards_destroy(ctx);
 	rist_log_priv(&ctx->common, RIST_LOG_INFO, "Triggering protocol loop termination\n");
 	atomic_store_explicit(&ctx->common.shutdown, 1, memory_order_release);
 	pthread_mutex_lock(&ctx->mutex);
@@ -1218,6 +1438,118 @@ int rist_set_opt(struct rist_ctx *ctx, enum rist_opt opt, void* optval1, void* o
 		return -1;
 
 	switch(opt) {
+	case RIST_OPT_SENDER_MULTI_WRITER:
+		;
+		bool *multi_writer = optval1;
+		if (ctx->mode != RIST_SENDER_MODE || multi_writer == NULL || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire))
+			return -1;
+		ctx->sender_ctx->multi_writer = *multi_writer;
+		break;
+	case RIST_OPT_RECEIVER_DATAOUT_POOL:
+		;
+		uint32_t *pool_size = optval1;
+		if (ctx->mode != RIST_RECEIVER_MODE || pool_size == NULL || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire) || ctx->receiver_ctx->protocol_running)
+			return -1;
+		ctx->receiver_ctx->dataout_pool_size = *pool_size;
+		break;
+	case RIST_OPT_SENDER_KEYSTREAM_PRECOMPUTE:
+		;
+		uint32_t *keystream_depth = optval1;
+		if (ctx->mode != RIST_SENDER_MODE || keystream_depth == NULL || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire) || ctx->sender_ctx->protocol_running)
+			return -1;
+		ctx->sender_ctx->keystream_depth = *keystream_depth;
+		break;
+	case RIST_OPT_SENDER_FEC:
+		;
+		uint32_t *fec_columns = optval1;
+		uint32_t *fec_rows = optval2;
+		bool *fec_row = optval3;
+		if (ctx->mode != RIST_SENDER_MODE || fec_columns == NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire) || ctx->sender_ctx->protocol_running)
+			return -1;
+		rist_fec_encoder_destroy(ctx->sender_ctx->fec);
+		ctx->sender_ctx->fec = NULL;
+		if (*fec_columns == 0)
+			break;
+		if (fec_rows == NULL || rist_fec_config_check(*fec_columns, *fec_rows, fec_row && *fec_row) != 0) {
+			rist_log_priv2(cctx->logging_settings, RIST_LOG_ERROR, "Invalid FEC matrix %ux%u\n", *fec_columns, fec_rows ? *fec_rows : 0);
+			return -1;
+		}
+		ctx->sender_ctx->fec = rist_fec_encoder_create(*fec_columns, *fec_rows, fec_row && *fec_row);
+		if (!ctx->sender_ctx->fec)
+			return -1;
+		const char *xor_name;
+		rist_fec_xor_select(&xor_name);
+		rist_log_priv2(cctx->logging_settings, RIST_LOG_INFO, "FEC enabled, %ux%u matrix%s, using %s XOR\n",
+					   *fec_columns, *fec_rows, fec_row && *fec_row ? " with row FEC" : "", xor_name);
+		break;
+	case RIST_OPT_SENDER_ADAPTIVE_WEIGHTS:
+		;
+		bool *adaptive_weights = optval1;
+		if (ctx->mode != RIST_SENDER_MODE || adaptive_weights == NULL || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire) || ctx->sender_ctx->protocol_running)
+			return -1;
+		ctx->sender_ctx->adaptive_weights = *adaptive_weights;
+		break;
+	case RIST_OPT_RX_TIMESTAMPS:
+		;
+		uint32_t *rx_timestamps = optval1;
+		if (rx_timestamps == NULL || *rx_timestamps > 2 || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire))
+			return -1;
+#if HAVE_SO_TIMESTAMPING
+		pthread_mutex_lock(&cctx->peerlist_lock);
+		cctx->rx_timestamps = *rx_timestamps;
+		// Peers created so far already have their sockets
+		for (struct rist_peer *peer = cctx->PEERS; peer && cctx->rx_timestamps; peer = peer->next)
+			rist_rx_timestamps_enable(peer);
+		pthread_mutex_unlock(&cctx->peerlist_lock);
+#else
+		if (*rx_timestamps) {
+			rist_log_priv2(cctx->logging_settings, RIST_LOG_ERROR, "Receive timestamps are not supported on this platform\n");
+			return -1;
+		}
+#endif
+		break;
+	case RIST_OPT_IO_ENGINE:
+		;
+		uint32_t *io_engine = optval1;
+		if (io_engine == NULL || *io_engine > RIST_IO_ENGINE_IO_URING || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (atomic_load_explicit(&cctx->startup_complete, memory_order_acquire))
+			return -1;
+		pthread_mutex_lock(&cctx->peerlist_lock);
+		int engine_ret = rist_io_engine_set(cctx, (enum rist_io_engine)*io_engine);
+		pthread_mutex_unlock(&cctx->peerlist_lock);
+		if (engine_ret != 0)
+			return -1;
+		break;
+	case RIST_OPT_RECEIVER_SHARDS:
+		;
+		uint32_t *shard_count = optval1;
+		if (ctx->mode != RIST_RECEIVER_MODE || shard_count == NULL || *shard_count > RIST_RECEIVER_SHARDS_MAX || optval2 != NULL || optval3 != NULL)
+			return -1;
+		if (ctx->receiver_ctx->protocol_running || cctx->PEERS != NULL) {
+			rist_log_priv2(cctx->logging_settings, RIST_LOG_ERROR, "Receiver shards must be set before any peer is created\n");
+			return -1;
+		}
+#if !HAVE_SO_REUSEPORT
+		if (*shard_count > 1) {
+			rist_log_priv2(cctx->logging_settings, RIST_LOG_ERROR, "Receiver shards need SO_REUSEPORT, which this platform lacks\n");
+			return -1;
+		}
+#endif
+		ctx->receiver_ctx->shard_count = *shard_count;
+		break;
 	case RIST_OPT_THREAD_CALLBACK:
 		;
 		rist_thread_callback_t *thread_callback  = optval1;
@@ -20,6 +20,62 @@ static double round_two_digits(double number)
 	return (double)(new_number) / 100;
 }
 
+/* The buffer pool is shared by the whole context, these are running totals */
+static void rist_buffer_pool_statistics(struct rist_common_ctx *cctx, cJSON *json_stats)
+{
+	uint64_t pooled = 0;
+	pthread_mutex_lock(&cctx->rist_free_buffer_mutex);
+	uint64_t hits = cctx->rist_free_buffer_hits;
+	uint64_t misses = cctx->rist_free_buffer_misses;
+	for (int i = 0; i < RIST_BUFFER_POOL_LISTS; i++)
+		pooled += cctx->rist_free_buffer_count[i];
+	pthread_mutex_unlock(&cctx->rist_free_buffer_mutex);
+	cJSON_AddNumberToObject(json_stats, "buffer_pool_hits", (double)hits);
+	cJSON_AddNumberToObject(json_stats, "buffer_pool_misses", (double)misses);
+	cJSON_AddNumberToObject(json_stats, "buffer_pool_free", (double)pooled);
+}
+
+#define DRAIN_COUNTER(f, counter) \
+	(uint32_t)atomic_exchange_explicit(&(f)->counters.counter, 0, memory_order_relaxed)
+
+/* Move the packet path counters into stats_instant, called by the stats report */
+void rist_flow_counters_drain(struct rist_flow *flow)
+{
+	struct rist_peer_flow_stats *s = &flow->stats_instant;
+	s->lost += DRAIN_COUNTER(flow, lost);
+	s->received += DRAIN_COUNTER(flow, received);
+	s->dupe += DRAIN_COUNTER(flow, dupe);
+	s->dropped_full += DRAIN_COUNTER(flow, dropped_full);
+	s->dropped_late += DRAIN_COUNTER(flow, dropped_late);
+	s->buffer_duration_sum += atomic_exchange_explicit(&flow->counters.buffer_duration_sum, 0, memory_order_relaxed);
+	s->buffer_duration_count += DRAIN_COUNTER(flow, buffer_duration_count);
+	/* missing is decremented when a queued nack gets cancelled, unsigned wrap keeps the sum right */
+	s->missing += DRAIN_COUNTER(flow, missing);
+	s->retries += DRAIN_COUNTER(flow, retries);
+	s->recovered += DRAIN_COUNTER(flow, recovered);
+	s->reordered += DRAIN_COUNTER(flow, reordered);
+	s->recovered_0nack += DRAIN_COUNTER(flow, recovered_0nack);
+	s->recovered_fec += DRAIN_COUNTER(flow, recovered_fec);
+	s->recovered_1nack += DRAIN_COUNTER(flow, recovered_1nack);
+	s->recovered_2nack += DRAIN_COUNTER(flow, recovered_2nack);
+	s->recovered_3nack += DRAIN_COUNTER(flow, recovered_3nack);
+	s->recovered_morenack += DRAIN_COUNTER(flow, recovered_morenack);
+	s->recovered_sum += DRAIN_COUNTER(flow, recovered_sum);
+}
+
+void rist_flow_counters_reset(struct rist_flow *flow)
+{
+	struct rist_flow_counters *c = &flow->counters;
+	atomic_ulong *counters[] = {
+		&c->lost, &c->received, &c->dupe, &c->dropped_full, &c->dropped_late,
+		&c->buffer_duration_sum, &c->buffer_duration_count, &c->missing, &c->retries,
+		&c->recovered, &c->reordered, &c->recovered_0nack, &c->recovered_fec, &c->recovered_1nack,
+		&c->recovered_2nack, &c->recovered_3nack, &c->recovered_morenack, &c->recovered_sum,
+	};
+	for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+		atomic_store_explicit(counters[i], 0, memory_order_relaxed);
+}
+
 void rist_sender_peer_statistics(struct rist_peer *peer)
 {
 	// TODO: print warning here?? stale flow?
@@ -83,6 +139,7 @@ void rist_sender_peer_statistics(struct rist_peer *peer)
 	cJSON_AddNumberToObject(json_stats, "avg_rtt", (double)avg_rtt / RIST_CLOCK);
 	cJSON_AddNumberToObject(json_stats, "retry_buffer_size", (double)retry_buf_size);
 	cJSON_AddNumberToObject(json_stats, "cooldown_time", (double)time_left);
+	rist_buffer_pool_statistics(cctx, json_stats);
 	char *stats_string = cJSON_PrintUnformatted(stats);
 	cJSON_Delete(stats);
 
@@ -113,6 +170,7 @@ void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *
 	if (!flow)
 		return;
 	pthread_mutex_lock(&ctx->common.stats_lock);
+	rist_flow_counters_drain(flow);
 	//Log errors that used to be packet
 	if (flow->stats_instant.dropped_full)
 		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Dropped %u packets due to buffers being full\n", flow->stats_instant.dropped_full );
@@ -209,15 +267,7 @@ void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *
 
 	uint64_t avg_buffer_duration = 0;
 	if (flow->stats_instant.buffer_duration_count > 0)
-	{
-
-		for (size_t i = 0; i < flow->stats_instant.buffer_duration_count; i++)
-		{
-			avg_buffer_duration += flow->stats_instant.buffer_duration[i];
-		}
-		avg_buffer_duration /= flow->stats_instant.buffer_duration_count;
-		flow->stats_instant.buffer_duration_count = 0;
-	}
+		avg_buffer_duration = flow->stats_instant.buffer_duration_sum / flow->stats_instant.buffer_duration_count;
 	cJSON_AddNumberToObject(json_stats, "quality", Q);
 	cJSON_AddNumberToObject(json_stats, "received", (double)flow->stats_instant.received);
 	cJSON_AddNumberToObject(json_stats, "dropped_late", (double)flow->stats_instant.dropped_late);
@@ -227,6 +277,7 @@ void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *
 	cJSON_AddNumberToObject(json_stats, "reordered", (double)flow->stats_instant.reordered);
 	cJSON_AddNumberToObject(json_stats, "retries", (double)flow->stats_instant.retries);
 	cJSON_AddNumberToObject(json_stats, "recovered_one_nack", (double)flow->stats_instant.recovered_0nack);
+	cJSON_AddNumberToObject(json_stats, "recovered_fec", (double)flow->stats_instant.recovered_fec);
 	cJSON_AddNumberToObject(json_stats, "recovered_two_nacks", (double)flow->stats_instant.recovered_1nack);
 	cJSON_AddNumberToObject(json_stats, "recovered_three_nacks", (double)flow->stats_instant.recovered_2nack);
 	cJSON_AddNumberToObject(json_stats, "recovered_four_nacks", (double)flow->stats_instant.recovered_3nack);
@@ -240,6 +291,7 @@ void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *
 	cJSON_AddNumberToObject(json_stats, "cur_inter_packet_spacing", (double)flow->stats_instant.cur_ips);
 	cJSON_AddNumberToObject(json_stats, "max_inter_packet_spacing", (double)flow->stats_instant.max_ips);
 	cJSON_AddNumberToObject(json_stats, "bitrate", (double)flow->bw.bitrate);
+	rist_buffer_pool_statistics(&ctx->common, json_stats);
 
 	char *stats_string = cJSON_PrintUnformatted(stats);
 	cJSON_Delete(stats);
@@ -261,6 +313,7 @@ void rist_receiver_flow_statistics(struct rist_receiver *ctx, struct rist_flow *
 	stats_container->stats.receiver_flow.reordered = flow->stats_instant.reordered;
 	stats_container->stats.receiver_flow.recovered = flow->stats_instant.recovered;
 	stats_container->stats.receiver_flow.recovered_one_retry = flow->stats_instant.recovered_0nack;
+	stats_container->stats.receiver_flow.recovered_fec = flow->stats_instant.recovered_fec;
 	stats_container->stats.receiver_flow.lost = flow->stats_instant.lost;
 	stats_container->stats.receiver_flow.quality = Q;
 	stats_container->stats.receiver_flow.min_inter_packet_spacing = flow->stats_instant.min_ips;
@@ -22,26 +22,53 @@
 #define RIST_PAYLOAD_TYPE_DATA_OOB          0x6 // Out-of-band data
 #define RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT  0x7
 #define RIST_PAYLOAD_TYPE_EAPOL				0x8
+#define RIST_PAYLOAD_TYPE_FEC               0x9
 
 // Maximum offset before the payload that the code can use to put in headers
 #define RIST_MAX_PAYLOAD_OFFSET (sizeof(struct rist_gre_key_seq) + sizeof(struct rist_protocol_hdr))
 
 /* shared functions in udp.c */
 RIST_PRIV void rist_send_nacks(struct rist_flow *f, struct rist_peer *peer);
-RIST_PRIV int rist_receiver_send_nacks(struct rist_peer *peer, uint32_t seq_array[], size_t array_len);
+RIST_PRIV int rist_receiver_send_nacks(struct rist_peer *peer, uint32_t seq_array[], size_t array_len, bool seq_ext);
 RIST_PRIV int rist_receiver_periodic_rtcp(struct rist_peer *peer);
 RIST_PRIV void rist_sender_periodic_rtcp(struct rist_peer *peer);
 RIST_PRIV int rist_respond_echoreq(struct rist_peer *peer, const uint64_t echo_request_time, uint32_t ssrc);
 RIST_PRIV int rist_request_echo(struct rist_peer *peer);
 RIST_PRIV int rist_send_common_rtcp(struct rist_peer *p, uint8_t payload_type, uint8_t *payload, size_t payload_len, uint64_t source_time, uint16_t src_port, uint16_t dst_port, uint32_t seq_rtp);
 RIST_PRIV void rist_sender_send_data_balanced(struct rist_sender *ctx, struct rist_buffer *buffer);
+RIST_PRIV void rist_sender_fec_encode(struct rist_sender *ctx, struct rist_buffer *buffer);
 RIST_PRIV int rist_sender_enqueue(struct rist_sender *ctx, const void *data, size_t len, uint64_t datagram_time, uint16_t src_port, uint16_t dst_port, uint32_t seq_rtp);
 RIST_PRIV void rist_clean_sender_enqueue(struct rist_sender *ctx);
+RIST_PRIV void rist_sender_queue_size_check(struct rist_sender *ctx, uint64_t now);
 RIST_PRIV void rist_retry_enqueue(struct rist_sender *ctx, uint32_t seq, struct rist_peer *peer);
-RIST_PRIV ssize_t rist_retry_dequeue(struct rist_sender *ctx);
+RIST_PRIV ssize_t rist_retry_dequeue(struct rist_sender *ctx, uint64_t deadline_limit);
+RIST_PRIV void rist_retry_queue_requeue(struct rist_sender *ctx);
 RIST_PRIV int rist_set_url(struct rist_peer *peer);
 RIST_PRIV void rist_create_socket(struct rist_peer *peer);
+/* udpsocket_open_bind for a socket sharing its address through SO_REUSEPORT, defined in udpsocket.c */
+RIST_PRIV int udpsocket_open_bind_reuseport(const char *host, uint16_t port, const char *mciface);
 RIST_PRIV size_t rist_get_sender_retry_queue_size(struct rist_sender *ctx);
+#if HAVE_SO_TIMESTAMPING
+RIST_PRIV int rist_rx_timestamps_enable(struct rist_peer *peer);
+/* Arrival time of a datagram received with msg on the timestampNTP_u64 timebase, realtime and now
+ * are sampled together right after the receive call. Falls back to now without a usable stamp. */
+RIST_PRIV uint64_t rist_rx_timestamp(const struct msghdr *msg, const struct timespec *realtime, uint64_t now);
+#endif
+#if HAVE_UDP_GRO
+RIST_PRIV int rist_udp_gro_set(struct rist_peer *peer, bool enable);
+/* Segment size of a datagram UDP GRO coalesced, 0 when msg carries a single one */
+RIST_PRIV size_t rist_udp_gro_segment(const struct msghdr *msg);
+#endif
+#if HAVE_SENDMMSG
+RIST_PRIV void rist_send_batch_begin(struct rist_sender *ctx);
+RIST_PRIV void rist_send_batch_flush(struct rist_sender *ctx);
+RIST_PRIV void rist_send_batch_end(struct rist_sender *ctx);
+RIST_PRIV ssize_t rist_send_batch_append(struct rist_peer *p, const uint8_t *hdr, size_t hdr_len, const uint8_t *payload, size_t payload_len);
+#if HAVE_UDP_SEGMENT
+/* Turns UDP GSO on for the batch when the kernel supports UDP_SEGMENT */
+RIST_PRIV void rist_send_batch_gso_probe(struct rist_sender *ctx);
+#endif
+#endif
 
 
 #endif
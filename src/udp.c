@@ -21,34 +21,49 @@
 #endif
 #include "crypto/psk.h"
 #include "mpegts.h"
+#include "fec.h"
+#include "path-sched.h"
+#include "pacer.h"
+#include "io-uring.h"
 #include <stdlib.h>
 #include <stddef.h>
 #include <errno.h>
 #include <stdint.h>
 #include <assert.h>
 #include <fcntl.h>
+#if HAVE_SO_TIMESTAMPING
+#include <linux/net_tstamp.h>
+#endif
+#if HAVE_UDP_SEGMENT || HAVE_UDP_GRO
+#include <netinet/udp.h>
+#endif
+#if HAVE_REUSEPORT_CBPF
+#include <linux/filter.h>
+#endif
 
 void rist_clean_sender_enqueue(struct rist_sender *ctx)
 {
 	int delete_count = 1;
+	size_t delete_index = atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed);
 
 	// Delete old packets (max 10 entries per function call)
 	while (delete_count++ < 10) {
-		struct rist_buffer *b = ctx->sender_queue[ctx->sender_queue_delete_index];
+		struct rist_buffer *b = ctx->sender_queue[delete_index];
 
 		/* our buffer size is zero, it must be just building up */
-		if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) == ctx->sender_queue_delete_index) {
+		if ((size_t)atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) == delete_index) {
 			break;
 		}
 
 		size_t safety_counter = 0;
-		while (!b && ((ctx->sender_queue_delete_index + 1)& (ctx->sender_queue_max -1)) != atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire)) {
-			ctx->sender_queue_delete_index = (ctx->sender_queue_delete_index + 1)& (ctx->sender_queue_max -1);
+		while (!b && ((delete_index + 1)& (ctx->sender_queue_max -1)) != atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire)) {
+			delete_index = (delete_index + 1)& (ctx->sender_queue_max -1);
+			atomic_store_explicit(&ctx->sender_queue_delete_index, delete_index, memory_order_release);
 			// This should never happen!
 			rist_log_priv(&ctx->common, RIST_LOG_ERROR,
 				"Moving delete index to %zu\n",
-				ctx->sender_queue_delete_index);
-			b = ctx->sender_queue[ctx->sender_queue_delete_index];
+				delete_index);
+			b = ctx->sender_queue[delete_index];
 			if (safety_counter++ > 1000)
 				return;
 		}
@@ -66,16 +81,132 @@ void rist_clean_sender_enqueue(struct rist_sender *ctx)
 		//		b->seq, b->size, delay, ctx->sender_recover_min_time);
 
 		/* now delete it */
-		ctx->sender_queue_bytesize -= b->size;
+		atomic_fetch_sub_explicit(&ctx->sender_queue_bytesize, b->size, memory_order_relaxed);
 		free_rist_buffer(&ctx->common, b);
-		ctx->sender_queue[ctx->sender_queue_delete_index] = NULL;
-		ctx->sender_queue_delete_index = (ctx->sender_queue_delete_index + 1)& (ctx->sender_queue_max -1);
+		ctx->sender_queue[delete_index] = NULL;
+		delete_index = (delete_index + 1)& (ctx->sender_queue_max -1);
+		// Hand the slot back to the writer
+		atomic_store_explicit(&ctx->sender_queue_delete_index, delete_index, memory_order_release);
+
+	}
+
+}
+
+/* Copy the retry history into new_size slots, keeping as much of it as fits, and point the
+ * pending retries at their new slots */
+static void rist_retry_queue_resize(struct rist_sender *ctx, struct rist_retry *new_queue, size_t new_size)
+{
+	size_t old_size = ctx->sender_retry_queue_size;
+	size_t keep = (old_size < new_size ? old_size : new_size) - 1;
+	size_t first = (ctx->sender_retry_queue_write_index - keep) & (old_size - 1);
+	for (size_t j = 0; j < keep; j++)
+		new_queue[1 + j] = ctx->sender_retry_queue[(first + j) & (old_size - 1)];
+	struct rist_retry_queue *q = &ctx->retry_pending;
+	for (size_t i = 0; i < q->count; i++) {
+		if (q->entries[i].history_index == SIZE_MAX)
+			continue;
+		size_t j = (q->entries[i].history_index - first) & (old_size - 1);
+		q->entries[i].history_index = j < keep ? 1 + j : SIZE_MAX;
+	}
+	free(ctx->sender_retry_queue);
+	ctx->sender_retry_queue = new_queue;
+	ctx->sender_retry_queue_size = new_size;
+	ctx->sender_retry_queue_write_index = (keep + 1) & (new_size - 1);
+}
+
+/* Move the sender ring (and the retry ring) to new_max slots. Runs on the protocol thread, which owns
+ * the read/delete side; the writer is held off through the sender_queue_resizing handshake. The
+ * writers' queue_lock is not taken here. */
+static int rist_sender_queue_resize(struct rist_sender *ctx, size_t new_max)
+{
+	struct rist_buffer **new_queue = calloc(new_max, sizeof(*new_queue));
+	struct rist_retry *new_retry = calloc(new_max, sizeof(*new_retry));
+	uint32_t *new_seq_index = calloc(new_max, sizeof(*new_seq_index));
+	if (!new_queue || !new_retry || !new_seq_index) {
+		free(new_queue);
+		free(new_retry);
+		free(new_seq_index);
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Could not resize sender buffer to %zu slots, OOM\n", new_max);
+		return -1;
+	}
 
+	pthread_mutex_lock(&ctx->resize_mutex);
+	atomic_store_explicit(&ctx->sender_queue_resizing, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	// A writer that got in before the flag was raised finishes its single enqueue and wakes us
+	while (atomic_load_explicit(&ctx->sender_queue_writing, memory_order_acquire))
+		pthread_cond_wait(&ctx->resize_condition, &ctx->resize_mutex);
+
+	size_t old_max = ctx->sender_queue_max;
+	size_t delete_index = atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed);
+	size_t write_index = atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_relaxed);
+	size_t read_index = atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_relaxed);
+	size_t used = (write_index - delete_index) & (old_max - 1);
+	// Offset of the next unsent packet from the delete index
+	size_t unsent = (read_index + 1 - delete_index) & (old_max - 1);
+	if (unsent > used)
+		unsent = 0;
+	int ret = -1;
+	if (used + 1 < new_max) {
+		// Re-base the ring so the oldest retained packet sits at slot 1, as after rist_sender_create
+		for (size_t i = 0; i < used; i++) {
+			struct rist_buffer *b = ctx->sender_queue[(delete_index + i) & (old_max - 1)];
+			size_t idx = (1 + i) & (new_max - 1);
+			new_queue[idx] = b;
+			if (b && i < unsent && b->type != RIST_PAYLOAD_TYPE_RTCP)
+				new_seq_index[b->seq_rtp & (new_max - 1)] = (uint32_t)idx;
+		}
+		free(ctx->sender_queue);
+		free(ctx->seq_index);
+		ctx->sender_queue = new_queue;
+		ctx->seq_index = new_seq_index;
+		ctx->sender_queue_max = new_max;
+		atomic_store_explicit(&ctx->sender_queue_delete_index, 1, memory_order_relaxed);
+		atomic_store_explicit(&ctx->sender_queue_read_index, unsent & (new_max - 1), memory_order_relaxed);
+		atomic_store_explicit(&ctx->sender_queue_write_index, (1 + used) & (new_max - 1), memory_order_relaxed);
+		new_queue = NULL;
+		new_seq_index = NULL;
+		ret = 0;
+	}
+	atomic_store_explicit(&ctx->sender_queue_resizing, false, memory_order_release);
+	pthread_cond_broadcast(&ctx->resize_condition);
+	pthread_mutex_unlock(&ctx->resize_mutex);
+	free(new_queue);
+	free(new_seq_index);
+
+	if (ret == 0) {
+		rist_retry_queue_resize(ctx, new_retry, new_max);
+		new_retry = NULL;
+		rist_log_priv(&ctx->common, RIST_LOG_INFO, "Sender buffer resized from %zu to %zu slots\n", old_max, new_max);
 	}
+	free(new_retry);
+	return ret;
+}
 
+void rist_sender_queue_size_check(struct rist_sender *ctx, uint64_t now)
+{
+	size_t used = (atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire) -
+		atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed)) & (ctx->sender_queue_max - 1);
+	size_t target = rist_queue_slots(used, RIST_SERVER_QUEUE_BUFFERS);
+	bool rate_sample = false;
+	uint64_t elapsed = now - ctx->queue_check_time;
+	if (elapsed >= ONE_SECOND) {
+		// Packets sent over the last window, retained for sender_recover_min_time
+		uint32_t seq_delta = ctx->common.seq - ctx->queue_check_seq;
+		uint64_t packets = (uint64_t)seq_delta * ctx->sender_recover_min_time * RIST_CLOCK / elapsed;
+		size_t rate_target = rist_queue_slots(packets, RIST_SERVER_QUEUE_BUFFERS);
+		if (rate_target > target)
+			target = rate_target;
+		rate_sample = true;
+		ctx->queue_check_seq = ctx->common.seq;
+		ctx->queue_check_time = now;
+	}
+	// Grow as soon as occupancy needs it, shrink only on a rate sample showing 4x headroom
+	if (target > ctx->sender_queue_max || (rate_sample && target * 4 <= ctx->sender_queue_max))
+		rist_sender_queue_resize(ctx, target);
 }
 
-size_t rist_send_seq_rtcp(struct rist_peer *p, uint16_t seq_rtp, uint8_t payload_type, uint8_t *payload, size_t payload_len, uint64_t source_time, uint16_t src_port, uint16_t dst_port, bool retry)
+size_t rist_send_seq_rtcp(struct rist_peer *p, uint32_t seq_rtp, uint8_t payload_type, uint8_t *payload, size_t payload_len, uint64_t source_time, uint16_t src_port, uint16_t dst_port, bool retry)
 {
 	struct rist_common_ctx *ctx = get_cctx(p);
 	uint8_t *data;
@@ -117,11 +248,21 @@ size_t rist_send_seq_rtcp(struct rist_peer *p, uint16_t seq_rtp, uint8_t payload
 				//hdr->rtp.ssrc |= (1 << 31);
 				hdr->rtp.ssrc = htobe32(p->adv_flow_id | 0x01);
 			}
-			hdr->rtp.payload_type = RTP_PTYPE_MPEGTS;
+			hdr->rtp.payload_type = payload_type == RIST_PAYLOAD_TYPE_FEC ? RTP_PTYPE_FEC : RTP_PTYPE_MPEGTS;
 			hdr->rtp.ts = htobe32(timestampRTP_u32(0, source_time));
+			if (ctx->profile != RIST_PROFILE_SIMPLE && payload_type == RIST_PAYLOAD_TYPE_DATA_RAW) {
+				// TR-06-2 8.3 sequence number extension, null packet deleted payloads carry it in their own extension
+				struct rist_rtp_hdr_ext *hdr_ext = (void *)&header_buf[hdr_len];
+				SET_BIT(hdr->rtp.flags, 4);
+				memcpy(&hdr_ext->identifier, "RI", 2);
+				hdr_ext->length = htobe16(1);
+				SET_BIT(hdr_ext->flags, 6);
+				hdr_ext->seq_ext = htobe16((uint16_t)(seq_rtp >> 16));
+				hdr_len += sizeof(*hdr_ext);
+			}
 		}
 		// copy the rtp header data (needed for encryption)
-		memcpy(_payload - hdr_len, hdr, hdr_len);
+		memcpy(_payload - hdr_len, header_buf, hdr_len);
 	}
 
 	{
@@ -144,10 +285,21 @@ size_t rist_send_seq_rtcp(struct rist_peer *p, uint16_t seq_rtp, uint8_t payload
 		}
 	}
 
+#if HAVE_SENDMMSG
+	struct rist_send_batch *batch = p->sender_ctx ? p->sender_ctx->send_batch : NULL;
+	if (batch)
+		batch->retry = retry;
+	if (ctx->profile == RIST_PROFILE_SIMPLE && (ret = rist_send_batch_append(p, NULL, 0, data, len)) >= 0)
+		goto out;
+#endif
 	if (ctx->profile == RIST_PROFILE_SIMPLE)
 		ret = sendto(p->sd,(const char*)data, len, 0, &(p->u.address), p->address_len);
 	else
 		ret = _librist_proto_gre_send_data(p, payload_type, proto_type, data, len, src_port, dst_port, p->rist_gre_version);
+#if HAVE_SENDMMSG
+	if (batch)
+		batch->retry = false;
+#endif
 
 out:
 	if (RIST_UNLIKELY(ret <= 0)) {
@@ -160,11 +312,228 @@ out:
 	return ret;
 }
 
+#if HAVE_SENDMMSG
+/* Datagrams sent by the sender protocol thread during a drain loop are staged here and
+ * flushed with one sendmmsg call per socket. Stats and bitrate are accounted when staging,
+ * datagrams the kernel refuses at flush time are taken back out of them. */
+void rist_send_batch_begin(struct rist_sender *ctx)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	if (!batch)
+		return;
+	batch->count = 0;
+	batch->retry = false;
+	batch->owner = pthread_self();
+	batch->active = true;
+}
+
+ssize_t rist_send_batch_append(struct rist_peer *p, const uint8_t *hdr, size_t hdr_len, const uint8_t *payload, size_t payload_len)
+{
+	struct rist_send_batch *batch = p->sender_ctx ? p->sender_ctx->send_batch : NULL;
+	if (!batch || !batch->active || !pthread_equal(batch->owner, pthread_self()))
+		return -1;
+	size_t len = hdr_len + payload_len;
+	if (RIST_UNLIKELY(len > RIST_SEND_BATCH_SLOT_SIZE)) {
+		// Keep ordering intact before the caller sends this one directly
+		rist_send_batch_flush(p->sender_ctx);
+		return -1;
+	}
+	if (batch->count == RIST_SEND_BATCH_SIZE)
+		rist_send_batch_flush(p->sender_ctx);
+
+	size_t i = batch->count++;
+	if (hdr_len)
+		memcpy(batch->buf[i], hdr, hdr_len);
+	memcpy(&batch->buf[i][hdr_len], payload, payload_len);
+	batch->iov[i].iov_base = batch->buf[i];
+	batch->iov[i].iov_len = len;
+	memset(&batch->msgs[i], 0, sizeof(batch->msgs[i]));
+	batch->msgs[i].msg_hdr.msg_name = &p->u.address;
+	batch->msgs[i].msg_hdr.msg_namelen = p->address_len;
+	batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+	batch->msgs[i].msg_hdr.msg_iovlen = 1;
+#if HAVE_SO_TXTIME
+	rist_pacer_cmsg(p, &batch->msgs[i].msg_hdr, batch->ctrl[i]);
+#endif
+	batch->peer[i] = p;
+	batch->is_retry[i] = batch->retry;
+	return (ssize_t)len;
+}
+
+static void rist_send_batch_rollback(struct rist_send_batch *batch, size_t i, int errorcode)
+{
+	struct rist_peer *p = batch->peer[i];
+	size_t len = batch->iov[i].iov_len;
+	rist_log_priv(get_cctx(p), RIST_LOG_ERROR, "Send failed: errno=%d, reason=%s, socket=%d\n", errorcode, strerror(errorcode), p->sd);
+	if (p->stats_sender_instant.sent > 0)
+		p->stats_sender_instant.sent--;
+	if (p->stats_receiver_instant.sent_rtcp > 0)
+		p->stats_receiver_instant.sent_rtcp--;
+	struct rist_bandwidth_estimation *bw = &p->bw;
+	if (batch->is_retry[i]) {
+		bw = &p->retry_bw;
+		if (p->stats_sender_instant.retrans > 0)
+			p->stats_sender_instant.retrans--;
+		p->stats_sender_instant.retrans_skip++;
+	}
+	bw->bytes = bw->bytes > len ? bw->bytes - len : 0;
+	bw->bytes_fast = bw->bytes_fast > len ? bw->bytes_fast - len : 0;
+}
+
+static int rist_send_batch_sendmmsg(struct rist_sender *ctx, int sd, struct mmsghdr *msgs, unsigned int count)
+{
+#if HAVE_IO_URING
+	if (ctx->common.uring)
+		return rist_uring_sendmmsg(ctx->common.uring, sd, msgs, count);
+#else
+	RIST_MARK_UNUSED(ctx);
+#endif
+	return sendmmsg(sd, msgs, count, MSG_DONTWAIT);
+}
+
+static void rist_send_batch_run(struct rist_sender *ctx, int sd, size_t start, size_t end)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	while (start < end) {
+		int sent = rist_send_batch_sendmmsg(ctx, sd, &batch->msgs[start], (unsigned int)(end - start));
+		if (sent <= 0) {
+			// The datagram at start failed, skip it and carry on with the rest
+			rist_send_batch_rollback(batch, start, sent < 0 ? errno : EIO);
+			start++;
+		} else {
+			start += sent;
+		}
+	}
+}
+
+#if HAVE_UDP_SEGMENT
+void rist_send_batch_gso_probe(struct rist_sender *ctx)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	int sd = udpsocket_open(AF_INET);
+	if (sd < 0)
+		return;
+	int segment = 0;
+	socklen_t len = sizeof(segment);
+	batch->gso = getsockopt(sd, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+	udpsocket_close(sd);
+	if (batch->gso)
+		rist_log_priv(&ctx->common, RIST_LOG_INFO, "UDP GSO is available, coalescing sender bursts\n");
+}
+
+/* Groups the datagrams of a run into GSO messages: consecutive datagrams to the same peer where
+ * all but the last have the size of the first, which the kernel splits back up at that size.
+ * Datagrams carrying a departure time stay on their own. */
+static size_t rist_send_batch_gso_build(struct rist_send_batch *batch, size_t start, size_t end)
+{
+	size_t n = 0;
+	size_t i = start;
+	while (i < end) {
+		size_t seg = batch->iov[i].iov_len;
+		size_t total = seg;
+		size_t count = 1;
+		if (batch->msgs[i].msg_hdr.msg_controllen == 0) {
+			while (i + count < end && batch->peer[i + count] == batch->peer[i]
+					&& batch->msgs[i + count].msg_hdr.msg_controllen == 0
+					&& total + batch->iov[i + count].iov_len <= RIST_SEND_GSO_MAX_BYTES) {
+				size_t len = batch->iov[i + count].iov_len;
+				if (len > seg)
+					break;
+				total += len;
+				count++;
+				// A short datagram can only close a message
+				if (len < seg)
+					break;
+			}
+		}
+		struct msghdr *msg = &batch->gso_msgs[n].msg_hdr;
+		*msg = batch->msgs[i].msg_hdr;
+		msg->msg_iovlen = count;
+		if (count > 1) {
+			memset(batch->gso_ctrl[n], 0, sizeof(batch->gso_ctrl[n]));
+			msg->msg_control = batch->gso_ctrl[n];
+			msg->msg_controllen = sizeof(batch->gso_ctrl[n]);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(msg);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t gso_size = (uint16_t)seg;
+			memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+		}
+		batch->gso_first[n] = i;
+		batch->gso_count[n] = count;
+		n++;
+		i += count;
+	}
+	return n;
+}
+
+/* Returns the first datagram not handed to the kernel yet, end once the run is out */
+static size_t rist_send_batch_gso_run(struct rist_sender *ctx, int sd, size_t start, size_t end)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	size_t n = rist_send_batch_gso_build(batch, start, end);
+	size_t m = 0;
+	while (m < n) {
+		int sent = rist_send_batch_sendmmsg(ctx, sd, &batch->gso_msgs[m], (unsigned int)(n - m));
+		if (sent > 0) {
+			m += sent;
+			continue;
+		}
+		int errorcode = sent < 0 ? errno : EIO;
+		size_t first = batch->gso_first[m];
+		size_t count = batch->gso_count[m];
+		if (count > 1 && (errorcode == EIO || errorcode == EINVAL || errorcode == ENOPROTOOPT || errorcode == EOPNOTSUPP)) {
+			// The route or the device cannot segment, e.g. no checksum offload, go back to one datagram per message
+			batch->gso = false;
+			rist_log_priv(&ctx->common, RIST_LOG_WARN, "UDP GSO send failed (%s), disabling it\n", strerror(errorcode));
+			return first;
+		}
+		for (size_t i = first; i < first + count; i++)
+			rist_send_batch_rollback(batch, i, errorcode);
+		m++;
+	}
+	return end;
+}
+#endif
+
+void rist_send_batch_flush(struct rist_sender *ctx)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	if (!batch || !batch->count)
+		return;
+	size_t start = 0;
+	while (start < batch->count) {
+		// sendmmsg works on a single socket, send each run of datagrams sharing one
+		int sd = batch->peer[start]->sd;
+		size_t end = start + 1;
+		while (end < batch->count && batch->peer[end]->sd == sd)
+			end++;
+#if HAVE_UDP_SEGMENT
+		if (batch->gso)
+			start = rist_send_batch_gso_run(ctx, sd, start, end);
+#endif
+		rist_send_batch_run(ctx, sd, start, end);
+		start = end;
+	}
+	batch->count = 0;
+}
+
+void rist_send_batch_end(struct rist_sender *ctx)
+{
+	struct rist_send_batch *batch = ctx->send_batch;
+	if (!batch)
+		return;
+	rist_send_batch_flush(ctx);
+	batch->active = false;
+}
+#endif
+
 /* This function is used by receiver for all and by sender only for rist-data and oob-data */
 int rist_send_common_rtcp(struct rist_peer *p, uint8_t payload_type, uint8_t *payload, size_t payload_len, uint64_t source_time, uint16_t src_port, uint16_t dst_port, uint32_t seq_rtp)
 {
 	// This can only and will most likely be zero for data packets. RTCP should always have a value.
-	assert(payload_type != RIST_PAYLOAD_TYPE_DATA_RAW && payload_type != RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT && payload_type != RIST_PAYLOAD_TYPE_DATA_OOB ? dst_port != 0 : 1);
+	assert(payload_type != RIST_PAYLOAD_TYPE_DATA_RAW && payload_type != RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT && payload_type != RIST_PAYLOAD_TYPE_DATA_OOB && payload_type != RIST_PAYLOAD_TYPE_FEC ? dst_port != 0 : 1);
 	if (dst_port == 0)
 		dst_port = p->config.virt_dst_port;
 	if (src_port == 0)
@@ -185,7 +554,7 @@ int rist_send_common_rtcp(struct rist_peer *p, uint8_t payload_type, uint8_t *pa
 	if (RIST_UNLIKELY(p->config.timing_mode == RIST_TIMING_MODE_ARRIVAL) && !p->receiver_mode)
 		source_time = timestampNTP_u64();
 
-	size_t ret = rist_send_seq_rtcp(p, (uint16_t)seq_rtp, payload_type, payload, payload_len, source_time, src_port, dst_port, false);
+	size_t ret = rist_send_seq_rtcp(p, seq_rtp, payload_type, payload, payload_len, source_time, src_port, dst_port, false);
 
 	if ((!p->compression && ret < payload_len) || ret <= 0)
 	{
@@ -323,6 +692,49 @@ void rist_populate_cname(struct rist_peer *peer)
 	}
 }
 
+/* Number of shards a listening socket of peer is spread over, see RIST_OPT_RECEIVER_SHARDS */
+static uint32_t rist_peer_shards(struct rist_peer *peer)
+{
+	if (!peer->receiver_mode || peer->multicast_receiver)
+		return 0;
+	struct rist_receiver *ctx = peer->receiver_ctx->shard_parent ? peer->receiver_ctx->shard_parent : peer->receiver_ctx;
+	return ctx->shard_count > 1 ? ctx->shard_count : 0;
+}
+
+#if HAVE_REUSEPORT_CBPF
+/* Picks the shard from the source address instead of the kernel's 4-tuple hash: the RTP and RTCP ports of
+ * the simple profile then pick the same shard for a sender. The sockets of every port are bound in shard
+ * order, so the index into the reuseport group is the shard. */
+static void rist_shard_steer(struct rist_peer *peer, uint32_t shards)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 2, 0),
+		// IPv4 source address
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_JUMP(BPF_JMP | BPF_JA, 10, 0, 0),
+		// IPv6 source address folded into 32 bits
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shards),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+	if (setsockopt(peer->sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0)
+		rist_log_priv(get_cctx(peer), RIST_LOG_WARN, "Could not steer the shards by source address (%s), senders are hashed by the kernel\n",
+			strerror(errno));
+}
+#endif
+
 void rist_create_socket(struct rist_peer *peer)
 {
 	if(!peer->address_family && rist_set_url(peer)) {
@@ -359,7 +771,16 @@ void rist_create_socket(struct rist_peer *peer)
 			peer->multicast_receiver = IN6_IS_ADDR_MULTICAST(&addrv6->sin6_addr);
 		}
 
-		peer->sd = udpsocket_open_bind(host, port, peer->miface);
+		uint32_t shards = rist_peer_shards(peer);
+		if (shards) {
+			peer->sd = udpsocket_open_bind_reuseport(host, port, peer->miface);
+			peer->reuseport = peer->sd >= 0;
+#if HAVE_REUSEPORT_CBPF
+			if (peer->reuseport)
+				rist_shard_steer(peer, shards);
+#endif
+		} else
+			peer->sd = udpsocket_open_bind(host, port, peer->miface);
 		if (peer->sd >= 0) {
 			rist_log_priv(get_cctx(peer), RIST_LOG_INFO, "Starting in URL listening mode (socket# %d)\n", peer->sd);
 		} else {
@@ -456,6 +877,19 @@ void rist_create_socket(struct rist_peer *peer)
 			current_sendbuf);
 	}
 
+#if HAVE_SO_TIMESTAMPING
+	if (get_cctx(peer)->rx_timestamps)
+		rist_rx_timestamps_enable(peer);
+#endif
+#if HAVE_UDP_GRO
+#if HAVE_IO_URING
+	// The io_uring engine reads into fixed size buffers
+	rist_udp_gro_set(peer, get_cctx(peer)->uring == NULL);
+#else
+	rist_udp_gro_set(peer, true);
+#endif
+#endif
+
 	if (peer->cname[0] == 0)
 		rist_populate_cname(peer);
 	rist_log_priv(get_cctx(peer), RIST_LOG_INFO, "Peer cname is %s\n", peer->cname);
@@ -468,6 +902,95 @@ void rist_create_socket(struct rist_peer *peer)
 #endif
 }
 
+#if HAVE_SO_TIMESTAMPING
+int rist_rx_timestamps_enable(struct rist_peer *peer)
+{
+	struct rist_common_ctx *cctx = get_cctx(peer);
+	if (peer->sd < 0)
+		return -1;
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (cctx->rx_timestamps == 2)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (setsockopt(peer->sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+		return 0;
+	int errorcode = errno;
+	int enable = 1;
+	if (setsockopt(peer->sd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0) {
+		rist_log_priv(cctx, RIST_LOG_INFO, "SO_TIMESTAMPING not available (%s), using SO_TIMESTAMPNS on socket %d\n",
+			strerror(errorcode), peer->sd);
+		return 0;
+	}
+	rist_log_priv(cctx, RIST_LOG_WARN, "Could not enable receive timestamps on socket %d: %s\n", peer->sd, strerror(errno));
+	return -1;
+}
+
+/* Kernel and NIC stamps are CLOCK_REALTIME (a NIC clock is only usable when it is synchronised
+ * to it). Their age against realtime is taken off now, so a realtime step only skews the packets
+ * in flight, and those are caught by the range check. */
+static bool rist_rx_timestamp_age(const struct timespec *stamp, const struct timespec *realtime, uint64_t *age)
+{
+	if (stamp->tv_sec == 0 && stamp->tv_nsec == 0)
+		return false;
+	int64_t age_ns = ((int64_t)realtime->tv_sec - (int64_t)stamp->tv_sec) * 1000000000LL +
+		((int64_t)realtime->tv_nsec - (int64_t)stamp->tv_nsec);
+	if (age_ns < 0 || age_ns >= 1000000000LL)
+		return false;
+	*age = (uint64_t)age_ns * RIST_CLOCK / 1000000;
+	return true;
+}
+
+uint64_t rist_rx_timestamp(const struct msghdr *msg, const struct timespec *realtime, uint64_t now)
+{
+	uint64_t age;
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR((struct msghdr *)msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+		if (cm->cmsg_type == SCM_TIMESTAMPING) {
+			// software, deprecated and raw hardware stamps, the hardware one is the closest to the wire
+			struct timespec stamps[3];
+			memcpy(stamps, CMSG_DATA(cm), sizeof(stamps));
+			if (rist_rx_timestamp_age(&stamps[2], realtime, &age) || rist_rx_timestamp_age(&stamps[0], realtime, &age))
+				return now - age;
+		} else if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec stamp;
+			memcpy(&stamp, CMSG_DATA(cm), sizeof(stamp));
+			if (rist_rx_timestamp_age(&stamp, realtime, &age))
+				return now - age;
+		}
+	}
+	return now;
+}
+#endif
+
+#if HAVE_UDP_GRO
+int rist_udp_gro_set(struct rist_peer *peer, bool enable)
+{
+	int value = enable;
+	peer->gro = false;
+	if (peer->sd < 0)
+		return -1;
+	if (setsockopt(peer->sd, SOL_UDP, UDP_GRO, &value, sizeof(value)) != 0) {
+		if (enable)
+			rist_log_priv(get_cctx(peer), RIST_LOG_INFO, "UDP GRO not available on socket %d: %s\n", peer->sd, strerror(errno));
+		return -1;
+	}
+	peer->gro = enable;
+	return 0;
+}
+
+size_t rist_udp_gro_segment(const struct msghdr *msg)
+{
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR((struct msghdr *)msg, cm)) {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+			int segment;
+			memcpy(&segment, CMSG_DATA(cm), sizeof(segment));
+			return segment > 0 ? (size_t)segment : 0;
+		}
+	}
+	return 0;
+}
+#endif
+
 int rist_receiver_periodic_rtcp(struct rist_peer *peer) {
 	uint8_t payload_type = RIST_PAYLOAD_TYPE_RTCP;
 	uint8_t *rtcp_buf = get_cctx(peer)->buf.rtcp;
@@ -481,7 +1004,7 @@ int rist_receiver_periodic_rtcp(struct rist_peer *peer) {
 	return rist_send_common_rtcp(peer, payload_type, &rtcp_buf[RIST_MAX_PAYLOAD_OFFSET], payload_len, 0, peer->local_port, peer->remote_port, 0);
 }
 
-int rist_receiver_send_nacks(struct rist_peer *peer, uint32_t seq_array[], size_t array_len)
+int rist_receiver_send_nacks(struct rist_peer *peer, uint32_t seq_array[], size_t array_len, bool seq_ext)
 {
 	if (get_cctx(peer)->debug)
 		rist_log_priv(get_cctx(peer), RIST_LOG_DEBUG, "Sending %d nacks starting with %"PRIu32"\n",
@@ -497,6 +1020,10 @@ int rist_receiver_send_nacks(struct rist_peer *peer, uint32_t seq_array[], size_
 		struct rist_rtp_nack_record *rec;
 		uint32_t fci_count = 1;
 
+		// The caller never mixes seq msbs in one call, the records below only carry the low 16 bits
+		if (seq_ext)
+			rist_rtcp_write_seqext(rtcp_buf, &payload_len, (uint16_t)(seq_array[0] >> 16), peer->adv_flow_id);
+
 		// Now the NACK message
 		if (peer->receiver_ctx->nack_type == RIST_NACK_BITMASK)
 		{
@@ -625,6 +1152,18 @@ int rist_request_echo(struct rist_peer *peer) {
 	}
 }
 
+/* Leave the enqueue section, waking a resize that is waiting for us */
+static inline void rist_sender_enqueue_done(struct rist_sender *ctx)
+{
+	atomic_store_explicit(&ctx->sender_queue_writing, false, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (RIST_UNLIKELY(atomic_load_explicit(&ctx->sender_queue_resizing, memory_order_relaxed))) {
+		pthread_mutex_lock(&ctx->resize_mutex);
+		pthread_cond_broadcast(&ctx->resize_condition);
+		pthread_mutex_unlock(&ctx->resize_mutex);
+	}
+}
+
 int rist_sender_enqueue(struct rist_sender *ctx, const void *data, size_t len, uint64_t datagram_time, uint16_t src_port, uint16_t dst_port, uint32_t seq_rtp)
 {
 	uint8_t payload_type = RIST_PAYLOAD_TYPE_DATA_RAW;
@@ -645,160 +1184,304 @@ int rist_sender_enqueue(struct rist_sender *ctx, const void *data, size_t len, u
 		{
 			memcpy(&hdr_ext->identifier, "RI", 2);
 			hdr_ext->length = htobe16(1);
+			if (ctx->common.profile != RIST_PROFILE_SIMPLE) {
+				SET_BIT(hdr_ext->flags, 6);
+				hdr_ext->seq_ext = htobe16((uint16_t)(seq_rtp >> 16));
+			}
 			len += sizeof(*hdr_ext);
 			payload = tmp_buf;
 			payload_type = RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT;
 		}
 	}
 
-	/* insert into sender fifo queue */
-	pthread_mutex_lock(&ctx->queue_lock);
-	size_t sender_write_index = atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire);
-	ctx->sender_queue[sender_write_index] = rist_new_buffer(&ctx->common, payload, len, payload_type, 0, datagram_time, src_port, dst_port);
-	if (RIST_UNLIKELY(!ctx->sender_queue[sender_write_index])) {
+	struct rist_buffer *b = rist_new_buffer(&ctx->common, payload, len, payload_type, 0, datagram_time, src_port, dst_port);
+	if (RIST_UNLIKELY(!b)) {
 		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "\t Could not create packet buffer inside sender buffer, OOM, decrease max bitrate or buffer time length\n");
-		pthread_mutex_unlock(&ctx->queue_lock);
 		return -1;
 	}
-	ctx->sender_queue[sender_write_index]->seq_rtp = (uint16_t)seq_rtp;
-	ctx->sender_queue_bytesize += len;
-	atomic_store_explicit(&ctx->sender_queue_write_index, (sender_write_index + 1) & (ctx->sender_queue_max - 1), memory_order_release);
-	pthread_mutex_unlock(&ctx->queue_lock);
+	b->seq_rtp = seq_rtp;
+
+	/* Keep the protocol thread from swapping the ring underneath us, see rist_sender_queue_resize */
+	atomic_store_explicit(&ctx->sender_queue_writing, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (RIST_UNLIKELY(atomic_load_explicit(&ctx->sender_queue_resizing, memory_order_acquire))) {
+		pthread_mutex_lock(&ctx->resize_mutex);
+		while (atomic_load_explicit(&ctx->sender_queue_resizing, memory_order_acquire)) {
+			atomic_store_explicit(&ctx->sender_queue_writing, false, memory_order_release);
+			pthread_cond_broadcast(&ctx->resize_condition);
+			pthread_cond_wait(&ctx->resize_condition, &ctx->resize_mutex);
+		}
+		// Raised under the mutex, a new resize sees it before it can start
+		atomic_store_explicit(&ctx->sender_queue_writing, true, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		pthread_mutex_unlock(&ctx->resize_mutex);
+	}
+
+	/* insert into sender fifo queue, only this (single) writer moves the write index */
+	size_t sender_write_index = atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_relaxed);
+	size_t next_write_index = (sender_write_index + 1) & (ctx->sender_queue_max - 1);
+	if (RIST_UNLIKELY(next_write_index == atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_acquire))) {
+		rist_sender_enqueue_done(ctx);
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "\t Sender buffer is full, dropping packet, decrease max bitrate or buffer time length\n");
+		free_rist_buffer(&ctx->common, b);
+		return -1;
+	}
+	ctx->sender_queue[sender_write_index] = b;
+	atomic_fetch_add_explicit(&ctx->sender_queue_bytesize, len, memory_order_relaxed);
+	atomic_store_explicit(&ctx->sender_queue_write_index, next_write_index, memory_order_release);
+	rist_sender_enqueue_done(ctx);
 
 	return 0;
 }
 
-void rist_sender_send_data_balanced(struct rist_sender *ctx, struct rist_buffer *buffer)
+/* Parity protects the stream as a whole, so it goes out on every data path like a weight 0 peer.
+   Only peers that advertise FEC support in their keepalive get it, a receiver without it would
+   output the parity as data and lose packets to the colliding parity seq numbers. */
+static void rist_sender_send_fec(struct rist_sender *ctx, const struct rist_fec_packet *fec, uint64_t source_time, uint16_t src_port, uint16_t dst_port)
 {
-	struct rist_peer *peer;
-	struct rist_peer *selected_peer_by_weight = NULL;
-	uint32_t max_remainder = 0;
-	int peercnt;
-	bool looped = false;
-
-	//We can do it safely here, since this function is only to be called once per packet
-	buffer->seq = ctx->common.seq++;
 	uint64_t now = timestampNTP_u64();
-
-peer_select:
-
-	peercnt = 0;
-	for (peer = ctx->common.PEERS; peer; peer = peer->next) {
-
+	for (struct rist_peer *peer = ctx->common.PEERS; peer; peer = peer->next) {
 		if (!peer->is_data || peer->parent)
 			continue;
+		if (peer->listening) {
+			for (struct rist_peer *child = peer->child; child; child = child->sibling_next) {
 #if HAVE_SRP_SUPPORT
-		if (!peer->listening && !peer->multicast_sender && !eap_is_authenticated(peer->eap_ctx))
-			continue;
+				if (!eap_is_authenticated(child->eap_ctx))
+					continue;
 #endif
-		if ((!peer->listening && !peer->authenticated) || peer->dead
-			|| (peer->listening && !peer->child_alive_count)) {
-			ctx->weight_counter -= peer->config.weight;
-			if (ctx->weight_counter <= 0) {
-				ctx->weight_counter = ctx->total_weight;
+				if (child->authenticated && child->is_data && child->data.f && (!child->dead || (child->dead_since + peer->recovery_buffer_ticks) < now))
+					rist_send_common_rtcp(child, RIST_PAYLOAD_TYPE_FEC, fec->data, fec->len, source_time, src_port, dst_port, fec->seq);
 			}
-			peer->w_count = peer->config.weight;
 			continue;
 		}
-		peercnt++;
-
-		/*************************************/
-		/* * * * * * * * * * * * * * * * * * */
-		/** Heuristics for sender goes here **/
-		/* * * * * * * * * * * * * * * * * * */
-		/*************************************/
-
-		if (peer->config.weight == 0 && !looped) {
-			if (peer->listening) {
-				struct rist_peer *child = peer->child;
-				while (child) {
 #if HAVE_SRP_SUPPORT
-					if (!eap_is_authenticated(child->eap_ctx))
-					{
-						//do nothing
-					} else
+		if (!peer->multicast_sender && !eap_is_authenticated(peer->eap_ctx))
+			continue;
 #endif
-					if (child->authenticated && child->is_data && (!child->dead || (child->dead && (child->dead_since + peer->recovery_buffer_ticks) < now))) {
-						uint8_t *payload = buffer->data;
-						rist_send_common_rtcp(child, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port, buffer->seq_rtp);
-					}
-					child = child->sibling_next;
-				}
-			} else if (!peer->dead || (peer->dead && (peer->dead_since + peer->recovery_buffer_ticks) < now)) {
-				uint8_t *payload = buffer->data;
-				rist_send_common_rtcp(peer, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port, buffer->seq_rtp);
-			}
-		} else {
-			/* Election of next peer */
-			// printf("peer election: considering %p, count=%d (wc: %d)\n",
-			// peer, peer->w_count, ctx->weight_counter);
-			if (peer->w_count > max_remainder) {
-				max_remainder = peer->w_count;
-				selected_peer_by_weight = peer;
-			}
-		}
+		if (peer->authenticated && !peer->dead && peer->data.f)
+			rist_send_common_rtcp(peer, RIST_PAYLOAD_TYPE_FEC, fec->data, fec->len, source_time, src_port, dst_port, fec->seq);
 	}
-	looped = true;
-	if (selected_peer_by_weight) {
-		peer = selected_peer_by_weight;
-		if (peer->listening) {
-			struct rist_peer *child = peer->child;
-			while (child) {
+}
+
+void rist_sender_fec_encode(struct rist_sender *ctx, struct rist_buffer *buffer)
+{
+	if (ctx->common.profile == RIST_PROFILE_SIMPLE)
+		return;
+	struct rist_fec_packet fec[2];
+	uint8_t *payload = (uint8_t *)buffer->data + RIST_MAX_PAYLOAD_OFFSET;
+	size_t len = buffer->size;
+	uint8_t expanded[7 * 204];
+	if (buffer->type == RIST_PAYLOAD_TYPE_DATA_RAW_RTP_EXT) {
+		// Protect the payload the way receivers store it: without the extension, null packets restored
+		struct rist_rtp_hdr_ext *hdr_ext = (struct rist_rtp_hdr_ext *)payload;
+		len -= sizeof(*hdr_ext);
+		memcpy(expanded, &payload[sizeof(*hdr_ext)], len);
+		if (CHECK_BIT(hdr_ext->flags, 7))
+			expand_null_packets(expanded, &len, hdr_ext->npd_bits);
+		payload = expanded;
+	}
+	size_t count = rist_fec_encoder_add(ctx->fec, buffer->seq_rtp, payload, len, timestampRTP_u32(0, buffer->source_time), fec);
+	for (size_t i = 0; i < count; i++)
+		rist_sender_send_fec(ctx, &fec[i], buffer->source_time, buffer->src_port, buffer->dst_port);
+}
+
+static void rist_sender_send_path(struct rist_peer *peer, struct rist_buffer *buffer, uint64_t now)
+{
+	uint8_t *payload = buffer->data;
+	if (peer->config.pacing_mode != RIST_PACING_MODE_OFF)
+		rist_pacer_depart(peer, buffer->size, buffer->time, now);
+	if (peer->listening) {
+		struct rist_peer *child = peer->child;
+		while (child) {
 #if HAVE_SRP_SUPPORT
-					if (!eap_is_authenticated(child->eap_ctx))
-					{
-						//do nothing
-					} else
+			if (!eap_is_authenticated(child->eap_ctx))
+			{
+				//do nothing
+			} else
 #endif
-				if (child->authenticated && child->is_data && (!child->dead || (child->dead && (child->dead_since + peer->recovery_buffer_ticks) < now))) {
-					uint8_t *payload = buffer->data;
-					rist_send_common_rtcp(child, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port,  buffer->seq_rtp);
-				}
-				child = child->sibling_next;
+			if (child->authenticated && child->is_data && (!child->dead || (child->dead && (child->dead_since + peer->recovery_buffer_ticks) < now))) {
+				rist_send_common_rtcp(child, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port, buffer->seq_rtp);
 			}
-		} else if (!peer->dead || (peer->dead && (peer->dead_since + peer->recovery_buffer_ticks) < now)) {
-			uint8_t *payload = buffer->data;
-			rist_send_common_rtcp(peer, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port, buffer->seq_rtp);
+			child = child->sibling_next;
 		}
-		ctx->weight_counter--;
-		peer->w_count--;
+	} else if (!peer->dead || (peer->dead && (peer->dead_since + peer->recovery_buffer_ticks) < now)) {
+		rist_send_common_rtcp(peer, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, buffer->src_port, buffer->dst_port, buffer->seq_rtp);
 	}
+	peer->pacer.txtime_ns = 0;
+}
 
-	if (ctx->total_weight > 0 && (ctx->weight_counter == 0 || !selected_peer_by_weight)) {
-		peer = ctx->common.PEERS;
-		ctx->weight_counter = ctx->total_weight;
-		for (; peer; peer = peer->next) {
-			peer->w_count = peer->config.weight;
-		}
-		if (!looped && !selected_peer_by_weight && peercnt > 0)
-			goto peer_select;
+void rist_sender_send_data_balanced(struct rist_sender *ctx, struct rist_buffer *buffer)
+{
+	//We can do it safely here, since this function is only to be called once per packet
+	buffer->seq = ctx->common.seq++;
+	uint64_t now = timestampNTP_u64();
+
+	/*************************************/
+	/* * * * * * * * * * * * * * * * * * */
+	/** Heuristics for sender goes here **/
+	/* * * * * * * * * * * * * * * * * * */
+	/*************************************/
+
+	// Elect the weighted path first, it brings the path set up to date
+	struct rist_peer *selected = rist_paths_next(ctx, now);
+	struct rist_path_set *ps = &ctx->paths;
+	for (size_t i = 0; i < ps->mirror_count; i++) {
+		if (rist_path_usable(ps->mirrors[i]))
+			rist_sender_send_path(ps->mirrors[i], buffer, now);
+		else
+			atomic_store_explicit(&ctx->paths_dirty, true, memory_order_relaxed);
 	}
+	if (selected)
+		rist_sender_send_path(selected, buffer, now);
+	// Remembered so retransmission requests can be held against the path
+	buffer->peer = selected;
 }
 
 static size_t rist_sender_index_get(struct rist_sender *ctx, uint32_t seq)
 {
-	size_t idx = ctx->seq_index[(uint16_t)seq];
+	// Entries of packets that left the ring may predate a resize, the seq_rtp check catches those
+	size_t idx = ctx->seq_index[seq & (ctx->sender_queue_max - 1)] & (ctx->sender_queue_max - 1);
 	return idx;
 }
 
 size_t rist_get_sender_retry_queue_size(struct rist_sender *ctx)
 {
-	size_t retry_queue_size = (ctx->sender_retry_queue_write_index - ctx->sender_retry_queue_read_index)
-							& (ctx->sender_retry_queue_size - 1);
-	return retry_queue_size;
+	return ctx->retry_pending.count;
 }
 
-/* This function must return, 0 when there is nothing to send, < 0 on error and > 0 for bytes sent */
-ssize_t rist_retry_dequeue(struct rist_sender *ctx)
+static inline bool retry_entry_before(const struct rist_retry_pending *a, const struct rist_retry_pending *b)
 {
-	size_t sender_retry_queue_read_index = (ctx->sender_retry_queue_read_index + 1)& (ctx->sender_retry_queue_size -1);
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
 
-	if (sender_retry_queue_read_index == ctx->sender_retry_queue_write_index) {
-		return 0;
+static void retry_heap_sift_up(struct rist_retry_pending *heap, size_t i)
+{
+	struct rist_retry_pending tmp = heap[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!retry_entry_before(&tmp, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
 	}
+	heap[i] = tmp;
+}
 
-	ctx->sender_retry_queue_read_index = sender_retry_queue_read_index;
-	struct rist_retry *retry = &ctx->sender_retry_queue[ctx->sender_retry_queue_read_index];
+static void retry_heap_sift_down(struct rist_retry_pending *heap, size_t count, size_t i)
+{
+	struct rist_retry_pending tmp = heap[i];
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && retry_entry_before(&heap[child + 1], &heap[child]))
+			child++;
+		if (!retry_entry_before(&heap[child], &tmp))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = tmp;
+}
+
+static int rist_retry_queue_push(struct rist_sender *ctx, const struct rist_retry_pending *r)
+{
+	struct rist_retry_queue *q = &ctx->retry_pending;
+	if (RIST_UNLIKELY(q->count == q->size)) {
+		size_t size = q->size ? 2 * q->size : RIST_RETRY_QUEUE_INITIAL;
+		struct rist_retry_pending *entries = realloc(q->entries, size * sizeof(*entries));
+		if (!entries) {
+			rist_log_priv(&ctx->common, RIST_LOG_ERROR,
+				"Could not grow the retry queue beyond %zu entries, OOM\n", q->size);
+			return -1;
+		}
+		q->entries = entries;
+		q->size = size;
+	}
+	// Deferred entries only exist inside sender_send_nacks, so count == heap_count here
+	q->entries[q->count] = *r;
+	retry_heap_sift_up(q->entries, q->count);
+	q->count++;
+	q->heap_count++;
+	return 0;
+}
+
+/* Takes the earliest deadline off the heap if it is no later than limit. Like the receiver
+ * missing queue, the entry moves to the first deferred slot and stays valid until removed. */
+static struct rist_retry_pending *rist_retry_queue_pop(struct rist_retry_queue *q, uint64_t limit)
+{
+	if (q->heap_count == 0 || q->entries[0].deadline > limit)
+		return NULL;
+	struct rist_retry_pending top = q->entries[0];
+	q->heap_count--;
+	if (q->heap_count > 0) {
+		q->entries[0] = q->entries[q->heap_count];
+		retry_heap_sift_down(q->entries, q->heap_count, 0);
+	}
+	q->entries[q->heap_count] = top;
+	return &q->entries[q->heap_count];
+}
+
+void rist_retry_queue_requeue(struct rist_sender *ctx)
+{
+	struct rist_retry_queue *q = &ctx->retry_pending;
+	while (q->heap_count < q->count) {
+		retry_heap_sift_up(q->entries, q->heap_count);
+		q->heap_count++;
+	}
+}
+
+/* The retry was sent or given up on: drop it and let new requests for its seq in */
+static void rist_retry_done(struct rist_sender *ctx, struct rist_retry_pending *r, struct rist_buffer *buffer)
+{
+	struct rist_retry_queue *q = &ctx->retry_pending;
+	size_t idx = (size_t)(r - q->entries);
+	assert(idx >= q->heap_count && idx < q->count);
+	if (r->history_index != SIZE_MAX) {
+		struct rist_retry *retry = &ctx->sender_retry_queue[r->history_index];
+		if (retry->seq == r->seq && retry->peer == r->peer)
+			retry->active = false;
+	}
+	if (buffer)
+		buffer->retry_queued = false;
+	q->count--;
+	if (idx != q->count)
+		q->entries[idx] = q->entries[q->count];
+}
+
+/* Retries get what the data leaves of recovery_maxbitrate. The bucket holds two protocol loop
+ * intervals worth of it (at least one packet), so retries go out evenly rather than in bursts. */
+static bool rist_retry_tokens_take(struct rist_sender *ctx, struct rist_peer *bucket, size_t max_bitrate,
+								   size_t data_bitrate, size_t bytes, uint64_t now)
+{
+	double rate = max_bitrate > data_bitrate ? (double)(max_bitrate - data_bitrate) / 8.0 : 0.0;
+	double depth = rate * 2.0 * (double)ctx->common.rist_max_jitter / (double)ONE_SECOND;
+	if (depth < (double)bytes)
+		depth = (double)bytes;
+	if (bucket->retry_tokens_time == 0)
+		bucket->retry_tokens = depth;
+	else if (now > bucket->retry_tokens_time)
+		bucket->retry_tokens += rate * (double)(now - bucket->retry_tokens_time) / (double)ONE_SECOND;
+	bucket->retry_tokens_time = now;
+	if (bucket->retry_tokens > depth)
+		bucket->retry_tokens = depth;
+	if (bucket->retry_tokens < (double)bytes)
+		return false;
+	bucket->retry_tokens -= (double)bytes;
+	return true;
+}
+
+/* Sends the pending retry with the earliest deadline, provided that deadline is no later than
+ * deadline_limit. This function must return 0 when there is nothing to send, -2 when the retry
+ * was held back to respect the bandwidth limit, < 0 on error and > 0 for bytes sent */
+ssize_t rist_retry_dequeue(struct rist_sender *ctx, uint64_t deadline_limit)
+{
+	struct rist_retry_pending *retry = rist_retry_queue_pop(&ctx->retry_pending, deadline_limit);
+	if (!retry)
+		return 0;
+	struct rist_peer *peer = retry->peer;
 
 	// If they request a non-sense seq number, we will catch it when we check the seq number against
 	// the one on that buffer position and it does not match
@@ -807,109 +1490,110 @@ ssize_t rist_retry_dequeue(struct rist_sender *ctx)
 	if (RIST_UNLIKELY(ctx->sender_queue[idx] == NULL)) {
 		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
 			" Couldn't find block %" PRIu32 " (i=%zu/r=%zu/w=%zu/d=%zu/rs=%zu), consider increasing the buffer size\n",
-			retry->seq, idx, atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire), ctx->sender_queue_delete_index,
+			retry->seq, idx, atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed),
 			rist_get_sender_retry_queue_size(ctx));
-		retry->peer->stats_sender_instant.retrans_skip++;
+		peer->stats_sender_instant.retrans_skip++;
+		rist_retry_done(ctx, retry, NULL);
 		return -1;
-	} else if (RIST_UNLIKELY((uint16_t)retry->seq != ctx->sender_queue[idx]->seq_rtp)) {
+	} else if (RIST_UNLIKELY(retry->seq != ctx->sender_queue[idx]->seq_rtp)) {
 		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
-			" Couldn't find block %" PRIu16 " (i=%zu/r=%zu/w=%zu/d=%zu/rs=%zu), found an old one instead %" PRIu32 " (%" PRIu64 "), bitrate is too high\n",
-			(uint16_t)retry->seq, idx, atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire), ctx->sender_queue_delete_index,
+			" Couldn't find block %" PRIu32 " (i=%zu/r=%zu/w=%zu/d=%zu/rs=%zu), found an old one instead %" PRIu32 " (%zu), bitrate is too high\n",
+			retry->seq, idx, atomic_load_explicit(&ctx->sender_queue_read_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_write_index, memory_order_acquire), atomic_load_explicit(&ctx->sender_queue_delete_index, memory_order_relaxed),
 			rist_get_sender_retry_queue_size(ctx), ctx->sender_queue[idx]->seq_rtp, ctx->sender_queue_max);
-		retry->peer->stats_sender_instant.retrans_skip++;
+		peer->stats_sender_instant.retrans_skip++;
+		rist_retry_done(ctx, retry, NULL);
 		return -1;
 	}
-	/* we're consuming the retry for an existing buffer, set it to false to allow new retries to come in */
-	ctx->sender_queue[idx]->retry_queued = false;
-	retry->active = false;
+	struct rist_buffer *buffer = ctx->sender_queue[idx];
 
 	// TODO: re-enable rist_send_data_allowed (cooldown feature)
 
-	struct rist_bandwidth_estimation *retry_bw = &retry->peer->retry_bw;
-	struct rist_bandwidth_estimation *cli_bw = &retry->peer->bw;
-	if (retry->peer->peer_data)
-	{
-		retry_bw = &retry->peer->peer_data->retry_bw;
+	// Check buffer element age
+	uint64_t now = timestampNTP_u64();
+	/* queue_time holds the original insertion time for this seq */
+	uint64_t data_age = (now - buffer->time) / RIST_CLOCK;
+	uint64_t retry_age = (now - retry->insert_time) / RIST_CLOCK;
+	if (RIST_UNLIKELY(now > retry->deadline)) {
+		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
+			"Retry-request of element %" PRIu32 " (idx %zu) that was sent %" PRIu64
+				"ms ago missed its deadline by %" PRIu64 "ms after %" PRIu64 "ms in the queue\n",
+			retry->seq, idx, data_age, (now - retry->deadline) / RIST_CLOCK, retry_age);
+		// Retries that ran out of time waiting for tokens are the ones the old hard limit dropped
+		if (retry->throttled)
+			peer->stats_sender_instant.bandwidth_skip++;
+		else
+			peer->stats_sender_instant.retrans_skip++;
+		rist_retry_done(ctx, retry, buffer);
+		return -1;
+	}
+
+	if (buffer->transmit_count >= peer->config.max_retries) {
+		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Datagram %"PRIu32
+			" is missing, but nack count is too large (%u), age is %"PRIu64"ms, retry #%lu\n",
+			retry->seq, buffer->transmit_count, data_age, buffer->transmit_count);
+		peer->stats_sender_instant.retrans_skip++;
+		rist_retry_done(ctx, retry, buffer);
+		return -1;
 	}
+
+	struct rist_peer *bucket = peer->peer_data ? peer->peer_data : peer;
+	struct rist_bandwidth_estimation *retry_bw = &bucket->retry_bw;
+	struct rist_bandwidth_estimation *cli_bw = &peer->bw;
 	// update bandwidth values
 	rist_calculate_bitrate(0, cli_bw);
 	rist_calculate_bitrate(0, retry_bw);
 
 	// Make sure we do not flood the network with retries
-	size_t current_bitrate = 0;
 	size_t data_bitrate = 0;
 	size_t retry_bitrate = 0;
-	if (retry->peer->config.congestion_control_mode == RIST_CONGESTION_CONTROL_MODE_AGGRESSIVE) {
+	if (peer->config.congestion_control_mode == RIST_CONGESTION_CONTROL_MODE_AGGRESSIVE) {
 		data_bitrate = cli_bw->eight_times_bitrate_fast / 8;
 		retry_bitrate = retry_bw->eight_times_bitrate_fast / 8;
-	} else if (retry->peer->config.congestion_control_mode == RIST_CONGESTION_CONTROL_MODE_NORMAL) {
+	} else if (peer->config.congestion_control_mode == RIST_CONGESTION_CONTROL_MODE_NORMAL) {
 		data_bitrate = cli_bw->eight_times_bitrate / 8;
 		retry_bitrate = retry_bw->eight_times_bitrate_fast / 8;
 	} else {
 		data_bitrate = cli_bw->eight_times_bitrate / 8;
 		retry_bitrate = retry_bw->eight_times_bitrate / 8;
 	}
-	current_bitrate =  data_bitrate + retry_bitrate;
-	size_t max_bitrate = retry->peer->config.recovery_maxbitrate * 1000;
-	if (current_bitrate > max_bitrate) {
-		rist_log_priv(&ctx->common, RIST_LOG_DEBUG, "Max bandwidth exceeded: (%zu + %zu) > %zu, not resending packet %"PRIu64".\n",
-			data_bitrate, retry_bitrate, max_bitrate, idx);
-		retry->peer->stats_sender_instant.bandwidth_skip++;
+	size_t max_bitrate = (size_t)peer->config.recovery_maxbitrate * 1000;
+	if (!rist_retry_tokens_take(ctx, bucket, max_bitrate, data_bitrate, buffer->size, now)) {
+		// Stays in a deferred slot until rist_retry_queue_requeue, the deadline check drops it if it waits too long
+		if (ctx->common.debug)
+			rist_log_priv(&ctx->common, RIST_LOG_DEBUG, "Max bandwidth reached: (%zu + %zu) of %zu, holding back packet %"PRIu32".\n",
+				data_bitrate, retry_bitrate, max_bitrate, retry->seq);
+		retry->throttled = true;
 		return -2;
 	}
 
-	// Check buffer element age
-	uint64_t now = timestampNTP_u64();
-	/* queue_time holds the original insertion time for this seq */
-	uint64_t data_age = (now - ctx->sender_queue[idx]->time) / RIST_CLOCK;
-	uint64_t retry_age = (now - retry->insert_time) / RIST_CLOCK;
-	if (RIST_UNLIKELY(retry_age > retry->peer->config.recovery_length_max)) {
-		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
-			"Retry-request of element %" PRIu32 " (idx %zu) that was sent %" PRIu64
-				"ms ago has been in the queue too long to matter: %"PRIu64"ms > %ums\n",
-			retry->seq, idx, data_age, retry_age, retry->peer->config.recovery_length_max);
-		retry->peer->stats_sender_instant.retrans_skip++;
-		return -1;
-	}
-
-	struct rist_buffer *buffer = ctx->sender_queue[idx];
 	if (ctx->common.debug)
 		rist_log_priv(&ctx->common, RIST_LOG_DEBUG,
-			"Resending %"PRIu32"/%"PRIu32"/%"PRIu16" (idx %zu) after %" PRIu64
-			"ms of first transmission and %"PRIu64"ms in queue, bitrate is %zu + %zu, %zu\n",
-			retry->seq, buffer->seq, buffer->seq_rtp, idx, data_age, retry_age, data_bitrate,
-			retry_bitrate, current_bitrate);
+			"Resending %"PRIu32"/%"PRIu32"/%"PRIu32" (idx %zu) after %" PRIu64
+			"ms of first transmission and %"PRIu64"ms in queue, %" PRIu64 "ms before its deadline, bitrate is %zu + %zu\n",
+			retry->seq, buffer->seq, buffer->seq_rtp, idx, data_age, retry_age, (retry->deadline - now) / RIST_CLOCK,
+			data_bitrate, retry_bitrate);
 
 	uint8_t *payload = buffer->data;
-
-	size_t ret = 0;
-	if (buffer->transmit_count >= retry->peer->config.max_retries) {
-		rist_log_priv(&ctx->common, RIST_LOG_ERROR, "Datagram %"PRIu32
-			" is missing, but nack count is too large (%u), age is %"PRIu64"ms, retry #%lu\n",
-			retry->seq, buffer->transmit_count, data_age, buffer->transmit_count);
-			retry->peer->stats_sender_instant.retrans_skip++;
-			return -1;
-	}
-
 	uint16_t src_port = buffer->src_port;
 	if (src_port == 0)
-		src_port = 32768 + retry->peer->peer_data->adv_peer_id;
-	ret = (size_t)rist_send_seq_rtcp(retry->peer->peer_data, buffer->seq_rtp, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, src_port, (retry->peer->peer_data->config.virt_dst_port & ~1UL), true);
+		src_port = 32768 + peer->peer_data->adv_peer_id;
+	size_t ret = (size_t)rist_send_seq_rtcp(peer->peer_data, buffer->seq_rtp, buffer->type, &payload[RIST_MAX_PAYLOAD_OFFSET], buffer->size, buffer->source_time, src_port, (peer->peer_data->config.virt_dst_port & ~1UL), true);
 	// update bandwidth value
 	rist_calculate_bitrate(ret, retry_bw);
+	rist_retry_done(ctx, retry, buffer);
 
 	if (ret < buffer->size) {
 		rist_log_priv(&ctx->common, RIST_LOG_ERROR,
-			"Resending of packet failed %zu != %zu for seq %"PRIu32"\n", ret, buffer->size, retry->seq);
-		retry->peer->stats_sender_instant.retrans_skip++;
+			"Resending of packet failed %zu != %zu for seq %"PRIu32"\n", ret, buffer->size, buffer->seq_rtp);
+		peer->stats_sender_instant.retrans_skip++;
 		return -1;
 	}
 
 	buffer->transmit_count++;
-	if (retry->peer->peer_data)
-		retry->peer->peer_data->stats_sender_instant.retrans++;
+	if (peer->peer_data)
+		peer->peer_data->stats_sender_instant.retrans++;
 	else
-		retry->peer->stats_sender_instant.retrans++;
+		peer->stats_sender_instant.retrans++;
 	return ret;
 }
 
@@ -1035,7 +1719,28 @@ void rist_retry_enqueue(struct rist_sender *ctx, uint32_t seq, struct rist_peer
 			}
 		}
 	}
-	// Now insert into the missing queue
+	// The receiver plays the packet out recovery_length_max after it arrived, one trip after
+	// buffer->time. The retransmission takes the same trip, half an rtt is kept as margin for it
+	// being slower than the original.
+	uint64_t rtt = peer->last_rtt;
+	if (peer->config.recovery_rtt_min > rtt)
+		rtt = peer->config.recovery_rtt_min;
+	if (peer->config.recovery_rtt_max < rtt)
+		rtt = peer->config.recovery_rtt_max;
+	struct rist_retry_pending pending = {
+		.peer = peer,
+		.insert_time = now,
+		.deadline = buffer->time + (uint64_t)peer->config.recovery_length_max * RIST_CLOCK - rtt / 2,
+		.seq = seq,
+		.history_index = ctx->sender_retry_queue_write_index,
+	};
+	if (rist_retry_queue_push(ctx, &pending) != 0) {
+		peer->stats_sender_instant.retrans_skip++;
+		buffer->retry_queued = false;
+		return;
+	}
+	rist_paths_nack(ctx, buffer->peer);
+	// Now record it in the retry history
 	buffer->last_retry_request = now;
 	retry = &ctx->sender_retry_queue[ctx->sender_retry_queue_write_index];
 	retry->seq = seq;
@@ -7,6 +7,7 @@
 
 #include "librist/udpsocket.h"
 #include "log-private.h"
+#include "udp-private.h"
 #ifdef _WIN32
 #include <ws2ipdef.h>
 #ifndef MCAST_JOIN_GROUP
@@ -287,7 +288,7 @@ int udpsocket_open_connect(const char *host, uint16_t port, const char *mciface)
 	return sd;
 }
 
-int udpsocket_open_bind(const char *host, uint16_t port, const char *mciface)
+static int udpsocket_bind(const char *host, uint16_t port, const char *mciface, bool reuseport)
 {
 	int sd;
 	struct sockaddr_in6 raw;
@@ -312,6 +313,15 @@ int udpsocket_open_bind(const char *host, uint16_t port, const char *mciface)
 		/* Non-critical error */
 		rist_log_priv3( RIST_LOG_ERROR, "Cannot set SO_REUSEADDR: %s\n", strerror(errno));
 	}
+#if HAVE_SO_REUSEPORT
+	if (reuseport && setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, (char *)&yes, sizeof(int)) < 0) {
+		rist_log_priv3(RIST_LOG_ERROR, "Cannot set SO_REUSEPORT: %s\n", strerror(errno));
+		udpsocket_close(sd);
+		return -1;
+	}
+#else
+	RIST_MARK_UNUSED(reuseport);
+#endif
 
 	if (is_multicast) {
 		struct sockaddr_in6 sa = { .sin6_family = raw.sin6_family, .sin6_port = raw.sin6_port };
@@ -332,6 +342,16 @@ int udpsocket_open_bind(const char *host, uint16_t port, const char *mciface)
 	return sd;
 }
 
+int udpsocket_open_bind(const char *host, uint16_t port, const char *mciface)
+{
+	return udpsocket_bind(host, port, mciface, false);
+}
+
+int udpsocket_open_bind_reuseport(const char *host, uint16_t port, const char *mciface)
+{
+	return udpsocket_bind(host, port, mciface, true);
+}
+
 int udpsocket_set_nonblocking(int sd)
 {
 #ifdef _WIN32
@@ -0,0 +1,149 @@
+/* librist. Copyright © 2020 SipRadius LLC. All right reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Pushes a fixed packet rate from a sender to a receiver over loopback with the given I/O engine on
+ * both ends and reports the CPU time the process spent per packet. Every engine gets the same
+ * workload, so the figures compare directly. */
+
+#include "librist/librist.h"
+#include "rist-private.h"
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static atomic_ulong stop;
+static const char *engine_names[] = { "default", "poll", "epoll", "io_uring" };
+
+struct bench_sender {
+	struct rist_ctx *ctx;
+	uint32_t rate;
+	uint32_t seconds;
+	uint64_t sent;
+};
+
+static uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct rist_ctx *bench_setup(bool sender, const char *url, uint32_t engine, struct rist_logging_settings *logging)
+{
+	struct rist_ctx *ctx;
+	int ret = sender ? rist_sender_create(&ctx, RIST_PROFILE_MAIN, 0, logging) : rist_receiver_create(&ctx, RIST_PROFILE_MAIN, logging);
+	if (ret != 0)
+		return NULL;
+	if (engine != RIST_IO_ENGINE_DEFAULT && rist_set_opt(ctx, RIST_OPT_IO_ENGINE, &engine, NULL, NULL) != 0) {
+		rist_destroy(ctx);
+		return NULL;
+	}
+	const struct rist_peer_config *peer_config = NULL;
+	struct rist_peer *peer;
+	if (rist_parse_address2(url, (void *)&peer_config) || rist_peer_create(ctx, &peer, peer_config) == -1) {
+		free((void *)peer_config);
+		rist_destroy(ctx);
+		return NULL;
+	}
+	free((void *)peer_config);
+	if (rist_start(ctx) == -1) {
+		rist_destroy(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+static PTHREAD_START_FUNC(send_data, arg)
+{
+	struct bench_sender *s = arg;
+	char buffer[1316] = { 0 };
+	struct rist_data_block data = { 0 };
+	data.payload = buffer;
+	data.payload_len = sizeof(buffer);
+	uint64_t start = now_ns(CLOCK_MONOTONIC);
+	uint64_t total = (uint64_t)s->rate * s->seconds;
+	// Write in 1ms bursts, the way a TS multiplexer hands over its output
+	while (s->sent < total && !atomic_load(&stop)) {
+		uint64_t due = (now_ns(CLOCK_MONOTONIC) - start) * s->rate / 1000000000ULL;
+		if (due > total)
+			due = total;
+		for (; s->sent < due; s->sent++) {
+			if (rist_sender_data_write(s->ctx, &data) != (int)data.payload_len) {
+				atomic_store(&stop, 1);
+				break;
+			}
+		}
+		usleep(1000);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3 || argc > 5)
+		return 99;
+	uint32_t engine = (uint32_t)atoi(argv[1]);
+	int port = atoi(argv[2]);
+	uint32_t seconds = argc >= 4 ? (uint32_t)atoi(argv[3]) : 5;
+	uint32_t rate = argc >= 5 ? (uint32_t)atoi(argv[4]) : 20000;
+	if (engine > RIST_IO_ENGINE_IO_URING || seconds == 0 || rate == 0)
+		return 99;
+	atomic_init(&stop, 0);
+
+	struct rist_logging_settings *logging = NULL;
+	if (rist_logging_set(&logging, RIST_LOG_WARN, NULL, NULL, NULL, stderr) != 0)
+		return 99;
+	char receiver_url[64];
+	char sender_url[64];
+	snprintf(receiver_url, sizeof(receiver_url), "rist://@127.0.0.1:%d", port);
+	snprintf(sender_url, sizeof(sender_url), "rist://127.0.0.1:%d", port);
+	struct rist_ctx *receiver = bench_setup(false, receiver_url, engine, logging);
+	struct rist_ctx *sender = receiver ? bench_setup(true, sender_url, engine, logging) : NULL;
+	if (!receiver || !sender) {
+		fprintf(stderr, "I/O engine %s is not available\n", engine_names[engine]);
+		if (receiver)
+			rist_destroy(receiver);
+		free(logging);
+		return 77;
+	}
+
+	struct bench_sender s = { .ctx = sender, .rate = rate, .seconds = seconds, .sent = 0 };
+	struct rusage usage_start, usage_end;
+	getrusage(RUSAGE_SELF, &usage_start);
+	uint64_t cpu_start = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+	uint64_t wall_start = now_ns(CLOCK_MONOTONIC);
+	pthread_t send_loop;
+	if (pthread_create(&send_loop, NULL, send_data, &s) != 0) {
+		rist_destroy(sender);
+		rist_destroy(receiver);
+		free(logging);
+		return 99;
+	}
+
+	uint64_t received = 0;
+	uint64_t deadline = wall_start + ((uint64_t)seconds + 1) * 1000000000ULL;
+	struct rist_data_block *b = NULL;
+	while (now_ns(CLOCK_MONOTONIC) < deadline && !atomic_load(&stop)) {
+		if (rist_receiver_data_read2(receiver, &b, 5) > 0) {
+			received++;
+			rist_receiver_data_block_free2(&b);
+		}
+	}
+	atomic_store(&stop, 1);
+	pthread_join(send_loop, NULL);
+	uint64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	uint64_t wall = now_ns(CLOCK_MONOTONIC) - wall_start;
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	fprintf(stdout, "%-8s %"PRIu64" sent, %"PRIu64" received in %.2fs, cpu %.1f%% (%.2fus per packet), %ld context switches\n",
+		engine_names[engine], s.sent, received, (double)wall / 1e9, 100.0 * (double)cpu / (double)wall,
+		received ? (double)cpu / 1000.0 / (double)received : 0.0,
+		(usage_end.ru_nvcsw - usage_start.ru_nvcsw) + (usage_end.ru_nivcsw - usage_start.ru_nivcsw));
+
+	rist_destroy(sender);
+	rist_destroy(receiver);
+	free(logging);
+	return received > 0 ? 0 : 1;
+}
@@ -7,6 +7,7 @@
 
 #include "librist/librist.h"
 #include "rist-private.h"
+#include "getopt-shim.h"
 #include <stdatomic.h>
 
 #ifdef _WIN32
@@ -15,6 +16,9 @@
 
 atomic_ulong failed;
 atomic_ulong stop;
+atomic_ulong recovered_fec;
+uint32_t io_engine = RIST_IO_ENGINE_DEFAULT;
+bool io_engine_unavailable = false;
 
 struct rist_logging_settings *logging_settings_sender = NULL;
 struct rist_logging_settings *logging_settings_receiver = NULL;
@@ -38,36 +42,116 @@ int log_callback(void *arg, int level, const char *msg) {
     return 0;
 }
 
-struct rist_ctx *setup_rist_receiver(int profile, const char *url) {
+int stats_callback(void *arg, const struct rist_stats *stats) {
+    (void)arg;
+    if (stats->stats_type == RIST_STATS_RECEIVER_FLOW)
+        atomic_fetch_add(&recovered_fec, stats->stats.receiver_flow.recovered_fec);
+    rist_stats_free(stats);
+    return 0;
+}
+
+// Packets every weighted sender path carried, to check the bonding split
+#define MAX_PATHS 8
+struct path_share {
+    uint32_t peer_id;
+    uint32_t weight;
+    atomic_ulong sent;
+};
+struct path_share path_shares[MAX_PATHS];
+size_t path_count = 0;
+
+int sender_stats_callback(void *arg, const struct rist_stats *stats) {
+    (void)arg;
+    if (stats->stats_type == RIST_STATS_SENDER_PEER) {
+        for (size_t i = 0; i < path_count; i++) {
+            if (path_shares[i].peer_id == stats->stats.sender_peer.peer_id)
+                atomic_fetch_add(&path_shares[i].sent, stats->stats.sender_peer.sent);
+        }
+    }
+    rist_stats_free(stats);
+    return 0;
+}
+
+// Every path should have carried its weight's share of the stream, within 10%
+static bool check_path_shares(void) {
+    uint64_t total_sent = 0;
+    uint32_t total_weight = 0;
+    for (size_t i = 0; i < path_count; i++) {
+        total_sent += atomic_load(&path_shares[i].sent);
+        total_weight += path_shares[i].weight;
+    }
+    if (total_sent == 0) {
+        fprintf(stderr, "No per path sender stats were reported\n");
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < path_count; i++) {
+        double share = (double)atomic_load(&path_shares[i].sent) / (double)total_sent;
+        double expected = (double)path_shares[i].weight / (double)total_weight;
+        fprintf(stdout, "Path %u (weight %u) carried %.1f%% of the packets, expected %.1f%%\n",
+                path_shares[i].peer_id, path_shares[i].weight, share * 100.0, expected * 100.0);
+        if (share < expected - 0.1 || share > expected + 0.1)
+            ok = false;
+    }
+    return ok;
+}
+
+struct rist_ctx *setup_rist_receiver(int profile, const char *url, uint32_t dataout_pool, uint32_t rx_timestamps, uint32_t shards) {
     struct rist_ctx *ctx;
 	if (rist_receiver_create(&ctx, profile, logging_settings_receiver) != 0) {
 		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not create rist receiver context\n");
 		return NULL;
 	}
-    // Rely on the library to parse the url
-    struct rist_peer_config *peer_config = NULL;
-    if (rist_parse_address2(url, (void *)&peer_config))
-    {
-		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not parse peer options for receiver\n");
+    if (dataout_pool > 0 && rist_set_opt(ctx, RIST_OPT_RECEIVER_DATAOUT_POOL, &dataout_pool, NULL, NULL) != 0) {
+		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not enable the receiver output pool\n");
+		return NULL;
+	}
+    if (rx_timestamps > 0 && rist_set_opt(ctx, RIST_OPT_RX_TIMESTAMPS, &rx_timestamps, NULL, NULL) != 0) {
+		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not enable receive timestamps\n");
 		return NULL;
 	}
-    struct rist_peer *peer;
-    if (rist_peer_create(ctx, &peer, peer_config) == -1) {
-		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not add peer connector to receiver\n");
+    if (io_engine != RIST_IO_ENGINE_DEFAULT && rist_set_opt(ctx, RIST_OPT_IO_ENGINE, &io_engine, NULL, NULL) != 0) {
+		io_engine_unavailable = true;
 		return NULL;
 	}
+    if (shards > 0 && rist_set_opt(ctx, RIST_OPT_RECEIVER_SHARDS, &shards, NULL, NULL) != 0) {
+		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not set the receiver shards\n");
+		return NULL;
+	}
+    // Rely on the library to parse the url, a comma separated list adds a peer per url
+    char *urls = strdup(url);
+    for (char *next = urls; next != NULL;) {
+        char *cur = next;
+        next = strchr(cur, ',');
+        if (next)
+            *next++ = '\0';
+        struct rist_peer_config *peer_config = NULL;
+        if (rist_parse_address2(cur, (void *)&peer_config))
+        {
+			rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not parse peer options for receiver\n");
+			free(urls);
+			return NULL;
+		}
+        struct rist_peer *peer;
+        if (rist_peer_create(ctx, &peer, peer_config) == -1) {
+			rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not add peer connector to receiver\n");
+			free(urls);
+			return NULL;
+		}
 #if HAVE_SRP_SUPPORT
-    if (strlen(peer_config->srp_username) > 0 &&
-        strlen(peer_config->srp_password) > 0) {
-        int srp_error =
-            rist_enable_eap_srp_2(peer, peer_config->srp_username,
-                                peer_config->srp_password, NULL, NULL);
-        if (srp_error)
-          rist_log(logging_settings_receiver, RIST_LOG_WARN,
-                   "Error %d trying to enable SRP for peer\n", srp_error);
-    }
+        if (strlen(peer_config->srp_username) > 0 &&
+            strlen(peer_config->srp_password) > 0) {
+            int srp_error =
+                rist_enable_eap_srp_2(peer, peer_config->srp_username,
+                                    peer_config->srp_password, NULL, NULL);
+            if (srp_error)
+              rist_log(logging_settings_receiver, RIST_LOG_WARN,
+                       "Error %d trying to enable SRP for peer\n", srp_error);
+        }
 #endif
-    free((void *)peer_config);
+        free((void *)peer_config);
+    }
+    free(urls);
 	if (rist_start(ctx) == -1) {
 		rist_log(logging_settings_receiver, RIST_LOG_ERROR, "Could not start rist sender\n");
 		return NULL;
@@ -75,39 +159,66 @@ struct rist_ctx *setup_rist_receiver(int profile, const char *url) {
     return ctx;
 }
 
-struct rist_ctx *setup_rist_sender(int profile, const char *url) {
+struct rist_ctx *setup_rist_sender(int profile, const char *url, uint32_t keystream_depth, uint32_t fec_columns, uint32_t fec_rows, bool adaptive_weights) {
     struct rist_ctx *ctx;
     if (rist_sender_create(&ctx, profile, 0, logging_settings_sender) != 0) {
 		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not create rist sender context\n");
 		return NULL;
 	}
-
-    const struct rist_peer_config *peer_config_link = NULL;
-    if (rist_parse_address2(url, (void *)&peer_config_link))
-    {
-		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not parse peer options for sender\n");
+    if (keystream_depth > 0 && rist_set_opt(ctx, RIST_OPT_SENDER_KEYSTREAM_PRECOMPUTE, &keystream_depth, NULL, NULL) != 0) {
+		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not enable keystream precomputation\n");
 		return NULL;
 	}
-
-    struct rist_peer *peer;
-    if (rist_peer_create(ctx, &peer, peer_config_link) == -1) {
-		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not add peer connector to sender\n");
+    bool fec_row = true;
+    if (fec_columns > 0 && rist_set_opt(ctx, RIST_OPT_SENDER_FEC, &fec_columns, &fec_rows, &fec_row) != 0) {
+		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not enable FEC\n");
 		return NULL;
 	}
+    if (adaptive_weights && rist_set_opt(ctx, RIST_OPT_SENDER_ADAPTIVE_WEIGHTS, &adaptive_weights, NULL, NULL) != 0) {
+		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not enable adaptive path weights\n");
+		return NULL;
+	}
+    if (io_engine != RIST_IO_ENGINE_DEFAULT && rist_set_opt(ctx, RIST_OPT_IO_ENGINE, &io_engine, NULL, NULL) != 0) {
+		io_engine_unavailable = true;
+		return NULL;
+	}
+
+    char *urls = strdup(url);
+    for (char *next = urls; next != NULL;) {
+        char *cur = next;
+        next = strchr(cur, ',');
+        if (next)
+            *next++ = '\0';
+        const struct rist_peer_config *peer_config_link = NULL;
+        if (rist_parse_address2(cur, (void *)&peer_config_link))
+        {
+			rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not parse peer options for sender\n");
+			free(urls);
+			return NULL;
+		}
+
+        struct rist_peer *peer;
+        if (rist_peer_create(ctx, &peer, peer_config_link) == -1) {
+			rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not add peer connector to sender\n");
+			free(urls);
+			return NULL;
+		}
 
 #if HAVE_SRP_SUPPORT
-    if (strlen(peer_config_link->srp_username) > 0 &&
-        strlen(peer_config_link->srp_password) > 0) {
-        int srp_error =
-            rist_enable_eap_srp_2(peer, peer_config_link->srp_username,
-                                peer_config_link->srp_password, NULL, NULL);
-        if (srp_error)
-          rist_log(logging_settings_sender, RIST_LOG_WARN,
-                   "Error %d trying to enable SRP for peer\n", srp_error);
-    }
+        if (strlen(peer_config_link->srp_username) > 0 &&
+            strlen(peer_config_link->srp_password) > 0) {
+            int srp_error =
+                rist_enable_eap_srp_2(peer, peer_config_link->srp_username,
+                                    peer_config_link->srp_password, NULL, NULL);
+            if (srp_error)
+              rist_log(logging_settings_sender, RIST_LOG_WARN,
+                       "Error %d trying to enable SRP for peer\n", srp_error);
+        }
 #endif
 
-	free((void *)peer_config_link);
+		free((void *)peer_config_link);
+    }
+    free(urls);
 	if (rist_start(ctx) == -1) {
 		rist_log(logging_settings_sender, RIST_LOG_ERROR, "Could not start rist sender\n");
 		return NULL;
@@ -115,8 +226,15 @@ struct rist_ctx *setup_rist_sender(int profile, const char *url) {
     return ctx;
 }
 
+// Every sender context sends the same stream as a flow of its own
+#define MAX_SENDERS 4
+struct test_senders {
+    struct rist_ctx *ctx[MAX_SENDERS];
+    size_t count;
+};
+
 static PTHREAD_START_FUNC(send_data, arg) {
-    struct rist_ctx *rist_sender = arg;
+    struct test_senders *senders = arg;
     int send_counter = 0;
     char buffer[1316] = { 0 };
     struct rist_data_block data = { 0 };
@@ -127,18 +245,20 @@ static PTHREAD_START_FUNC(send_data, arg) {
         sprintf(buffer, "DEADBEAF TEST PACKET #%i", send_counter);
         data.payload = &buffer;
         data.payload_len = 1316;
-        int ret = rist_sender_data_write(rist_sender, &data);
-        if (ret < 0) {
-            fprintf(stderr, "Failed to send test packet with error code %d!\n", ret);
-            atomic_store(&failed, 1);
-            atomic_store(&stop, 1);
-            break;
-        }
-        else if (ret != (int)data.payload_len) {
-            fprintf(stderr, "Failed to send test packet %d != %d !\n", ret, (int)data.payload_len);
-            atomic_store(&failed, 1);
-            atomic_store(&stop, 1);
-            break;
+        for (size_t i = 0; i < senders->count; i++) {
+            int ret = rist_sender_data_write(senders->ctx[i], &data);
+            if (ret < 0) {
+                fprintf(stderr, "Failed to send test packet with error code %d!\n", ret);
+                atomic_store(&failed, 1);
+                atomic_store(&stop, 1);
+                break;
+            }
+            else if (ret != (int)data.payload_len) {
+                fprintf(stderr, "Failed to send test packet %d != %d !\n", ret, (int)data.payload_len);
+                atomic_store(&failed, 1);
+                atomic_store(&stop, 1);
+                break;
+            }
         }
         send_counter++;
 #ifdef _WIN32
@@ -158,21 +278,102 @@ static PTHREAD_START_FUNC(send_data, arg) {
     return 0;
 }
 
+static struct option long_options[] = {
+{ "dataout-pool",     required_argument, NULL, 'p' },
+{ "keystream-depth",  required_argument, NULL, 'k' },
+{ "seq-start",        required_argument, NULL, 'q' },
+{ "fec",              required_argument, NULL, 'f' },
+{ "adaptive-weights", no_argument,       NULL, 'a' },
+{ "rx-timestamps",    required_argument, NULL, 't' },
+{ "io-engine",        required_argument, NULL, 'e' },
+{ "receiver-shards",  required_argument, NULL, 's' },
+{ "sender-per-url",   no_argument,       NULL, 'm' },
+{ "receiver-queue-shrink", no_argument,  NULL, 'r' },
+{ 0, 0, 0, 0 },
+};
+
+const char usage[] = "usage: %s profile receiver-url sender-url loss-percent [options]\n"
+"       --dataout-pool=N      number of shared receiver output threads\n"
+"       --keystream-depth=N   packets of AES-CTR keystream the sender precomputes per peer\n"
+"       --seq-start=N         first RTP sequence number, to run the stream across the 16bit boundary\n"
+"       --fec=LxD             FEC matrix the sender protects the stream with, row FEC included\n"
+"       --adaptive-weights    let the sender adapt the weights of its (comma separated) peers\n"
+"       --rx-timestamps=N     receive timestamp mode of the receiver\n"
+"       --io-engine=N         I/O engine of both sides, skipped when this host does not have it\n"
+"       --receiver-shards=N   number of SO_REUSEPORT shards the receiver listens with\n"
+"       --sender-per-url      a sender context per comma separated sender url instead of one bonding them\n"
+"       --receiver-queue-shrink  fail unless the receiver buffer shrank to the measured rate during the run\n";
+
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
+    uint32_t dataout_pool = 0;
+    uint32_t keystream_depth = 0;
+    uint32_t seq_start = 0;
+    uint32_t fec_columns = 0;
+    uint32_t fec_rows = 0;
+    bool adaptive_weights = false;
+    uint32_t rx_timestamps = 0;
+    uint32_t shards = 0;
+    bool sender_per_url = false;
+    bool queue_shrink = false;
+    int c;
+    int option_index;
+
+    while ((c = getopt_long(argc, argv, "p:k:q:f:at:e:s:mr", long_options, &option_index)) != -1) {
+        switch (c) {
+        case 'p':
+            dataout_pool = (uint32_t)atoi(optarg);
+            break;
+        case 'k':
+            keystream_depth = (uint32_t)atoi(optarg);
+            break;
+        case 'q':
+            seq_start = (uint32_t)atoi(optarg);
+            break;
+        case 'f':
+            if (sscanf(optarg, "%ux%u", &fec_columns, &fec_rows) != 2) {
+                fprintf(stderr, usage, argv[0]);
+                return 99;
+            }
+            break;
+        case 'a':
+            adaptive_weights = true;
+            break;
+        case 't':
+            rx_timestamps = (uint32_t)atoi(optarg);
+            break;
+        case 'e':
+            io_engine = (uint32_t)atoi(optarg);
+            break;
+        case 's':
+            shards = (uint32_t)atoi(optarg);
+            break;
+        case 'm':
+            sender_per_url = true;
+            break;
+        case 'r':
+            queue_shrink = true;
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 99;
+        }
+    }
+    if (argc - optind != 4) {
+        fprintf(stderr, usage, argv[0]);
         return 99;
     }
-    int profile = atoi(argv[1]);
-    char *url1 = strdup(argv[2]);
-    char *url2 = strdup(argv[3]);
-    int losspercent = atoi(argv[4]) * 10;
+    int profile = atoi(argv[optind]);
+    char *url1 = strdup(argv[optind + 1]);
+    char *url2 = strdup(argv[optind + 2]);
+    int losspercent = atoi(argv[optind + 3]) * 10;
 	int ret = 0;
 
     struct rist_ctx *receiver_ctx = NULL;
-    struct rist_ctx *sender_ctx = NULL;
+    struct test_senders senders = { 0 };
 
     atomic_init(&failed, 0);
     atomic_init(&stop, 0);
+    atomic_init(&recovered_fec, 0);
 
 
     fprintf(stdout, "Testing profile %i with receiver url %s and sender url %s and losspercentage: %i\n", profile, url1, url2, losspercent);
@@ -189,9 +390,43 @@ int main(int argc, char *argv[]) {
 		ret = 99;
 		goto out;
 	}
-	receiver_ctx = setup_rist_receiver(profile, url1);
-    sender_ctx = setup_rist_sender(profile, url2);
-	if (!sender_ctx || !receiver_ctx) {
+	receiver_ctx = setup_rist_receiver(profile, url1, dataout_pool, rx_timestamps, shards);
+    for (char *next = url2; next != NULL && senders.count < MAX_SENDERS && !io_engine_unavailable;) {
+        char *cur = next;
+        next = sender_per_url ? strchr(cur, ',') : NULL;
+        if (next)
+            *next++ = '\0';
+        struct rist_ctx *sender_ctx = setup_rist_sender(profile, cur, keystream_depth, fec_columns, fec_rows, adaptive_weights);
+        if (!sender_ctx) {
+            ret = 99;
+            break;
+        }
+        sender_ctx->sender_ctx->common.seq_rtp = seq_start;
+        senders.ctx[senders.count++] = sender_ctx;
+    }
+	if (io_engine_unavailable) {
+		fprintf(stderr, "I/O engine %u is not available\n", io_engine);
+		ret = 77;
+		goto out;
+	}
+	if (ret != 0 || !receiver_ctx) {
+		ret = 99;
+		goto out;
+	}
+    if (fec_columns > 0 && rist_stats_callback_set(receiver_ctx, 500, stats_callback, NULL) != 0) {
+		ret = 99;
+		goto out;
+	}
+    // Bonded over weighted paths: track what each of them carried
+    for (struct rist_peer *p = senders.count == 1 ? senders.ctx[0]->sender_ctx->common.PEERS : NULL; p && path_count < MAX_PATHS; p = p->next) {
+        if (p->config.weight == 0)
+            continue;
+        path_shares[path_count].peer_id = p->adv_peer_id;
+        path_shares[path_count].weight = p->config.weight;
+        atomic_init(&path_shares[path_count].sent, 0);
+        path_count++;
+    }
+    if (path_count > 1 && rist_stats_callback_set(senders.ctx[0], 100, sender_stats_callback, NULL) != 0) {
 		ret = 99;
 		goto out;
 	}
@@ -199,11 +434,18 @@ int main(int argc, char *argv[]) {
     if (losspercent > 0) {
         receiver_ctx->receiver_ctx->simulate_loss = true;
         receiver_ctx->receiver_ctx->loss_percentage = losspercent;
-        sender_ctx->sender_ctx->simulate_loss = true;
-        sender_ctx->sender_ctx->loss_percentage = losspercent;
+        // The shards took their settings at start
+        for (uint32_t i = 0; receiver_ctx->receiver_ctx->shards && i + 1 < shards; i++) {
+            receiver_ctx->receiver_ctx->shards[i]->receiver_ctx->simulate_loss = true;
+            receiver_ctx->receiver_ctx->shards[i]->receiver_ctx->loss_percentage = losspercent;
+        }
+        for (size_t i = 0; i < senders.count; i++) {
+            senders.ctx[i]->sender_ctx->simulate_loss = true;
+            senders.ctx[i]->sender_ctx->loss_percentage = losspercent;
+        }
     }
     pthread_t send_loop;
-    if (pthread_create(&send_loop, NULL, send_data, (void *)sender_ctx) != 0)
+    if (pthread_create(&send_loop, NULL, send_data, (void *)&senders) != 0)
     {
         fprintf(stderr, "Could not start send data thread\n");
 		ret = 99;
@@ -212,18 +454,38 @@ int main(int argc, char *argv[]) {
 
     struct rist_data_block *b = NULL;
     char rcompare[1316];
-    int receive_count = 1;
-    bool got_first = false;
-    while (receive_count < 16000) {
+    // Every flow is checked on its own, the counter is the packet number it expects next
+    struct {
+        uint32_t flow_id;
+        int receive_count;
+    } flows[MAX_SENDERS];
+    size_t flow_count = 0;
+    // The receiver contexts (parent or shards) that handed us data
+    struct rist_receiver *shards_seen[MAX_SENDERS];
+    size_t shards_seen_count = 0;
+    // Receiver buffer slots of the flow, largest seen and current
+    size_t queue_slots_max = 0;
+    size_t queue_slots = 0;
+    bool done = false;
+    while (!done) {
         if (atomic_load(&stop))
             break;
         int queue_length = rist_receiver_data_read2(receiver_ctx, &b, 5);
         if (queue_length > 0) {
-            if (!got_first) {
-                receive_count = (int)b->seq;
-				got_first = true;
-			}
-            sprintf(rcompare, "DEADBEAF TEST PACKET #%i", receive_count);
+            size_t i;
+            for (i = 0; i < flow_count && flows[i].flow_id != b->flow_id; i++);
+            if (i == flow_count) {
+                if (flow_count == senders.count) {
+                    fprintf(stderr, "Unexpected flow %u\n", b->flow_id);
+                    atomic_store(&failed, 1);
+                    atomic_store(&stop, 1);
+                    break;
+                }
+                flows[i].flow_id = b->flow_id;
+                flows[i].receive_count = (int)((uint32_t)b->seq - seq_start);
+                flow_count++;
+            }
+            sprintf(rcompare, "DEADBEAF TEST PACKET #%i", flows[i].receive_count);
             if (strcmp(rcompare, b->payload)) {
                 fprintf(stderr, "Packet contents not as expected!\n");
                 fprintf(stderr, "Got : %s\n", (char*)b->payload);
@@ -232,20 +494,58 @@ int main(int argc, char *argv[]) {
                 atomic_store(&stop, 1);
                 break;
             }
-            receive_count++;
+            flows[i].receive_count++;
+            struct rist_receiver *shard = b->peer ? b->peer->receiver_ctx : NULL;
+            size_t j;
+            for (j = 0; j < shards_seen_count && shards_seen[j] != shard; j++);
+            if (j == shards_seen_count && shard && shards_seen_count < MAX_SENDERS)
+                shards_seen[shards_seen_count++] = shard;
+            if (b->peer && b->peer->flow) {
+                queue_slots = b->peer->flow->receiver_queue_max;
+                if (queue_slots > queue_slots_max)
+                    queue_slots_max = queue_slots;
+            }
             rist_receiver_data_block_free2((struct rist_data_block **const)&b);
+            done = flow_count == senders.count;
+            for (i = 0; i < flow_count; i++) {
+                if (flows[i].receive_count < 16000)
+                    done = false;
+            }
         }
     }
-	if (!got_first || receive_count < 12500)
+	if (flow_count < senders.count)
+		atomic_store(&failed, 1);
+	for (size_t i = 0; i < flow_count; i++) {
+		if (flows[i].receive_count < 12500)
+			atomic_store(&failed, 1);
+	}
+	for (size_t i = 0; i < shards_seen_count; i++)
+		fprintf(stdout, "Received data from %s receiver context %p\n", shards_seen[i]->shard_parent ? "shard" : "parent", (void *)shards_seen[i]);
+	if (queue_shrink && queue_slots >= queue_slots_max) {
+		fprintf(stderr, "Receiver buffer did not shrink, %zu slots\n", queue_slots);
+		atomic_store(&failed, 1);
+	}
+	// Senders from different addresses are steered to different shards
+	if (senders.count > 1 && shards > 1 && shards_seen_count < 2) {
+		fprintf(stderr, "All flows were received on a single shard\n");
 		atomic_store(&failed, 1);
+	}
+	if (fec_columns > 0 && atomic_load(&recovered_fec) == 0) {
+		fprintf(stderr, "No packets were rebuilt from FEC\n");
+		atomic_store(&failed, 1);
+	}
+	if (path_count > 1 && !check_path_shares()) {
+		fprintf(stderr, "Paths did not carry their weighted share\n");
+		atomic_store(&failed, 1);
+	}
 	if (atomic_load(&failed))
 		ret = 1;
 	pthread_join(send_loop, NULL);
 out:
 	free(url1);
 	free(url2);
-	if (sender_ctx)
-		rist_destroy(sender_ctx);
+	for (size_t i = 0; i < senders.count; i++)
+		rist_destroy(senders.ctx[i]);
 	if (receiver_ctx)
 		rist_destroy(receiver_ctx);
 	free(logging_settings_receiver);
@@ -51,6 +51,7 @@ struct rist_prometheus_client_flow_stats {
 		double rist_client_flow_reordered_packets;
 		double rist_client_flow_recovered_packets;
 		double rist_client_flow_recovered_one_retry_packets;
+		double rist_client_flow_recovered_fec_packets;
 		double rist_client_flow_lost_packets;
 	} counters;
 
@@ -65,6 +66,7 @@ struct rist_prometheus_client_flow_stats {
 		double rist_client_flow_reordered_packets;
 		double rist_client_flow_recovered_packets;
 		double rist_client_flow_recovered_one_retry_packets;
+		double rist_client_flow_recovered_fec_packets;
 		double rist_client_flow_lost_packets;
 		double rist_client_flow_min_iat_seconds;
 		double rist_client_flow_cur_iat_seconds;
@@ -217,6 +219,7 @@ static int rist_prometheus_format_client_flow_stats(struct rist_prometheus_stats
 	PROMETHEUS_COUNTER_PRINT_CLIENT(rist_client_flow_reordered_packets, "Total number of reordered packets", "packets")
 	PROMETHEUS_COUNTER_PRINT_CLIENT(rist_client_flow_recovered_packets, "Total number of recovered packets", "packets")
 	PROMETHEUS_COUNTER_PRINT_CLIENT(rist_client_flow_recovered_one_retry_packets, "Total number of recovered after one retry packets", "packets")
+	PROMETHEUS_COUNTER_PRINT_CLIENT(rist_client_flow_recovered_fec_packets, "Total number of packets rebuilt from FEC", "packets")
 	PROMETHEUS_COUNTER_PRINT_CLIENT(rist_client_flow_lost_packets, "Total number of lost packets", "packets")
 	PROMETHEUS_GAUGE_PRINT_CLIENT(rist_client_flow_min_iat_seconds, "Minimum inter arrival time in seconds", "seconds")
 	PROMETHEUS_GAUGE_PRINT_CLIENT(rist_client_flow_cur_iat_seconds, "Current inter arrival time in seconds", "seconds")
@@ -287,6 +290,7 @@ void rist_prometheus_handle_client_stats(struct rist_prometheus_stats *ctx, cons
 	s->container[s->container_offset].rist_client_flow_reordered_packets = s->counters.rist_client_flow_reordered_packets += stats->reordered;
 	s->container[s->container_offset].rist_client_flow_recovered_packets = s->counters.rist_client_flow_recovered_packets += stats->recovered;
 	s->container[s->container_offset].rist_client_flow_recovered_one_retry_packets = s->counters.rist_client_flow_recovered_one_retry_packets += stats->recovered_one_retry;
+	s->container[s->container_offset].rist_client_flow_recovered_fec_packets = s->counters.rist_client_flow_recovered_fec_packets += stats->recovered_fec;
 	s->container[s->container_offset].rist_client_flow_lost_packets = s->counters.rist_client_flow_lost_packets += stats->lost;
 	s->container[s->container_offset].rist_client_flow_min_iat_seconds = ((double)1 / (double)1000000) * stats->min_inter_packet_spacing;
 	s->container[s->container_offset].rist_client_flow_cur_iat_seconds = ((double)1 / (double)1000000) * stats->cur_inter_packet_spacing;
@@ -30,6 +30,7 @@ const char help_urlstr[] = "\nUsage: append to end of individual rist:// url(s)
 "    param congestion-control=#  mitigation mode: (0=disabled, 1=normal, 2=aggressive)\n"
 "    param min-retries=##  min retries count before congestion control kicks in\n"
 "    param max-retries=##  max retries count\n"
+"    param pacing=#  sender output pacing: (0=off, 1=timer, 2=SO_TXTIME with timer fallback)\n"
 "    param weight=#  default weight for multi-path load balancing. Use 0 for duplicate paths.\n"
 "    param username=abcde  Username to identify this peer during authentication\n"
 "    param password=abcde  Password corresponding to this peer's Username\n"